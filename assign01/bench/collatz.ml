@@ -0,0 +1,24 @@
+function steps(x) {
+  var count;
+  count = 0;
+  while (x != 1) {
+    if (x - (x / 2) * 2 == 0) {
+      x = x / 2;
+    } else {
+      x = 3 * x + 1;
+    }
+    count = count + 1;
+  }
+  count;
+}
+var k; var best; var c;
+k = 1;
+best = 0;
+while (k < 30000) {
+  c = steps(k);
+  if (c > best) {
+    best = c;
+  }
+  k = k + 1;
+}
+println(best);
@@ -0,0 +1,10 @@
+function fib(n) {
+  var r;
+  if (n < 2) {
+    r = n;
+  } else {
+    r = fib(n - 1) + fib(n - 2);
+  }
+  r;
+}
+println(fib(27));
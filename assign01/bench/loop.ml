@@ -0,0 +1,13 @@
+var i; var j; var s; var n;
+n = 1500;
+i = 0;
+s = 0;
+while (i < n) {
+  j = 0;
+  while (j < n) {
+    s = s + (i * j) / (j + 1) - i;
+    j = j + 1;
+  }
+  i = i + 1;
+}
+println(s);
@@ -0,0 +1,32 @@
+#!/bin/bash
+# Time each benchmark with each execution engine (real seconds):
+#   bench/run.sh [minilang binary] [engine...]
+#
+#   loop     nested counting loops with arithmetic in the body
+#   fib      doubly recursive calls
+#   collatz  loops with data-dependent branches, and a call per number
+dir=$(dirname "$0")
+bin=${1:-$dir/../minilang}
+shift
+engines=${*:-tree stack reg closure}
+out=$(mktemp)
+TIMEFORMAT=%R
+
+printf "%-10s" benchmark
+for e in $engines; do printf "%9s" "$e"; done
+printf "\n"
+for f in "$dir"/*.ml; do
+  printf "%-10s" "$(basename "$f" .ml)"
+  expected=""
+  for e in $engines; do
+    t=$( { time "$bin" -x "$e" "$f" > "$out" 2>&1; } 2>&1 )
+    if [ -z "$expected" ]; then
+      expected=$(cat "$out")
+    elif [ "$(cat "$out")" != "$expected" ]; then
+      echo "output of $e differs" >&2
+    fi
+    printf "%8ss" "$t"
+  done
+  printf "\n"
+done
+rm -f "$out"
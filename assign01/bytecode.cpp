@@ -0,0 +1,611 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <algorithm>
+#include "ast.h"
+#include "node.h"
+#include "bytecode.h"
+
+namespace {
+
+// Name and operand kinds of each instruction (see Opcode)
+struct OpcodeInfo {
+  const char *name;
+  const char *operands;
+};
+
+const OpcodeInfo OPCODES[NUM_OPCODES] = {
+  {"int", "k"}, {"load", "i"}, {"store", "i"}, {"load_global", "g"}, {"store_global", "g"},
+  {"define", "i"}, {"define_global", "g"}, {"pop", ""}, {"dup", ""}, {"numeric", "s"},
+  {"add", "s"}, {"sub", "s"}, {"multiply", "s"}, {"divide", "s"},
+  {"add_safe", ""}, {"sub_safe", ""}, {"multiply_safe", ""}, {"divide_safe", ""},
+  {"less", ""}, {"less_equal", ""}, {"greater", ""}, {"greater_equal", ""}, {"equal", ""}, {"not_equal", ""},
+  {"bool", ""}, {"jump", "L"}, {"jump_zero", "L"}, {"jump_nonzero", "L"},
+  {"function", "cg"}, {"callee", "ns"}, {"call", "ns"}, {"return", ""}, {"fail", "s"}, {"halt", ""},
+  {"incr", "vks"}, {"less_jump", "vvLs"}, {"compare_k", "vkos"}, {"compare_k_jump", "vkoLs"},
+  {"print_var", "gvwLs"},
+};
+
+int arith_opcode(int tag, bool safe)
+{
+  switch (tag)
+  {
+  case AST_ADD:
+    return safe ? OP_ADD_SAFE : OP_ADD;
+  case AST_SUB:
+    return safe ? OP_SUB_SAFE : OP_SUB;
+  case AST_MULTIPLY:
+    return safe ? OP_MULTIPLY_SAFE : OP_MULTIPLY;
+  case AST_DIVIDE:
+    return safe ? OP_DIVIDE_SAFE : OP_DIVIDE;
+  case AST_LESS:
+    return OP_LESS;
+  case AST_LESS_EQUAL:
+    return OP_LESS_EQUAL;
+  case AST_GREATER:
+    return OP_GREATER;
+  case AST_GREATER_EQUAL:
+    return OP_GREATER_EQUAL;
+  case AST_EQUAL:
+    return OP_EQUAL;
+  case AST_NOT_EQUAL:
+    return OP_NOT_EQUAL;
+  }
+  return -1;
+}
+
+// Comparison with its operands swapped
+int mirror(int tag)
+{
+  switch (tag)
+  {
+  case AST_LESS:
+    return AST_GREATER;
+  case AST_LESS_EQUAL:
+    return AST_GREATER_EQUAL;
+  case AST_GREATER:
+    return AST_LESS;
+  case AST_GREATER_EQUAL:
+    return AST_LESS_EQUAL;
+  }
+  return tag;
+}
+
+const char *compare_str(int tag)
+{
+  switch (tag)
+  {
+  case AST_LESS:
+    return "<";
+  case AST_LESS_EQUAL:
+    return "<=";
+  case AST_GREATER:
+    return ">";
+  case AST_GREATER_EQUAL:
+    return ">=";
+  case AST_EQUAL:
+    return "==";
+  }
+  return "!=";
+}
+
+}
+
+BytecodeCompiler::BytecodeCompiler()
+    : m_chunk(nullptr), m_num_locals(0), m_depth(0)
+{
+}
+
+BytecodeCompiler::~BytecodeCompiler()
+{
+}
+
+std::vector<Chunk *> BytecodeCompiler::compile(Node *unit)
+{
+  // Functions are numbered in order, after the unit
+  m_chunks.push_back(new Chunk());
+  unit->each_child([this](Node *stmt) {
+    if (stmt->get_tag() == AST_FUNCTION)
+    {
+      Chunk *chunk = new Chunk();
+      chunk->fn = stmt;
+      m_chunks.push_back(chunk);
+    }
+  });
+
+  m_chunks[0]->name = "<unit>";
+  m_chunks[0]->fn = nullptr;
+  compile_chunk(m_chunks[0], unit, 0, true);
+  for (unsigned int i = 1; i < m_chunks.size(); i++)
+  {
+    Node *fn = m_chunks[i]->fn;
+    m_chunks[i]->name = fn->get_kid(0)->get_str();
+    compile_chunk(m_chunks[i], fn->get_last_kid(), fn->get_last_kid()->get_num_slots(), false);
+    m_chunks[i]->num_params = fn->get_num_kids() == 3 ? fn->get_kid(1)->get_num_kids() : 0;
+  }
+
+  std::vector<Chunk *> chunks;
+  chunks.swap(m_chunks);
+  return chunks;
+}
+
+// The unit's own variables are globals, a function's body is the first
+// level of locals (its parameters are the first slots)
+void BytecodeCompiler::compile_chunk(Chunk *chunk, Node *body, unsigned level_slots, bool unit)
+{
+  m_chunk = chunk;
+  chunk->num_params = 0;
+  chunk->max_stack = 0;
+  m_bases.assign(1, -1);
+  if (!unit)
+  {
+    m_bases.push_back(0);
+  }
+  m_num_locals = level_slots;
+  chunk->num_locals = level_slots;
+  m_depth = 0;
+
+  compile_list(body, true);
+  emit(unit ? OP_HALT : OP_RETURN);
+  pop();
+}
+
+void BytecodeCompiler::compile_block(Node *block, bool want)
+{
+  unsigned saved = m_num_locals;
+  m_bases.push_back(int(m_num_locals));
+  m_num_locals += block->get_num_slots();
+  m_chunk->num_locals = std::max(m_chunk->num_locals, m_num_locals);
+
+  compile_list(block, want);
+
+  m_bases.pop_back();
+  m_num_locals = saved;
+}
+
+// The value of a list is the value of its last statement
+void BytecodeCompiler::compile_list(Node *list, bool want)
+{
+  for (unsigned int i = 0; i < list->get_num_kids(); i++)
+  {
+    compile_stmt(list->get_kid(i), want && i == list->get_num_kids() - 1);
+  }
+}
+
+void BytecodeCompiler::compile_stmt(Node *stmt, bool want)
+{
+  if (stmt->get_tag() == AST_FUNCTION)
+  {
+    unsigned index = 1;
+    while (m_chunks[index]->fn != stmt)
+    {
+      index++;
+    }
+    emit(OP_FUNCTION, int(index), stmt->get_slot());
+  }
+  else
+  {
+    Node *ast = stmt->get_kid(0);
+    switch (ast->get_tag())
+    {
+    case AST_IF:
+    {
+      unsigned skip = compile_jump_unless(ast->get_kid(0), ast);
+      compile_block(ast->get_kid(1), false);
+      if (ast->get_last_kid()->get_tag() == AST_ELSE)
+      {
+        unsigned end = emit_jump(OP_JUMP);
+        patch(skip);
+        compile_block(ast->get_last_kid()->get_kid(0), false);
+        patch(end);
+      }
+      else
+      {
+        patch(skip);
+      }
+      break;
+    }
+
+    case AST_WHILE:
+    {
+      unsigned top = unsigned(m_chunk->code.size());
+      unsigned exit = compile_jump_unless(ast->get_kid(0), ast);
+      compile_block(ast->get_kid(1), false);
+      emit(OP_JUMP, int(top));
+      patch(exit);
+      break;
+    }
+
+    // Redefinitions have no address and do nothing
+    case AST_DEFINITION:
+      if (ast->has_address())
+      {
+        emit_access(ast, OP_DEFINE, OP_DEFINE_GLOBAL);
+      }
+      break;
+
+    default:
+      compile_expr(ast, want);
+      return;
+    }
+  }
+
+  // Other statements evaluate to 0
+  if (want)
+  {
+    emit(OP_INT, 0);
+    push();
+  }
+}
+
+void BytecodeCompiler::compile_expr(Node *ast, bool want)
+{
+  switch (ast->get_tag())
+  {
+  case AST_INT_LITERAL:
+    emit(OP_INT, atoi(ast->get_str().c_str()));
+    push();
+    break;
+
+  case AST_VARREF:
+    emit_access(ast, OP_LOAD, OP_LOAD_GLOBAL);
+    push();
+    break;
+
+  case AST_ASSIGNMENT:
+    if (!want && compile_incr(ast))
+    {
+      return;
+    }
+    compile_expr(ast->get_kid(1), true);
+    if (want)
+    {
+      emit(OP_DUP);
+      push();
+    }
+    emit_access(ast->get_kid(0), OP_STORE, OP_STORE_GLOBAL);
+    pop();
+    return;
+
+  case AST_FNCALL:
+    compile_call(ast, want);
+    return;
+
+  // The second operand is only evaluated if the first doesn't decide
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+  {
+    bool is_and = ast->get_tag() == AST_LOGICAL_AND;
+    compile_numeric(ast->get_kid(0), ast);
+    unsigned decided = emit_jump(is_and ? OP_JUMP_ZERO : OP_JUMP_NONZERO);
+    compile_numeric(ast->get_kid(1), ast);
+    emit(OP_BOOL);
+    unsigned end = emit_jump(OP_JUMP);
+    patch(decided);
+    emit(OP_INT, is_and ? 0 : 1);
+    patch(end);
+    break;
+  }
+
+  default:
+  {
+    unsigned target;
+    if (compile_compare_k(ast, false, target))
+    {
+      break;
+    }
+    int op = arith_opcode(ast->get_tag(), ast->is_safe());
+    assert(op >= 0);
+    compile_numeric(ast->get_kid(0), ast);
+    compile_numeric(ast->get_kid(1), ast);
+    if (op == OP_ADD || op == OP_SUB || op == OP_MULTIPLY || op == OP_DIVIDE)
+    {
+      emit(op, site(ast));
+    }
+    else
+    {
+      emit(op);
+    }
+    pop();
+    break;
+  }
+  }
+
+  if (!want)
+  {
+    emit(OP_POP);
+    pop();
+  }
+}
+
+// The callee is checked before the arguments are evaluated
+void BytecodeCompiler::compile_call(Node *ast, bool want)
+{
+  unsigned skip = 0;
+  bool fused = compile_print_var(ast, want, skip);
+
+  if (!ast->has_address())
+  {
+    emit(OP_FAIL, site(ast));
+    push();
+  }
+  else
+  {
+    unsigned num_args = ast->get_num_kids() == 0 ? 0 : ast->get_kid(0)->get_num_kids();
+    emit_access(ast, OP_LOAD, OP_LOAD_GLOBAL);
+    push();
+    emit(OP_CALLEE, int(num_args), site(ast));
+    for (unsigned int i = 0; i < num_args; i++)
+    {
+      compile_expr(ast->get_kid(0)->get_kid(i), true);
+    }
+    emit(OP_CALL, int(num_args), site(ast));
+    pop(num_args);
+  }
+
+  if (!want)
+  {
+    emit(OP_POP);
+    pop();
+  }
+  if (fused)
+  {
+    patch(skip);
+  }
+}
+
+// Operands and conditions must be integers (unless known to be), and
+// an assignment is rejected without being evaluated
+void BytecodeCompiler::compile_numeric(Node *ast, Node *site_ast)
+{
+  if (ast->get_tag() == AST_ASSIGNMENT)
+  {
+    emit(OP_FAIL, site(site_ast));
+    push();
+    return;
+  }
+  compile_expr(ast, true);
+  if (!ast->is_numeric())
+  {
+    emit(OP_NUMERIC, site(site_ast));
+  }
+}
+
+// Conditions comparing variables, or a variable with a literal, test
+// and jump in one instruction
+unsigned BytecodeCompiler::compile_jump_unless(Node *cond, Node *site_ast)
+{
+  unsigned target;
+  if (compile_less_jump(cond, target) || compile_compare_k(cond, true, target))
+  {
+    return target;
+  }
+  compile_numeric(cond, site_ast);
+  return emit_jump(OP_JUMP_ZERO);
+}
+
+// x = x + k (or k + x), as a statement
+bool BytecodeCompiler::compile_incr(Node *assign)
+{
+  Node *add = assign->get_kid(1);
+  if (add->get_tag() != AST_ADD)
+  {
+    return false;
+  }
+  Node *var = add->get_kid(0);
+  Node *k = add->get_kid(1);
+  if (var->get_tag() == AST_INT_LITERAL)
+  {
+    std::swap(var, k);
+  }
+  if (var->get_tag() != AST_VARREF || k->get_tag() != AST_INT_LITERAL ||
+      var_operand(var) != var_operand(assign->get_kid(0)))
+  {
+    return false;
+  }
+  emit(OP_INCR, {var_operand(var), atoi(k->get_str().c_str()), site(add)});
+  return true;
+}
+
+// a < b (or b > a) for variables a and b, as a condition
+bool BytecodeCompiler::compile_less_jump(Node *ast, unsigned &target)
+{
+  if (ast->get_tag() != AST_LESS && ast->get_tag() != AST_GREATER)
+  {
+    return false;
+  }
+  Node *left = ast->get_kid(0);
+  Node *right = ast->get_kid(1);
+  if (left->get_tag() != AST_VARREF || right->get_tag() != AST_VARREF)
+  {
+    return false;
+  }
+
+  // Both operands are checked at the same site, so the order doesn't
+  // change which error is reported
+  if (ast->get_tag() == AST_GREATER)
+  {
+    std::swap(left, right);
+  }
+  emit(OP_LESS_JUMP, {var_operand(left), var_operand(right), -1, site(ast)});
+  target = unsigned(m_chunk->code.size() - 2);
+  return true;
+}
+
+// A variable compared with a literal, pushed or (as a condition) tested
+bool BytecodeCompiler::compile_compare_k(Node *ast, bool jump, unsigned &target)
+{
+  int op = arith_opcode(ast->get_tag(), false);
+  if (op < OP_LESS || op > OP_NOT_EQUAL)
+  {
+    return false;
+  }
+  int tag = ast->get_tag();
+  Node *var = ast->get_kid(0);
+  Node *k = ast->get_kid(1);
+  if (var->get_tag() == AST_INT_LITERAL)
+  {
+    std::swap(var, k);
+    tag = mirror(tag);
+  }
+  if (var->get_tag() != AST_VARREF || k->get_tag() != AST_INT_LITERAL)
+  {
+    return false;
+  }
+
+  int val = atoi(k->get_str().c_str());
+  if (jump)
+  {
+    emit(OP_COMPARE_K_JUMP, {var_operand(var), val, tag, -1, site(ast)});
+    target = unsigned(m_chunk->code.size() - 2);
+  }
+  else
+  {
+    emit(OP_COMPARE_K, {var_operand(var), val, tag, site(ast)});
+    push();
+  }
+  return true;
+}
+
+// print(x) or println(x) of a variable, with the call's code following
+// for when the global no longer holds an intrinsic
+bool BytecodeCompiler::compile_print_var(Node *call, bool want, unsigned &target)
+{
+  if (!call->has_address() || (call->get_str() != "print" && call->get_str() != "println"))
+  {
+    return false;
+  }
+  int callee = var_operand(call);
+  if (callee >= 0 || call->get_num_kids() == 0 || call->get_kid(0)->get_num_kids() != 1 ||
+      call->get_kid(0)->get_kid(0)->get_tag() != AST_VARREF)
+  {
+    return false;
+  }
+  emit(OP_PRINT_VAR, {-1 - callee, var_operand(call->get_kid(0)->get_kid(0)), want ? 1 : 0, -1, site(call)});
+  target = unsigned(m_chunk->code.size() - 2);
+  return true;
+}
+
+int BytecodeCompiler::var_operand(Node *ref)
+{
+  int base = m_bases[m_bases.size() - 1 - ref->get_depth()];
+  return base < 0 ? -1 - ref->get_slot() : base + ref->get_slot();
+}
+
+void BytecodeCompiler::emit_access(Node *ref, int local_op, int global_op)
+{
+  int base = m_bases[m_bases.size() - 1 - ref->get_depth()];
+  if (base < 0)
+  {
+    emit(global_op, ref->get_slot());
+  }
+  else
+  {
+    emit(local_op, base + ref->get_slot());
+  }
+}
+
+void BytecodeCompiler::emit(int op)
+{
+  m_chunk->code.push_back(op);
+}
+
+void BytecodeCompiler::emit(int op, int operand)
+{
+  m_chunk->code.push_back(op);
+  m_chunk->code.push_back(operand);
+}
+
+void BytecodeCompiler::emit(int op, int operand1, int operand2)
+{
+  m_chunk->code.push_back(op);
+  m_chunk->code.push_back(operand1);
+  m_chunk->code.push_back(operand2);
+}
+
+void BytecodeCompiler::emit(int op, std::initializer_list<int> operands)
+{
+  m_chunk->code.push_back(op);
+  m_chunk->code.insert(m_chunk->code.end(), operands);
+}
+
+int BytecodeCompiler::site(Node *ast)
+{
+  m_chunk->sites.push_back(ast);
+  return int(m_chunk->sites.size() - 1);
+}
+
+// Conditional jumps pop the condition
+unsigned BytecodeCompiler::emit_jump(int op)
+{
+  emit(op, -1);
+  if (op != OP_JUMP)
+  {
+    pop();
+  }
+  return unsigned(m_chunk->code.size() - 1);
+}
+
+void BytecodeCompiler::patch(unsigned jump)
+{
+  m_chunk->code[jump] = int(m_chunk->code.size());
+}
+
+void BytecodeCompiler::push(unsigned count)
+{
+  m_depth += count;
+  m_chunk->max_stack = std::max(m_chunk->max_stack, m_depth);
+}
+
+void BytecodeCompiler::pop(unsigned count)
+{
+  m_depth -= count;
+}
+
+void BytecodeCompiler::disassemble(const Chunk *chunk)
+{
+  printf("%s: %u params, %u locals, stack depth %u\n", chunk->name.c_str(), chunk->num_params, chunk->num_locals,
+         chunk->max_stack);
+  unsigned pc = 0;
+  while (pc < chunk->code.size())
+  {
+    const OpcodeInfo &info = OPCODES[chunk->code[pc]];
+    printf(*info.operands != '\0' ? "  %4u  %-14s" : "  %4u  %s", pc, info.name);
+    pc++;
+    for (const char *kind = info.operands; *kind != '\0'; kind++, pc++)
+    {
+      int operand = chunk->code[pc];
+      const char *sep = kind == info.operands ? " " : ", ";
+      switch (*kind)
+      {
+      case 'g':
+        printf("%sg%d", sep, operand);
+        break;
+      case 'L':
+        printf("%s@%d", sep, operand);
+        break;
+      case 'v':
+        printf(operand < 0 ? "%sg%d" : "%s%d", sep, operand < 0 ? -1 - operand : operand);
+        break;
+      case 'o':
+        printf("%s%s", sep, compare_str(operand));
+        break;
+      case 's':
+      {
+        const Location &loc = chunk->sites[operand]->get_loc();
+        printf("  ; %d:%d", loc.get_line(), loc.get_col());
+        break;
+      }
+      default:
+        printf("%s%d", sep, operand);
+        break;
+      }
+    }
+    printf("\n");
+  }
+}
+
+const char *BytecodeCompiler::opcode_name(int op)
+{
+  return OPCODES[op].name;
+}
@@ -0,0 +1,146 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <string>
+#include <vector>
+#include <initializer_list>
+class Node;
+
+// Instructions of the stack VM. Operands follow the opcode in the code
+// array; "site" operands index the chunk's table of ast nodes, whose
+// locations are used to report errors.
+enum Opcode {
+  OP_INT,           // k: push k
+  OP_LOAD,          // i: push local i
+  OP_STORE,         // i: pop into local i
+  OP_LOAD_GLOBAL,   // i: push global i
+  OP_STORE_GLOBAL,  // i: pop into global i
+  OP_DEFINE,        // i: set local i to -1
+  OP_DEFINE_GLOBAL, // i: set global i to -1
+  OP_POP,
+  OP_DUP,
+  OP_NUMERIC,       // site: fail if the top value isn't an integer
+  OP_ADD,           // site: checked arithmetic, failing at the site
+  OP_SUB,
+  OP_MULTIPLY,
+  OP_DIVIDE,
+  OP_ADD_SAFE,      // arithmetic known not to fail
+  OP_SUB_SAFE,
+  OP_MULTIPLY_SAFE,
+  OP_DIVIDE_SAFE,
+  OP_LESS,
+  OP_LESS_EQUAL,
+  OP_GREATER,
+  OP_GREATER_EQUAL,
+  OP_EQUAL,
+  OP_NOT_EQUAL,
+  OP_BOOL,          // replace the top by 1 if it is non-zero, else 0
+  OP_JUMP,          // target
+  OP_JUMP_ZERO,     // target: pop, jump if 0
+  OP_JUMP_NONZERO,  // target: pop, jump if not 0
+  OP_FUNCTION,      // chunk, i: define a function in global i
+  OP_CALLEE,        // n, site: check the top is callable with n args
+  OP_CALL,          // n, site: call the callee below n args
+  OP_RETURN,        // return the top from a function
+  OP_FAIL,          // site: call of an undefined name, or operator or
+                    // condition whose operand is an assignment
+  OP_HALT,          // end of the unit, with the top as its result
+
+  // Superinstructions for common statements and conditions. A variable
+  // operand v is local v if it isn't negative, otherwise global -1-v.
+  OP_INCR,          // v, k, site: v = v + k, checked
+  OP_LESS_JUMP,     // v1, v2, target, site: jump unless v1 < v2
+  OP_COMPARE_K,     // v, k, tag, site: push the comparison of v with k
+  OP_COMPARE_K_JUMP,// v, k, tag, target, site: jump unless it holds
+  OP_PRINT_VAR,     // g, v, want, target, site: if global g is an
+                    // intrinsic, call it with v (pushing the result if
+                    // want) and jump to target, otherwise continue with
+                    // the code of the call
+  NUM_OPCODES,
+};
+
+// First of the superinstructions
+const int FIRST_FUSED_OPCODE = OP_INCR;
+
+// Compiled code of the unit or of one function. Variables of the
+// function's nested blocks get their own locals, after the parameters
+// and variables of the body (functions are only defined in the unit,
+// so no block's variables outlive the call).
+struct Chunk {
+  std::string name;
+  Node *fn;
+  unsigned num_params;
+  unsigned num_locals;
+  unsigned max_stack;
+  std::vector<int> code;
+  std::vector<Node *> sites;
+};
+
+// Compiles the (analyzed and optimized) unit to bytecode for the stack
+// VM. Chunk 0 is the unit, the others are its functions in order.
+class BytecodeCompiler {
+private:
+  std::vector<Chunk *> m_chunks;
+  Chunk *m_chunk;
+
+  // Base local of each enclosing block (-1 for the unit's globals),
+  // the next free local, and the current operand stack depth
+  std::vector<int> m_bases;
+  unsigned m_num_locals;
+  unsigned m_depth;
+
+  // copy constructor and assignment operator prohibited
+  BytecodeCompiler(const BytecodeCompiler &);
+  BytecodeCompiler &operator=(const BytecodeCompiler &);
+
+public:
+  BytecodeCompiler();
+  ~BytecodeCompiler();
+
+  // Compile the unit, returning its chunks (which the caller owns)
+  std::vector<Chunk *> compile(Node *unit);
+
+  // Print a chunk's instructions
+  static void disassemble(const Chunk *chunk);
+
+  static const char *opcode_name(int op);
+
+private:
+  void compile_chunk(Chunk *chunk, Node *body, unsigned level_slots, bool unit);
+  void compile_block(Node *block, bool want);
+  void compile_list(Node *list, bool want);
+  void compile_stmt(Node *stmt, bool want);
+  void compile_expr(Node *ast, bool want);
+  void compile_call(Node *ast, bool want);
+  void compile_numeric(Node *ast, Node *site);
+
+  // Compile a condition of site, returning a jump (to patch) taken if
+  // it is false
+  unsigned compile_jump_unless(Node *cond, Node *site);
+
+  // Superinstructions, false if the node doesn't have their shape
+  bool compile_incr(Node *assign);
+  bool compile_compare_k(Node *ast, bool jump, unsigned &target);
+  bool compile_less_jump(Node *ast, unsigned &target);
+  bool compile_print_var(Node *call, bool want, unsigned &target);
+
+  // Operand of a superinstruction for a variable
+  int var_operand(Node *ref);
+
+  // Load, store or define the variable at a node's address
+  void emit_access(Node *ref, int local_op, int global_op);
+
+  void emit(int op);
+  void emit(int op, int operand);
+  void emit(int op, int operand1, int operand2);
+  void emit(int op, std::initializer_list<int> operands);
+  int site(Node *ast);
+  unsigned emit_jump(int op);
+  void patch(unsigned jump);
+
+  // Track the operand stack depth
+  void push(unsigned count = 1);
+  void pop(unsigned count = 1);
+};
+
+#endif // BYTECODE_H
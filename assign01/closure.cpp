@@ -0,0 +1,652 @@
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <algorithm>
+#include "ast.h"
+#include "node.h"
+#include "exceptions.h"
+#include "function.h"
+#include "environment.h"
+#include "memo.h"
+#include "interp.h"
+#include "closure.h"
+
+namespace {
+
+typedef ClosureCompiler::IntCode IntCode;
+
+// Operands are evaluated in order, then combined by op
+template <typename Op>
+IntCode binary(const IntCode &left, const IntCode &right, Op op)
+{
+  return [left, right, op](Value *frame) {
+    int op1 = left(frame);
+    return op(op1, right(frame));
+  };
+}
+
+}
+
+ClosureCompiler::ClosureCompiler(Interpreter *interp, Environment *globals, bool log_tiers)
+    : m_interp(interp), m_globals(globals), m_log_tiers(log_tiers), m_num_locals(0), m_max_locals(0)
+{
+}
+
+ClosureCompiler::~ClosureCompiler()
+{
+}
+
+Value ClosureCompiler::run(Node *unit)
+{
+  // Functions are numbered in order
+  unit->each_child([this](Node *stmt) {
+    if (stmt->get_tag() == AST_FUNCTION)
+    {
+      m_fns.push_back(stmt);
+    }
+  });
+  for (auto i = m_fns.begin(); i != m_fns.end(); ++i)
+  {
+    Node *body = (*i)->get_last_kid();
+    Code code = compile_body(body, body->get_num_slots(), false);
+    m_bodies.push_back({code, m_max_locals});
+  }
+
+  Code code = compile_body(unit, 0, true);
+  return code(m_frames.push(m_max_locals));
+}
+
+void ClosureCompiler::compile_function(Function *fn)
+{
+  Node *body = fn->get_body();
+  Code code = compile_body(body, body->get_num_slots(), false);
+  fn->set_code(int(m_bodies.size()));
+  m_bodies.push_back({code, m_max_locals});
+}
+
+Value ClosureCompiler::call_function(Function *fn, const std::vector<Value> &args)
+{
+  SlotStack::Mark mark = m_frames.get_mark();
+  Value *frame = m_frames.push(body(fn).num_locals);
+  std::copy(args.begin(), args.end(), frame);
+  Value result = run_body(fn, frame);
+  m_frames.pop(mark);
+  return result;
+}
+
+// The blocks below the unit are the first levels of locals, as if they
+// were nested in a function's body
+unsigned ClosureCompiler::compile_loop(Node *loop, const std::vector<Node *> &blocks)
+{
+  m_bases.assign(1, -1);
+  m_num_locals = 0;
+  for (auto i = blocks.begin() + 1; i != blocks.end(); ++i)
+  {
+    m_bases.push_back(int(m_num_locals));
+    m_num_locals += (*i)->get_num_slots();
+  }
+  m_max_locals = m_num_locals;
+
+  Code code = compile_while(loop);
+  m_loops.push_back({code, m_max_locals});
+  return unsigned(m_loops.size() - 1);
+}
+
+Value ClosureCompiler::run_loop(unsigned loop, Value *frame)
+{
+  return m_loops[loop].code(frame);
+}
+
+// The unit's own variables are globals, a function's body is the first
+// level of locals (its parameters are the first slots)
+ClosureCompiler::Code ClosureCompiler::compile_body(Node *body, unsigned level_slots, bool unit)
+{
+  m_bases.assign(1, -1);
+  if (!unit)
+  {
+    m_bases.push_back(0);
+  }
+  m_num_locals = level_slots;
+  m_max_locals = level_slots;
+  return unit ? compile_list(body) : compile_tail_list(body, false);
+}
+
+ClosureCompiler::Code ClosureCompiler::compile_block(Node *block)
+{
+  unsigned saved = m_num_locals;
+  m_bases.push_back(int(m_num_locals));
+  m_num_locals += block->get_num_slots();
+  m_max_locals = std::max(m_max_locals, m_num_locals);
+
+  Code code = compile_list(block);
+
+  m_bases.pop_back();
+  m_num_locals = saved;
+  return code;
+}
+
+// The value of a list is the value of its last statement
+ClosureCompiler::Code ClosureCompiler::compile_list(Node *list)
+{
+  std::vector<Code> stmts;
+  for (unsigned int i = 0; i < list->get_num_kids(); i++)
+  {
+    stmts.push_back(compile_stmt(list->get_kid(i)));
+  }
+  if (stmts.size() == 1)
+  {
+    return stmts[0];
+  }
+
+  Code last = stmts.back();
+  stmts.pop_back();
+  return [stmts, last](Value *frame) {
+    for (auto i = stmts.begin(); i != stmts.end(); ++i)
+    {
+      (*i)(frame);
+    }
+    return last(frame);
+  };
+}
+
+ClosureCompiler::Code ClosureCompiler::compile_tail_block(Node *block, bool discard)
+{
+  unsigned saved = m_num_locals;
+  m_bases.push_back(int(m_num_locals));
+  m_num_locals += block->get_num_slots();
+  m_max_locals = std::max(m_max_locals, m_num_locals);
+
+  Code code = compile_tail_list(block, discard);
+
+  m_bases.pop_back();
+  m_num_locals = saved;
+  return code;
+}
+
+ClosureCompiler::Code ClosureCompiler::compile_tail_list(Node *list, bool discard)
+{
+  Node *ast = list->get_last_kid()->get_kid(0);
+  Code last;
+  if (ast->get_tag() == AST_FNCALL)
+  {
+    last = compile_call(ast, true, discard);
+  }
+  else if (ast->get_tag() == AST_IF)
+  {
+    IntCode cond = compile_int(ast->get_kid(0), ast);
+    Code then_block = compile_tail_block(ast->get_kid(1), true);
+    Code else_block;
+    if (ast->get_last_kid()->get_tag() == AST_ELSE)
+    {
+      else_block = compile_tail_block(ast->get_last_kid()->get_kid(0), true);
+    }
+    last = [cond, then_block, else_block](Value *frame) {
+      if (cond(frame) != 0)
+      {
+        then_block(frame);
+      }
+      else if (else_block)
+      {
+        else_block(frame);
+      }
+      return Value();
+    };
+  }
+  else
+  {
+    last = compile_stmt(list->get_last_kid());
+  }
+
+  std::vector<Code> stmts;
+  for (unsigned int i = 0; i < list->get_num_kids() - 1; i++)
+  {
+    stmts.push_back(compile_stmt(list->get_kid(i)));
+  }
+  if (stmts.empty())
+  {
+    return last;
+  }
+  return [stmts, last](Value *frame) {
+    for (auto i = stmts.begin(); i != stmts.end(); ++i)
+    {
+      (*i)(frame);
+    }
+    return last(frame);
+  };
+}
+
+ClosureCompiler::Code ClosureCompiler::compile_stmt(Node *stmt)
+{
+  if (stmt->get_tag() == AST_FUNCTION)
+  {
+    int index = int(std::find(m_fns.begin(), m_fns.end(), stmt) - m_fns.begin());
+    return [this, stmt, index](Value *) {
+      m_interp->define_function(stmt, m_globals)->set_code(index);
+      return Value();
+    };
+  }
+
+  // If, while and definitions evaluate to 0
+  Node *ast = stmt->get_kid(0);
+  switch (ast->get_tag())
+  {
+  case AST_IF:
+  {
+    IntCode cond = compile_int(ast->get_kid(0), ast);
+    Code then_block = compile_block(ast->get_kid(1));
+    if (ast->get_last_kid()->get_tag() != AST_ELSE)
+    {
+      return [cond, then_block](Value *frame) {
+        if (cond(frame) != 0)
+        {
+          then_block(frame);
+        }
+        return Value();
+      };
+    }
+    Code else_block = compile_block(ast->get_last_kid()->get_kid(0));
+    return [cond, then_block, else_block](Value *frame) {
+      if (cond(frame) != 0)
+      {
+        then_block(frame);
+      }
+      else
+      {
+        else_block(frame);
+      }
+      return Value();
+    };
+  }
+
+  case AST_WHILE:
+    return compile_while(ast);
+
+  // Redefinitions have no address and do nothing
+  case AST_DEFINITION:
+  {
+    if (!ast->has_address())
+    {
+      return [](Value *) { return Value(); };
+    }
+    int slot = local(ast);
+    if (slot >= 0)
+    {
+      return [slot](Value *frame) {
+        frame[slot] = Value(-1);
+        return Value();
+      };
+    }
+    Environment *globals = m_globals;
+    unsigned global = ast->get_slot();
+    return [globals, global](Value *) {
+      globals->define(global);
+      return Value();
+    };
+  }
+
+  default:
+    return compile_expr(ast);
+  }
+}
+
+ClosureCompiler::Code ClosureCompiler::compile_expr(Node *ast)
+{
+  switch (ast->get_tag())
+  {
+  case AST_INT_LITERAL:
+  {
+    Value val(atoi(ast->get_str().c_str()));
+    return [val](Value *) { return val; };
+  }
+
+  case AST_VARREF:
+  {
+    int slot = local(ast);
+    if (slot >= 0)
+    {
+      return [slot](Value *frame) { return frame[slot]; };
+    }
+    Environment *globals = m_globals;
+    unsigned global = ast->get_slot();
+    return [globals, global](Value *) { return globals->lookup(global); };
+  }
+
+  case AST_ASSIGNMENT:
+  {
+    Code rhs = compile_expr(ast->get_kid(1));
+    int slot = local(ast->get_kid(0));
+    if (slot >= 0)
+    {
+      return [rhs, slot](Value *frame) {
+        Value val = rhs(frame);
+        frame[slot] = val;
+        return val;
+      };
+    }
+    Environment *globals = m_globals;
+    unsigned global = ast->get_kid(0)->get_slot();
+    return [rhs, globals, global](Value *frame) {
+      Value val = rhs(frame);
+      globals->assign(global, val);
+      return val;
+    };
+  }
+
+  case AST_FNCALL:
+    return compile_call(ast, false, false);
+
+  default:
+  {
+    IntCode op = compile_op(ast);
+    return [op](Value *frame) { return Value(op(frame)); };
+  }
+  }
+}
+
+ClosureCompiler::Code ClosureCompiler::compile_while(Node *ast)
+{
+  IntCode cond = compile_int(ast->get_kid(0), ast);
+  Code body = compile_block(ast->get_kid(1));
+  return [cond, body](Value *frame) {
+    while (cond(frame) != 0)
+    {
+      body(frame);
+    }
+    return Value();
+  };
+}
+
+// The callee is checked before the arguments are evaluated, into the
+// frame of the call. Calls of intrinsics (and errors) in tail position
+// are made as usual.
+ClosureCompiler::Code ClosureCompiler::compile_call(Node *ast, bool tail, bool discard)
+{
+  if (!ast->has_address())
+  {
+    return [ast](Value *) -> Value { EvaluationError::raise(ast->get_loc(), "Invalid function"); };
+  }
+
+  std::vector<Code> args;
+  for (unsigned int i = 0; ast->get_num_kids() != 0 && i < ast->get_kid(0)->get_num_kids(); i++)
+  {
+    args.push_back(compile_expr(ast->get_kid(0)->get_kid(i)));
+  }
+  int slot = local(ast);
+  unsigned global = ast->get_slot();
+
+  return [this, ast, args, slot, global, tail, discard](Value *frame) {
+    const Value &callee = slot >= 0 ? frame[slot] : m_globals->lookup(global);
+    unsigned num_args = unsigned(args.size());
+    SlotStack::Mark mark = m_frames.get_mark();
+    Value result;
+
+    if (callee.get_kind() == VALUE_FUNCTION)
+    {
+      Function *fn = callee.get_function();
+      if (fn->get_num_params() != num_args)
+      {
+        EvaluationError::raise(ast->get_loc(), "Invalid params");
+      }
+      if (tail)
+      {
+        std::vector<Value> values;
+        for (unsigned int i = 0; i < num_args; i++)
+        {
+          values.push_back(args[i](frame));
+        }
+        m_tail.fn = fn;
+        m_tail.args.swap(values);
+        m_tail.discard = discard;
+        return Value();
+      }
+      Value *callee_frame = m_frames.push(body(fn).num_locals);
+      for (unsigned int i = 0; i < num_args; i++)
+      {
+        callee_frame[i] = args[i](frame);
+      }
+      result = call(fn, callee_frame);
+    }
+    else if (callee.get_kind() == VALUE_INTRINSIC_FN)
+    {
+      IntrinsicFn fn = callee.get_intrinsic_fn();
+      Value *arg_values = m_frames.push(num_args);
+      for (unsigned int i = 0; i < num_args; i++)
+      {
+        arg_values[i] = args[i](frame);
+      }
+      result = fn(arg_values, num_args, ast->get_loc(), m_interp);
+    }
+    else
+    {
+      EvaluationError::raise(ast->get_loc(), "Invalid function");
+    }
+
+    m_frames.pop(mark);
+    return result;
+  };
+}
+
+const ClosureCompiler::Body &ClosureCompiler::body(Function *fn)
+{
+  if (fn->get_code() < 0)
+  {
+    if (m_log_tiers)
+    {
+      fprintf(stderr, "tier: function %s compiled when called from compiled code\n", fn->get_name().c_str());
+    }
+    compile_function(fn);
+  }
+  return m_bodies[fn->get_code()];
+}
+
+// A memoized function's cached result replaces the call
+Value ClosureCompiler::call(Function *fn, Value *frame)
+{
+  MemoCache *memo = fn->get_memo();
+  std::vector<int> key;
+  if (memo != nullptr)
+  {
+    int cached;
+    if (!Interpreter::memo_key(std::vector<Value>(frame, frame + fn->get_num_params()), key))
+    {
+      memo = nullptr;
+    }
+    else if (memo->lookup(key, cached))
+    {
+      return cached;
+    }
+  }
+
+  Value result = run_body(fn, frame);
+  if (memo != nullptr && result.is_numeric())
+  {
+    memo->insert(key, result.get_ival());
+  }
+  return result;
+}
+
+// Run a function's body, then the tail calls it leaves
+Value ClosureCompiler::run_body(Function *fn, Value *frame)
+{
+  Value result = body(fn).code(frame);
+
+  // After a tail call in an if arm, the result is the if's value
+  bool discard = false;
+  while (m_tail.fn != nullptr)
+  {
+    discard = discard || m_tail.discard;
+    fn = m_tail.fn;
+    m_tail.fn = nullptr;
+    std::vector<Value> args;
+    args.swap(m_tail.args);
+
+    std::vector<int> tail_key;
+    int cached;
+    if (fn->get_memo() != nullptr && Interpreter::memo_key(args, tail_key) && fn->get_memo()->lookup(tail_key, cached))
+    {
+      result = cached;
+      break;
+    }
+
+    SlotStack::Mark mark = m_frames.get_mark();
+    const Body &tail_body = body(fn);
+    Value *tail_frame = m_frames.push(tail_body.num_locals);
+    std::copy(args.begin(), args.end(), tail_frame);
+    result = tail_body.code(tail_frame);
+    m_frames.pop(mark);
+  }
+
+  if (discard)
+  {
+    result = 0;
+  }
+  return result;
+}
+
+// Operands and conditions must be integers (unless known to be), and
+// an assignment is rejected without being evaluated
+ClosureCompiler::IntCode ClosureCompiler::compile_int(Node *ast, Node *site)
+{
+  switch (ast->get_tag())
+  {
+  case AST_ASSIGNMENT:
+    return [site](Value *) -> int { EvaluationError::raise(site->get_loc(), "Non-numeric condition"); };
+
+  case AST_INT_LITERAL:
+  {
+    int val = atoi(ast->get_str().c_str());
+    return [val](Value *) { return val; };
+  }
+
+  case AST_ADD:
+  case AST_SUB:
+  case AST_MULTIPLY:
+  case AST_DIVIDE:
+  case AST_LESS:
+  case AST_LESS_EQUAL:
+  case AST_GREATER:
+  case AST_GREATER_EQUAL:
+  case AST_EQUAL:
+  case AST_NOT_EQUAL:
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+    return compile_op(ast);
+  }
+
+  int slot = ast->get_tag() == AST_VARREF ? local(ast) : -1;
+  if (slot >= 0 && ast->is_numeric())
+  {
+    return [slot](Value *frame) { return frame[slot].get_ival(); };
+  }
+  if (slot >= 0)
+  {
+    return [slot, site](Value *frame) {
+      if (!frame[slot].is_numeric())
+      {
+        EvaluationError::raise(site->get_loc(), "Non-numeric condition");
+      }
+      return frame[slot].get_ival();
+    };
+  }
+
+  Code code = compile_expr(ast);
+  if (ast->is_numeric())
+  {
+    return [code](Value *frame) { return code(frame).get_ival(); };
+  }
+  return [code, site](Value *frame) {
+    Value val = code(frame);
+    if (!val.is_numeric())
+    {
+      EvaluationError::raise(site->get_loc(), "Non-numeric condition");
+    }
+    return val.get_ival();
+  };
+}
+
+// Errors are raised by Interpreter::doOp, so they are the tree walker's
+IntCode ClosureCompiler::compile_op(Node *ast)
+{
+  IntCode left = compile_int(ast->get_kid(0), ast);
+  IntCode right = compile_int(ast->get_kid(1), ast);
+  bool safe = ast->is_safe();
+
+  switch (ast->get_tag())
+  {
+  case AST_ADD:
+    if (safe)
+    {
+      return binary(left, right, [](int op1, int op2) { return op1 + op2; });
+    }
+    return binary(left, right, [ast](int op1, int op2) {
+      int result;
+      if (__builtin_add_overflow(op1, op2, &result))
+      {
+        Interpreter::doOp(AST_ADD, op1, op2, ast);
+      }
+      return result;
+    });
+  case AST_SUB:
+    if (safe)
+    {
+      return binary(left, right, [](int op1, int op2) { return op1 - op2; });
+    }
+    return binary(left, right, [ast](int op1, int op2) {
+      int result;
+      if (__builtin_sub_overflow(op1, op2, &result))
+      {
+        Interpreter::doOp(AST_SUB, op1, op2, ast);
+      }
+      return result;
+    });
+  case AST_MULTIPLY:
+    if (safe)
+    {
+      return binary(left, right, [](int op1, int op2) { return op1 * op2; });
+    }
+    return binary(left, right, [ast](int op1, int op2) {
+      int result;
+      if (__builtin_mul_overflow(op1, op2, &result))
+      {
+        Interpreter::doOp(AST_MULTIPLY, op1, op2, ast);
+      }
+      return result;
+    });
+  case AST_DIVIDE:
+    if (safe)
+    {
+      return binary(left, right, [](int op1, int op2) { return op1 / op2; });
+    }
+    return binary(left, right, [ast](int op1, int op2) {
+      if (op2 == 0 || (op2 == -1 && op1 == INT_MIN))
+      {
+        Interpreter::doOp(AST_DIVIDE, op1, op2, ast);
+      }
+      return op1 / op2;
+    });
+  case AST_LESS:
+    return binary(left, right, [](int op1, int op2) { return op1 < op2 ? 1 : 0; });
+  case AST_LESS_EQUAL:
+    return binary(left, right, [](int op1, int op2) { return op1 <= op2 ? 1 : 0; });
+  case AST_GREATER:
+    return binary(left, right, [](int op1, int op2) { return op1 > op2 ? 1 : 0; });
+  case AST_GREATER_EQUAL:
+    return binary(left, right, [](int op1, int op2) { return op1 >= op2 ? 1 : 0; });
+  case AST_EQUAL:
+    return binary(left, right, [](int op1, int op2) { return op1 == op2 ? 1 : 0; });
+  case AST_NOT_EQUAL:
+    return binary(left, right, [](int op1, int op2) { return op1 != op2 ? 1 : 0; });
+
+  // The second operand is only evaluated if the first doesn't decide
+  case AST_LOGICAL_AND:
+    return [left, right](Value *frame) { return left(frame) != 0 && right(frame) != 0 ? 1 : 0; };
+  default:
+    return [left, right](Value *frame) { return left(frame) != 0 || right(frame) != 0 ? 1 : 0; };
+  }
+}
+
+int ClosureCompiler::local(Node *ref)
+{
+  int base = m_bases[m_bases.size() - 1 - ref->get_depth()];
+  return base < 0 ? -1 : base + ref->get_slot();
+}
@@ -0,0 +1,132 @@
+#ifndef CLOSURE_H
+#define CLOSURE_H
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include "value.h"
+#include "slotstack.h"
+class Node;
+class Interpreter;
+class Environment;
+class Function;
+
+// Execution engine which converts the (analyzed and optimized) unit,
+// once, into a tree of C++ closures: each node becomes a function
+// object holding its resolved slot or decoded constant and the closures
+// of its children, so running the program is a chain of calls with no
+// tag dispatch or ast traversal. Locals are numbered as for the VMs
+// (parameters first, then the variables of the body and its nested
+// blocks) and live in a frame on a SlotStack; globals are the slots of
+// the unit's Environment, shared with the tree walker.
+//
+// For tiered execution the tree walker runs the program, and has the
+// compiler compile the functions and while loops which become hot. A
+// function called by compiled code is compiled when first called.
+class ClosureCompiler {
+public:
+  // Code of a statement or expression, run with the current frame
+  typedef std::function<Value(Value *)> Code;
+
+  // Code of an operand or condition, whose value must be an integer
+  typedef std::function<int(Value *)> IntCode;
+
+private:
+  // Compiled body of a function
+  struct Body {
+    Code code;
+    unsigned num_locals;
+  };
+
+  // Call left by a body's code for its caller to make (see TailCall in
+  // interp.h)
+  struct TailCall {
+    Function *fn = nullptr;
+    std::vector<Value> args;
+    bool discard = false;
+  };
+
+  // Compiled while loop, run in a frame holding the variables of its
+  // enclosing blocks and then those of its own nested blocks
+  struct Loop {
+    Code code;
+    unsigned num_locals;
+  };
+
+  Interpreter *m_interp;
+  Environment *m_globals;
+  std::vector<Node *> m_fns;
+
+  // Compiled code is added while other code runs, so it is kept in
+  // deques, which don't move their elements
+  std::deque<Body> m_bodies;
+  std::deque<Loop> m_loops;
+  SlotStack m_frames;
+  TailCall m_tail;
+
+  // Whether to report functions compiled when compiled code calls them
+  bool m_log_tiers;
+
+  // Base local of each enclosing block (-1 for the unit's globals),
+  // the next free local, and the locals needed by the current body
+  std::vector<int> m_bases;
+  unsigned m_num_locals;
+  unsigned m_max_locals;
+
+  // copy constructor and assignment operator prohibited
+  ClosureCompiler(const ClosureCompiler &);
+  ClosureCompiler &operator=(const ClosureCompiler &);
+
+public:
+  ClosureCompiler(Interpreter *interp, Environment *globals, bool log_tiers = false);
+  ~ClosureCompiler();
+
+  // Compile and execute the unit, returning the value of its last
+  // statement
+  Value run(Node *unit);
+
+  // Compile a function defined by the tree walker, and call it
+  void compile_function(Function *fn);
+  Value call_function(Function *fn, const std::vector<Value> &args);
+
+  // Compile a while loop whose enclosing statement lists (from the
+  // unit down) are blocks, returning its index. Its frame holds the
+  // slots of the blocks below the unit in order, and the loop runs
+  // from its condition.
+  unsigned compile_loop(Node *loop, const std::vector<Node *> &blocks);
+  unsigned get_loop_locals(unsigned loop) const { return m_loops[loop].num_locals; }
+  Value run_loop(unsigned loop, Value *frame);
+
+private:
+  Code compile_body(Node *body, unsigned level_slots, bool unit);
+  Code compile_block(Node *block);
+  Code compile_list(Node *list);
+  Code compile_stmt(Node *stmt);
+  Code compile_expr(Node *ast);
+  Code compile_while(Node *ast);
+
+  // Compile a function body (or an if arm at its end), leaving a call
+  // of a user-defined function in the last statement to the caller
+  Code compile_tail_block(Node *block, bool discard);
+  Code compile_tail_list(Node *list, bool discard);
+
+  // Compile a call, made here or (if tail) left in m_tail
+  Code compile_call(Node *ast, bool tail, bool discard);
+
+  // Compile an operand or condition, checking it is numeric at site
+  IntCode compile_int(Node *ast, Node *site);
+  IntCode compile_op(Node *ast);
+
+  // Local holding a variable, or -1 for a global
+  int local(Node *ref);
+
+  // Compiled body of a function, compiling it if it has none
+  const Body &body(Function *fn);
+
+  // Call a function with the arguments in its frame, then make the
+  // tail calls it leaves
+  Value call(Function *fn, Value *frame);
+  Value run_body(Function *fn, Value *frame);
+};
+
+#endif // CLOSURE_H
@@ -0,0 +1,183 @@
+#include <cstdlib>
+#include <string>
+#include "ast.h"
+#include "node.h"
+#include "interp.h"
+#include "constfold.h"
+
+ConstantFolder::ConstantFolder(unsigned num_symbols)
+    : m_num_assigns(num_symbols, 0), m_known(num_symbols, false), m_value(num_symbols, 0)
+{
+}
+
+ConstantFolder::~ConstantFolder()
+{
+}
+
+void ConstantFolder::run(Node *unit)
+{
+  count_assignments(unit);
+  fold(unit);
+}
+
+// Check if node is an int literal
+bool ConstantFolder::is_constant(Node *ast, int &val)
+{
+  if (ast->get_tag() != AST_INT_LITERAL)
+  {
+    return false;
+  }
+  val = atoi(ast->get_str().c_str());
+  return true;
+}
+
+// New literal keeps the location of the node it replaces, so errors
+// (e.g. a constant divisor of 0) are still reported at the same place
+Node *ConstantFolder::make_constant(Node *ast, int val)
+{
+  Node *lit = new Node(AST_INT_LITERAL, std::to_string(val));
+  lit->set_loc(ast->get_loc());
+  return lit;
+}
+
+void ConstantFolder::count_assignments(Node *ast)
+{
+  ast->preorder([this](Node *n) {
+    if (n->get_tag() == AST_ASSIGNMENT && n->get_kid(0)->has_address())
+    {
+      m_num_assigns[n->get_kid(0)->get_symbol()]++;
+    }
+    else if (n->get_tag() == AST_FUNCTION)
+    {
+      m_num_assigns[n->get_symbol()]++;
+    }
+  });
+}
+
+Node *ConstantFolder::fold(Node *ast)
+{
+  int val1, val2;
+
+  switch (ast->get_tag())
+  {
+  // Variable known to be constant here
+  case AST_VARREF:
+    if (ast->has_address() && m_known[ast->get_symbol()])
+    {
+      return make_constant(ast, m_value[ast->get_symbol()]);
+    }
+    return ast;
+
+  // Target of the assignment is not a read
+  case AST_ASSIGNMENT:
+    fold_kids(ast, 1);
+    return ast;
+
+  case AST_DEFINITION:
+    return ast;
+
+  // Only the body of a function is folded
+  case AST_FUNCTION:
+    fold_kids(ast, ast->get_num_kids() - 1);
+    return ast;
+
+  // Statements are folded in order, so constants are only
+  // propagated to reads after the assignment
+  case AST_UNIT:
+  case AST_STATEMENT_LIST:
+    for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+    {
+      Node *kid = ast->get_kid(i);
+      Node *folded = fold(kid);
+      if (folded != kid)
+      {
+        ast->set_kid(i, folded);
+        delete kid;
+      }
+      note_constant_assignment(folded);
+    }
+    return ast;
+
+  case AST_ADD:
+  case AST_SUB:
+  case AST_MULTIPLY:
+  case AST_DIVIDE:
+  case AST_GREATER:
+  case AST_LESS:
+  case AST_GREATER_EQUAL:
+  case AST_LESS_EQUAL:
+  case AST_EQUAL:
+  case AST_NOT_EQUAL:
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+    fold_kids(ast, 0);
+    if (!is_constant(ast->get_kid(0), val1))
+    {
+      return ast;
+    }
+
+    // Short circuit: second operand is never evaluated
+    if (ast->get_tag() == AST_LOGICAL_AND && val1 == 0)
+    {
+      return make_constant(ast, 0);
+    }
+    if (ast->get_tag() == AST_LOGICAL_OR && val1 != 0)
+    {
+      return make_constant(ast, 1);
+    }
+
+    if (!is_constant(ast->get_kid(1), val2))
+    {
+      return ast;
+    }
+
+    // Leave division by 0 and overflow for execution to report
+    if (Interpreter::fails(ast->get_tag(), val1, val2))
+    {
+      return ast;
+    }
+
+    return make_constant(ast, Interpreter::doOp(ast->get_tag(), val1, val2, ast).get_ival());
+
+  default:
+    fold_kids(ast, 0);
+    return ast;
+  }
+}
+
+void ConstantFolder::fold_kids(Node *ast, unsigned start)
+{
+  for (unsigned int i = start; i < ast->get_num_kids(); i++)
+  {
+    Node *kid = ast->get_kid(i);
+    Node *folded = fold(kid);
+    if (folded != kid)
+    {
+      ast->set_kid(i, folded);
+      delete kid;
+    }
+  }
+}
+
+void ConstantFolder::note_constant_assignment(Node *stmt)
+{
+  int val;
+
+  if (stmt->get_tag() != AST_STATEMENT || stmt->get_kid(0)->get_tag() != AST_ASSIGNMENT)
+  {
+    return;
+  }
+
+  // Variable must belong to this block and be assigned only here
+  Node *target = stmt->get_kid(0)->get_kid(0);
+  if (!target->has_address() || target->get_depth() != 0 || m_num_assigns[target->get_symbol()] != 1)
+  {
+    return;
+  }
+
+  if (is_constant(stmt->get_kid(0)->get_kid(1), val))
+  {
+    m_known[target->get_symbol()] = true;
+    m_value[target->get_symbol()] = val;
+  }
+}
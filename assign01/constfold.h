@@ -0,0 +1,52 @@
+#ifndef CONSTFOLD_H
+#define CONSTFOLD_H
+
+#include <vector>
+class Node;
+
+// Optimization pass run between Interpreter::analyze and
+// Interpreter::execute. Operators whose operands are integer literals
+// are replaced by their result, and a variable which is assigned
+// exactly once from a constant (by a statement in its own block) is
+// replaced by that constant wherever it is read after the assignment.
+class ConstantFolder {
+private:
+  // Number of assignments (including function definitions) of each symbol
+  std::vector<unsigned> m_num_assigns;
+
+  // Value of each symbol known to be constant at the current point
+  std::vector<bool> m_known;
+  std::vector<int> m_value;
+
+  // copy constructor and assignment operator prohibited
+  ConstantFolder(const ConstantFolder &);
+  ConstantFolder &operator=(const ConstantFolder &);
+
+public:
+  ConstantFolder(unsigned num_symbols);
+  ~ConstantFolder();
+
+  // Fold the (analyzed) unit in place
+  void run(Node *unit);
+
+  // Check if a node is an integer literal, retrieving its value
+  static bool is_constant(Node *ast, int &val);
+
+  // Create an integer literal to replace a node
+  static Node *make_constant(Node *ast, int val);
+
+private:
+  void count_assignments(Node *ast);
+
+  // Fold a node, returning the node which should replace it
+  Node *fold(Node *ast);
+
+  // Fold the children of a node starting at index start
+  void fold_kids(Node *ast, unsigned start);
+
+  // Record the value of a statement assigning a constant, if it
+  // is the only assignment of its variable
+  void note_constant_assignment(Node *stmt);
+};
+
+#endif // CONSTFOLD_H
@@ -0,0 +1,806 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <climits>
+#include <algorithm>
+#include "ast.h"
+#include "node.h"
+#include "ctranslator.h"
+
+namespace {
+
+// Start of every translated program
+const char RUNTIME_HEAD[] =
+  "#include <stdio.h>\n"
+  "#include <stdlib.h>\n"
+  "#include <limits.h>\n"
+  "\n"
+  "enum { ML_INT, ML_INTRINSIC, ML_FUNCTION };\n"
+  "\n"
+  "// An int, or the index of an intrinsic or a function\n"
+  "typedef struct\n"
+  "{\n"
+  "  int kind;\n"
+  "  int ival;\n"
+  "} Value;\n"
+  "\n";
+
+// The runtime, following the tables of the program's functions
+const char RUNTIME[] =
+  "static inline Value ml_value(int kind, int ival)\n"
+  "{\n"
+  "  Value val;\n"
+  "  val.kind = kind;\n"
+  "  val.ival = ival;\n"
+  "  return val;\n"
+  "}\n"
+  "\n"
+  "static inline Value ml_int(int ival)\n"
+  "{\n"
+  "  return ml_value(ML_INT, ival);\n"
+  "}\n"
+  "\n"
+  "static inline void ml_fail(int line, int col, const char *msg)\n"
+  "{\n"
+  "  fprintf(stderr, \"%s:%d:%d: Error: %s\\n\", ml_srcfile, line, col, msg);\n"
+  "  exit(1);\n"
+  "}\n"
+  "\n"
+  "static inline int ml_num(Value val, int line, int col)\n"
+  "{\n"
+  "  if (val.kind != ML_INT)\n"
+  "    ml_fail(line, col, \"Non-numeric condition\");\n"
+  "  return val.ival;\n"
+  "}\n"
+  "\n"
+  "static inline int ml_checked(long long result, int line, int col)\n"
+  "{\n"
+  "  if (result < INT_MIN || result > INT_MAX)\n"
+  "    ml_fail(line, col, \"Integer overflow\");\n"
+  "  return (int)result;\n"
+  "}\n"
+  "\n"
+  "static inline int ml_add(int op1, int op2, int line, int col)\n"
+  "{\n"
+  "  return ml_checked((long long)op1 + op2, line, col);\n"
+  "}\n"
+  "\n"
+  "static inline int ml_sub(int op1, int op2, int line, int col)\n"
+  "{\n"
+  "  return ml_checked((long long)op1 - op2, line, col);\n"
+  "}\n"
+  "\n"
+  "static inline int ml_multiply(int op1, int op2, int line, int col)\n"
+  "{\n"
+  "  return ml_checked((long long)op1 * op2, line, col);\n"
+  "}\n"
+  "\n"
+  "static inline int ml_divide(int op1, int op2, int line, int col, int div_line, int div_col)\n"
+  "{\n"
+  "  if (op2 == 0)\n"
+  "    ml_fail(div_line, div_col, \"Attempt to divide by 0\");\n"
+  "  if (op2 == -1 && op1 == INT_MIN)\n"
+  "    ml_fail(line, col, \"Integer overflow\");\n"
+  "  return op1 / op2;\n"
+  "}\n"
+  "\n"
+  "static inline void ml_put(Value val)\n"
+  "{\n"
+  "  if (val.kind == ML_INT)\n"
+  "    printf(\"%d\", val.ival);\n"
+  "  else if (val.kind == ML_INTRINSIC)\n"
+  "    printf(\"<intrinsic function>\");\n"
+  "  else\n"
+  "    printf(\"<function %s>\", ml_names[val.ival]);\n"
+  "}\n"
+  "\n"
+  "// Check a value can be called with num_args arguments\n"
+  "static inline void ml_callee(Value callee, int num_args, int line, int col)\n"
+  "{\n"
+  "  if (callee.kind == ML_INT)\n"
+  "    ml_fail(line, col, \"Invalid function\");\n"
+  "  if (callee.kind == ML_FUNCTION && ml_params[callee.ival] != num_args)\n"
+  "    ml_fail(line, col, \"Invalid params\");\n"
+  "}\n"
+  "\n"
+  "// print, println and readint\n"
+  "static inline Value ml_intrinsic(int index, Value *args, int num_args, int line, int col)\n"
+  "{\n"
+  "  static const char *const names[] = {\"print\", \"println\", \"readint\"};\n"
+  "  char msg[64];\n"
+  "  int read = 0;\n"
+  "\n"
+  "  if (num_args != (index == 2 ? 0 : 1))\n"
+  "  {\n"
+  "    sprintf(msg, \"Wrong number of arguments passed to %s function\", names[index]);\n"
+  "    ml_fail(line, col, msg);\n"
+  "  }\n"
+  "  if (index == 2)\n"
+  "  {\n"
+  "    if (scanf(\" %d\", &read) != 1)\n"
+  "      read = 0;\n"
+  "    return ml_int(read);\n"
+  "  }\n"
+  "  ml_put(args[0]);\n"
+  "  if (index == 1)\n"
+  "    printf(\"\\n\");\n"
+  "  return ml_int(0);\n"
+  "}\n"
+  "\n";
+
+const char *operator_str(int tag)
+{
+  switch (tag)
+  {
+  case AST_ADD:
+    return "+";
+  case AST_SUB:
+    return "-";
+  case AST_MULTIPLY:
+    return "*";
+  case AST_DIVIDE:
+    return "/";
+  case AST_GREATER:
+    return ">";
+  case AST_LESS:
+    return "<";
+  case AST_GREATER_EQUAL:
+    return ">=";
+  case AST_LESS_EQUAL:
+    return "<=";
+  case AST_EQUAL:
+    return "==";
+  case AST_NOT_EQUAL:
+    return "!=";
+  case AST_LOGICAL_AND:
+    return "&&";
+  case AST_LOGICAL_OR:
+    return "||";
+  }
+  return nullptr;
+}
+
+// Runtime function of a checked arithmetic operator
+const char *checked_fn(int tag)
+{
+  switch (tag)
+  {
+  case AST_ADD:
+    return "ml_add";
+  case AST_SUB:
+    return "ml_sub";
+  case AST_MULTIPLY:
+    return "ml_multiply";
+  }
+  return "ml_divide";
+}
+
+std::string quote(const std::string &str)
+{
+  std::string quoted = "\"";
+  for (auto i = str.begin(); i != str.end(); ++i)
+  {
+    if (*i == '"' || *i == '\\')
+    {
+      quoted += '\\';
+    }
+    quoted += *i;
+  }
+  return quoted + "\"";
+}
+
+}
+
+CTranslator::CTranslator(const std::vector<std::string> &intrinsics)
+    : m_intrinsics(intrinsics), m_indent(0), m_num_temps(0), m_num_locals(0), m_max_locals(0),
+      m_fn(-1), m_loops(false), m_discard(false), m_generic(false)
+{
+}
+
+CTranslator::~CTranslator()
+{
+}
+
+void CTranslator::translate(Node *unit)
+{
+  // Globals are named after their variables (or functions)
+  for (unsigned int i = 0; i < unit->get_num_slots(); i++)
+  {
+    m_globals.push_back("g" + std::to_string(i));
+  }
+  for (unsigned int i = 0; i < m_intrinsics.size(); i++)
+  {
+    m_globals[i] = identifier(m_intrinsics[i]) + "_" + std::to_string(i);
+  }
+  m_slot_fns.assign(m_globals.size(), -1);
+  std::vector<bool> redefined(m_globals.size(), false);
+  unit->each_child([&](Node *stmt) {
+    Node *def = stmt->get_tag() == AST_FUNCTION ? stmt : stmt->get_kid(0);
+    if (def->get_tag() != AST_FUNCTION && def->get_tag() != AST_DEFINITION)
+    {
+      return;
+    }
+    if (!def->has_address())
+    {
+      return;
+    }
+    unsigned slot = unsigned(def->get_slot());
+    m_globals[slot] = identifier(def->get_kid(0)->get_str()) + "_" + std::to_string(slot);
+    if (def->get_tag() == AST_FUNCTION)
+    {
+      m_fns.push_back(def);
+      redefined[slot] = redefined[slot] || m_slot_fns[slot] >= 0;
+      m_slot_fns[slot] = int(m_fns.size() - 1);
+    }
+  });
+  for (unsigned int i = 0; i < m_slot_fns.size(); i++)
+  {
+    if (redefined[i])
+    {
+      m_slot_fns[i] = -1;
+    }
+  }
+
+  std::string main_code = translate_main(unit);
+  std::vector<std::string> fn_code;
+  for (unsigned int i = 0; i < m_fns.size(); i++)
+  {
+    fn_code.push_back(translate_function(i));
+  }
+
+  // Names and parameter counts of the functions, for the runtime
+  std::string names, num_params;
+  for (auto i = m_fns.begin(); i != m_fns.end(); ++i)
+  {
+    names += quote((*i)->get_kid(0)->get_str()) + ", ";
+    num_params += std::to_string(params(*i).size()) + ", ";
+  }
+  printf("// Translated by minilang\n");
+  printf("%s", RUNTIME_HEAD);
+  printf("static const char ml_srcfile[] = %s;\n", quote(m_srcfile).c_str());
+  printf("static const char *const ml_names[] = {%s\"\"};\n", names.c_str());
+  printf("static const int ml_params[] = {%s0};\n\n", num_params.c_str());
+  printf("%s", RUNTIME);
+
+  // Functions are called directly if the callee is known, otherwise
+  // with their arguments in an array
+  for (unsigned int i = 0; i < m_fns.size(); i++)
+  {
+    std::string decl;
+    for (unsigned int j = 0; j < params(m_fns[i]).size(); j++)
+    {
+      decl += (j > 0 ? ", Value l" : "Value l") + std::to_string(j);
+    }
+    printf("static Value %s(%s);\n", function_name(i).c_str(), decl.empty() ? "void" : decl.c_str());
+  }
+  printf("\nstatic struct\n{\n");
+  for (auto i = m_globals.begin(); i != m_globals.end(); ++i)
+  {
+    printf("  Value %s;\n", i->c_str());
+  }
+  printf("} G;\n\n");
+
+  std::string table;
+  for (unsigned int i = 0; m_generic && i < m_fns.size(); i++)
+  {
+    std::string args;
+    for (unsigned int j = 0; j < params(m_fns[i]).size(); j++)
+    {
+      args += (j > 0 ? ", args[" : "args[") + std::to_string(j) + "]";
+    }
+    printf("static Value w%u(Value *args)\n{\n", i);
+    printf("  %s%s(%s);\n}\n\n", params(m_fns[i]).empty() ? "(void)args;\n  return " : "return ",
+           function_name(i).c_str(), args.c_str());
+    table += "w" + std::to_string(i) + ", ";
+  }
+  if (m_generic)
+  {
+    printf("static Value (*const ml_functions[])(Value *) = {%s0};\n\n", table.c_str());
+  }
+
+  for (auto i = fn_code.begin(); i != fn_code.end(); ++i)
+  {
+    printf("%s\n", i->c_str());
+  }
+  printf("%s", main_code.c_str());
+}
+
+// A function's parameters are its first locals, and the C function's
+std::string CTranslator::translate_function(unsigned index)
+{
+  Node *fn = m_fns[index];
+  Node *body = fn->get_last_kid();
+  unsigned num_params = unsigned(params(fn).size());
+
+  m_code.clear();
+  m_indent = 1;
+  m_num_temps = 0;
+  m_bases.assign(1, -1);
+  m_bases.push_back(0);
+  m_num_locals = body->get_num_slots();
+  m_max_locals = m_num_locals;
+  m_fn = int(index);
+  m_loops = false;
+  m_discard = false;
+  std::string result = translate_tail_list(body, false);
+
+  std::string decl;
+  for (unsigned int i = 0; i < num_params; i++)
+  {
+    decl += (i > 0 ? ", Value l" : "Value l") + std::to_string(i);
+  }
+  std::string code = "static Value " + function_name(index) + "(" + (decl.empty() ? "void" : decl) + ")\n{\n";
+  for (unsigned int i = num_params; i < m_max_locals; i++)
+  {
+    code += "  Value l" + std::to_string(i) + " = {ML_INT, 0};\n";
+  }
+
+  // After a tail call in an if arm, the result is the if's value
+  if (m_discard)
+  {
+    code += "  int discard = 0;\n";
+    result = "discard ? ml_int(0) : " + result;
+  }
+  if (m_loops)
+  {
+    code += "top:;\n";
+  }
+  return code + m_code + "  return " + result + ";\n}\n";
+}
+
+// The unit's own variables are globals, its blocks' are locals of main
+std::string CTranslator::translate_main(Node *unit)
+{
+  m_code.clear();
+  m_indent = 1;
+  m_num_temps = 0;
+  m_bases.assign(1, -1);
+  m_num_locals = 0;
+  m_max_locals = 0;
+  m_fn = -1;
+  for (unsigned int i = 0; i < m_intrinsics.size(); i++)
+  {
+    line("G." + m_globals[i] + " = ml_value(ML_INTRINSIC, " + std::to_string(i) + ");");
+  }
+  std::string result = translate_list(unit, true);
+
+  std::string code = "int main(void)\n{\n";
+  for (unsigned int i = 0; i < m_max_locals; i++)
+  {
+    code += "  Value l" + std::to_string(i) + " = {ML_INT, 0};\n";
+  }
+  code += m_code;
+  code += "  printf(\"Result: \");\n";
+  code += "  ml_put(" + result + ");\n";
+  code += "  printf(\"\\n\");\n";
+  return code + "  return 0;\n}\n";
+}
+
+void CTranslator::translate_block(Node *block)
+{
+  unsigned saved = m_num_locals;
+  m_bases.push_back(int(m_num_locals));
+  m_num_locals += block->get_num_slots();
+  m_max_locals = std::max(m_max_locals, m_num_locals);
+
+  translate_list(block, false);
+
+  m_bases.pop_back();
+  m_num_locals = saved;
+}
+
+// The value of a list is the value of its last statement
+std::string CTranslator::translate_list(Node *list, bool want)
+{
+  for (unsigned int i = 0; i < list->get_num_kids() - 1; i++)
+  {
+    translate_stmt(list->get_kid(i), false);
+  }
+  return translate_stmt(list->get_last_kid(), want);
+}
+
+std::string CTranslator::translate_stmt(Node *stmt, bool want)
+{
+  if (stmt->get_tag() == AST_FUNCTION)
+  {
+    int index = int(std::find(m_fns.begin(), m_fns.end(), stmt) - m_fns.begin());
+    line("G." + m_globals[stmt->get_slot()] + " = ml_value(ML_FUNCTION, " + std::to_string(index) + ");");
+    return "ml_int(0)";
+  }
+
+  // If, while and definitions evaluate to 0
+  Node *ast = stmt->get_kid(0);
+  switch (ast->get_tag())
+  {
+  case AST_IF:
+  {
+    line("if (" + integer(ast->get_kid(0), ast) + ")");
+    line("{");
+    m_indent++;
+    translate_block(ast->get_kid(1));
+    m_indent--;
+    line("}");
+    if (ast->get_last_kid()->get_tag() == AST_ELSE)
+    {
+      line("else");
+      line("{");
+      m_indent++;
+      translate_block(ast->get_last_kid()->get_kid(0));
+      m_indent--;
+      line("}");
+    }
+    return "ml_int(0)";
+  }
+
+  // A condition which needs statements is tested inside the loop
+  case AST_WHILE:
+  {
+    std::string saved;
+    saved.swap(m_code);
+    m_indent++;
+    std::string cond = integer(ast->get_kid(0), ast);
+    m_indent--;
+    std::string cond_code;
+    cond_code.swap(m_code);
+    m_code.swap(saved);
+
+    if (cond_code.empty())
+    {
+      line("while (" + cond + ")");
+      line("{");
+    }
+    else
+    {
+      line("for (;;)");
+      line("{");
+      m_code += cond_code;
+      line("  if (!" + cond + ")");
+      line("    break;");
+    }
+    m_indent++;
+    translate_block(ast->get_kid(1));
+    m_indent--;
+    line("}");
+    return "ml_int(0)";
+  }
+
+  // Redefinitions have no address and do nothing
+  case AST_DEFINITION:
+    if (ast->has_address())
+    {
+      line(variable(ast) + " = ml_int(-1);");
+    }
+    return "ml_int(0)";
+
+  default:
+  {
+    std::string val = value(ast);
+    if (!want)
+    {
+      drop(val);
+    }
+    return val;
+  }
+  }
+}
+
+void CTranslator::translate_tail_block(Node *block)
+{
+  unsigned saved = m_num_locals;
+  m_bases.push_back(int(m_num_locals));
+  m_num_locals += block->get_num_slots();
+  m_max_locals = std::max(m_max_locals, m_num_locals);
+
+  drop(translate_tail_list(block, true));
+
+  m_bases.pop_back();
+  m_num_locals = saved;
+}
+
+std::string CTranslator::translate_tail_list(Node *list, bool discard)
+{
+  for (unsigned int i = 0; i < list->get_num_kids() - 1; i++)
+  {
+    translate_stmt(list->get_kid(i), false);
+  }
+
+  Node *ast = list->get_last_kid()->get_kid(0);
+  if (ast->get_tag() == AST_FNCALL)
+  {
+    return call(ast, true, discard);
+  }
+  if (ast->get_tag() == AST_IF)
+  {
+    line("if (" + integer(ast->get_kid(0), ast) + ")");
+    line("{");
+    m_indent++;
+    translate_tail_block(ast->get_kid(1));
+    m_indent--;
+    line("}");
+    if (ast->get_last_kid()->get_tag() == AST_ELSE)
+    {
+      line("else");
+      line("{");
+      m_indent++;
+      translate_tail_block(ast->get_last_kid()->get_kid(0));
+      m_indent--;
+      line("}");
+    }
+    return "ml_int(0)";
+  }
+  return translate_stmt(list->get_last_kid(), true);
+}
+
+std::string CTranslator::value(Node *ast)
+{
+  switch (ast->get_tag())
+  {
+  case AST_INT_LITERAL:
+    return "ml_int(" + literal(ast) + ")";
+
+  case AST_VARREF:
+    return variable(ast);
+
+  case AST_ASSIGNMENT:
+  {
+    std::string rhs = value(ast->get_kid(1));
+    std::string var = variable(ast->get_kid(0));
+    line(var + " = " + rhs + ";");
+    return var;
+  }
+
+  case AST_FNCALL:
+    return call(ast, false, false);
+  }
+  return "ml_int(" + op(ast) + ")";
+}
+
+// The callee is checked before the arguments are evaluated. A call in
+// tail position of the function itself (by its global's name) assigns
+// the parameters and loops instead, so tail recursion runs in constant
+// stack.
+std::string CTranslator::call(Node *ast, bool tail, bool discard)
+{
+  if (!ast->has_address())
+  {
+    line("ml_fail(" + location(ast) + ", \"Invalid function\");");
+    return "ml_int(0)";
+  }
+
+  unsigned num_args = ast->get_num_kids() == 0 ? 0 : ast->get_kid(0)->get_num_kids();
+  std::string callee = temp("Value", variable(ast));
+  line("ml_callee(" + callee + ", " + std::to_string(num_args) + ", " + location(ast) + ");");
+
+  std::string args = "NULL";
+  if (num_args > 0)
+  {
+    args = "t" + std::to_string(m_num_temps++);
+    line("Value " + args + "[" + std::to_string(num_args) + "];");
+    for (unsigned int i = 0; i < num_args; i++)
+    {
+      std::string arg = value(ast->get_kid(0)->get_kid(i));
+      line(args + "[" + std::to_string(i) + "] = " + arg + ";");
+    }
+  }
+
+  // A global defined once by a function with the right number of
+  // parameters is almost always that function
+  int known = -1;
+  if (variable(ast)[0] == 'G' && m_slot_fns[ast->get_slot()] >= 0 &&
+      params(m_fns[m_slot_fns[ast->get_slot()]]).size() == num_args)
+  {
+    known = m_slot_fns[ast->get_slot()];
+  }
+  std::string direct;
+  for (unsigned int i = 0; i < num_args; i++)
+  {
+    direct += (i > 0 ? ", " : "") + args + "[" + std::to_string(i) + "]";
+  }
+
+  if (tail && known >= 0 && known == m_fn)
+  {
+    line("if (" + callee + ".kind == ML_FUNCTION && " + callee + ".ival == " + std::to_string(known) + ")");
+    line("{");
+    for (unsigned int i = 0; i < num_args; i++)
+    {
+      line("  l" + std::to_string(i) + " = " + args + "[" + std::to_string(i) + "];");
+    }
+    if (discard)
+    {
+      line("  discard = 1;");
+    }
+    line("  goto top;");
+    line("}");
+    m_loops = true;
+    m_discard = m_discard || discard;
+  }
+
+  std::string result = temp("Value", "");
+  line("if (" + callee + ".kind == ML_INTRINSIC)");
+  line("  " + result + " = ml_intrinsic(" + callee + ".ival, " + args + ", " + std::to_string(num_args) + ", " +
+       location(ast) + ");");
+  if (known >= 0)
+  {
+    line("else if (" + callee + ".ival == " + std::to_string(known) + ")");
+    line("  " + result + " = " + function_name(unsigned(known)) + "(" + direct + ");");
+  }
+  line("else");
+  line("  " + result + " = ml_functions[" + callee + ".ival](" + args + ");");
+  m_generic = true;
+  return result;
+}
+
+// Operands and conditions must be integers (unless known to be), and
+// an assignment is rejected without being evaluated
+std::string CTranslator::integer(Node *ast, Node *site)
+{
+  switch (ast->get_tag())
+  {
+  case AST_ASSIGNMENT:
+    line("ml_fail(" + location(site) + ", \"Non-numeric condition\");");
+    return "0";
+
+  case AST_INT_LITERAL:
+    return literal(ast);
+
+  case AST_ADD:
+  case AST_SUB:
+  case AST_MULTIPLY:
+  case AST_DIVIDE:
+  case AST_LESS:
+  case AST_LESS_EQUAL:
+  case AST_GREATER:
+  case AST_GREATER_EQUAL:
+  case AST_EQUAL:
+  case AST_NOT_EQUAL:
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+    return op(ast);
+  }
+
+  std::string val = value(ast);
+  if (ast->is_numeric())
+  {
+    return val + ".ival";
+  }
+  return temp("int", "ml_num(" + val + ", " + location(site) + ")");
+}
+
+// The left operand is copied to a temporary if the right one needs
+// statements (which could change it); the right operand of && and ||
+// is only evaluated if the left one doesn't decide
+std::string CTranslator::op(Node *ast)
+{
+  int tag = ast->get_tag();
+  bool logical = tag == AST_LOGICAL_AND || tag == AST_LOGICAL_OR;
+  std::string left = integer(ast->get_kid(0), ast);
+
+  std::string saved;
+  saved.swap(m_code);
+  m_indent += logical ? 1 : 0;
+  std::string right = integer(ast->get_kid(1), ast);
+  m_indent -= logical ? 1 : 0;
+  std::string right_code;
+  right_code.swap(m_code);
+  m_code.swap(saved);
+
+  if (logical && !right_code.empty())
+  {
+    std::string result = temp("int", left + " != 0");
+    line(std::string("if (") + (tag == AST_LOGICAL_AND ? "" : "!") + result + ")");
+    line("{");
+    m_code += right_code;
+    line("  " + result + " = " + right + " != 0;");
+    line("}");
+    return result;
+  }
+  if (!right_code.empty() && !stable(left))
+  {
+    left = temp("int", left);
+  }
+  m_code += right_code;
+
+  // Errors are reported as by Interpreter::doOp
+  bool checked = !ast->is_safe() && (tag == AST_ADD || tag == AST_SUB || tag == AST_MULTIPLY || tag == AST_DIVIDE);
+  if (!checked)
+  {
+    return "(" + left + " " + operator_str(tag) + " " + right + ")";
+  }
+  std::string args = left + ", " + right + ", " + location(ast);
+  if (tag == AST_DIVIDE)
+  {
+    args += ", " + location(ast->get_kid(1));
+  }
+  return temp("int", std::string(checked_fn(tag)) + "(" + args + ")");
+}
+
+std::string CTranslator::variable(Node *ref)
+{
+  int base = m_bases[m_bases.size() - 1 - ref->get_depth()];
+  if (base < 0)
+  {
+    return "G." + m_globals[ref->get_slot()];
+  }
+  return "l" + std::to_string(base + ref->get_slot());
+}
+
+std::string CTranslator::temp(const char *type, const std::string &init)
+{
+  std::string name = "t" + std::to_string(m_num_temps++);
+  line(std::string(type) + " " + name + (init.empty() ? "" : " = " + init) + ";");
+  return name;
+}
+
+// Temporaries whose value isn't used are marked as such
+void CTranslator::drop(const std::string &expr)
+{
+  for (unsigned int i = 0; i + 1 < expr.size(); i++)
+  {
+    if (expr[i] == 't' && isdigit((unsigned char)expr[i + 1]) && (i == 0 || !isalnum((unsigned char)expr[i - 1])))
+    {
+      line("(void)" + expr + ";");
+      return;
+    }
+  }
+}
+
+void CTranslator::line(const std::string &text)
+{
+  m_code += std::string(m_indent * 2, ' ') + text + "\n";
+}
+
+std::string CTranslator::function_name(unsigned index) const
+{
+  return "f" + std::to_string(index) + "_" + identifier(m_fns[index]->get_kid(0)->get_str());
+}
+
+// All sites are in the same file
+std::string CTranslator::location(Node *ast)
+{
+  m_srcfile = ast->get_loc().get_srcfile();
+  return std::to_string(ast->get_loc().get_line()) + ", " + std::to_string(ast->get_loc().get_col());
+}
+
+// There are no negative literals in C either
+std::string CTranslator::literal(Node *ast)
+{
+  int val = atoi(ast->get_str().c_str());
+  if (val == INT_MIN)
+  {
+    return "(-" + std::to_string(INT_MAX) + " - 1)";
+  }
+  return val < 0 ? "(" + std::to_string(val) + ")" : std::to_string(val);
+}
+
+std::string CTranslator::identifier(const std::string &name)
+{
+  std::string id = name;
+  for (auto i = id.begin(); i != id.end(); ++i)
+  {
+    if (!isalnum((unsigned char)*i))
+    {
+      *i = '_';
+    }
+  }
+  return id;
+}
+
+std::vector<Node *> CTranslator::params(Node *fn)
+{
+  std::vector<Node *> params;
+  if (fn->get_num_kids() == 3)
+  {
+    Node *list = fn->get_kid(1);
+    for (unsigned int i = 0; i < list->get_num_kids(); i++)
+    {
+      params.push_back(list->get_kid(i));
+    }
+  }
+  return params;
+}
+
+// Literals and temporaries don't change once computed
+bool CTranslator::stable(const std::string &expr)
+{
+  return expr[0] == 't' || isdigit((unsigned char)expr[0]) || expr.compare(0, 2, "(-") == 0;
+}
@@ -0,0 +1,106 @@
+#ifndef CTRANSLATOR_H
+#define CTRANSLATOR_H
+
+#include <string>
+#include <vector>
+class Node;
+
+// Translates the (analyzed and optimized) unit to a self-contained C
+// program, printed to stdout, which a C compiler turns into a native
+// executable behaving like the interpreter. Values are a kind and an
+// int (the index of an intrinsic or a function for those kinds), the
+// globals are the fields of a struct, and each minilang function is a
+// C function whose locals (numbered as for the VMs) are C variables.
+// Errors are raised by a small runtime, which also implements the
+// intrinsics, with the locations of the sites which fail.
+//
+// Expressions are translated to C expressions which have no effects
+// and can't fail; anything else (calls, assignments and checked
+// operations) becomes statements computing temporaries, emitted in
+// minilang's evaluation order.
+class CTranslator {
+private:
+  std::vector<std::string> m_intrinsics;
+  std::vector<Node *> m_fns;
+
+  // C name of each global, and the function defined in it (-1 if
+  // none, or more than one)
+  std::vector<std::string> m_globals;
+  std::vector<int> m_slot_fns;
+
+  // Code of the current body, its indentation and temporaries
+  std::string m_code;
+  unsigned m_indent;
+  unsigned m_num_temps;
+
+  // Base local of each enclosing block (-1 for the unit's globals),
+  // the next free local, and the locals needed by the current body
+  std::vector<int> m_bases;
+  unsigned m_num_locals;
+  unsigned m_max_locals;
+
+  // Function being translated (-1 for the unit), and whether a tail
+  // call of itself loops to the start (from an if arm, if discard)
+  int m_fn;
+  bool m_loops;
+  bool m_discard;
+
+  // Whether a call may need a function's wrapper, which takes its
+  // arguments in an array
+  bool m_generic;
+
+  // File the program was read from
+  std::string m_srcfile;
+
+  // copy constructor and assignment operator prohibited
+  CTranslator(const CTranslator &);
+  CTranslator &operator=(const CTranslator &);
+
+public:
+  // The intrinsics are the first globals, in the order of their names
+  CTranslator(const std::vector<std::string> &intrinsics);
+  ~CTranslator();
+
+  void translate(Node *unit);
+
+private:
+  // Translate a body, returning the C function's code
+  std::string translate_function(unsigned index);
+  std::string translate_main(Node *unit);
+
+  // Statements return a C expression of their value (if wanted)
+  void translate_block(Node *block);
+  std::string translate_list(Node *list, bool want);
+  std::string translate_stmt(Node *stmt, bool want);
+
+  // Translate a function body (or an if arm at its end), turning a
+  // call of the function itself in the last statement into a loop
+  void translate_tail_block(Node *block);
+  std::string translate_tail_list(Node *list, bool discard);
+
+  // C expression of the Value of an expression
+  std::string value(Node *ast);
+  std::string call(Node *ast, bool tail, bool discard);
+
+  // C expression of the int value of an operand or condition,
+  // checking it is numeric at site
+  std::string integer(Node *ast, Node *site);
+  std::string op(Node *ast);
+
+  // C variable holding a minilang variable
+  std::string variable(Node *ref);
+
+  // Declare a temporary initialized to init, returning its name
+  std::string temp(const char *type, const std::string &init);
+  void drop(const std::string &expr);
+  void line(const std::string &text);
+
+  std::string function_name(unsigned index) const;
+  std::string location(Node *ast);
+  static std::string literal(Node *ast);
+  static std::string identifier(const std::string &name);
+  static std::vector<Node *> params(Node *fn);
+  static bool stable(const std::string &expr);
+};
+
+#endif // CTRANSLATOR_H
@@ -0,0 +1,326 @@
+#include <algorithm>
+#include "ast.h"
+#include "node.h"
+#include "constfold.h"
+#include "interp.h"
+#include "deadcode.h"
+
+DeadCodeEliminator::DeadCodeEliminator(unsigned num_symbols)
+    : m_num_reads(num_symbols, 0), m_fn_reads(num_symbols), m_changed(false)
+{
+}
+
+DeadCodeEliminator::~DeadCodeEliminator()
+{
+}
+
+bool DeadCodeEliminator::run(Node *unit)
+{
+  bool removed = false;
+
+  // Removing code can make more code dead, so repeat until nothing changes
+  do
+  {
+    std::fill(m_num_reads.begin(), m_num_reads.end(), 0);
+    for (auto i = m_fn_reads.begin(); i != m_fn_reads.end(); ++i)
+    {
+      i->clear();
+    }
+    count_reads(unit, -1);
+    count_live_reads();
+
+    m_changed = false;
+    eliminate_list(unit, true);
+    removed = removed || m_changed;
+  } while (m_changed);
+
+  return removed;
+}
+
+// Only literals, variables, and operators on literals which can't
+// fail are pure (an operand variable might not be numeric)
+bool DeadCodeEliminator::is_pure(Node *ast)
+{
+  int val, val2;
+
+  switch (ast->get_tag())
+  {
+  case AST_INT_LITERAL:
+  case AST_VARREF:
+    return true;
+  case AST_ADD:
+  case AST_SUB:
+  case AST_MULTIPLY:
+  case AST_DIVIDE:
+  case AST_GREATER:
+  case AST_LESS:
+  case AST_GREATER_EQUAL:
+  case AST_LESS_EQUAL:
+  case AST_EQUAL:
+  case AST_NOT_EQUAL:
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+    if (ast->get_tag() == AST_DIVIDE && (!ConstantFolder::is_constant(ast->get_kid(1), val) || val == 0 || val == -1))
+    {
+      return false;
+    }
+
+    // Arithmetic on constants which folding left alone overflows
+    if ((ast->get_tag() == AST_ADD || ast->get_tag() == AST_SUB || ast->get_tag() == AST_MULTIPLY) &&
+        (!ConstantFolder::is_constant(ast->get_kid(0), val) || !ConstantFolder::is_constant(ast->get_kid(1), val2) ||
+         Interpreter::fails(ast->get_tag(), val, val2)))
+    {
+      return false;
+    }
+    for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+    {
+      if (ast->get_kid(i)->get_tag() == AST_VARREF || !is_pure(ast->get_kid(i)))
+      {
+        return false;
+      }
+    }
+    return true;
+  default:
+    return false;
+  }
+}
+
+void DeadCodeEliminator::count_reads(Node *ast, int fn_symbol)
+{
+  switch (ast->get_tag())
+  {
+  case AST_VARREF:
+  case AST_FNCALL:
+    if (ast->has_address() && fn_symbol < 0)
+    {
+      m_num_reads[ast->get_symbol()]++;
+    }
+    else if (ast->has_address())
+    {
+      m_fn_reads[fn_symbol].push_back(ast->get_symbol());
+    }
+    break;
+
+  // Neither the target of an assignment statement nor a definition
+  // is a read. An assignment used as an operand or condition is an
+  // error which must stay, so its variable must stay too.
+  case AST_STATEMENT:
+    if (ast->get_kid(0)->get_tag() == AST_ASSIGNMENT)
+    {
+      count_reads(ast->get_kid(0)->get_kid(1), fn_symbol);
+      return;
+    }
+    break;
+  case AST_DEFINITION:
+    return;
+
+  case AST_FUNCTION:
+    count_reads(ast->get_last_kid(), ast->get_symbol());
+    return;
+  }
+
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    count_reads(ast->get_kid(i), fn_symbol);
+  }
+}
+
+// A function read by live code is live, and so is everything its body
+// reads; functions which only read each other stay unread
+void DeadCodeEliminator::count_live_reads()
+{
+  std::vector<int> live;
+  for (unsigned int i = 0; i < m_num_reads.size(); i++)
+  {
+    if (m_num_reads[i] > 0)
+    {
+      live.push_back(int(i));
+    }
+  }
+
+  while (!live.empty())
+  {
+    int fn_symbol = live.back();
+    live.pop_back();
+    for (auto i = m_fn_reads[fn_symbol].begin(); i != m_fn_reads[fn_symbol].end(); ++i)
+    {
+      if (m_num_reads[*i]++ == 0)
+      {
+        live.push_back(*i);
+      }
+    }
+  }
+}
+
+void DeadCodeEliminator::eliminate_list(Node *list, bool value_list)
+{
+  int val;
+
+  for (unsigned int i = 0; i < list->get_num_kids(); i++)
+  {
+    Node *stmt = list->get_kid(i);
+
+    // Function that is never used
+    if (stmt->get_tag() == AST_FUNCTION)
+    {
+      if (m_num_reads[stmt->get_symbol()] == 0)
+      {
+        remove_statement(list, i--, value_list);
+        continue;
+      }
+      eliminate_list(stmt->get_last_kid(), true);
+      continue;
+    }
+
+    Node *ast = stmt->get_kid(0);
+    bool last = i == list->get_num_kids() - 1;
+
+    switch (ast->get_tag())
+    {
+    // Redefinitions do nothing, and unread variables are not needed
+    case AST_DEFINITION:
+      if (!ast->has_address() || m_num_reads[ast->get_symbol()] == 0)
+      {
+        remove_statement(list, i--, value_list);
+      }
+      break;
+
+    case AST_IF:
+    {
+      eliminate_list(ast->get_kid(1), false);
+      if (ast->get_last_kid()->get_tag() == AST_ELSE)
+      {
+        eliminate_list(ast->get_last_kid()->get_kid(0), false);
+      }
+
+      if (!ConstantFolder::is_constant(ast->get_kid(0), val))
+      {
+        break;
+      }
+
+      // Only one arm can execute
+      Node *taken = nullptr;
+      if (val != 0)
+      {
+        taken = ast->get_kid(1);
+      }
+      else if (ast->get_last_kid()->get_tag() == AST_ELSE)
+      {
+        taken = ast->get_last_kid()->get_kid(0);
+      }
+
+      if (taken == nullptr)
+      {
+        remove_statement(list, i--, value_list);
+      }
+      else if (taken->get_num_slots() == 0)
+      {
+        // Arm defines nothing, so its statements can join this list
+        unsigned num_stmts = taken->get_num_kids();
+        splice_block(list, i, taken, value_list);
+        i += num_stmts - 1;
+      }
+      else if (ast->get_num_kids() == 3)
+      {
+        // Keep the arm as a block, as "if (1) { ... }"
+        Node *other = ast->remove_kid(val != 0 ? 2 : 1);
+        if (val == 0)
+        {
+          Node *else_node = ast->remove_kid(1);
+          ast->append_kid(else_node->remove_kid(0));
+          delete else_node;
+
+          Node *cond = ast->get_kid(0);
+          ast->set_kid(0, ConstantFolder::make_constant(cond, 1));
+          delete cond;
+        }
+        delete other;
+        m_changed = true;
+      }
+      break;
+    }
+
+    case AST_WHILE:
+      eliminate_list(ast->get_kid(1), false);
+
+      // Loop that is never entered
+      if (ConstantFolder::is_constant(ast->get_kid(0), val) && val == 0)
+      {
+        remove_statement(list, i--, value_list);
+      }
+      break;
+
+    default:
+      stmt->set_kid(0, eliminate_expr(ast));
+
+      // Statement without effect (unless it gives the result)
+      if (is_pure(stmt->get_kid(0)) && !(last && value_list))
+      {
+        if (list->get_num_kids() > 1)
+        {
+          remove_statement(list, i--, value_list);
+        }
+      }
+      break;
+    }
+  }
+}
+
+Node *DeadCodeEliminator::eliminate_expr(Node *ast)
+{
+  // Assignment statement to a variable which is never read has
+  // the same effect and value as its right hand side
+  if (ast->get_tag() == AST_ASSIGNMENT)
+  {
+    Node *target = ast->get_kid(0);
+    if (target->has_address() && m_num_reads[target->get_symbol()] == 0)
+    {
+      Node *rhs = ast->remove_kid(1);
+      delete ast;
+      m_changed = true;
+      return rhs;
+    }
+  }
+
+  return ast;
+}
+
+void DeadCodeEliminator::remove_statement(Node *list, unsigned i, bool value_list)
+{
+  Node *stmt = list->get_kid(i);
+
+  // Removed statements all have the value 0, which the unit or
+  // function body might still need; and lists can't be empty
+  if ((value_list && i == list->get_num_kids() - 1) || list->get_num_kids() == 1)
+  {
+    list->set_kid(i, new Node(AST_STATEMENT, {ConstantFolder::make_constant(stmt, 0)}));
+  }
+  else
+  {
+    list->remove_kid(i);
+  }
+
+  delete stmt;
+  m_changed = true;
+}
+
+void DeadCodeEliminator::splice_block(Node *list, unsigned i, Node *block, bool value_list)
+{
+  Node *stmt = list->get_kid(i);
+  bool last = i == list->get_num_kids() - 1;
+
+  // The if statement's value was 0
+  if (last && value_list)
+  {
+    list->insert_kid(i + 1, new Node(AST_STATEMENT, {ConstantFolder::make_constant(stmt, 0)}));
+  }
+
+  list->remove_kid(i);
+  while (block->get_num_kids() > 0)
+  {
+    list->insert_kid(i, block->remove_kid(block->get_num_kids() - 1));
+  }
+
+  delete stmt;
+  m_changed = true;
+}
@@ -0,0 +1,64 @@
+#ifndef DEADCODE_H
+#define DEADCODE_H
+
+#include <vector>
+class Node;
+
+// Optimization pass run after constant folding. Removes if arms and
+// while loops whose (constant) condition means they never execute,
+// definitions of variables which are never read (along with the
+// assignments to them), side-effect-free expression statements, and
+// functions which are never called or referenced.
+//
+// Statements may move between blocks, so the unit must be analyzed
+// again before it is executed.
+class DeadCodeEliminator {
+private:
+  // Number of reads (references and calls) of each symbol from
+  // code which can execute
+  std::vector<unsigned> m_num_reads;
+
+  // Symbols read by the body of each function
+  std::vector<std::vector<int>> m_fn_reads;
+  bool m_changed;
+
+  // copy constructor and assignment operator prohibited
+  DeadCodeEliminator(const DeadCodeEliminator &);
+  DeadCodeEliminator &operator=(const DeadCodeEliminator &);
+
+public:
+  DeadCodeEliminator(unsigned num_symbols);
+  ~DeadCodeEliminator();
+
+  // Eliminate dead code from the (analyzed) unit in place,
+  // returning true if anything was removed
+  bool run(Node *unit);
+
+  // Check if evaluating an expression can have no effect
+  // (no calls, assignments or possible evaluation errors)
+  static bool is_pure(Node *ast);
+
+private:
+  // Count reads outside functions, and record the reads of each function
+  void count_reads(Node *ast, int fn_symbol);
+
+  // Count the reads of the functions reachable from the top level
+  void count_live_reads();
+
+  // Eliminate dead statements from a statement list. The value of
+  // the last statement of the unit or a function body is its result,
+  // so it is only replaced by a statement with the same value.
+  void eliminate_list(Node *list, bool value_list);
+
+  // Replace the expression of a statement, if it is an assignment to
+  // an unread variable, by its right hand side
+  Node *eliminate_expr(Node *ast);
+
+  // Remove the statement at index i of a list
+  void remove_statement(Node *list, unsigned i, bool value_list);
+
+  // Replace the statement at index i by the statements of a block
+  void splice_block(Node *list, unsigned i, Node *block, bool value_list);
+};
+
+#endif // DEADCODE_H
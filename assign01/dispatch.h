@@ -0,0 +1,35 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+// Instruction dispatch for the run loops of the VMs, which are written
+// as
+//
+//   DISPATCH()
+//   {
+//   INSTRUCTION(OP_X):
+//     ...
+//     NEXT();
+//   }
+//
+// With THREADED_DISPATCH (set by the Makefile, and needing the labels
+// as values of GCC and Clang), every instruction ends by jumping through
+// the table of its VM's handlers (OPCODE_LABELS, in opcode order) to the
+// next one, so each handler has its own indirect branch to predict.
+// Otherwise the handlers are the cases of a switch in a loop.
+
+#ifdef THREADED_DISPATCH
+
+#define DISPATCH() NEXT();
+#define INSTRUCTION(op) L_##op
+#define NEXT() goto *OPCODE_LABELS[*pc++]
+#define LABEL(op) &&L_##op
+
+#else
+
+#define DISPATCH() for (;;) switch (*pc++)
+#define INSTRUCTION(op) case op
+#define NEXT() continue
+
+#endif
+
+#endif // DISPATCH_H
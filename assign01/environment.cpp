@@ -1,30 +1,28 @@
 #include "environment.h"
-#include <iostream>
 
-using std::map;
-
-Environment::Environment(Environment *parent)
-    : m_parent(parent)
+Environment::Environment(Environment *parent, unsigned num_slots)
+    : m_parent(parent), m_slots(new Value[num_slots]), m_num_slots(num_slots), m_stack(nullptr)
 {
   assert(m_parent != this);
 }
 
-Environment::~Environment()
-{
-  // Empty the map
-  references.clear();
-}
-
-// Assign a value to a defined variable
-void Environment::assign(std::string var, Value i)
+Environment::Environment(Environment *parent, unsigned num_slots, SlotStack *stack)
+    : m_parent(parent), m_num_slots(num_slots), m_stack(stack), m_mark(stack->get_mark())
 {
-  references[var] = i;
+  m_slots = m_stack->push(num_slots);
 }
 
-// Check if var is defined in this environment
-bool Environment::has(std::string var)
+Environment::~Environment()
 {
-  return (references.count(var) != 0);
+  // Free the slots
+  if (m_stack != nullptr)
+  {
+    m_stack->pop(m_mark);
+  }
+  else
+  {
+    delete[] m_slots;
+  }
 }
 
 // Return parent
@@ -33,19 +31,23 @@ Environment *Environment::getParent()
   return m_parent;
 }
 
-// Return value of var
-Value Environment::lookup(std::string var)
+// Walk up depth levels
+Environment *Environment::ancestor(int depth)
 {
-  // F → ident
-  return references[var];
+  Environment *env = this;
+  while (depth-- > 0)
+  {
+    assert(env->m_parent != nullptr);
+    env = env->m_parent;
+  }
+  return env;
 }
 
 // Define a var
-void Environment::define(std::string var)
+void Environment::define(unsigned slot)
 {
   // Stmt → var ident ;
 
   // use as a marker for now
-  references.insert({var, -1});
+  assign(slot, -1);
 }
-// TODO: implement member functions
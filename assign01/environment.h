@@ -2,41 +2,50 @@
 #define ENVIRONMENT_H
 
 #include <cassert>
-#include <map>
-#include <string>
 #include "value.h"
-
+#include "slotstack.h"
+
+// Runtime environment: a fixed-size array of slots, one per name
+// defined in the corresponding block. Names are resolved to slot
+// indices ahead of time by Interpreter::analyze.
+//
+// An environment which can be captured by a function is allocated on
+// the heap and owns its slots. Other environments are local variables
+// of the interpreter, with slots on its SlotStack, and are freed when
+// their block or call finishes.
 class Environment {
 private:
   Environment *m_parent;
-
-  // TODO: representation of environment (map of names to values)
-  std::map<std::string, Value> references;
-  
+  Value *m_slots;
+  unsigned m_num_slots;
+  SlotStack *m_stack;
+  SlotStack::Mark m_mark;
 
   // copy constructor and assignment operator prohibited
   Environment(const Environment &);
   Environment &operator=(const Environment &);
 
 public:
-  Environment(Environment *parent = nullptr);
+  Environment(Environment *parent = nullptr, unsigned num_slots = 0);
+  Environment(Environment *parent, unsigned num_slots, SlotStack *stack);
   ~Environment();
 
   // Return parent of this environment
   Environment* getParent();
-  
-  // Assign value to a VARREF
-  void assign(std::string var, Value i);
 
-  // Retrieve value of a VARREF
-  Value lookup(std::string var);
+  // Return the environment depth levels up the parent chain
+  Environment *ancestor(int depth);
+
+  // Assign value to a slot
+  void assign(unsigned slot, const Value &val) { assert(slot < m_num_slots); m_slots[slot] = val; }
+
+  // Retrieve value of a slot
+  const Value &lookup(unsigned slot) const { assert(slot < m_num_slots); return m_slots[slot]; }
 
-  // Check if var exists in current environment
-  bool has(std::string var);
+  // Define the variable in a slot
+  void define(unsigned slot);
 
-  // Define a VARREF
-  void define(std::string var);
-  // TODO: add member functions allowing lookup, definition, and assignment
+  unsigned get_num_slots() const { return m_num_slots; }
 };
 
 #endif // ENVIRONMENT_H
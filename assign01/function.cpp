@@ -1,11 +1,16 @@
+#include "node.h"
 #include "function.h"
 
-Function::Function(const std::string &name, const std::vector<std::string> &params, Environment *parent_env, Node *body)
+Function::Function(const std::string &name, unsigned num_params, Environment *parent_env, Node *body)
   : ValRep(VALREP_FUNCTION)
   , m_name(name)
-  , m_params(params)
   , m_parent_env(parent_env)
-  , m_body(body) {
+  , m_body(body)
+  , m_num_params(num_params)
+  , m_num_slots(body->get_num_slots())
+  , m_captured(body->is_captured())
+  , m_memo(nullptr)
+  , m_code(-1) {
 }
 
 Function::~Function() {
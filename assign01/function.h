@@ -1,32 +1,54 @@
 #ifndef FUNCTION_H
 #define FUNCTION_H
 
-#include <vector>
 #include <string>
 #include "valrep.h"
 class Environment;
 class Node;
+class MemoCache;
 
+// A function's frame is an environment whose first slots are its
+// parameters, followed by the variables of its body. Its layout is
+// fixed when the function is defined, so a call only fills the slots.
 class Function : public ValRep {
 private:
   std::string m_name;
-  std::vector<std::string> m_params;
   Environment *m_parent_env;
   Node *m_body;
 
+  // Layout of the frame: the number of parameters and slots, and
+  // whether the frame can be captured (so it must outlive the call)
+  unsigned m_num_params;
+  unsigned m_num_slots;
+  bool m_captured;
+
+  // Results of earlier calls, if the function is memoized
+  MemoCache *m_memo;
+
+  // Index of the function's compiled code (-1 if it has none)
+  int m_code;
+
   // value semantics prohibited
   Function(const Function &);
   Function &operator=(const Function &);
 
 public:
-  Function(const std::string &name, const std::vector<std::string> &params, Environment *parent_env, Node *body);
+  Function(const std::string &name, unsigned num_params, Environment *parent_env, Node *body);
   virtual ~Function();
 
-  std::string get_name() const { return m_name; }
-  const std::vector<std::string> &get_params() const { return m_params; }
-  unsigned get_num_params() const { return unsigned(m_params.size()); }
+  const std::string &get_name() const { return m_name; }
   Environment *get_parent_env() const { return m_parent_env; }
   Node *get_body() const { return m_body; }
+
+  unsigned get_num_params() const { return m_num_params; }
+  unsigned get_num_slots() const { return m_num_slots; }
+  bool is_captured() const { return m_captured; }
+
+  void set_memo(MemoCache *memo) { m_memo = memo; }
+  MemoCache *get_memo() const { return m_memo; }
+
+  void set_code(int code) { m_code = code; }
+  int get_code() const { return m_code; }
 };
 
 #endif // FUNCTION_H
@@ -0,0 +1,522 @@
+#include <cstdio>
+#include <algorithm>
+#include "ast.h"
+#include "node.h"
+#include "interp.h"
+#include "constfold.h"
+#include "ssa.h"
+#include "gvn.h"
+
+// Maximum number of times values are renumbered (numbering a loop
+// header's phis needs the values from the end of the loop body)
+const int MAX_NUMBERING_ROUNDS = 4;
+
+ValueNumbering::ValueNumbering(unsigned num_symbols, const std::vector<std::string> &intrinsics)
+    : m_intrinsics(intrinsics), m_promotable(num_symbols, true), m_current(num_symbols, nullptr),
+      m_since(num_symbols, 0), m_clock(0), m_names(num_symbols), m_level(num_symbols, 0),
+      m_slot(num_symbols, 0), m_cur_level(0), m_changed(false)
+{
+}
+
+ValueNumbering::~ValueNumbering()
+{
+}
+
+bool ValueNumbering::run(Node *unit)
+{
+  find_promotable(unit);
+
+  SSAFunction ir("<unit>", m_promotable);
+  ir.build_unit(unit, m_intrinsics);
+  number(ir);
+
+  for (unsigned int i = 0; i < m_intrinsics.size(); i++)
+  {
+    m_names[i] = m_intrinsics[i];
+    m_slot[i] = int(i);
+    m_visible[m_intrinsics[i]] = int(i);
+  }
+  lower_list(ir, unit);
+
+  return m_changed;
+}
+
+void ValueNumbering::print(Node *unit)
+{
+  find_promotable(unit);
+
+  SSAFunction ir("<unit>", m_promotable);
+  ir.build_unit(unit, m_intrinsics);
+  number(ir);
+  ir.print();
+
+  for (auto i = unit->cbegin(); i != unit->cend(); ++i)
+  {
+    if ((*i)->get_tag() == AST_FUNCTION)
+    {
+      SSAFunction fn_ir((*i)->get_kid(0)->get_str(), m_promotable);
+      fn_ir.build_function(*i);
+      number(fn_ir);
+      printf("\n");
+      fn_ir.print();
+    }
+  }
+}
+
+// A global variable which a function body assigns can change
+// during any call
+void ValueNumbering::find_promotable(Node *unit)
+{
+  for (auto i = unit->cbegin(); i != unit->cend(); ++i)
+  {
+    Node *fn = *i;
+    if (fn->get_tag() != AST_FUNCTION)
+    {
+      continue;
+    }
+
+    std::vector<bool> local(m_promotable.size(), false);
+    if (fn->get_num_kids() == 3)
+    {
+      fn->get_kid(1)->each_child([&local](Node *param) { local[param->get_symbol()] = true; });
+    }
+    find_locals(fn->get_last_kid(), local);
+    find_global_assignments(fn->get_last_kid(), local);
+  }
+}
+
+void ValueNumbering::find_locals(Node *ast, std::vector<bool> &local)
+{
+  if (ast->get_tag() == AST_DEFINITION)
+  {
+    local[ast->get_kid(0)->get_symbol()] = true;
+    return;
+  }
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    find_locals(ast->get_kid(i), local);
+  }
+}
+
+void ValueNumbering::find_global_assignments(Node *ast, const std::vector<bool> &local)
+{
+  if (ast->get_tag() == AST_ASSIGNMENT && !local[ast->get_kid(0)->get_symbol()])
+  {
+    m_promotable[ast->get_kid(0)->get_symbol()] = false;
+  }
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    find_global_assignments(ast->get_kid(i), local);
+  }
+}
+
+// Blocks are numbered in an order where each block comes after its
+// dominator, so one pass in order sees every dominating instruction
+// first. Repeat while loop phis find more equivalences.
+void ValueNumbering::number(SSAFunction &ir)
+{
+  for (int round = 0; round < MAX_NUMBERING_ROUNDS; round++)
+  {
+    std::map<std::vector<int>, std::vector<IRInstr *>> table;
+    bool changed = false;
+
+    for (auto i = ir.get_blocks().begin(); i != ir.get_blocks().end(); ++i)
+    {
+      for (auto j = (*i)->instrs.begin(); j != (*i)->instrs.end(); ++j)
+      {
+        IRInstr *instr = *j;
+        IRInstr *old_leader = SSAFunction::leader(instr);
+        bool old_known = instr->known;
+        int old_value = instr->value;
+
+        number_instr(instr, table);
+        if (SSAFunction::leader(instr) != old_leader || instr->known != old_known || instr->value != old_value)
+        {
+          changed = true;
+        }
+      }
+    }
+
+    if (!changed)
+    {
+      break;
+    }
+  }
+}
+
+void ValueNumbering::number_instr(IRInstr *instr, std::map<std::vector<int>, std::vector<IRInstr *>> &table)
+{
+  std::vector<int> key = {instr->op};
+  std::vector<IRInstr *> args;
+
+  instr->leader = instr;
+  instr->known = instr->op == IR_CONST;
+  for (auto i = instr->args.begin(); i != instr->args.end(); ++i)
+  {
+    // A loop phi's value from the end of the body can be itself
+    IRInstr *arg = SSAFunction::leader(*i);
+    if (arg != instr)
+    {
+      args.push_back(arg);
+    }
+  }
+
+  switch (instr->op)
+  {
+  case IR_CONST:
+    return;
+
+  case IR_ENTRY:
+    key.push_back(instr->symbol);
+    break;
+
+  case IR_BINARY:
+  {
+    IRInstr *left = args[0], *right = args[1];
+    if (left->known && right->known)
+    {
+      // Folding can't fail
+      if (!Interpreter::fails(instr->tag, left->value, right->value))
+      {
+        instr->known = true;
+        instr->value = Interpreter::doOp(instr->tag, left->value, right->value, nullptr).get_ival();
+        return;
+      }
+    }
+
+    // Operands of commutative operators in a fixed order
+    bool commutative = instr->tag == AST_ADD || instr->tag == AST_MULTIPLY || instr->tag == AST_EQUAL || instr->tag == AST_NOT_EQUAL;
+    std::vector<int> left_key = {left->known, left->known ? left->value : int(left->id)};
+    std::vector<int> right_key = {right->known, right->known ? right->value : int(right->id)};
+    if (commutative && right_key < left_key)
+    {
+      std::swap(left_key, right_key);
+    }
+    key.push_back(instr->tag);
+    key.insert(key.end(), left_key.begin(), left_key.end());
+    key.insert(key.end(), right_key.begin(), right_key.end());
+    break;
+  }
+
+  case IR_PHI:
+  {
+    // All args the same value (or the same constant): a copy
+    bool same_value = true, same_constant = true;
+    for (auto i = args.begin(); i != args.end(); ++i)
+    {
+      same_value = same_value && *i == args[0];
+      same_constant = same_constant && (*i)->known && (*i)->value == args[0]->value;
+    }
+    if (same_value)
+    {
+      instr->leader = args[0];
+    }
+    if (same_value || same_constant)
+    {
+      instr->known = args[0]->known;
+      instr->value = args[0]->value;
+      return;
+    }
+
+    // Otherwise only a phi in the same block can be equivalent
+    key.push_back(int(instr->block->id));
+    for (auto i = args.begin(); i != args.end(); ++i)
+    {
+      key.insert(key.end(), {(*i)->known, (*i)->known ? (*i)->value : int((*i)->id)});
+    }
+    break;
+  }
+
+  default:
+    // Loads, stores, calls and functions are all different
+    return;
+  }
+
+  std::vector<IRInstr *> &found = table[key];
+  for (auto i = found.begin(); i != found.end(); ++i)
+  {
+    if (SSAFunction::dominates((*i)->block, instr->block))
+    {
+      instr->leader = SSAFunction::leader(*i);
+      return;
+    }
+  }
+  found.push_back(instr);
+}
+
+void ValueNumbering::lower_function(Node *fn)
+{
+  std::vector<IRInstr *> current(m_current.size(), nullptr);
+  std::map<std::string, int> visible = m_visible;
+  current.swap(m_current);
+
+  SSAFunction ir(fn->get_kid(0)->get_str(), m_promotable);
+  ir.build_function(fn);
+  number(ir);
+
+  // Parameters are in the function body's scope
+  m_cur_level++;
+  if (fn->get_num_kids() == 3)
+  {
+    Node *params = fn->get_kid(1);
+    for (unsigned int i = 0; i < params->get_num_kids(); i++)
+    {
+      declare(params->get_kid(i));
+      set_current(params->get_kid(i)->get_symbol(), ir.get_value(params->get_kid(i)));
+    }
+  }
+  lower_list(ir, fn->get_last_kid());
+  m_cur_level--;
+
+  current.swap(m_current);
+  m_visible = visible;
+}
+
+void ValueNumbering::lower_list(SSAFunction &ir, Node *list)
+{
+  for (unsigned int i = 0; i < list->get_num_kids(); i++)
+  {
+    Node *stmt = list->get_kid(i);
+    if (stmt->get_tag() == AST_FUNCTION)
+    {
+      declare(stmt->get_kid(0));
+      set_current(stmt->get_symbol(), ir.get_value(stmt));
+      lower_function(stmt);
+      continue;
+    }
+
+    Node *ast = stmt->get_kid(0);
+    switch (ast->get_tag())
+    {
+    case AST_DEFINITION:
+      declare(ast->get_kid(0));
+      if (ast->has_address())
+      {
+        set_current(ast->get_symbol(), ir.get_value(ast));
+      }
+      break;
+
+    // Each arm starts from the values before the if, and the
+    // if's phis merge them
+    case AST_IF:
+    {
+      ast->set_kid(0, lower_expr(ir, ast->get_kid(0)));
+      std::vector<IRInstr *> current = m_current;
+      std::map<std::string, int> visible = m_visible;
+
+      m_cur_level++;
+      lower_list(ir, ast->get_kid(1));
+      m_current = current;
+      m_visible = visible;
+      if (ast->get_last_kid()->get_tag() == AST_ELSE)
+      {
+        lower_list(ir, ast->get_last_kid()->get_kid(0));
+        m_current = current;
+        m_visible = visible;
+      }
+      m_cur_level--;
+
+      const std::vector<IRInstr *> &phis = ir.get_phis(ast);
+      for (auto j = phis.begin(); j != phis.end(); ++j)
+      {
+        set_current((*j)->symbol, *j);
+      }
+      break;
+    }
+
+    // The values at the loop header hold in the condition, at the
+    // start of the body and after the loop
+    case AST_WHILE:
+    {
+      const std::vector<IRInstr *> &phis = ir.get_phis(ast);
+      for (auto j = phis.begin(); j != phis.end(); ++j)
+      {
+        set_current((*j)->symbol, *j);
+      }
+
+      ast->set_kid(0, lower_expr(ir, ast->get_kid(0)));
+      std::vector<IRInstr *> current = m_current;
+      std::map<std::string, int> visible = m_visible;
+
+      m_cur_level++;
+      lower_list(ir, ast->get_kid(1));
+      m_cur_level--;
+      m_current = current;
+      m_visible = visible;
+      break;
+    }
+
+    default:
+      stmt->set_kid(0, lower_expr(ir, ast));
+      break;
+    }
+  }
+}
+
+Node *ValueNumbering::lower_expr(SSAFunction &ir, Node *ast)
+{
+  switch (ast->get_tag())
+  {
+  case AST_INT_LITERAL:
+    return ast;
+
+  case AST_ASSIGNMENT:
+    ast->set_kid(1, lower_expr(ir, ast->get_kid(1)));
+    set_current(ast->get_kid(0)->get_symbol(), ir.get_value(ast));
+    return ast;
+
+  case AST_FNCALL:
+    if (ast->get_num_kids() > 0)
+    {
+      Node *args = ast->get_kid(0);
+      for (unsigned int i = 0; i < args->get_num_kids(); i++)
+      {
+        args->set_kid(i, lower_expr(ir, args->get_kid(i)));
+      }
+    }
+    return ast;
+  }
+
+  IRInstr *val = ir.get_value(ast);
+  if (val != nullptr && !has_effects(ast))
+  {
+    // A known value can replace the expression only if computing it
+    // can't fail (such as "(a / 0) || 1", which is always 1)
+    IRInstr *leader = SSAFunction::leader(val);
+    if (leader->known && !can_fail(ir, ast))
+    {
+      Node *lit = ConstantFolder::make_constant(ast, leader->value);
+      delete ast;
+      m_changed = true;
+      return lit;
+    }
+
+    int symbol = holder(leader);
+    if (symbol >= 0 && !(ast->get_tag() == AST_VARREF && ast->get_symbol() == symbol))
+    {
+      Node *ref = new Node(AST_VARREF, m_names[symbol]);
+      ref->set_loc(ast->get_loc());
+      ref->set_address(m_cur_level - m_level[symbol], m_slot[symbol], symbol);
+      delete ast;
+      m_changed = true;
+      return ref;
+    }
+  }
+
+  // A global read in a function body holds its value on entry
+  if (ast->get_tag() == AST_VARREF)
+  {
+    if (m_current[ast->get_symbol()] == nullptr)
+    {
+      set_current(ast->get_symbol(), val);
+    }
+    return ast;
+  }
+
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    ast->set_kid(i, lower_expr(ir, ast->get_kid(i)));
+  }
+  return ast;
+}
+
+void ValueNumbering::declare(Node *ref)
+{
+  int symbol = ref->get_symbol();
+  m_names[symbol] = ref->get_str();
+  m_level[symbol] = m_cur_level;
+  m_slot[symbol] = ref->get_slot();
+  m_visible[ref->get_str()] = symbol;
+}
+
+void ValueNumbering::set_current(int symbol, IRInstr *val)
+{
+  if (m_promotable[symbol])
+  {
+    m_current[symbol] = val;
+    m_since[symbol] = m_clock++;
+  }
+}
+
+int ValueNumbering::holder(IRInstr *val)
+{
+  int best = -1;
+  for (unsigned int i = 0; i < m_current.size(); i++)
+  {
+    if (m_current[i] == nullptr || SSAFunction::leader(m_current[i]) != val)
+    {
+      continue;
+    }
+
+    // The name must refer to this variable here
+    auto visible = m_visible.find(m_names[i]);
+    if (visible != m_visible.end() && visible->second == int(i) && (best < 0 || m_since[i] < m_since[best]))
+    {
+      best = int(i);
+    }
+  }
+  return best;
+}
+
+bool ValueNumbering::can_fail(SSAFunction &ir, Node *ast)
+{
+  switch (ast->get_tag())
+  {
+  case AST_INT_LITERAL:
+  case AST_VARREF:
+    return false;
+  case AST_ADD:
+  case AST_SUB:
+  case AST_MULTIPLY:
+  case AST_DIVIDE:
+  case AST_GREATER:
+  case AST_LESS:
+  case AST_GREATER_EQUAL:
+  case AST_LESS_EQUAL:
+  case AST_EQUAL:
+  case AST_NOT_EQUAL:
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+    break;
+  default:
+    return true;
+  }
+
+  int tag = ast->get_tag();
+  bool arith = tag == AST_ADD || tag == AST_SUB || tag == AST_MULTIPLY || tag == AST_DIVIDE;
+  int vals[2] = {0, 0};
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    // A variable whose value isn't known might not be numeric (other
+    // operands are integers if they don't fail), and arithmetic can
+    // only be checked on known values
+    Node *kid = ast->get_kid(i);
+    IRInstr *val = ir.get_value(kid);
+    bool known = val != nullptr && SSAFunction::leader(val)->known;
+    if (can_fail(ir, kid) || (!known && (arith || kid->get_tag() == AST_VARREF)))
+    {
+      return true;
+    }
+    if (known)
+    {
+      vals[i] = SSAFunction::leader(val)->value;
+    }
+  }
+  return arith && Interpreter::fails(tag, vals[0], vals[1]);
+}
+
+bool ValueNumbering::has_effects(Node *ast)
+{
+  if (ast->get_tag() == AST_FNCALL || ast->get_tag() == AST_ASSIGNMENT)
+  {
+    return true;
+  }
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    if (has_effects(ast->get_kid(i)))
+    {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,91 @@
+#ifndef GVN_H
+#define GVN_H
+
+#include <map>
+#include <string>
+#include <vector>
+class Node;
+class SSAFunction;
+struct IRInstr;
+
+// Optimization pass which converts the unit and each function body to
+// SSA form (see SSAFunction), finds equivalent values by global value
+// numbering, and applies the results back to the ast:
+//
+//  - an expression whose value is a known constant becomes a literal
+//  - an expression (without calls or assignments) whose value a
+//    variable already holds becomes a reference to that variable
+//    (common subexpression elimination), and a variable holding a
+//    copy of another one's value is replaced by the original
+//    (copy propagation), so dead code elimination can remove
+//    the copy
+//
+// New references get addresses, but the unit should be analyzed
+// again before it is executed.
+class ValueNumbering {
+private:
+  std::vector<std::string> m_intrinsics;
+
+  // Variables no call can change, which are put in SSA form
+  std::vector<bool> m_promotable;
+
+  // While applying results: the value of each SSA variable and when
+  // it was assigned, the variables visible by name, and where each
+  // variable is defined (block level and slot)
+  std::vector<IRInstr *> m_current;
+  std::vector<unsigned> m_since;
+  unsigned m_clock;
+  std::map<std::string, int> m_visible;
+  std::vector<std::string> m_names;
+  std::vector<int> m_level, m_slot;
+  int m_cur_level;
+
+  bool m_changed;
+
+  // copy constructor and assignment operator prohibited
+  ValueNumbering(const ValueNumbering &);
+  ValueNumbering &operator=(const ValueNumbering &);
+
+public:
+  ValueNumbering(unsigned num_symbols, const std::vector<std::string> &intrinsics);
+  ~ValueNumbering();
+
+  // Number values of the (analyzed) unit and rewrite redundant
+  // expressions, returning true if anything changed
+  bool run(Node *unit);
+
+  // Print the numbered IR of the unit and each function
+  void print(Node *unit);
+
+  // Find equivalent instructions and constant values
+  static void number(SSAFunction &ir);
+
+private:
+  void find_promotable(Node *unit);
+  void find_locals(Node *ast, std::vector<bool> &local);
+  void find_global_assignments(Node *ast, const std::vector<bool> &local);
+
+  static void number_instr(IRInstr *instr, std::map<std::vector<int>, std::vector<IRInstr *>> &table);
+
+  // Apply the results to a function body, and to statements
+  void lower_function(Node *fn);
+  void lower_list(SSAFunction &ir, Node *list);
+  Node *lower_expr(SSAFunction &ir, Node *ast);
+
+  // Make a name visible in the current block
+  void declare(Node *ref);
+  void set_current(int symbol, IRInstr *val);
+
+  // Visible variable which has held a value the longest, or -1
+  int holder(IRInstr *val);
+
+  // True if evaluating an expression calls or assigns
+  static bool has_effects(Node *ast);
+
+  // True if evaluating an expression could raise an error: a call or
+  // assignment, an operand which might not be numeric (one whose value
+  // isn't known), or arithmetic which isn't known not to fail
+  static bool can_fail(SSAFunction &ir, Node *ast);
+};
+
+#endif // GVN_H
@@ -0,0 +1,297 @@
+#include "ast.h"
+#include "node.h"
+#include "deadcode.h"
+#include "inliner.h"
+
+Inliner::Inliner(unsigned num_symbols, unsigned num_intrinsics, unsigned max_size)
+    : m_max_size(max_size), m_num_intrinsics(num_intrinsics), m_num_assigns(num_symbols, 0),
+      m_exact_fn(num_symbols, nullptr), m_defined(num_symbols, false), m_changed(false)
+{
+}
+
+Inliner::~Inliner()
+{
+}
+
+bool Inliner::run(Node *unit)
+{
+  collect(unit);
+
+  // A symbol defined by a single function definition always holds it
+  for (unsigned int i = 0; i < m_exact_fn.size(); i++)
+  {
+    if (m_exact_fn[i] != nullptr && m_num_assigns[i] != 1)
+    {
+      m_exact_fn[i] = nullptr;
+    }
+  }
+
+  m_changed = false;
+  inline_calls(unit);
+  return m_changed;
+}
+
+Node *Inliner::copy(Node *ast)
+{
+  Node *dup = new Node(ast->get_tag(), ast->get_str());
+  dup->set_loc(ast->get_loc());
+  if (ast->has_address())
+  {
+    dup->set_address(ast->get_depth(), ast->get_slot(), ast->get_symbol());
+  }
+  dup->set_num_slots(ast->get_num_slots());
+
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    dup->append_kid(copy(ast->get_kid(i)));
+  }
+  return dup;
+}
+
+unsigned Inliner::size(Node *ast)
+{
+  unsigned count = 0;
+  ast->preorder([&count](Node *) { count++; });
+  return count;
+}
+
+void Inliner::collect(Node *ast)
+{
+  ast->preorder([this](Node *n) {
+    if (n->get_tag() == AST_ASSIGNMENT)
+    {
+      m_num_assigns[n->get_kid(0)->get_symbol()]++;
+    }
+    else if (n->get_tag() == AST_DEFINITION && n->has_address())
+    {
+      m_num_assigns[n->get_symbol()]++;
+    }
+    else if (n->get_tag() == AST_FUNCTION)
+    {
+      m_num_assigns[n->get_symbol()]++;
+      m_exact_fn[n->get_symbol()] = n;
+    }
+  });
+}
+
+Node *Inliner::inline_calls(Node *ast, bool divisor)
+{
+  switch (ast->get_tag())
+  {
+  case AST_FUNCTION:
+  {
+    // Parameters are defined by the function's block
+    std::set<std::string> names;
+    if (ast->get_num_kids() == 3)
+    {
+      ast->get_kid(1)->each_child([&names](Node *param) { names.insert(param->get_str()); });
+    }
+    inline_block(ast->get_last_kid(), names);
+
+    // Calls after this point can be inlined
+    m_defined[ast->get_symbol()] = true;
+    return ast;
+  }
+
+  case AST_STATEMENT_LIST:
+    inline_block(ast, std::set<std::string>());
+    return ast;
+
+  case AST_FNCALL:
+  {
+    if (ast->get_num_kids() > 0)
+    {
+      inline_calls(ast->get_kid(0));
+    }
+
+    Node *fn = ast->has_address() ? m_exact_fn[ast->get_symbol()] : nullptr;
+    if (fn == nullptr || !m_defined[ast->get_symbol()] || !can_inline(ast, fn))
+    {
+      return ast;
+    }
+
+    // A variable or literal raises no errors itself, so it takes the
+    // call's location (where errors of the operator using it are)
+    Node *expr = fn->get_last_kid()->get_kid(0)->get_kid(0);
+    bool simple = expr->get_tag() == AST_VARREF || expr->get_tag() == AST_INT_LITERAL;
+    if (divisor && !simple)
+    {
+      return ast;
+    }
+    Node *params = fn->get_num_kids() == 3 ? fn->get_kid(1) : nullptr;
+    Node *args = ast->get_num_kids() > 0 ? ast->get_kid(0) : nullptr;
+    m_changed = true;
+    Node *inlined = substitute(expr, params, args);
+    if (simple)
+    {
+      inlined->set_loc(ast->get_loc());
+    }
+    return inlined;
+  }
+  }
+
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    Node *kid = ast->get_kid(i);
+    Node *inlined = inline_calls(kid, ast->get_tag() == AST_DIVIDE && i == 1);
+    if (inlined != kid)
+    {
+      ast->set_kid(i, inlined);
+      delete kid;
+    }
+  }
+  return ast;
+}
+
+void Inliner::inline_block(Node *block, const std::set<std::string> &names)
+{
+  m_blocks.push_back(names);
+  block->each_child([this](Node *stmt) {
+    if (stmt->get_tag() == AST_STATEMENT && stmt->get_kid(0)->get_tag() == AST_DEFINITION)
+    {
+      m_blocks.back().insert(stmt->get_kid(0)->get_kid(0)->get_str());
+    }
+  });
+
+  for (unsigned int i = 0; i < block->get_num_kids(); i++)
+  {
+    inline_calls(block->get_kid(i));
+  }
+  m_blocks.pop_back();
+}
+
+bool Inliner::can_inline(Node *call, Node *fn)
+{
+  // Body must be a single small expression (not an assignment, which
+  // is an error where the call is an operand or condition)
+  Node *body = fn->get_last_kid();
+  if (body->get_num_kids() != 1)
+  {
+    return false;
+  }
+  Node *expr = body->get_kid(0)->get_kid(0);
+  int tag = expr->get_tag();
+  if (tag == AST_DEFINITION || tag == AST_ASSIGNMENT || tag == AST_IF || tag == AST_WHILE || size(expr) > m_max_size)
+  {
+    return false;
+  }
+
+  // Wrong number of arguments is an error at runtime
+  Node *params = fn->get_num_kids() == 3 ? fn->get_kid(1) : nullptr;
+  unsigned num_params = params != nullptr ? params->get_num_kids() : 0;
+  unsigned num_args = call->get_num_kids() > 0 ? call->get_kid(0)->get_num_kids() : 0;
+  if (num_params != num_args)
+  {
+    return false;
+  }
+
+  // Free names must mean the same thing at the call
+  bool ok = true;
+  std::vector<unsigned> uses(num_params, 0);
+  expr->preorder([&](Node *n) {
+    if (n->get_tag() == AST_VARREF || n->get_tag() == AST_FNCALL)
+    {
+      for (unsigned int i = 0; i < num_params; i++)
+      {
+        if (n->get_symbol() == params->get_kid(i)->get_symbol())
+        {
+          uses[i]++;
+          return;
+        }
+      }
+      if (n->get_symbol() == fn->get_symbol())
+      {
+        ok = false;
+      }
+      for (auto i = m_blocks.begin(); i != m_blocks.end(); ++i)
+      {
+        if (i->count(n->get_str()) != 0)
+        {
+          ok = false;
+        }
+      }
+    }
+    else if (n->get_tag() == AST_ASSIGNMENT)
+    {
+      for (unsigned int i = 0; i < num_params; i++)
+      {
+        if (n->get_kid(0)->get_symbol() == params->get_kid(i)->get_symbol())
+        {
+          ok = false;
+        }
+      }
+    }
+  });
+  if (!ok)
+  {
+    return false;
+  }
+
+  // Arguments are evaluated where (and as often as) the parameter is used
+  bool effects = has_effects(expr);
+  for (unsigned int i = 0; i < num_args; i++)
+  {
+    Node *arg = call->get_kid(0)->get_kid(i);
+    if (arg->get_tag() == AST_INT_LITERAL)
+    {
+      continue;
+    }
+    if (effects || !DeadCodeEliminator::is_pure(arg))
+    {
+      return false;
+    }
+    if (arg->get_tag() != AST_VARREF && uses[i] > 1)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Only assignments and calls to user functions can change variables
+bool Inliner::has_effects(Node *ast)
+{
+  bool effects = false;
+  ast->preorder([this, &effects](Node *n) {
+    if (n->get_tag() == AST_ASSIGNMENT)
+    {
+      effects = true;
+    }
+    else if (n->get_tag() == AST_FNCALL)
+    {
+      bool intrinsic = n->has_address() && n->get_symbol() < int(m_num_intrinsics) && m_num_assigns[n->get_symbol()] == 0;
+      effects = effects || !intrinsic;
+    }
+  });
+  return effects;
+}
+
+Node *Inliner::substitute(Node *ast, Node *params, Node *args)
+{
+  if (ast->get_tag() == AST_VARREF && params != nullptr)
+  {
+    for (unsigned int i = 0; i < params->get_num_kids(); i++)
+    {
+      if (ast->get_symbol() == params->get_kid(i)->get_symbol())
+      {
+        // Errors (e.g. dividing by it) are reported where the
+        // parameter was used
+        Node *arg = copy(args->get_kid(i));
+        arg->set_loc(ast->get_loc());
+        return arg;
+      }
+    }
+  }
+
+  Node *dup = new Node(ast->get_tag(), ast->get_str());
+  dup->set_loc(ast->get_loc());
+  if (ast->has_address())
+  {
+    dup->set_address(ast->get_depth(), ast->get_slot(), ast->get_symbol());
+  }
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    dup->append_kid(substitute(ast->get_kid(i), params, args));
+  }
+  return dup;
+}
@@ -0,0 +1,80 @@
+#ifndef INLINER_H
+#define INLINER_H
+
+#include <set>
+#include <string>
+#include <vector>
+class Node;
+
+// Optimization pass which replaces calls to small functions by the
+// function's body. A function can be inlined if its body is a single
+// expression of at most a given number of nodes which doesn't call the
+// function itself, and the function is the only value its name is ever
+// given. Only calls which come after the definition are inlined, so the
+// call could not have failed.
+//
+// Functions are defined at the top level, so a function body's free
+// names refer to global variables (the function's parent environment).
+// A call is only inlined where none of those names is redefined by an
+// enclosing block. Parameters are replaced by copies of the arguments,
+// which must be literals, variables the body can't change, or pure
+// expressions used at most once.
+class Inliner {
+private:
+  unsigned m_max_size;
+  unsigned m_num_intrinsics;
+
+  // Number of assignments (and definitions) of each symbol
+  std::vector<unsigned> m_num_assigns;
+
+  // Function each symbol always holds (if any), and whether the
+  // definition comes before the current point
+  std::vector<Node *> m_exact_fn;
+  std::vector<bool> m_defined;
+
+  // Names defined by each block enclosing the current point
+  // (apart from the unit)
+  std::vector<std::set<std::string>> m_blocks;
+
+  bool m_changed;
+
+  // copy constructor and assignment operator prohibited
+  Inliner(const Inliner &);
+  Inliner &operator=(const Inliner &);
+
+public:
+  Inliner(unsigned num_symbols, unsigned num_intrinsics, unsigned max_size);
+  ~Inliner();
+
+  // Inline calls in the (analyzed) unit, returning true if any were
+  // inlined (the unit must then be analyzed again)
+  bool run(Node *unit);
+
+  // Create a copy of a tree, including lexical addresses
+  static Node *copy(Node *ast);
+
+  // Number of nodes in a tree
+  static unsigned size(Node *ast);
+
+private:
+  void collect(Node *ast);
+
+  // Inline calls in a tree, returning the node which should replace it.
+  // Dividing by 0 is reported at the divisor, so a call which is one is
+  // only inlined if the body can't report errors at its own location.
+  Node *inline_calls(Node *ast, bool divisor = false);
+
+  // Inline calls in the statements of a block defining the given names
+  void inline_block(Node *block, const std::set<std::string> &names);
+
+  // Check if a call can be replaced by the function's body
+  bool can_inline(Node *call, Node *fn);
+
+  // True if evaluating the body could change a variable
+  bool has_effects(Node *ast);
+
+  // Copy of a tree with parameters replaced by arguments
+  Node *substitute(Node *ast, Node *params, Node *args);
+};
+
+#endif // INLINER_H
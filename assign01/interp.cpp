@@ -1,47 +1,115 @@
 #include <cassert>
+#include <climits>
 #include <algorithm>
 #include <memory>
 #include "ast.h"
 #include "node.h"
 #include "exceptions.h"
 #include "function.h"
+#include "scope.h"
+#include "constfold.h"
+#include "deadcode.h"
+#include "typeinfer.h"
+#include "inliner.h"
+#include "specializer.h"
+#include "licm.h"
+#include "range.h"
+#include "gvn.h"
+#include "partial.h"
+#include "progprint.h"
+#include "purity.h"
+#include "memo.h"
+#include "bytecode.h"
+#include "stackvm.h"
+#include "regcompiler.h"
+#include "regvm.h"
+#include "closure.h"
+#include "iterative.h"
+#include "ctranslator.h"
 #include "interp.h"
 
 Interpreter::Interpreter(Node *ast_to_adopt)
-    : m_ast(ast_to_adopt)
+    : m_ast(ast_to_adopt), m_num_symbols(0), m_inline_limit(DEFAULT_INLINE_LIMIT),
+      m_clone_limit(DEFAULT_CLONE_LIMIT), m_globals(nullptr), m_memo_size(0), m_engine(ENGINE_TREE),
+      m_fusion_stats(false), m_tier(nullptr), m_call_threshold(DEFAULT_CALL_THRESHOLD),
+      m_loop_threshold(DEFAULT_LOOP_THRESHOLD), m_log_tiers(false),
+      m_stack_limit(IterativeEvaluator::DEFAULT_LIMIT)
 {
 }
 
 Interpreter::~Interpreter()
 {
   delete m_ast;
+  for (auto i = m_memo_caches.begin(); i != m_memo_caches.end(); ++i)
+  {
+    delete *i;
+  }
 }
 
+// Maximum number of times the folding and dead code passes are repeated
+const int MAX_OPTIMIZE_ROUNDS = 4;
+
+// Global slots of the intrinsic functions (defined first, in this order)
+enum
+{
+  SLOT_PRINT,
+  SLOT_PRINTLN,
+  SLOT_READINT,
+  NUM_INTRINSICS,
+};
+
+const char *const INTRINSIC_NAMES[NUM_INTRINSICS] = {"print", "println", "readint"};
+
 void Interpreter::analyze()
 {
   // Recursively analyze nodes of the ast
 
-  // Create environment for checking
-  Environment *env = new Environment();
+  // Create scope for checking
+  Scope global;
+  m_num_symbols = 0;
 
   // Define intrinsic functions
-  env->define("print");
-  env->define("println");
-  env->define("readint");
+  for (unsigned int i = 0; i < NUM_INTRINSICS; i++)
+  {
+    global.define(INTRINSIC_NAMES[i], m_num_symbols++);
+  }
 
   // Recurse over tree to search for semantic error
-  analyze_recurse(m_ast, env);
+  m_late_calls.clear();
+  analyze_recurse(m_ast, &global);
+  m_ast->set_num_slots(global.get_num_slots());
+
+  // Functions are only defined at the top level, so a call in a function
+  // body to a function defined later refers to the global scope
+  for (auto i = m_late_calls.begin(); i != m_late_calls.end(); ++i)
+  {
+    int depth;
+    ScopeEntry entry;
+    if (global.resolve(i->first->get_str(), depth, entry))
+    {
+      i->first->set_address(i->second, entry.slot, entry.symbol);
+    }
+  }
+
+  // Blocks without slots get no environment at runtime
+  std::vector<bool> materialized(1, true);
+  assign_env_depths(m_ast, materialized);
 }
 
-void Interpreter::analyze_recurse(Node *ast, Environment *env)
+void Interpreter::analyze_recurse(Node *ast, Scope *scope)
 {
+  int depth;
+  ScopeEntry entry;
+
+  switch (ast->get_tag())
+  {
   // variable was referenced
-  if (ast->get_tag() == AST_VARREF)
+  case AST_VARREF:
   {
-
     // Check if VARREF was defined
-    if (findEnv(ast, env)->has(ast->get_str()))
+    if (scope->resolve(ast->get_str(), depth, entry))
     {
+      ast->set_address(depth, entry.slot, entry.symbol);
       return;
     }
 
@@ -50,230 +118,553 @@ void Interpreter::analyze_recurse(Node *ast, Environment *env)
     SemanticError::raise(ast->get_loc(), err.c_str());
   }
 
-  // We define a VARREF, insert into map
-  if (ast->get_tag() == AST_DEFINITION || ast->get_tag() == AST_FUNCTION)
+  case AST_FNCALL:
+    // An undefined callee is an error only if the call is executed
+    ast->clear_address();
+    if (scope->resolve(ast->get_str(), depth, entry))
+    {
+      ast->set_address(depth, entry.slot, entry.symbol);
+    }
+    else if (scope->in_function())
+    {
+      m_late_calls.push_back({ast, scope->get_level()});
+    }
+    break;
+
+  // We define a VARREF, give it a slot
+  case AST_DEFINITION:
   {
-    env->define(ast->get_kid(0)->get_str());
+    const std::string name = ast->get_kid(0)->get_str();
+    bool redefinition = scope->has(name);
+    entry = define_name(scope, name);
+    ast->get_kid(0)->set_address(0, entry.slot, entry.symbol);
+
+    // Redefining a name keeps its value, so only the first definition
+    // in a block gets an address (and does anything at runtime)
+    if (!redefinition)
+    {
+      ast->set_address(0, entry.slot, entry.symbol);
+    }
+    else
+    {
+      ast->clear_address();
+    }
+    return;
   }
 
-  if (ast->get_tag() == AST_P_LIST)
+  case AST_FUNCTION:
   {
-    for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+    // The function refers to the environment it is defined in after
+    // that environment's block finishes
+    scope->capture();
+
+    // The function is bound in the enclosing scope
+    entry = define_name(scope, ast->get_kid(0)->get_str());
+    ast->get_kid(0)->set_address(0, entry.slot, entry.symbol);
+    ast->set_address(0, entry.slot, entry.symbol);
+
+    // Parameters occupy the first slots of the function's scope
+    Scope fn_scope(scope, true);
+    if (ast->get_num_kids() == 3)
+    {
+      Node *params = ast->get_kid(1);
+      for (unsigned int i = 0; i < params->get_num_kids(); i++)
+      {
+        entry = fn_scope.define_fresh(params->get_kid(i)->get_str(), m_num_symbols++);
+        params->get_kid(i)->set_address(0, entry.slot, entry.symbol);
+      }
+    }
+
+    analyze_block(ast->get_last_kid(), &fn_scope);
+    return;
+  }
+
+  // Condition is in the enclosing scope, each arm is a new block
+  case AST_IF:
+  {
+    analyze_recurse(ast->get_kid(0), scope);
+
+    Scope if_scope(scope);
+    analyze_block(ast->get_kid(1), &if_scope);
+
+    if (ast->get_last_kid()->get_tag() == AST_ELSE)
     {
-      env->define(ast->get_kid(i)->get_str());
+      Scope else_scope(scope);
+      analyze_block(ast->get_last_kid()->get_kid(0), &else_scope);
     }
+    return;
+  }
+
+  case AST_WHILE:
+  {
+    analyze_recurse(ast->get_kid(0), scope);
+
+    Scope while_scope(scope);
+    analyze_block(ast->get_kid(1), &while_scope);
+    return;
+  }
   }
 
   // Check all of node's children
   for (unsigned int i = 0; i < ast->get_num_kids(); i++)
   {
-    if (ast->get_kid(i)->get_tag() == AST_IF || ast->get_kid(i)->get_tag() == AST_WHILE || ast->get_kid(i)->get_tag() == AST_ELSE || ast->get_kid(i)->get_tag() == AST_FUNCTION)
+    analyze_recurse(ast->get_kid(i), scope);
+  }
+}
+
+void Interpreter::analyze_block(Node *block, Scope *scope)
+{
+  analyze_recurse(block, scope);
+  block->set_num_slots(scope->get_num_slots());
+  block->set_captured(scope->is_captured());
+}
+
+// Count only the environments which exist at runtime in the depth
+// of each address. materialized has one entry per enclosing scope.
+void Interpreter::assign_env_depths(Node *ast, std::vector<bool> &materialized)
+{
+  if (ast->has_address())
+  {
+    int level = int(materialized.size()) - 1;
+    int env_depth = 0;
+    for (int i = level - ast->get_depth() + 1; i <= level; i++)
     {
-      analyze_recurse(ast->get_kid(i), new Environment(env));
+      if (materialized[i])
+      {
+        env_depth++;
+      }
+    }
+    ast->set_env_depth(env_depth);
+    ast->set_global(level == ast->get_depth());
+  }
+
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    // Every statement list below the unit is a block with a scope
+    Node *kid = ast->get_kid(i);
+    if (kid->get_tag() == AST_STATEMENT_LIST)
+    {
+      materialized.push_back(kid->get_num_slots() > 0);
+      assign_env_depths(kid, materialized);
+      materialized.pop_back();
     }
     else
     {
-      analyze_recurse(ast->get_kid(i), env);
+      assign_env_depths(kid, materialized);
     }
   }
 }
 
-Value Interpreter::execute()
+// Define a name in a scope, numbering it if it is a new variable
+ScopeEntry Interpreter::define_name(Scope *scope, const std::string &name)
 {
-  // TODO: implement
-  // Global environment
-  Environment *global_env = new Environment();
+  if (scope->has(name))
+  {
+    return scope->define(name, -1);
+  }
+  return scope->define(name, m_num_symbols++);
+}
 
-  // Define intrinsic functions
-  global_env->define("print");
-  global_env->define("println");
-  global_env->define("readint");
+void Interpreter::optimize()
+{
+  // Removing code can expose more constants (e.g. a variable whose
+  // other assignment was in a dead loop), and inlining can expose
+  // both, so repeat a few times
+  for (int i = 0; i < MAX_OPTIMIZE_ROUNDS; i++)
+  {
+    // Fold constant expressions and propagate constant variables
+    ConstantFolder folder(m_num_symbols);
+    folder.run(m_ast);
 
-  // Bind intrinsic functions
-  global_env->assign("print", &intrinsic_print);
-  global_env->assign("println", &intrinsic_println);
-  global_env->assign("readint", &intrinsic_readint);
+    // Replace expressions whose value is known or already in a variable
+    ValueNumbering gvn(m_num_symbols, intrinsic_names());
+    bool changed = gvn.run(m_ast);
 
-  // Evaluates each statement
-  for (unsigned int i = 0; i < m_ast->get_num_kids() - 1; i++)
+    // Remove code which can never execute or has no effect
+    DeadCodeEliminator dce(m_num_symbols);
+    changed = dce.run(m_ast) || changed;
+
+    // Replace calls to small functions by their bodies
+    if (m_inline_limit > 0)
+    {
+      Inliner inliner(m_num_symbols, NUM_INTRINSICS, m_inline_limit);
+      changed = inliner.run(m_ast) || changed;
+    }
+
+    // Call clones of functions specialized for literal arguments
+    if (m_clone_limit > 0)
+    {
+      Specializer specializer(m_num_symbols, m_clone_limit);
+      changed = specializer.run(m_ast) || changed;
+    }
+
+    if (!changed)
+    {
+      break;
+    }
+
+    // Statements may have moved to other blocks
+    analyze();
+  }
+
+  // Find operands which don't need a runtime non-numeric check
+  TypeInference types(m_num_symbols, NUM_INTRINSICS);
+  types.run(m_ast);
+
+  // Find arithmetic which can't overflow
+  RangeAnalysis ranges(m_num_symbols, NUM_INTRINSICS);
+  ranges.run(m_ast);
+
+  // Move invariant expressions out of loops (only those which can't
+  // fail, so this needs the numeric operands and ranges)
+  LoopInvariantMotion licm(m_num_symbols, NUM_INTRINSICS, ranges);
+  if (licm.run(m_ast))
   {
-    ex(m_ast->get_kid(i), global_env);
+    analyze();
+    TypeInference retyped(m_num_symbols, NUM_INTRINSICS);
+    retyped.run(m_ast);
+    RangeAnalysis reranged(m_num_symbols, NUM_INTRINSICS);
+    reranged.run(m_ast);
+  }
+}
+
+void Interpreter::partial_evaluate()
+{
+  PartialEvaluator pe(m_num_symbols, intrinsic_names());
+  Node *residual = pe.run(m_ast);
+  if (residual == m_ast)
+  {
+    return;
   }
+  delete m_ast;
+  m_ast = residual;
+  analyze();
 
-  // Return for result
-  return ex(m_ast->get_last_kid(), global_env);
+  // Drop definitions and stores of variables whose values were all
+  // used at compile time, and functions no longer called
+  DeadCodeEliminator dce(m_num_symbols);
+  if (dce.run(m_ast))
+  {
+    analyze();
+  }
 }
 
-Value Interpreter::ex(Node *ast, Environment *env)
+void Interpreter::print_program()
 {
-  // Execute each statement in a block of statements
-  if (ast->get_tag() == AST_STATEMENT_LIST)
+  ProgramPrinter printer;
+  printer.print(m_ast);
+}
+
+void Interpreter::print_memo_stats()
+{
+  for (auto i = m_memo_caches.begin(); i != m_memo_caches.end(); ++i)
   {
-    for (unsigned int i = 0; i < ast->get_num_kids() - 1; i++)
+    (*i)->print_stats();
+  }
+}
+
+void Interpreter::print_ir()
+{
+  ValueNumbering gvn(m_num_symbols, intrinsic_names());
+  gvn.print(m_ast);
+}
+
+// The tree walker and closures have no code of their own, so show the
+// register VM's
+void Interpreter::print_code()
+{
+  if (m_engine == ENGINE_STACK)
+  {
+    BytecodeCompiler compiler;
+    std::vector<Chunk *> chunks = compiler.compile(m_ast);
+    for (auto i = chunks.begin(); i != chunks.end(); ++i)
     {
-      ex(ast->get_kid(i), env);
+      BytecodeCompiler::disassemble(*i);
+      delete *i;
     }
-    return ex(ast->get_last_kid(), env);
   }
+  else
+  {
+    RegisterCompiler compiler;
+    std::vector<Chunk *> chunks = compiler.compile(m_ast);
+    for (auto i = chunks.begin(); i != chunks.end(); ++i)
+    {
+      RegisterCompiler::disassemble(*i);
+      delete *i;
+    }
+  }
+}
 
-  if (ast->get_tag() == AST_FUNCTION)
+void Interpreter::print_c()
+{
+  CTranslator translator(intrinsic_names());
+  translator.translate(m_ast);
+}
+
+std::vector<std::string> Interpreter::intrinsic_names()
+{
+  return std::vector<std::string>(INTRINSIC_NAMES, INTRINSIC_NAMES + NUM_INTRINSICS);
+}
+
+Value Interpreter::execute()
+{
+  // Find the functions whose calls can be memoized
+  if (m_memo_size > 0)
   {
-    std::string fn_name;
-    std::vector<std::string> param_names;
-    Node *body;
+    PurityAnalysis purity(m_num_symbols, NUM_INTRINSICS);
+    purity.run(m_ast);
+  }
+
+  // Global environment
+  Environment *global_env = new Environment(nullptr, m_ast->get_num_slots());
+  m_globals = global_env;
+
+  // Bind intrinsic functions
+  global_env->assign(SLOT_PRINT, &intrinsic_print);
+  global_env->assign(SLOT_PRINTLN, &intrinsic_println);
+  global_env->assign(SLOT_READINT, &intrinsic_readint);
 
-    fn_name = ast->get_kid(0)->get_str();
-    if (ast->get_num_kids() != 2)
+  // Run the bytecode instead of walking the tree
+  if (m_engine == ENGINE_STACK)
+  {
+    BytecodeCompiler compiler;
+    StackVM vm(this, global_env, compiler.compile(m_ast), m_fusion_stats);
+    Value result = vm.run();
+    if (m_fusion_stats)
     {
-      for (unsigned int i = 0; i < ast->get_kid(1)->get_num_kids(); i++)
-      {
-        param_names.push_back(ast->get_kid(1)->get_kid(i)->get_str());
-      }
+      vm.print_fusion_stats();
     }
+    return result;
+  }
+  if (m_engine == ENGINE_REGISTER || m_engine == ENGINE_JIT)
+  {
+    RegisterCompiler compiler;
+    RegisterVM vm(this, global_env, compiler.compile(m_ast),
+                  m_engine == ENGINE_JIT ? RegisterVM::DEFAULT_JIT_THRESHOLD : 0);
+    return vm.run();
+  }
+  if (m_engine == ENGINE_CLOSURE)
+  {
+    ClosureCompiler compiler(this, global_env);
+    return compiler.run(m_ast);
+  }
 
-    body = ast->get_last_kid();
+  if (m_engine == ENGINE_ITERATIVE)
+  {
+    IterativeEvaluator evaluator(this, global_env, m_stack_limit);
+    return evaluator.run(m_ast);
+  }
 
-    Value fn_val(new Function(fn_name, param_names, env, body));
-    env->define(fn_name);
-    env->assign(fn_name, fn_val);
+  // Hot functions and loops are compiled while walking the tree
+  std::unique_ptr<ClosureCompiler> tier;
+  if (m_engine == ENGINE_TIERED)
+  {
+    tier.reset(new ClosureCompiler(this, global_env, m_log_tiers));
+    m_tier = tier.get();
+  }
 
-    return 0;
+  // Evaluates each statement
+  for (unsigned int i = 0; i < m_ast->get_num_kids() - 1; i++)
+  {
+    ex(m_ast->get_kid(i), global_env);
   }
 
-  // Call function
-  if (ast->get_tag() == AST_FNCALL)
+  // Return for result
+  Value result = ex(m_ast->get_last_kid(), global_env);
+  m_tier = nullptr;
+  return result;
+}
+
+Value Interpreter::ex(Node *ast, Environment *env)
+{
+  // A node which ran before takes its specialized form
+  switch (ast->get_quick())
   {
-    // Find the function definition
-    Environment *location = findEnv(ast, env);
-    if ((location->lookup(ast->get_str())).get_kind() == VALUE_FUNCTION)
-    {
-      Function *fn = (location->lookup(ast->get_str())).get_function();
-      Environment *f_block = new Environment(fn->get_parent_env());
+  case QUICK_NONE:
+    break;
 
-      // Get args the the program entered
-      if (ast->get_num_kids() == 0)
-      {
-        if (fn->get_num_params() == 0)
-        {
-          return ex(fn->get_body(), f_block);
-        }
-        else
-        {
-          EvaluationError::raise(ast->get_loc(), "Invalid params");
-        }
-      }
+  case QUICK_STATEMENT:
+    return ex(ast->get_kid(0), env);
 
-      unsigned numargs = ast->get_kid(0)->get_num_kids();
+  case QUICK_LITERAL:
+    return ast->get_quick_value();
 
-      if (numargs != fn->get_num_params())
-      {
-        EvaluationError::raise(ast->get_loc(), "Invalid params");
-      }
-      // Evaluate each arg
-      for (unsigned int i = 0; i < ast->get_kid(0)->get_num_kids(); i++)
-      {
-        f_block->define(fn->get_params()[i]);
-        f_block->assign(fn->get_params()[i], ex(ast->get_kid(0)->get_kid(i), env));
-      }
+  case QUICK_LOAD_LOCAL:
+    return env->lookup(ast->get_slot());
+
+  case QUICK_LOAD_GLOBAL:
+    return m_globals->lookup(ast->get_slot());
 
-      return ex(fn->get_body(), f_block);
+  case QUICK_STORE_LOCAL:
+  {
+    Value val = ex(ast->get_kid(1), env);
+    env->assign(ast->get_kid(0)->get_slot(), val);
+    return val;
+  }
+
+  case QUICK_STORE_GLOBAL:
+  {
+    Value val = ex(ast->get_kid(1), env);
+    m_globals->assign(ast->get_kid(0)->get_slot(), val);
+    return val;
+  }
+
+  case QUICK_INT_ADD:
+  {
+    int op1, op2, result;
+    ex_quick_operands(ast, env, op1, op2);
+    if (__builtin_add_overflow(op1, op2, &result))
+    {
+      EvaluationError::raise(ast->get_loc(), "Integer overflow");
     }
-    
-    if ((location->lookup(ast->get_str())).get_kind() != VALUE_INTRINSIC_FN) {
-      EvaluationError::raise(ast->get_loc(), "Invalid function");
+    return result;
+  }
+
+  case QUICK_INT_SUB:
+  {
+    int op1, op2, result;
+    ex_quick_operands(ast, env, op1, op2);
+    if (__builtin_sub_overflow(op1, op2, &result))
+    {
+      EvaluationError::raise(ast->get_loc(), "Integer overflow");
     }
+    return result;
+  }
 
-    // Get args the the program entered
-    if (ast->get_num_kids() == 0)
+  case QUICK_INT_LESS:
+  {
+    int op1, op2;
+    ex_quick_operands(ast, env, op1, op2);
+    return op1 < op2 ? 1 : 0;
+  }
+
+  case QUICK_INT_OP:
+  {
+    int op1, op2;
+    ex_quick_operands(ast, env, op1, op2);
+    if (ast->is_safe())
     {
-      IntrinsicFn fn = (location->lookup(ast->get_str())).get_intrinsic_fn();
-      return fn(nullptr, 0, ast->get_loc(), this);
+      return unchecked_op(ast->get_tag(), op1, op2);
     }
+    return doOp(ast->get_tag(), op1, op2, ast);
+  }
 
-    unsigned numargs = ast->get_kid(0)->get_num_kids();
-    Value args[numargs];
+  case QUICK_INTRINSIC_CALL:
+  {
+    // The name may have been given another value
+    const Value &callee = findEnv(ast, env)->lookup(ast->get_slot());
+    if (callee.get_kind() == VALUE_INTRINSIC_FN && callee.get_intrinsic_fn() == ast->get_quick_value().get_intrinsic_fn())
+    {
+      return call_intrinsic(ast, callee.get_intrinsic_fn(), env);
+    }
+    ast->quicken(QUICK_NONE);
+    break;
+  }
+  }
 
-    // Evaluate each arg
-    if (numargs != 0)
+  // Execute each statement in a block of statements
+  if (ast->get_tag() == AST_STATEMENT_LIST)
+  {
+    for (unsigned int i = 0; i < ast->get_num_kids() - 1; i++)
     {
-      for (unsigned int i = 0; i < ast->get_kid(0)->get_num_kids(); i++)
-      {
-        args[i] = ex(ast->get_kid(0)->get_kid(i), env);
-      }
+      ex(ast->get_kid(i), env);
     }
+    return ex(ast->get_last_kid(), env);
+  }
 
-    // Retrieve the function
-    IntrinsicFn fn = (location->lookup(ast->get_str())).get_intrinsic_fn();
+  if (ast->get_tag() == AST_FUNCTION)
+  {
+    define_function(ast, env);
+    return 0;
+  }
 
-    // Execute the function
-    return fn(args, numargs, ast->get_loc(), this);
+  // Call function
+  if (ast->get_tag() == AST_FNCALL)
+  {
+    IntrinsicFn intrinsic = nullptr;
+    Function *fn = find_callee(ast, env, intrinsic);
+    if (fn != nullptr)
+    {
+      return call(ast, fn, env);
+    }
+    ast->quicken(QUICK_INTRINSIC_CALL, intrinsic);
+    return call_intrinsic(ast, intrinsic, env);
   }
 
   // Is statement
   if (ast->get_tag() == AST_STATEMENT)
   {
+    ast->quicken(QUICK_STATEMENT);
     return ex(ast->get_kid(0), env);
   }
 
   // Is int literal
   if (ast->get_tag() == AST_INT_LITERAL)
   {
-    return atoi(ast->get_str().c_str());
+    Value val(atoi(ast->get_str().c_str()));
+    ast->quicken(QUICK_LITERAL, val);
+    return val;
   }
 
-  // Vardef
+  // Vardef (redefinitions have no address and do nothing)
   if (ast->get_tag() == AST_DEFINITION)
   {
-    env->define(ast->get_kid(0)->get_str());
+    if (ast->has_address())
+    {
+      env->define(ast->get_slot());
+    }
     return 0;
   }
 
   // Var assignment
   if (ast->get_tag() == AST_ASSIGNMENT)
   {
-    // Find correct environment
-    Environment *location = findEnv(ast->get_kid(0), env);
+    Value val = ex(ast->get_kid(1), env);
 
     // Assign in the appropriate environment
-    location->assign(ast->get_kid(0)->get_str(), ex(ast->get_kid(1), env));
+    Node *target = ast->get_kid(0);
+    findEnv(target, env)->assign(target->get_slot(), val);
+    if (target->is_global())
+    {
+      ast->quicken(QUICK_STORE_GLOBAL);
+    }
+    else if (target->get_env_depth() == 0)
+    {
+      ast->quicken(QUICK_STORE_LOCAL);
+    }
 
     // Return assignment value
-    return location->lookup(ast->get_kid(0)->get_str());
+    return val;
   }
 
   // Var reference
   if (ast->get_tag() == AST_VARREF)
   {
-    // Find correct environment
-    Environment *location = findEnv(ast, env);
-
-    // Retrieve variable value
-    return location->lookup(ast->get_str());
+    // Retrieve variable value from the correct environment
+    if (ast->is_global())
+    {
+      ast->quicken(QUICK_LOAD_GLOBAL);
+    }
+    else if (ast->get_env_depth() == 0)
+    {
+      ast->quicken(QUICK_LOAD_LOCAL);
+    }
+    return findEnv(ast, env)->lookup(ast->get_slot());
   }
 
   // If statement
   if (ast->get_tag() == AST_IF)
   {
-    // Check if the condition actually produces a number
-    if (non_numeric(ast->get_kid(0), env))
-    {
-      EvaluationError::raise(ast->get_loc(), "Non-numeric condition");
-    }
-
     // Check if condition evaluates to true
-    if (ex(ast->get_kid(0), env).get_ival() != 0)
+    if (ex_numeric(ast->get_kid(0), env, ast) != 0)
     {
-      // Create new block
-      Environment *block_env = new Environment(env);
-      ex(ast->get_kid(1), block_env);
+      ex_block(ast->get_kid(1), env);
     }
 
     // Execute else block if above not trigered
     else if (ast->get_last_kid()->get_tag() == AST_ELSE)
     {
-      // Create new block
-      Environment *block_env = new Environment(env);
-      ex(ast->get_last_kid()->get_kid(0), block_env);
+      ex_block(ast->get_last_kid()->get_kid(0), env);
     }
     return 0;
   }
@@ -281,30 +672,27 @@ Value Interpreter::ex(Node *ast, Environment *env)
   // While loop
   if (ast->get_tag() == AST_WHILE)
   {
-    // Check if the condition actually produces a number
-    if (non_numeric(ast->get_kid(0), env))
+    if (m_tier != nullptr && m_compiled_loops.count(ast) != 0)
     {
-      EvaluationError::raise(ast->get_loc(), "Non-numeric condition");
+      return run_loop(ast, env);
     }
 
     // Execute body while condition evaluates to true
-    while (ex(ast->get_kid(0), env).get_ival() != 0)
+    while (ex_numeric(ast->get_kid(0), env, ast) != 0)
     {
-      // Create new block
-      Environment *block_env = new Environment(env);
-      ex(ast->get_kid(1), block_env);
+      ex_block(ast->get_kid(1), env);
+
+      // Once the loop is hot, it continues in compiled code
+      if (m_tier != nullptr && tier_up(ast))
+      {
+        return run_loop(ast, env);
+      }
     }
     return 0;
   }
 
-  // Check if operand1 is numeric
-  if (non_numeric(ast->get_kid(0), env))
-  {
-    EvaluationError::raise(ast->get_loc(), "Non-numeric condition");
-  }
-
   // Retrieve first operand
-  int val1 = (ex(ast->get_kid(0), env)).get_ival();
+  int val1 = ex_numeric(ast->get_kid(0), env, ast);
 
   // Short circuit &&
   if (ast->get_tag() == AST_LOGICAL_AND)
@@ -323,46 +711,479 @@ Value Interpreter::ex(Node *ast, Environment *env)
     }
   }
 
-  // Check if operand2 is numeric
-  if (non_numeric(ast->get_kid(1), env))
+  // Retrieve second operand
+  int val2 = ex_numeric(ast->get_kid(1), env, ast);
+
+  // The operands were integers, so specialize the operator for them
+  switch (ast->get_tag())
   {
-    EvaluationError::raise(ast->get_loc(), "Non-numeric condition");
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+    break;
+  case AST_ADD:
+    ast->quicken(ast->is_safe() ? QUICK_INT_OP : QUICK_INT_ADD);
+    break;
+  case AST_SUB:
+    ast->quicken(ast->is_safe() ? QUICK_INT_OP : QUICK_INT_SUB);
+    break;
+  case AST_LESS:
+    ast->quicken(QUICK_INT_LESS);
+    break;
+  default:
+    ast->quicken(QUICK_INT_OP);
   }
 
-  // Retrieve second operand
-  int val2 = (ex(ast->get_kid(1), env)).get_ival();
+  // Perform associated operation, without the overflow check if the
+  // operands are known to be in range
+  if (ast->is_safe())
+  {
+    return unchecked_op(ast->get_tag(), val1, val2);
+  }
+  return doOp(ast->get_tag(), val1, val2, ast);
+}
+
+Function *Interpreter::define_function(Node *ast, Environment *env)
+{
+  const std::string &fn_name = ast->get_kid(0)->get_str();
+  unsigned num_params = ast->get_num_kids() == 2 ? 0 : ast->get_kid(1)->get_num_kids();
 
-  // Perform associated operation
-  return doOp(ast->get_tag(), val1, val2, ast->get_kid(1));
+  // The parameters were given the first slots of the body by analyze
+  Function *fn = new Function(fn_name, num_params, env, ast->get_last_kid());
+  if (m_memo_size > 0 && ast->is_pure())
+  {
+    m_memo_caches.push_back(new MemoCache(fn_name, m_memo_size));
+    fn->set_memo(m_memo_caches.back());
+  }
+  Value fn_val(fn);
+  env->assign(ast->get_slot(), fn_val);
+  return fn;
 }
 
-// Recursively find the appropriate environment for a var
-Environment *Interpreter::findEnv(Node *ref, Environment *env)
+// Execute a block in a new environment, if it needs one
+Value Interpreter::ex_block(Node *block, Environment *env)
+{
+  // No definitions, so names resolve to enclosing environments
+  if (block->get_num_slots() == 0)
+  {
+    return ex(block, env);
+  }
+
+  // An environment which can be captured must outlive the block
+  if (block->is_captured())
+  {
+    return ex(block, new Environment(env, block->get_num_slots()));
+  }
+
+  // Otherwise it is freed when the block finishes
+  Environment block_env(env, block->get_num_slots(), &m_slot_stack);
+  return ex(block, &block_env);
+}
+
+// Call a user-defined function. A call in tail position of the body
+// comes back here to be made after the body's frame is freed, so
+// tail recursion needs no C++ stack or environments.
+Value Interpreter::call(Node *ast, Function *fn, Environment *env)
+{
+  TailCall tail;
+  Value result;
+  std::vector<Value> args;
+
+  // A memoized function's args are needed first, to look them up
+  MemoCache *memo = fn->get_memo();
+  std::vector<int> key;
+  if (memo != nullptr)
+  {
+    for (unsigned int i = 0; i < fn->get_num_params(); i++)
+    {
+      args.push_back(ex(ast->get_kid(0)->get_kid(i), env));
+    }
+    int cached;
+    if (!memo_key(args, key))
+    {
+      memo = nullptr;
+    }
+    else if (memo->lookup(key, cached))
+    {
+      return cached;
+    }
+    result = enter(fn, nullptr, nullptr, &args, tail);
+  }
+  else
+  {
+    result = enter(fn, ast, env, nullptr, tail);
+  }
+
+  bool discard = false;
+  while (tail.fn != nullptr)
+  {
+    // After a tail call in an if arm, the result is the if's value
+    discard = discard || tail.discard;
+    fn = tail.fn;
+    tail.fn = nullptr;
+    args.swap(tail.args);
+
+    std::vector<int> tail_key;
+    int cached;
+    if (fn->get_memo() != nullptr && memo_key(args, tail_key) && fn->get_memo()->lookup(tail_key, cached))
+    {
+      result = cached;
+      break;
+    }
+    result = enter(fn, nullptr, nullptr, &args, tail);
+  }
+
+  if (discard)
+  {
+    result = 0;
+  }
+  if (memo != nullptr && result.is_numeric())
+  {
+    memo->insert(key, result.get_ival());
+  }
+  return result;
+}
+
+bool Interpreter::memo_key(const std::vector<Value> &args, std::vector<int> &key)
+{
+  for (auto i = args.begin(); i != args.end(); ++i)
+  {
+    if (!i->is_numeric())
+    {
+      return false;
+    }
+    key.push_back(i->get_ival());
+  }
+  return true;
+}
+
+// Run a function's body in a new frame, with the args of the call
+// ast (evaluated in env) or the given values
+Value Interpreter::enter(Function *fn, Node *ast, Environment *env, const std::vector<Value> *args, TailCall &tail)
+{
+  Node *body = fn->get_body();
+
+  // A hot function runs in compiled code, which makes its tail calls
+  if (m_tier != nullptr && tier_up(fn))
+  {
+    if (args != nullptr)
+    {
+      return m_tier->call_function(fn, *args);
+    }
+    std::vector<Value> values;
+    for (unsigned int i = 0; i < fn->get_num_params(); i++)
+    {
+      values.push_back(ex(ast->get_kid(0)->get_kid(i), env));
+    }
+    return m_tier->call_function(fn, values);
+  }
+
+  // No parameters or variables, so no environment needed
+  if (fn->get_num_slots() == 0)
+  {
+    return ex_tail(body, fn->get_parent_env(), tail, false);
+  }
+
+  // A frame which can be captured must outlive the call
+  if (fn->is_captured())
+  {
+    Environment *f_block = new Environment(fn->get_parent_env(), fn->get_num_slots());
+    bind_args(fn, f_block, ast, env, args);
+    return ex_tail(body, f_block, tail, false);
+  }
+
+  Environment f_block(fn->get_parent_env(), fn->get_num_slots(), &m_slot_stack);
+  bind_args(fn, &f_block, ast, env, args);
+  return ex_tail(body, &f_block, tail, false);
+}
+
+void Interpreter::bind_args(Function *fn, Environment *f_block, Node *ast, Environment *env, const std::vector<Value> *args)
+{
+  // Evaluate each arg, parameters occupy the first slots
+  for (unsigned int i = 0; i < fn->get_num_params(); i++)
+  {
+    f_block->assign(i, args != nullptr ? (*args)[i] : ex(ast->get_kid(0)->get_kid(i), env));
+  }
+}
+
+// Execute a function body (or an if arm at its end), leaving a call
+// of a user-defined function in the last statement to the caller
+Value Interpreter::ex_tail(Node *block, Environment *env, TailCall &tail, bool discard)
+{
+  for (unsigned int i = 0; i < block->get_num_kids() - 1; i++)
+  {
+    ex(block->get_kid(i), env);
+  }
+
+  Node *last = block->get_last_kid();
+  Node *ast = last->get_kid(0);
+  if (ast->get_tag() == AST_FNCALL)
+  {
+    return tail_call(ast, env, tail, discard);
+  }
+
+  if (ast->get_tag() == AST_IF)
+  {
+    if (ex_numeric(ast->get_kid(0), env, ast) != 0)
+    {
+      ex_tail_block(ast->get_kid(1), env, tail);
+    }
+    else if (ast->get_last_kid()->get_tag() == AST_ELSE)
+    {
+      ex_tail_block(ast->get_last_kid()->get_kid(0), env, tail);
+    }
+    return 0;
+  }
+
+  return ex(last, env);
+}
+
+// Execute an if arm at the end of a function body (see ex_block)
+void Interpreter::ex_tail_block(Node *block, Environment *env, TailCall &tail)
+{
+  if (block->get_num_slots() == 0)
+  {
+    ex_tail(block, env, tail, true);
+  }
+  else if (block->is_captured())
+  {
+    ex_tail(block, new Environment(env, block->get_num_slots()), tail, true);
+  }
+  else
+  {
+    Environment block_env(env, block->get_num_slots(), &m_slot_stack);
+    ex_tail(block, &block_env, tail, true);
+  }
+}
+
+// Evaluate the callee and args of a call in tail position
+Value Interpreter::tail_call(Node *ast, Environment *env, TailCall &tail, bool discard)
+{
+  // Intrinsics are called as usual
+  IntrinsicFn intrinsic = nullptr;
+  Function *fn = find_callee(ast, env, intrinsic);
+  if (fn == nullptr)
+  {
+    return ex(ast, env);
+  }
+
+  tail.args.clear();
+  for (unsigned int i = 0; i < fn->get_num_params(); i++)
+  {
+    tail.args.push_back(ex(ast->get_kid(0)->get_kid(i), env));
+  }
+  tail.fn = fn;
+  tail.discard = discard;
+  return Value();
+}
+
+Value Interpreter::call_intrinsic(Node *ast, IntrinsicFn fn, Environment *env)
+{
+  // Get args the the program entered
+  if (ast->get_num_kids() == 0)
+  {
+    return fn(nullptr, 0, ast->get_loc(), this);
+  }
+
+  unsigned numargs = ast->get_kid(0)->get_num_kids();
+  Value args[numargs];
+
+  // Evaluate each arg
+  for (unsigned int i = 0; i < numargs; i++)
+  {
+    args[i] = ex(ast->get_kid(0)->get_kid(i), env);
+  }
+
+  // Execute the function
+  return fn(args, numargs, ast->get_loc(), this);
+}
+
+// Find the callee of a call, returning the user-defined function or
+// nullptr and the intrinsic. The node caches the last function it
+// called, so a call of the same one needs no check of its args.
+Function *Interpreter::find_callee(Node *ast, Environment *env, IntrinsicFn &intrinsic)
+{
+  if (!ast->has_address())
+  {
+    EvaluationError::raise(ast->get_loc(), "Invalid function");
+  }
+  const Value &callee = findEnv(ast, env)->lookup(ast->get_slot());
+
+  if (callee.get_kind() == VALUE_FUNCTION)
+  {
+    Function *fn = callee.get_function();
+    if (fn != ast->get_cached_fn())
+    {
+      unsigned numargs = ast->get_num_kids() == 0 ? 0 : ast->get_kid(0)->get_num_kids();
+      if (numargs != fn->get_num_params())
+      {
+        EvaluationError::raise(ast->get_loc(), "Invalid params");
+      }
+      ast->set_cached_fn(fn);
+    }
+    return fn;
+  }
+
+  if (callee.get_kind() != VALUE_INTRINSIC_FN)
+  {
+    EvaluationError::raise(ast->get_loc(), "Invalid function");
+  }
+  intrinsic = callee.get_intrinsic_fn();
+  return nullptr;
+}
+
+bool Interpreter::tier_up(Function *fn)
+{
+  if (fn->get_code() >= 0)
+  {
+    return true;
+  }
+  unsigned runs = fn->get_body()->count_run();
+  if (m_call_threshold == 0 || runs < m_call_threshold)
+  {
+    return false;
+  }
+
+  if (m_log_tiers)
+  {
+    fprintf(stderr, "tier: function %s compiled after %u calls\n", fn->get_name().c_str(), runs);
+  }
+  m_tier->compile_function(fn);
+  return true;
+}
+
+bool Interpreter::tier_up(Node *loop)
 {
-  while (!env->has(ref->get_str()) && env->getParent() != nullptr)
+  unsigned runs = loop->count_run();
+  if (m_loop_threshold == 0 || runs < m_loop_threshold)
   {
-    env = env->getParent();
+    return false;
   }
 
-  return env;
+  CompiledLoop compiled;
+  find_blocks(m_ast, loop, compiled.blocks);
+  compiled.code = m_tier->compile_loop(loop, compiled.blocks);
+  m_compiled_loops[loop] = compiled;
+
+  if (m_log_tiers)
+  {
+    const Location &loc = loop->get_loc();
+    fprintf(stderr, "tier: loop at %s:%d:%d compiled after %u iterations\n", loc.get_srcfile().c_str(), loc.get_line(),
+            loc.get_col(), runs);
+  }
+  return true;
+}
+
+Value Interpreter::run_loop(Node *loop, Environment *env)
+{
+  const CompiledLoop &compiled = m_compiled_loops[loop];
+  const std::vector<Node *> &blocks = compiled.blocks;
+  std::vector<Value> frame(m_tier->get_loop_locals(compiled.code));
+
+  // The blocks below the unit have consecutive slots in the frame
+  std::vector<unsigned> bases(blocks.size(), 0);
+  for (unsigned i = 2; i < blocks.size(); i++)
+  {
+    bases[i] = bases[i - 1] + blocks[i - 1]->get_num_slots();
+  }
+
+  // Those with slots have environments, innermost first
+  std::vector<Environment *> envs(blocks.size(), nullptr);
+  Environment *block_env = env;
+  for (unsigned i = unsigned(blocks.size()) - 1; i > 0; i--)
+  {
+    if (blocks[i]->get_num_slots() > 0)
+    {
+      for (unsigned slot = 0; slot < blocks[i]->get_num_slots(); slot++)
+      {
+        frame[bases[i] + slot] = block_env->lookup(slot);
+      }
+      envs[i] = block_env;
+      block_env = block_env->getParent();
+    }
+  }
+
+  Value result = m_tier->run_loop(compiled.code, frame.data());
+
+  for (unsigned i = 1; i < blocks.size(); i++)
+  {
+    for (unsigned slot = 0; envs[i] != nullptr && slot < blocks[i]->get_num_slots(); slot++)
+    {
+      envs[i]->assign(slot, frame[bases[i] + slot]);
+    }
+  }
+  return result;
+}
+
+bool Interpreter::find_blocks(Node *ast, Node *target, std::vector<Node *> &blocks)
+{
+  if (ast == target)
+  {
+    return true;
+  }
+
+  bool block = ast->get_tag() == AST_UNIT || ast->get_tag() == AST_STATEMENT_LIST;
+  if (block)
+  {
+    blocks.push_back(ast);
+  }
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    if (find_blocks(ast->get_kid(i), target, blocks))
+    {
+      return true;
+    }
+  }
+  if (block)
+  {
+    blocks.pop_back();
+  }
+  return false;
+}
+
+// Find the appropriate environment for a var from its lexical address
+Environment *Interpreter::findEnv(Node *ref, Environment *env)
+{
+  // Globals are in the unit's environment, wherever the reference is
+  if (ref->is_global())
+  {
+    return m_globals;
+  }
+  return env->ancestor(ref->get_env_depth());
 }
 
 // Perform associated operation
-Value Interpreter::doOp(int tag, int op1, int op2, Node *divisor)
+Value Interpreter::doOp(int tag, int op1, int op2, Node *site)
 {
+  int result;
 
   switch (tag)
   {
   case AST_ADD:
-    return op1 + op2;
+    if (__builtin_add_overflow(op1, op2, &result))
+    {
+      EvaluationError::raise(site->get_loc(), "Integer overflow");
+    }
+    return result;
   case AST_SUB:
-    return op1 - op2;
+    if (__builtin_sub_overflow(op1, op2, &result))
+    {
+      EvaluationError::raise(site->get_loc(), "Integer overflow");
+    }
+    return result;
   case AST_MULTIPLY:
-    return op1 * op2;
+    if (__builtin_mul_overflow(op1, op2, &result))
+    {
+      EvaluationError::raise(site->get_loc(), "Integer overflow");
+    }
+    return result;
   case AST_DIVIDE:
     if (op2 == 0)
     {
-      EvaluationError::raise(divisor->get_loc(), "Attempt to divide by 0");
+      EvaluationError::raise(site->get_kid(1)->get_loc(), "Attempt to divide by 0");
+    }
+    if (op2 == -1 && op1 == INT_MIN)
+    {
+      EvaluationError::raise(site->get_loc(), "Integer overflow");
     }
     return op1 / op2;
   case AST_GREATER_EQUAL:
@@ -391,6 +1212,40 @@ Value Interpreter::doOp(int tag, int op1, int op2, Node *divisor)
   return 0;
 }
 
+bool Interpreter::fails(int tag, int op1, int op2)
+{
+  int result;
+
+  switch (tag)
+  {
+  case AST_ADD:
+    return __builtin_add_overflow(op1, op2, &result);
+  case AST_SUB:
+    return __builtin_sub_overflow(op1, op2, &result);
+  case AST_MULTIPLY:
+    return __builtin_mul_overflow(op1, op2, &result);
+  case AST_DIVIDE:
+    return op2 == 0 || (op2 == -1 && op1 == INT_MIN);
+  }
+  return false;
+}
+
+int Interpreter::unchecked_op(int tag, int op1, int op2)
+{
+  switch (tag)
+  {
+  case AST_ADD:
+    return op1 + op2;
+  case AST_SUB:
+    return op1 - op2;
+  case AST_MULTIPLY:
+    return op1 * op2;
+  case AST_DIVIDE:
+    return op1 / op2;
+  }
+  return doOp(tag, op1, op2, nullptr).get_ival();
+}
+
 // Intrinsic print operation
 Value Interpreter::intrinsic_print(Value args[], unsigned num_args,
                                    const Location &loc, Interpreter *interp)
@@ -422,33 +1277,39 @@ Value Interpreter::intrinsic_readint(Value args[], unsigned num_args,
   return read;
 }
 
-// Return true if var value is non numeric
-bool Interpreter::non_numeric(Node *ast, Environment *env)
+// Evaluate an operand or condition, which must produce a number
+// An operand of another kind makes the operator generic again (and
+// is an error, as in ex_numeric)
+void Interpreter::ex_quick_operands(Node *ast, Environment *env, int &op1, int &op2)
 {
-  switch (ast->get_tag())
+  Value left = ex(ast->get_kid(0), env);
+  if (left.is_numeric())
   {
-  case AST_VARREF:
-  {
-    Environment *location = findEnv(ast, env);
-    if (location->lookup(ast->get_str()).is_numeric() || location->lookup(ast->get_str()).get_kind() == VALUE_FUNCTION)
-    {
-      return false;
-    }
-    else
+    Value right = ex(ast->get_kid(1), env);
+    if (right.is_numeric())
     {
-      return true;
+      op1 = left.get_ival();
+      op2 = right.get_ival();
+      return;
     }
   }
-  case AST_UNIT:
-  case AST_STATEMENT:
-  case AST_DEFINITION:
-  case AST_ASSIGNMENT:
-  case AST_IF:
-  case AST_ELSE:
-  case AST_STATEMENT_LIST:
-  case AST_WHILE:
-    return true;
-  default:
-    return false;
+  ast->quicken(QUICK_NONE);
+  EvaluationError::raise(ast->get_loc(), "Non-numeric condition");
+}
+
+int Interpreter::ex_numeric(Node *ast, Environment *env, Node *site)
+{
+  // An assignment is rejected without being evaluated
+  if (ast->get_tag() == AST_ASSIGNMENT)
+  {
+    EvaluationError::raise(site->get_loc(), "Non-numeric condition");
   }
-}
\ No newline at end of file
+  Value val = ex(ast, env);
+
+  // Check if the value is actually a number (unless it is known to be)
+  if (!ast->is_numeric() && !val.is_numeric())
+  {
+    EvaluationError::raise(site->get_loc(), "Non-numeric condition");
+  }
+  return val.get_ival();
+}
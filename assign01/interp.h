@@ -3,36 +3,253 @@
 
 #include "value.h"
 #include "environment.h"
+#include "slotstack.h"
 
+#include <map>
 #include <set>
+#include <vector>
+#include <utility>
 
 class Node;
 class Location;
+class Function;
+class Scope;
+class MemoCache;
+class ClosureCompiler;
+struct ScopeEntry;
 
 class Interpreter {
 private:
+  // Call in tail position of a function body, to be made by the
+  // function's caller once the body's frame is freed
+  struct TailCall {
+    Function *fn = nullptr;
+    std::vector<Value> args;
+
+    // True if the call was in an if arm, so its value is not returned
+    bool discard = false;
+  };
+
+  // While loop compiled for tiered execution: the index of its code,
+  // and the statement lists enclosing it from the unit down, whose
+  // variables are moved into its frame while it runs
+  struct CompiledLoop {
+    unsigned code;
+    std::vector<Node *> blocks;
+  };
+
+  // Specialized forms of nodes, which the tree walker gives them after
+  // their first run (quickening). Each checks what it assumes, and the
+  // node goes back to the generic form if that no longer holds.
+  enum {
+    QUICK_NONE,
+    QUICK_STATEMENT,
+    // Literal, with its value in the node
+    QUICK_LITERAL,
+    // Variable in the current environment, or a global
+    QUICK_LOAD_LOCAL,
+    QUICK_LOAD_GLOBAL,
+    QUICK_STORE_LOCAL,
+    QUICK_STORE_GLOBAL,
+    // Operators whose operands were integers
+    QUICK_INT_ADD,
+    QUICK_INT_SUB,
+    QUICK_INT_LESS,
+    QUICK_INT_OP,
+    // Call of the intrinsic in the node
+    QUICK_INTRINSIC_CALL,
+  };
+
   Node *m_ast;
 
+  // Calls inside function bodies whose callee was not yet defined
+  // when the body was analyzed, with the nesting level of the call
+  std::vector<std::pair<Node *, unsigned>> m_late_calls;
+
+  // Number of distinct variables found by analyze
+  unsigned m_num_symbols;
+
+  // Maximum size (in nodes) of a function body to inline, 0 to disable
+  unsigned m_inline_limit;
+
+  // Maximum number of clones of a function specialized for constant
+  // arguments, 0 to disable
+  unsigned m_clone_limit;
+
+  // Environment of the unit being executed
+  Environment *m_globals;
+
+  // Slots of environments which are freed when their block finishes
+  SlotStack m_slot_stack;
+
+  // Number of results to cache for each pure function, 0 to disable
+  // memoization, and the caches of the functions defined so far
+  unsigned m_memo_size;
+  std::vector<MemoCache *> m_memo_caches;
+
+  // How execute runs the program
+  int m_engine;
+
+  // Whether to print how often the stack VM's superinstructions ran
+  bool m_fusion_stats;
+
+  // Tiered execution: the compiler of hot code (while it runs), the
+  // number of calls of a function and iterations of a loop after which
+  // they are compiled (0 to never compile them), whether to log it, and
+  // the loops compiled so far
+  ClosureCompiler *m_tier;
+  unsigned m_call_threshold;
+  unsigned m_loop_threshold;
+  bool m_log_tiers;
+  std::map<Node *, CompiledLoop> m_compiled_loops;
+
+  // Memory (in bytes) the iterative engine may use for the program's
+  // unfinished calls
+  size_t m_stack_limit;
+
 public:
+  enum {
+    // Walk the ast
+    ENGINE_TREE,
+    // Compile to bytecode for the stack VM
+    ENGINE_STACK,
+    // Compile to code for the register VM
+    ENGINE_REGISTER,
+    // Convert the ast to a tree of C++ closures
+    ENGINE_CLOSURE,
+    // Run the register VM, compiling hot functions to machine code
+    ENGINE_JIT,
+    // Walk the ast, compiling hot functions and loops to closures
+    ENGINE_TIERED,
+    // Walk the ast with explicit stacks instead of recursion
+    ENGINE_ITERATIVE,
+  };
+
+  static const unsigned DEFAULT_INLINE_LIMIT = 12;
+  static const unsigned DEFAULT_CLONE_LIMIT = 4;
+  static const unsigned DEFAULT_CALL_THRESHOLD = 1000;
+  static const unsigned DEFAULT_LOOP_THRESHOLD = 1000;
+
   Interpreter(Node *ast_to_adopt);
   ~Interpreter();
 
+  void set_inline_limit(unsigned limit) { m_inline_limit = limit; }
+  void set_clone_limit(unsigned limit) { m_clone_limit = limit; }
+  void set_memo_size(unsigned size) { m_memo_size = size; }
+  void set_engine(int engine) { m_engine = engine; }
+  void set_fusion_stats(bool fusion_stats) { m_fusion_stats = fusion_stats; }
+  void set_call_threshold(unsigned threshold) { m_call_threshold = threshold; }
+  void set_loop_threshold(unsigned threshold) { m_loop_threshold = threshold; }
+  void set_log_tiers(bool log_tiers) { m_log_tiers = log_tiers; }
+  void set_stack_limit(size_t limit) { m_stack_limit = limit; }
+
   void analyze();
+  void optimize();
   Value execute();
 
+  // Replace the (analyzed) program by what is left after executing
+  // everything which doesn't depend on input
+  void partial_evaluate();
+
+  // Print the program as source code
+  void print_program();
+
+  // Print the hits and misses of each memoized function to stderr
+  void print_memo_stats();
+
+  // Print the SSA form of the unit and its functions
+  void print_ir();
+
+  // Print the compiled code of the unit and its functions
+  void print_code();
+
+  // Print the program translated to a standalone C program
+  void print_c();
+
+  // Create the function defined by an AST_FUNCTION node, and assign
+  // it to the node's slot of env
+  Function *define_function(Node *ast, Environment *env);
+
+  // Get the cache key for a memoized call, false if an argument isn't
+  // an integer
+  static bool memo_key(const std::vector<Value> &args, std::vector<int> &key);
+
+  // Perform the associated operation of the operator node site,
+  // raising an error if the result overflows or the divisor is 0
+  static Value doOp(int tag, int op1, int op2, Node *site);
+
+  // Check if an operation would raise an error
+  static bool fails(int tag, int op1, int op2);
+
+  // Perform an arithmetic operation known not to fail
+  static int unchecked_op(int tag, int op1, int op2);
+
 private:
 
   // Evaluate expression of a given node
   Value ex(Node *ast, Environment *env);
 
-  // Find associated environment for a var
+  // Execute a statement list which has its own scope
+  Value ex_block(Node *block, Environment *env);
+
+  // Call a user-defined function, making tail calls in a loop
+  Value call(Node *ast, Function *fn, Environment *env);
+
+  // Run a function body in a new frame (args evaluated from the call
+  // ast in env, or given)
+  Value enter(Function *fn, Node *ast, Environment *env, const std::vector<Value> *args, TailCall &tail);
+  void bind_args(Function *fn, Environment *f_block, Node *ast, Environment *env, const std::vector<Value> *args);
+
+  // Execute a block in tail position, setting tail for a call in its
+  // last statement instead of making it
+  Value ex_tail(Node *block, Environment *env, TailCall &tail, bool discard);
+  void ex_tail_block(Node *block, Environment *env, TailCall &tail);
+  Value tail_call(Node *ast, Environment *env, TailCall &tail, bool discard);
+
+  // Count a run of a function or an iteration of a loop, compiling it
+  // if it is hot, and return true if it is compiled
+  bool tier_up(Function *fn);
+  bool tier_up(Node *loop);
+
+  // Continue a compiled while loop, with the variables of its enclosing
+  // blocks moved to its frame (on-stack replacement)
+  Value run_loop(Node *loop, Environment *env);
+
+  // Find the statement lists enclosing target, from ast down
+  static bool find_blocks(Node *ast, Node *target, std::vector<Node *> &blocks);
+
+  // Find the callee of a call (nullptr if it is an intrinsic), raising
+  // an error if it isn't a function taking the call's args
+  Function *find_callee(Node *ast, Environment *env, IntrinsicFn &intrinsic);
+
+  // Evaluate an operand or condition of site, which must be numeric
+  int ex_numeric(Node *ast, Environment *env, Node *site);
+
+  // Evaluate the operands of a specialized operator, which must still
+  // be integers
+  void ex_quick_operands(Node *ast, Environment *env, int &op1, int &op2);
+
+  // Evaluate the args of a call and call an intrinsic
+  Value call_intrinsic(Node *ast, IntrinsicFn fn, Environment *env);
+
+  // Find associated environment for a var (using its lexical address)
   Environment* findEnv(Node *ref, Environment *env);
   
-  // Perform the associated operation
-  Value doOp(int tag, int op1, int op2, Node *divisor);
+  // Recursively analyze AST for semantic errors, resolving names
+  // to lexical addresses
+  void analyze_recurse(Node *ast, Scope *scope);
+
+  // Analyze a statement list which has its own scope
+  void analyze_block(Node *block, Scope *scope);
+
+  // Compute the runtime depth of addresses, skipping blocks which
+  // need no environment
+  void assign_env_depths(Node *ast, std::vector<bool> &materialized);
 
-  // Recursively analyze AST for semantic errors
-  void analyze_recurse(Node *ast, Environment *env);
+  static std::vector<std::string> intrinsic_names();
+
+  // Define a name in a scope, giving new variables a symbol number
+  ScopeEntry define_name(Scope *scope, const std::string &name);
   // TODO: private member functions
 
   // Intrinsic function calls
@@ -40,9 +257,6 @@ private:
   static Value intrinsic_println(Value args[], unsigned num_args, const Location &loc, Interpreter *interp);
   static Value intrinsic_readint(Value args[], unsigned num_args, const Location &loc, Interpreter *interp);
 
-
-  // Check if node is non numeric
-  bool non_numeric(Node *ast, Environment *env);
 };
 
 #endif // INTERP_H
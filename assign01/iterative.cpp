@@ -0,0 +1,496 @@
+#include <cstdlib>
+#include "ast.h"
+#include "node.h"
+#include "exceptions.h"
+#include "function.h"
+#include "environment.h"
+#include "memo.h"
+#include "interp.h"
+#include "iterative.h"
+
+namespace {
+
+// Environment of a variable from its lexical address
+Environment *find_env(Node *ref, Environment *env)
+{
+  return env->ancestor(ref->get_env_depth());
+}
+
+}
+
+IterativeEvaluator::IterativeEvaluator(Interpreter *interp, Environment *globals, size_t limit)
+    : m_interp(interp), m_globals(globals), m_limit(limit), m_frame_bytes(0)
+{
+}
+
+IterativeEvaluator::~IterativeEvaluator()
+{
+  // After an error, free the environments of unfinished blocks and calls
+  while (!m_tasks.empty())
+  {
+    close_frame(m_tasks.back());
+    m_tasks.pop_back();
+  }
+}
+
+Value IterativeEvaluator::run(Node *unit)
+{
+  push(TASK_EVAL, unit, m_globals, false);
+  while (!m_tasks.empty())
+  {
+    Task &task = m_tasks.back();
+    switch (task.kind)
+    {
+    case TASK_EVAL:
+      eval(task);
+      break;
+    case TASK_BLOCK:
+      block(task);
+      break;
+    default:
+      ret(task);
+    }
+  }
+
+  Value result = m_values.back();
+  m_values.pop_back();
+  return result;
+}
+
+void IterativeEvaluator::push(int kind, Node *ast, Environment *env, bool tail)
+{
+  // Literals and variables are evaluated right away
+  if (kind == TASK_EVAL && ast->get_tag() == AST_VARREF)
+  {
+    m_values.push_back(find_env(ast, env)->lookup(ast->get_slot()));
+    return;
+  }
+  if (kind == TASK_EVAL && ast->get_tag() == AST_INT_LITERAL)
+  {
+    m_values.push_back(atoi(ast->get_str().c_str()));
+    return;
+  }
+
+  Task task;
+  task.kind = kind;
+  task.ast = ast;
+  task.env = env;
+  task.step = 0;
+  task.tail = tail;
+  task.fn = nullptr;
+  task.intrinsic = nullptr;
+  task.frame = nullptr;
+  task.owns_frame = false;
+  task.memo = nullptr;
+  task.discard = false;
+  m_tasks.push_back(task);
+}
+
+void IterativeEvaluator::finish(const Value &val)
+{
+  m_tasks.pop_back();
+  m_values.push_back(val);
+}
+
+void IterativeEvaluator::finish()
+{
+  m_tasks.pop_back();
+}
+
+// The task is on top of the stack, so it must not be used after
+// pushing another
+void IterativeEvaluator::eval(Task &task)
+{
+  Node *ast = task.ast;
+  switch (ast->get_tag())
+  {
+  case AST_UNIT:
+  case AST_STATEMENT_LIST:
+  {
+    // Statements run in order, and the list's value is the last one's,
+    // which takes the list's place
+    if (task.step > 0)
+    {
+      m_values.pop_back();
+    }
+    Node *stmt = ast->get_kid(task.step++);
+    if (task.step == ast->get_num_kids())
+    {
+      task.ast = stmt;
+      task.step = 0;
+    }
+    else
+    {
+      push(TASK_EVAL, stmt, task.env, false);
+    }
+    return;
+  }
+
+  case AST_STATEMENT:
+    // Only a call or an if is in tail position
+    task.ast = ast->get_kid(0);
+    task.tail = task.tail && (task.ast->get_tag() == AST_FNCALL || task.ast->get_tag() == AST_IF);
+    return;
+
+  case AST_FUNCTION:
+    m_interp->define_function(ast, task.env);
+    finish(0);
+    return;
+
+  case AST_FNCALL:
+    eval_call(task);
+    return;
+
+  case AST_INT_LITERAL:
+    finish(atoi(ast->get_str().c_str()));
+    return;
+
+  // Redefinitions have no address and do nothing
+  case AST_DEFINITION:
+    if (ast->has_address())
+    {
+      task.env->define(ast->get_slot());
+    }
+    finish(0);
+    return;
+
+  case AST_ASSIGNMENT:
+    if (task.step == 0)
+    {
+      task.step = 1;
+      push(TASK_EVAL, ast->get_kid(1), task.env, false);
+      return;
+    }
+    find_env(ast->get_kid(0), task.env)->assign(ast->get_kid(0)->get_slot(), m_values.back());
+    finish();
+    return;
+
+  case AST_VARREF:
+    finish(find_env(ast, task.env)->lookup(ast->get_slot()));
+    return;
+
+  case AST_IF:
+  {
+    if (task.step == 0)
+    {
+      task.step = 1;
+      push_numeric(ast->get_kid(0), task.env, ast);
+      return;
+    }
+
+    // The value of the arm is discarded
+    if (task.step == 2)
+    {
+      m_values.pop_back();
+      finish(0);
+      return;
+    }
+
+    Node *arm = nullptr;
+    if (pop_numeric(ast->get_kid(0), ast) != 0)
+    {
+      arm = ast->get_kid(1);
+    }
+    else if (ast->get_last_kid()->get_tag() == AST_ELSE)
+    {
+      arm = ast->get_last_kid()->get_kid(0);
+    }
+    if (arm == nullptr)
+    {
+      finish(0);
+      return;
+    }
+    task.step = 2;
+    push(TASK_BLOCK, arm, task.env, task.tail);
+    return;
+  }
+
+  case AST_WHILE:
+    if (task.step == 2)
+    {
+      m_values.pop_back();
+    }
+    if (task.step != 1)
+    {
+      task.step = 1;
+      push_numeric(ast->get_kid(0), task.env, ast);
+      return;
+    }
+    if (pop_numeric(ast->get_kid(0), ast) == 0)
+    {
+      finish(0);
+      return;
+    }
+    task.step = 2;
+    push(TASK_BLOCK, ast->get_kid(1), task.env, false);
+    return;
+
+  default:
+    break;
+  }
+
+  // Operators evaluate their operands in order, the second only if the
+  // first doesn't decide the result of && and ||
+  if (task.step == 0)
+  {
+    task.step = 1;
+    push_numeric(ast->get_kid(0), task.env, ast);
+    return;
+  }
+  if (task.step == 1)
+  {
+    int val1 = pop_numeric(ast->get_kid(0), ast);
+    if (ast->get_tag() == AST_LOGICAL_AND && val1 == 0)
+    {
+      finish(0);
+      return;
+    }
+    if (ast->get_tag() == AST_LOGICAL_OR && val1 != 0)
+    {
+      finish(1);
+      return;
+    }
+    m_values.push_back(val1);
+    task.step = 2;
+    push_numeric(ast->get_kid(1), task.env, ast);
+    return;
+  }
+
+  int val2 = pop_numeric(ast->get_kid(1), ast);
+  int val1 = m_values.back().get_ival();
+  m_values.pop_back();
+  if (ast->is_safe())
+  {
+    finish(Interpreter::unchecked_op(ast->get_tag(), val1, val2));
+  }
+  else
+  {
+    finish(Interpreter::doOp(ast->get_tag(), val1, val2, ast));
+  }
+}
+
+// The callee is checked before the args are evaluated, onto the
+// operand stack
+void IterativeEvaluator::eval_call(Task &task)
+{
+  Node *ast = task.ast;
+  unsigned num_args = ast->get_num_kids() == 0 ? 0 : ast->get_kid(0)->get_num_kids();
+
+  if (task.step == 0)
+  {
+    if (!ast->has_address())
+    {
+      EvaluationError::raise(ast->get_loc(), "Invalid function");
+    }
+    const Value &callee = find_env(ast, task.env)->lookup(ast->get_slot());
+    if (callee.get_kind() == VALUE_FUNCTION)
+    {
+      task.fn = callee.get_function();
+      if (num_args != task.fn->get_num_params())
+      {
+        EvaluationError::raise(ast->get_loc(), "Invalid params");
+      }
+    }
+    else if (callee.get_kind() == VALUE_INTRINSIC_FN)
+    {
+      task.intrinsic = callee.get_intrinsic_fn();
+    }
+    else
+    {
+      EvaluationError::raise(ast->get_loc(), "Invalid function");
+    }
+  }
+
+  if (task.step < num_args)
+  {
+    Node *arg = ast->get_kid(0)->get_kid(task.step++);
+    push(TASK_EVAL, arg, task.env, false);
+    return;
+  }
+
+  if (task.fn != nullptr)
+  {
+    call(task, num_args);
+    return;
+  }
+
+  Value *args = num_args == 0 ? nullptr : &m_values[m_values.size() - num_args];
+  Value result = task.intrinsic(args, num_args, ast->get_loc(), m_interp);
+  m_values.resize(m_values.size() - num_args);
+  finish(result);
+}
+
+void IterativeEvaluator::call(Task &task, unsigned num_args)
+{
+  Function *fn = task.fn;
+  Node *site = task.ast;
+
+  // A memoized function's cached result replaces the call
+  MemoCache *memo = fn->get_memo();
+  std::vector<int> key;
+  if (memo != nullptr)
+  {
+    int cached;
+    if (!Interpreter::memo_key(std::vector<Value>(m_values.end() - num_args, m_values.end()), key))
+    {
+      memo = nullptr;
+    }
+    else if (memo->lookup(key, cached))
+    {
+      m_values.resize(m_values.size() - num_args);
+      finish(cached);
+      return;
+    }
+  }
+
+  // A tail call's result isn't cached, as in Interpreter::call
+  if (task.tail)
+  {
+    tail_call(fn, site, num_args);
+    return;
+  }
+
+  // The call's task returns from it
+  task.kind = TASK_RETURN;
+  task.memo = memo;
+  if (memo != nullptr)
+  {
+    m_keys.push_back(key);
+  }
+  enter(task, fn, site, num_args);
+}
+
+// The blocks between the call and the call whose result it is finish
+// first, so their environments are freed. A tail call in an if arm
+// doesn't give the if's value, so the result is 0.
+void IterativeEvaluator::tail_call(Function *fn, Node *site, unsigned num_args)
+{
+  bool discard = false;
+  m_tasks.pop_back();
+  while (m_tasks.back().kind != TASK_RETURN)
+  {
+    Task &task = m_tasks.back();
+    if (task.kind == TASK_EVAL && task.ast->get_tag() == AST_IF)
+    {
+      discard = true;
+    }
+    close_frame(task);
+    m_tasks.pop_back();
+  }
+
+  Task &ret = m_tasks.back();
+  ret.discard = ret.discard || discard;
+  close_frame(ret);
+  enter(ret, fn, site, num_args);
+}
+
+void IterativeEvaluator::enter(Task &ret, Function *fn, Node *site, unsigned num_args)
+{
+  if (used() > m_limit)
+  {
+    EvaluationError::raise(site->get_loc(), "Stack overflow");
+  }
+
+  Node *body = fn->get_body();
+  open_frame(ret, fn->get_parent_env(), body);
+  Environment *env = ret.frame != nullptr ? ret.frame : fn->get_parent_env();
+
+  // Parameters occupy the first slots
+  for (unsigned int i = 0; i < num_args; i++)
+  {
+    env->assign(i, m_values[m_values.size() - num_args + i]);
+  }
+  m_values.resize(m_values.size() - num_args);
+  push(TASK_EVAL, body, env, true);
+}
+
+void IterativeEvaluator::block(Task &task)
+{
+  if (task.step == 0)
+  {
+    task.step = 1;
+    open_frame(task, task.env, task.ast);
+    push(TASK_EVAL, task.ast, task.frame != nullptr ? task.frame : task.env, task.tail);
+    return;
+  }
+  close_frame(task);
+  finish();
+}
+
+void IterativeEvaluator::ret(Task &task)
+{
+  close_frame(task);
+
+  Value &result = m_values.back();
+  if (task.discard)
+  {
+    result = 0;
+  }
+  if (task.memo != nullptr)
+  {
+    if (result.is_numeric())
+    {
+      task.memo->insert(m_keys.back(), result.get_ival());
+    }
+    m_keys.pop_back();
+  }
+  finish();
+}
+
+// An environment which can be captured must outlive its block or call,
+// others are freed (in the reverse order of their creation) when it
+// finishes
+void IterativeEvaluator::open_frame(Task &task, Environment *parent, Node *block)
+{
+  unsigned num_slots = block->get_num_slots();
+  if (num_slots == 0)
+  {
+    return;
+  }
+  task.owns_frame = !block->is_captured();
+  task.frame = task.owns_frame ? new Environment(parent, num_slots, &m_slot_stack) : new Environment(parent, num_slots);
+  m_frame_bytes += sizeof(Environment) + num_slots * sizeof(Value);
+}
+
+void IterativeEvaluator::close_frame(Task &task)
+{
+  if (task.frame == nullptr)
+  {
+    return;
+  }
+  m_frame_bytes -= sizeof(Environment) + task.frame->get_num_slots() * sizeof(Value);
+  if (task.owns_frame)
+  {
+    delete task.frame;
+  }
+  task.frame = nullptr;
+}
+
+// An assignment is rejected without being evaluated
+void IterativeEvaluator::push_numeric(Node *ast, Environment *env, Node *site)
+{
+  if (ast->get_tag() == AST_ASSIGNMENT)
+  {
+    EvaluationError::raise(site->get_loc(), "Non-numeric condition");
+  }
+  push(TASK_EVAL, ast, env, false);
+}
+
+int IterativeEvaluator::pop_numeric(Node *ast, Node *site)
+{
+  Value val = m_values.back();
+  m_values.pop_back();
+
+  // Check if the value is actually a number (unless it is known to be)
+  if (!ast->is_numeric() && !val.is_numeric())
+  {
+    EvaluationError::raise(site->get_loc(), "Non-numeric condition");
+  }
+  return val.get_ival();
+}
+
+size_t IterativeEvaluator::used() const
+{
+  return m_tasks.size() * sizeof(Task) + m_values.size() * sizeof(Value) + m_keys.size() * sizeof(std::vector<int>) +
+         m_frame_bytes;
+}
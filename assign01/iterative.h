@@ -0,0 +1,121 @@
+#ifndef ITERATIVE_H
+#define ITERATIVE_H
+
+#include <vector>
+#include "value.h"
+#include "slotstack.h"
+class Node;
+class Interpreter;
+class Environment;
+class Function;
+class MemoCache;
+
+// Execution engine which walks the ast like the tree walker, but keeps
+// what is left to do for each node being evaluated on a stack of tasks,
+// and the values of evaluated nodes on a stack of operands, instead of
+// recursing in C++. Recursion in the program therefore doesn't use the
+// C++ stack: instead the memory used by the two stacks and by the
+// environments of unfinished calls and blocks is limited, and a call
+// which would exceed the limit is an error at the call.
+class IterativeEvaluator {
+private:
+  enum {
+    // Evaluate a node, leaving its value on the operand stack
+    TASK_EVAL,
+    // Run a statement list in a new environment, if it needs one
+    TASK_BLOCK,
+    // Return from a call of a user-defined function
+    TASK_RETURN,
+  };
+
+  struct Task {
+    int kind;
+    Node *ast;
+    Environment *env;
+
+    // How far evaluation of the node has got
+    unsigned step;
+
+    // True if the value is the result of the enclosing call, so a call
+    // of a user-defined function here replaces it (a tail call)
+    bool tail;
+
+    // Callee of a call, which is found before its args are evaluated
+    Function *fn;
+    IntrinsicFn intrinsic;
+
+    // Environment created by a block or call, which is freed when it
+    // finishes unless it can be captured
+    Environment *frame;
+    bool owns_frame;
+
+    // For a return: the cache of the memoized function called (its key
+    // is on the key stack), and whether a tail call from an if arm
+    // made the result 0
+    MemoCache *memo;
+    bool discard;
+  };
+
+  Interpreter *m_interp;
+  Environment *m_globals;
+  std::vector<Task> m_tasks;
+  std::vector<Value> m_values;
+  std::vector<std::vector<int>> m_keys;
+  SlotStack m_slot_stack;
+
+  // Limit on the memory of the stacks and environments, and the memory
+  // of the environments of unfinished blocks and calls
+  size_t m_limit;
+  size_t m_frame_bytes;
+
+  // copy constructor and assignment operator prohibited
+  IterativeEvaluator(const IterativeEvaluator &);
+  IterativeEvaluator &operator=(const IterativeEvaluator &);
+
+public:
+  static const size_t DEFAULT_LIMIT = 64 << 20;
+
+  IterativeEvaluator(Interpreter *interp, Environment *globals, size_t limit = DEFAULT_LIMIT);
+  ~IterativeEvaluator();
+
+  // Execute the unit, returning the value of its last statement
+  Value run(Node *unit);
+
+private:
+  void push(int kind, Node *ast, Environment *env, bool tail);
+
+  // Finish the task on top, whose value is val (or already on the
+  // operand stack)
+  void finish(const Value &val);
+  void finish();
+
+  // Carry out the next step of the task on top
+  void eval(Task &task);
+  void eval_call(Task &task);
+  void block(Task &task);
+  void ret(Task &task);
+
+  // Call a user-defined function with the top num_args operands as its
+  // arguments, in the task of the call site, or in place of the
+  // enclosing call for a tail call
+  void call(Task &task, unsigned num_args);
+  void tail_call(Function *fn, Node *site, unsigned num_args);
+
+  // Create the environment of a function's body, binding the top
+  // num_args operands to its parameters
+  void enter(Task &ret, Function *fn, Node *site, unsigned num_args);
+
+  // Create and free the environment of a block or call
+  void open_frame(Task &task, Environment *parent, Node *block);
+  void close_frame(Task &task);
+
+  // Evaluate an operand or condition of site, then pop its value, which
+  // must be numeric, raising an error at site if not
+  void push_numeric(Node *ast, Environment *env, Node *site);
+  int pop_numeric(Node *ast, Node *site);
+
+  // Memory used by the stacks and environments
+  size_t used() const;
+};
+
+#endif // ITERATIVE_H
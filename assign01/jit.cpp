@@ -0,0 +1,426 @@
+#include <cstring>
+#include <algorithm>
+#include <climits>
+#include "ast.h"
+#include "node.h"
+#include "value.h"
+#include "function.h"
+#include "environment.h"
+#include "bytecode.h"
+#include "regcompiler.h"
+#include "nativecode.h"
+#include "jit.h"
+
+namespace {
+
+typedef X86Assembler A;
+
+// Machine registers for locals, callee-saved ones first. rbx holds the
+// window and rbp the VM; rax, rcx and rdx are scratch.
+const A::Reg LOCAL_REGS[] = {A::R12, A::R13, A::R14, A::R15, A::RSI, A::RDI, A::R8, A::R9, A::R10, A::R11};
+const unsigned NUM_LOCAL_REGS = sizeof(LOCAL_REGS) / sizeof(LOCAL_REGS[0]);
+const unsigned NUM_CALLEE_SAVED = 4;
+
+const A::Reg SAVED_REGS[] = {A::RBX, A::RBP, A::R12, A::R13, A::R14, A::R15};
+
+A::Cond compare_cond(int op)
+{
+  switch (op)
+  {
+  case ROP_LESS:
+  case ROP_JUMP_LESS:
+    return A::CC_L;
+  case ROP_LESS_EQUAL:
+  case ROP_JUMP_LESS_EQUAL:
+    return A::CC_LE;
+  case ROP_GREATER:
+  case ROP_JUMP_GREATER:
+    return A::CC_G;
+  case ROP_GREATER_EQUAL:
+  case ROP_JUMP_GREATER_EQUAL:
+    return A::CC_GE;
+  case ROP_EQUAL:
+  case ROP_JUMP_EQUAL:
+    return A::CC_E;
+  default:
+    return A::CC_NE;
+  }
+}
+
+}
+
+JitCompiler::JitCompiler(Environment *globals, CallHelper call_helper)
+    : m_globals(globals), m_call_helper(call_helper), m_chunk(nullptr), m_num_mapped(0)
+{
+}
+
+JitCompiler::~JitCompiler()
+{
+}
+
+NativeCode *JitCompiler::compile(const Chunk *chunk)
+{
+  m_chunk = chunk;
+  m_num_mapped = std::min(chunk->num_locals, NUM_LOCAL_REGS);
+  m_offsets.assign(chunk->code.size(), 0);
+
+  // The window and VM are the arguments
+  for (auto reg : SAVED_REGS)
+  {
+    m_asm.push(reg);
+  }
+  m_asm.sub64(A::RSP, 8);
+  m_asm.mov64(A::RBX, A::RDI);
+  m_asm.mov64(A::RBP, A::RSI);
+
+  // Arguments which aren't integers are left to the interpreter
+  m_asm.mov(A::RAX, 0);
+  for (unsigned int i = 0; i < chunk->num_params; i++)
+  {
+    m_asm.cmp(A::RBX, kind(int(i)), VALUE_INT);
+    m_returns.push_back(m_asm.jcc(A::CC_NE));
+  }
+  reload(false);
+
+  unsigned pc = 0;
+  while (pc < chunk->code.size())
+  {
+    pc = compile_insn(pc);
+  }
+  for (auto i = m_jumps.begin(); i != m_jumps.end(); ++i)
+  {
+    m_asm.patch(i->first, m_offsets[i->second]);
+  }
+  compile_exits();
+  return new NativeCode(m_asm.get_code());
+}
+
+unsigned JitCompiler::compile_insn(unsigned pc)
+{
+  m_offsets[pc] = m_asm.get_offset();
+  const int *insn = &m_chunk->code[pc];
+  int op = insn[0];
+  switch (op)
+  {
+  case ROP_LOADK:
+    store(insn[1], insn[2]);
+    return pc + 3;
+
+  case ROP_MOVE:
+    load(A::RAX, insn[2]);
+    store(insn[1], A::RAX);
+    return pc + 3;
+
+  // A global called at once is checked against the callee it had
+  case ROP_GET_GLOBAL:
+    if (pc + 3 < m_chunk->code.size() && m_chunk->code[pc + 3] == ROP_CALLEE && m_chunk->code[pc + 4] == insn[1]
+        && !mapped(insn[1]))
+    {
+      m_offsets[pc + 3] = m_asm.get_offset();
+      compile_callee(pc, insn[1], insn[2], m_chunk->code[pc + 5]);
+      return pc + 7;
+    }
+    m_asm.mov64(A::RCX, uint64_t(&m_globals->lookup(insn[2])));
+    m_asm.cmp(A::RCX, int32_t(Value::KIND_OFFSET), VALUE_INT);
+    exit(A::CC_NE, int(pc));
+    m_asm.load(A::RAX, A::RCX, int32_t(Value::DATA_OFFSET));
+    store(insn[1], A::RAX);
+    return pc + 3;
+
+  case ROP_SET_GLOBAL:
+    load(A::RAX, insn[2]);
+    m_asm.mov64(A::RCX, uint64_t(&m_globals->lookup(insn[1])));
+    m_asm.store(A::RCX, int32_t(Value::DATA_OFFSET), A::RAX);
+    m_asm.store(A::RCX, int32_t(Value::KIND_OFFSET), VALUE_INT);
+    return pc + 3;
+
+  case ROP_DEFINE:
+    store(insn[1], -1);
+    return pc + 2;
+
+  // Everything in the native code is an integer
+  case ROP_NUMERIC:
+    return pc + 3;
+
+  // Operations which would fail are left to the interpreter, to raise
+  // the error
+  case ROP_ADD:
+  case ROP_SUB:
+  case ROP_MULTIPLY:
+  case ROP_ADD_SAFE:
+  case ROP_SUB_SAFE:
+  case ROP_MULTIPLY_SAFE:
+    load(A::RAX, insn[2]);
+    load(A::RCX, insn[3]);
+    if (op == ROP_ADD || op == ROP_ADD_SAFE)
+    {
+      m_asm.alu(A::ALU_ADD, A::RAX, A::RCX);
+    }
+    else if (op == ROP_SUB || op == ROP_SUB_SAFE)
+    {
+      m_asm.alu(A::ALU_SUB, A::RAX, A::RCX);
+    }
+    else
+    {
+      m_asm.imul(A::RAX, A::RCX);
+    }
+    if (op <= ROP_MULTIPLY)
+    {
+      exit(A::CC_O, int(pc));
+      store(insn[1], A::RAX);
+      return pc + 5;
+    }
+    store(insn[1], A::RAX);
+    return pc + 4;
+
+  case ROP_DIVIDE:
+  case ROP_DIVIDE_SAFE:
+  {
+    load(A::RAX, insn[2]);
+    load(A::RCX, insn[3]);
+    if (op == ROP_DIVIDE)
+    {
+      m_asm.alu(A::ALU_TEST, A::RCX, A::RCX);
+      exit(A::CC_E, int(pc));
+      m_asm.cmp(A::RCX, -1);
+      unsigned divide = m_asm.jcc(A::CC_NE);
+      m_asm.cmp(A::RAX, INT_MIN);
+      exit(A::CC_E, int(pc));
+      m_asm.patch(divide, m_asm.get_offset());
+    }
+    m_asm.cdq();
+    m_asm.idiv(A::RCX);
+    store(insn[1], A::RAX);
+    return pc + (op == ROP_DIVIDE ? 5 : 4);
+  }
+
+  case ROP_LESS:
+  case ROP_LESS_EQUAL:
+  case ROP_GREATER:
+  case ROP_GREATER_EQUAL:
+  case ROP_EQUAL:
+  case ROP_NOT_EQUAL:
+    load(A::RCX, insn[2]);
+    load(A::RDX, insn[3]);
+    m_asm.alu(A::ALU_CMP, A::RCX, A::RDX);
+    m_asm.set(compare_cond(op));
+    store(insn[1], A::RAX);
+    return pc + 4;
+
+  case ROP_BOOL:
+    load(A::RCX, insn[2]);
+    m_asm.alu(A::ALU_TEST, A::RCX, A::RCX);
+    m_asm.set(A::CC_NE);
+    store(insn[1], A::RAX);
+    return pc + 3;
+
+  case ROP_JUMP:
+    jump(insn[1]);
+    return pc + 2;
+
+  case ROP_JUMP_ZERO:
+  case ROP_JUMP_NONZERO:
+    load(A::RAX, insn[1]);
+    m_asm.alu(A::ALU_TEST, A::RAX, A::RAX);
+    jump(op == ROP_JUMP_ZERO ? A::CC_E : A::CC_NE, insn[2]);
+    return pc + 3;
+
+  case ROP_JUMP_LESS:
+  case ROP_JUMP_LESS_EQUAL:
+  case ROP_JUMP_GREATER:
+  case ROP_JUMP_GREATER_EQUAL:
+  case ROP_JUMP_EQUAL:
+  case ROP_JUMP_NOT_EQUAL:
+    load(A::RAX, insn[1]);
+    load(A::RCX, insn[2]);
+    m_asm.alu(A::ALU_CMP, A::RAX, A::RCX);
+    jump(compare_cond(op), insn[3]);
+    return pc + 4;
+
+  case ROP_CALL:
+    compile_call(pc, insn[1], insn[2], m_chunk->sites[insn[3]]);
+    return pc + 4;
+
+  // The result replaces the callee, before the window
+  case ROP_RETURN:
+    load(A::RAX, insn[1]);
+    m_asm.store(A::RBX, data(-1), A::RAX);
+    m_asm.store(A::RBX, kind(-1), VALUE_INT);
+    m_asm.mov(A::RAX, NativeCode::COMPLETED);
+    m_returns.push_back(m_asm.jmp());
+    return pc + 2;
+
+  // Callees other than globals, definitions and failures are only
+  // interpreted
+  case ROP_CALLEE:
+    exit(int(pc));
+    return pc + 4;
+  case ROP_DEFINE_GLOBAL:
+  case ROP_FAIL:
+  case ROP_HALT:
+    exit(int(pc));
+    return pc + 2;
+  default:
+    exit(int(pc));
+    return pc + 3;
+  }
+}
+
+// The callee and its arity were checked when the code was compiled
+void JitCompiler::compile_callee(unsigned pc, int reg, int global, int num_args)
+{
+  const Value &callee = m_globals->lookup(global);
+  if (callee.get_kind() == VALUE_INT
+      || (callee.get_kind() == VALUE_FUNCTION && callee.get_function()->get_num_params() != unsigned(num_args)))
+  {
+    exit(int(pc));
+    return;
+  }
+
+  uint64_t contents;
+  memcpy(&contents, reinterpret_cast<const char *>(&callee) + Value::DATA_OFFSET, sizeof(contents));
+  m_asm.mov64(A::RAX, uint64_t(&callee));
+  m_asm.cmp(A::RAX, int32_t(Value::KIND_OFFSET), callee.get_kind());
+  exit(A::CC_NE, int(pc));
+  m_asm.mov64(A::RCX, contents);
+  m_asm.cmp64(A::RAX, int32_t(Value::DATA_OFFSET), A::RCX);
+  exit(A::CC_NE, int(pc));
+  m_asm.store(A::RBX, kind(reg), callee.get_kind());
+  m_asm.store64(A::RBX, data(reg), A::RCX);
+}
+
+// The callee's window is after the caller's registers, so only the
+// caller-saved machine registers need to be stored
+void JitCompiler::compile_call(unsigned pc, int reg, int num_args, Node *site)
+{
+  spill(true);
+  m_asm.mov64(A::RDI, A::RBP);
+  m_asm.mov64(A::RSI, A::RBX);
+  m_asm.mov(A::RDX, reg);
+  m_asm.mov(A::RCX, num_args);
+  m_asm.mov64(A::R8, uint64_t(site));
+  m_asm.mov64(A::RAX, uint64_t(m_call_helper));
+  m_asm.call(A::RAX);
+  m_asm.alu64(A::ALU_TEST, A::RAX, A::RAX);
+  exit(A::CC_E, NativeCode::FAILED);
+  m_asm.mov64(A::RBX, A::RAX);
+  reload(true);
+
+  // A result other than an integer is left to the interpreter
+  m_asm.cmp(A::RBX, kind(reg), VALUE_INT);
+  exit(A::CC_NE, int(pc + 4));
+}
+
+// Each exit stores the locals and returns where to continue
+void JitCompiler::compile_exits()
+{
+  for (auto i = m_exits.begin(); i != m_exits.end(); ++i)
+  {
+    for (auto j = i->second.begin(); j != i->second.end(); ++j)
+    {
+      m_asm.patch(*j, m_asm.get_offset());
+    }
+    if (i->first != NativeCode::FAILED)
+    {
+      spill(false);
+    }
+    m_asm.mov(A::RAX, i->first);
+    m_returns.push_back(m_asm.jmp());
+  }
+
+  for (auto i = m_returns.begin(); i != m_returns.end(); ++i)
+  {
+    m_asm.patch(*i, m_asm.get_offset());
+  }
+  m_asm.add64(A::RSP, 8);
+  for (int i = int(sizeof(SAVED_REGS) / sizeof(SAVED_REGS[0])) - 1; i >= 0; i--)
+  {
+    m_asm.pop(SAVED_REGS[i]);
+  }
+  m_asm.ret();
+}
+
+void JitCompiler::load(Reg dst, int reg)
+{
+  if (mapped(reg))
+  {
+    m_asm.mov(dst, LOCAL_REGS[reg]);
+  }
+  else
+  {
+    m_asm.load(dst, A::RBX, data(reg));
+  }
+}
+
+void JitCompiler::store(int reg, Reg src)
+{
+  if (mapped(reg))
+  {
+    m_asm.mov(LOCAL_REGS[reg], src);
+  }
+  else
+  {
+    m_asm.store(A::RBX, data(reg), src);
+    m_asm.store(A::RBX, kind(reg), VALUE_INT);
+  }
+}
+
+void JitCompiler::store(int reg, int32_t imm)
+{
+  if (mapped(reg))
+  {
+    m_asm.mov(LOCAL_REGS[reg], imm);
+  }
+  else
+  {
+    m_asm.store(A::RBX, data(reg), imm);
+    m_asm.store(A::RBX, kind(reg), VALUE_INT);
+  }
+}
+
+int32_t JitCompiler::kind(int reg)
+{
+  return reg * int32_t(sizeof(Value)) + int32_t(Value::KIND_OFFSET);
+}
+
+int32_t JitCompiler::data(int reg)
+{
+  return reg * int32_t(sizeof(Value)) + int32_t(Value::DATA_OFFSET);
+}
+
+// Kinds in the window are already integers
+void JitCompiler::spill(bool volatile_only)
+{
+  for (unsigned int i = volatile_only ? NUM_CALLEE_SAVED : 0; i < m_num_mapped; i++)
+  {
+    m_asm.store(A::RBX, data(int(i)), LOCAL_REGS[i]);
+  }
+}
+
+void JitCompiler::reload(bool volatile_only)
+{
+  for (unsigned int i = volatile_only ? NUM_CALLEE_SAVED : 0; i < m_num_mapped; i++)
+  {
+    m_asm.load(LOCAL_REGS[i], A::RBX, data(int(i)));
+  }
+}
+
+void JitCompiler::exit(int pc)
+{
+  m_exits[pc].push_back(m_asm.jmp());
+}
+
+void JitCompiler::exit(X86Assembler::Cond cond, int pc)
+{
+  m_exits[pc].push_back(m_asm.jcc(cond));
+}
+
+void JitCompiler::jump(X86Assembler::Cond cond, int target)
+{
+  m_jumps.push_back({m_asm.jcc(cond), target});
+}
+
+void JitCompiler::jump(int target)
+{
+  m_jumps.push_back({m_asm.jmp(), target});
+}
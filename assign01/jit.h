@@ -0,0 +1,85 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <map>
+#include <vector>
+#include "x86asm.h"
+class Value;
+class Node;
+class Environment;
+class RegisterVM;
+class NativeCode;
+struct Chunk;
+
+// Compiles the register code of a function to x86-64 machine code.
+// Integer locals are kept in machine registers (as many as there are
+// free), other registers stay in the call's window. The code only
+// handles integers: a global or call result which isn't one, a callee
+// other than the one a call site had when it was compiled, a checked
+// operation which would fail, or anything the JIT doesn't compile,
+// leaves the native code, storing the registers back in the window so
+// the register VM can carry on from that instruction.
+class JitCompiler {
+public:
+  // Makes the call whose callee is register callee of the window r,
+  // returning r (which may have moved), or null if it raised an error
+  typedef Value *(*CallHelper)(RegisterVM *vm, Value *r, int callee, int num_args, Node *site);
+
+private:
+  typedef X86Assembler::Reg Reg;
+
+  Environment *m_globals;
+  CallHelper m_call_helper;
+  X86Assembler m_asm;
+  const Chunk *m_chunk;
+
+  // Number of locals kept in machine registers
+  unsigned m_num_mapped;
+
+  // Native offset of each instruction, jumps to patch with the offset
+  // of their target instruction, and jumps to the exits which resume
+  // interpreting at an instruction, or return
+  std::vector<unsigned> m_offsets;
+  std::vector<std::pair<unsigned, int>> m_jumps;
+  std::map<int, std::vector<unsigned>> m_exits;
+  std::vector<unsigned> m_returns;
+
+  // copy constructor and assignment operator prohibited
+  JitCompiler(const JitCompiler &);
+  JitCompiler &operator=(const JitCompiler &);
+
+public:
+  JitCompiler(Environment *globals, CallHelper call_helper);
+  ~JitCompiler();
+
+  // Compile the code of a function (the compiler is used once)
+  NativeCode *compile(const Chunk *chunk);
+
+private:
+  // Compile the instruction at pc, returning the next one
+  unsigned compile_insn(unsigned pc);
+  void compile_callee(unsigned pc, int reg, int global, int num_args);
+  void compile_call(unsigned pc, int reg, int num_args, Node *site);
+  void compile_exits();
+
+  // Access a register of the window
+  void load(Reg dst, int reg);
+  void store(int reg, Reg src);
+  void store(int reg, int32_t imm);
+  int32_t kind(int reg);
+  int32_t data(int reg);
+  bool mapped(int reg) const { return unsigned(reg) < m_num_mapped; }
+
+  // Store the locals kept in machine registers (only the caller-saved
+  // ones, if volatile_only) back in the window, or load them from it
+  void spill(bool volatile_only);
+  void reload(bool volatile_only);
+
+  // Leave the native code to interpret from pc (on cond, if not jmp)
+  void exit(int pc);
+  void exit(X86Assembler::Cond cond, int pc);
+  void jump(X86Assembler::Cond cond, int target);
+  void jump(int target);
+};
+
+#endif // JIT_H
@@ -0,0 +1,325 @@
+#include <algorithm>
+#include "ast.h"
+#include "node.h"
+#include "constfold.h"
+#include "range.h"
+#include "licm.h"
+
+LoopInvariantMotion::LoopInvariantMotion(unsigned num_symbols, unsigned num_intrinsics, const RangeAnalysis &ranges)
+    : m_num_intrinsics(num_intrinsics), m_ranges(ranges), m_num_assigns(num_symbols, 0), m_exact_fn(num_symbols, nullptr),
+      m_variant(num_symbols, false), m_num_reads(num_symbols, 0), m_visited(num_symbols, false),
+      m_all_variant(false), m_loop(nullptr), m_num_temps(0), m_changed(false)
+{
+}
+
+LoopInvariantMotion::~LoopInvariantMotion()
+{
+}
+
+bool LoopInvariantMotion::run(Node *unit)
+{
+  collect(unit);
+
+  // A symbol defined only by one function definition always holds it
+  for (unsigned int i = 0; i < m_exact_fn.size(); i++)
+  {
+    if (m_exact_fn[i] != nullptr && m_num_assigns[i] != 1)
+    {
+      m_exact_fn[i] = nullptr;
+    }
+  }
+
+  hoist_list(unit);
+  return m_changed;
+}
+
+void LoopInvariantMotion::collect(Node *ast)
+{
+  switch (ast->get_tag())
+  {
+  case AST_ASSIGNMENT:
+    m_num_assigns[ast->get_kid(0)->get_symbol()]++;
+    break;
+
+  case AST_DEFINITION:
+    m_num_assigns[ast->get_kid(0)->get_symbol()]++;
+    return;
+
+  case AST_FUNCTION:
+    m_num_assigns[ast->get_symbol()]++;
+    m_exact_fn[ast->get_symbol()] = ast;
+    break;
+  }
+
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    collect(ast->get_kid(i));
+  }
+}
+
+void LoopInvariantMotion::hoist_list(Node *list)
+{
+  for (unsigned int i = 0; i < list->get_num_kids(); i++)
+  {
+    Node *stmt = list->get_kid(i);
+    if (stmt->get_tag() == AST_FUNCTION)
+    {
+      hoist_list(stmt->get_last_kid());
+      continue;
+    }
+
+    Node *ast = stmt->get_kid(0);
+    if (ast->get_tag() == AST_IF)
+    {
+      hoist_list(ast->get_kid(1));
+      if (ast->get_last_kid()->get_tag() == AST_ELSE)
+      {
+        hoist_list(ast->get_last_kid()->get_kid(0));
+      }
+    }
+    else if (ast->get_tag() == AST_WHILE)
+    {
+      // Inner loops first, so their preheaders can be hoisted further
+      hoist_list(ast->get_kid(1));
+      i += hoist_loop(list, i);
+    }
+  }
+}
+
+unsigned LoopInvariantMotion::hoist_loop(Node *list, unsigned i)
+{
+  Node *stmt = list->get_kid(i);
+  Node *loop = stmt->get_kid(0);
+  m_loop = loop;
+
+  std::fill(m_variant.begin(), m_variant.end(), false);
+  std::fill(m_num_reads.begin(), m_num_reads.end(), 0);
+  std::fill(m_visited.begin(), m_visited.end(), false);
+  m_all_variant = false;
+  find_variant(loop);
+  if (m_all_variant)
+  {
+    return 0;
+  }
+
+  // The condition is in the enclosing block, the body is nested in it
+  m_hoisted.clear();
+  m_temps.clear();
+  loop->set_kid(0, hoist(loop->get_kid(0), 0));
+  Node *body = loop->get_kid(1);
+  for (unsigned int j = 0; j < body->get_num_kids(); j++)
+  {
+    body->set_kid(j, hoist(body->get_kid(j), 1));
+  }
+
+  // Preheader: "var t; t = expr;" for each invariant
+  for (unsigned int j = 0; j < m_hoisted.size(); j++)
+  {
+    Node *def_ref = new Node(AST_VARREF, m_temps[j]);
+    Node *assign_ref = new Node(AST_VARREF, m_temps[j]);
+    def_ref->set_loc(stmt->get_loc());
+    assign_ref->set_loc(stmt->get_loc());
+
+    Node *def = new Node(AST_DEFINITION, {def_ref});
+    Node *assign = new Node(AST_ASSIGNMENT, {assign_ref, m_hoisted[j]});
+    list->insert_kid(i++, new Node(AST_STATEMENT, {def}));
+    list->insert_kid(i++, new Node(AST_STATEMENT, {assign}));
+  }
+
+  if (!m_hoisted.empty())
+  {
+    m_changed = true;
+  }
+  return unsigned(2 * m_hoisted.size());
+}
+
+// Temporaries added for inner loops have no address yet, and are
+// never invariant
+void LoopInvariantMotion::find_variant(Node *ast)
+{
+  switch (ast->get_tag())
+  {
+  case AST_VARREF:
+    if (ast->has_address())
+    {
+      m_num_reads[ast->get_symbol()]++;
+    }
+    return;
+
+  case AST_ASSIGNMENT:
+    if (ast->get_kid(0)->has_address())
+    {
+      m_variant[ast->get_kid(0)->get_symbol()] = true;
+    }
+    find_variant(ast->get_kid(1));
+    return;
+
+  case AST_DEFINITION:
+    if (ast->get_kid(0)->has_address())
+    {
+      m_variant[ast->get_kid(0)->get_symbol()] = true;
+    }
+    return;
+
+  // A call can change whatever the function's body (and the
+  // functions it calls) can; calling an undefined name fails
+  case AST_FNCALL:
+    if (ast->has_address())
+    {
+      int symbol = ast->get_symbol();
+      Node *fn = m_exact_fn[symbol];
+      if (fn != nullptr && !m_visited[symbol])
+      {
+        m_visited[symbol] = true;
+        find_variant(fn->get_last_kid());
+      }
+      else if (fn == nullptr && !(unsigned(symbol) < m_num_intrinsics && m_num_assigns[symbol] == 0))
+      {
+        m_all_variant = true;
+      }
+    }
+    break;
+  }
+
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    find_variant(ast->get_kid(i));
+  }
+}
+
+bool LoopInvariantMotion::is_invariant(Node *ast)
+{
+  int val;
+
+  switch (ast->get_tag())
+  {
+  case AST_INT_LITERAL:
+    return true;
+  case AST_VARREF:
+    return ast->has_address() && !m_variant[ast->get_symbol()];
+  case AST_ADD:
+  case AST_SUB:
+  case AST_MULTIPLY:
+  case AST_DIVIDE:
+  case AST_GREATER:
+  case AST_LESS:
+  case AST_GREATER_EQUAL:
+  case AST_LESS_EQUAL:
+  case AST_EQUAL:
+  case AST_NOT_EQUAL:
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+    if (ast->get_tag() == AST_DIVIDE && (!ConstantFolder::is_constant(ast->get_kid(1), val) || val == 0 || val == -1))
+    {
+      return false;
+    }
+    if ((ast->get_tag() == AST_ADD || ast->get_tag() == AST_SUB || ast->get_tag() == AST_MULTIPLY) &&
+        !m_ranges.is_safe_before(m_loop, ast))
+    {
+      return false;
+    }
+    for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+    {
+      Node *kid = ast->get_kid(i);
+      if (!is_invariant(kid) || !(kid->get_tag() == AST_INT_LITERAL || kid->is_numeric()))
+      {
+        return false;
+      }
+    }
+    return true;
+  default:
+    return false;
+  }
+}
+
+Node *LoopInvariantMotion::hoist(Node *ast, int nesting)
+{
+  switch (ast->get_tag())
+  {
+  case AST_INT_LITERAL:
+    return ast;
+
+  // Only worth a temporary if it saves walking up environments
+  case AST_VARREF:
+    if (is_invariant(ast) && ast->get_depth() > nesting && m_num_reads[ast->get_symbol()] > 1)
+    {
+      return temp_for(ast);
+    }
+    return ast;
+
+  case AST_ASSIGNMENT:
+    ast->set_kid(1, hoist(ast->get_kid(1), nesting));
+    return ast;
+
+  case AST_DEFINITION:
+    return ast;
+
+  case AST_STATEMENT_LIST:
+    for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+    {
+      ast->set_kid(i, hoist(ast->get_kid(i), nesting + 1));
+    }
+    return ast;
+  }
+
+  if (is_invariant(ast))
+  {
+    return temp_for(ast);
+  }
+
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    ast->set_kid(i, hoist(ast->get_kid(i), nesting));
+  }
+  return ast;
+}
+
+Node *LoopInvariantMotion::temp_for(Node *ast)
+{
+  // The same expression shares one temporary
+  unsigned index = 0;
+  while (index < m_hoisted.size() && !same(m_hoisted[index], ast))
+  {
+    index++;
+  }
+
+  Node *ref = new Node(AST_VARREF, index < m_hoisted.size() ? m_temps[index] : "$licm" + std::to_string(m_num_temps));
+  ref->set_loc(ast->get_loc());
+  ref->set_numeric(ast->is_numeric());
+
+  if (index < m_hoisted.size())
+  {
+    delete ast;
+  }
+  else
+  {
+    m_hoisted.push_back(ast);
+    m_temps.push_back(ref->get_str());
+    m_num_temps++;
+  }
+  return ref;
+}
+
+bool LoopInvariantMotion::same(Node *a, Node *b)
+{
+  if (a->get_tag() != b->get_tag() || a->get_num_kids() != b->get_num_kids())
+  {
+    return false;
+  }
+  if (a->get_tag() == AST_VARREF)
+  {
+    return a->get_symbol() == b->get_symbol();
+  }
+  if (a->get_tag() == AST_INT_LITERAL)
+  {
+    return a->get_str() == b->get_str();
+  }
+  for (unsigned int i = 0; i < a->get_num_kids(); i++)
+  {
+    if (!same(a->get_kid(i), b->get_kid(i)))
+    {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,93 @@
+#ifndef LICM_H
+#define LICM_H
+
+#include <string>
+#include <vector>
+class Node;
+class RangeAnalysis;
+
+// Optimization pass run after type inference. Moves expressions in a
+// while loop which always evaluate to the same value into temporary
+// variables assigned just before the loop (the preheader), along with
+// variables of enclosing blocks which the loop reads more than once.
+//
+// An expression is invariant if no variable it reads is defined or
+// assigned in the loop, either directly or by a function the loop
+// calls. The preheader runs even if the loop doesn't, so only
+// operators which can't fail (their operands are known to be numeric,
+// divisors are non-zero constants, and arithmetic can't overflow with
+// the values variables have before the loop) are moved; calls never are.
+// A call to anything other than a known function or an intrinsic
+// could change any variable, so loops containing one are left alone.
+//
+// New variables are added, so the unit must be analyzed again before
+// it is executed.
+class LoopInvariantMotion {
+private:
+  unsigned m_num_intrinsics;
+
+  // Intervals of the variables before each loop
+  const RangeAnalysis &m_ranges;
+
+  // Number of definitions and assignments of each symbol
+  std::vector<unsigned> m_num_assigns;
+
+  // Function each symbol always holds (if any)
+  std::vector<Node *> m_exact_fn;
+
+  // Symbols the current loop can change, and how often it reads each
+  std::vector<bool> m_variant;
+  std::vector<unsigned> m_num_reads;
+  std::vector<bool> m_visited;
+  bool m_all_variant;
+  Node *m_loop;
+
+  // Expressions moved into the preheader of the current loop,
+  // and the variables holding them
+  std::vector<Node *> m_hoisted;
+  std::vector<std::string> m_temps;
+  unsigned m_num_temps;
+
+  bool m_changed;
+
+  // copy constructor and assignment operator prohibited
+  LoopInvariantMotion(const LoopInvariantMotion &);
+  LoopInvariantMotion &operator=(const LoopInvariantMotion &);
+
+public:
+  LoopInvariantMotion(unsigned num_symbols, unsigned num_intrinsics, const RangeAnalysis &ranges);
+  ~LoopInvariantMotion();
+
+  // Hoist invariants out of the loops of the (analyzed, typed and
+  // range analyzed) unit, returning true if anything was moved
+  bool run(Node *unit);
+
+private:
+  void collect(Node *ast);
+
+  // Hoist loops in a list and the blocks nested in it
+  void hoist_list(Node *list);
+
+  // Hoist invariants out of the while statement at index i of a list,
+  // returning the number of statements inserted before it
+  unsigned hoist_loop(Node *list, unsigned i);
+
+  // Find the symbols code in a loop (or a function it calls) can change
+  void find_variant(Node *ast);
+
+  // Check if an expression always has the same value in the loop,
+  // and can be evaluated without failing
+  bool is_invariant(Node *ast);
+
+  // Replace invariants in an expression nested in the given number
+  // of blocks of the loop, returning the node which should replace it
+  Node *hoist(Node *ast, int nesting);
+
+  // Reference to the temporary holding an invariant expression
+  Node *temp_for(Node *ast);
+
+  // Check if two expressions are the same
+  static bool same(Node *a, Node *b);
+};
+
+#endif // LICM_H
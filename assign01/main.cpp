@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h> // for getopt
 #include <memory>
 #include "lexer.h"
@@ -11,6 +13,9 @@
 enum {
   PRINT_TOKENS,
   PRINT_AST,
+  PRINT_IR,
+  PRINT_CODE,
+  PRINT_C,
   EXECUTE,
 };
 
@@ -19,7 +24,17 @@ enum {
 int execute(int argc, char **argv) {
   // handle command line options
   int mode = EXECUTE, opt;
-  while ((opt = getopt(argc, argv, "lp")) != -1) {
+  int inline_limit = Interpreter::DEFAULT_INLINE_LIMIT;
+  int clone_limit = Interpreter::DEFAULT_CLONE_LIMIT;
+  bool partial = false;
+  int memo_size = 0;
+  bool fusion_stats = false;
+  int call_threshold = Interpreter::DEFAULT_CALL_THRESHOLD;
+  int loop_threshold = Interpreter::DEFAULT_LOOP_THRESHOLD;
+  bool log_tiers = false;
+  long stack_limit = 0;
+  int engine = Interpreter::ENGINE_TREE;
+  while ((opt = getopt(argc, argv, "lpsdtefvi:c:m:u:w:x:S:")) != -1) {
     switch (opt) {
     case 'l':
       mode = PRINT_TOKENS;
@@ -27,6 +42,84 @@ int execute(int argc, char **argv) {
     case 'p':
       mode = PRINT_AST;
       break;
+    case 's':
+      // print the optimized program in SSA form
+      mode = PRINT_IR;
+      break;
+    case 'd':
+      // disassemble the code the engine runs (the register VM's for tree
+      // and closure)
+      mode = PRINT_CODE;
+      break;
+    case 't':
+      // translate the program to C, to compile to a native executable
+      mode = PRINT_C;
+      break;
+    case 'e':
+      // partially evaluate the program first (with -p, print what's left)
+      partial = true;
+      break;
+    case 'f':
+      // report how often the stack VM's superinstructions ran
+      fusion_stats = true;
+      break;
+    case 'v':
+      // log functions and loops compiled by the tiered engine
+      log_tiers = true;
+      break;
+    case 'i':
+      // maximum size of function bodies to inline (0 disables inlining)
+      inline_limit = atoi(optarg);
+      break;
+    case 'c':
+      // maximum number of specialized clones per function (0 disables)
+      clone_limit = atoi(optarg);
+      break;
+    case 'm':
+      // memoize pure functions, caching this many results for each
+      memo_size = atoi(optarg);
+      break;
+    case 'u':
+      // calls of a function before the tiered engine compiles it (0
+      // never compiles functions)
+      call_threshold = atoi(optarg);
+      break;
+    case 'w':
+      // iterations of a while loop before the tiered engine compiles it
+      // (0 never compiles loops)
+      loop_threshold = atoi(optarg);
+      break;
+    case 'x':
+      // execution engine: tree (walk the ast), stack (bytecode VM), reg
+      // (register VM), closure (tree of C++ closures), jit (register
+      // VM compiling hot functions to x86-64 code), tiered (tree
+      // walker compiling hot functions and loops to closures) or iter
+      // (tree walker keeping its own stacks instead of recursing)
+      if (strcmp(optarg, "tree") == 0) {
+        engine = Interpreter::ENGINE_TREE;
+      } else if (strcmp(optarg, "stack") == 0) {
+        engine = Interpreter::ENGINE_STACK;
+      } else if (strcmp(optarg, "reg") == 0) {
+        engine = Interpreter::ENGINE_REGISTER;
+      } else if (strcmp(optarg, "closure") == 0) {
+        engine = Interpreter::ENGINE_CLOSURE;
+      } else if (strcmp(optarg, "jit") == 0) {
+        engine = Interpreter::ENGINE_JIT;
+      } else if (strcmp(optarg, "tiered") == 0) {
+        engine = Interpreter::ENGINE_TIERED;
+      } else if (strcmp(optarg, "iter") == 0) {
+        engine = Interpreter::ENGINE_ITERATIVE;
+      } else {
+        RuntimeError::raise("Unknown engine: %s", optarg);
+      }
+      break;
+    case 'S':
+      // memory (in KiB) the iter engine may use for unfinished calls
+      stack_limit = atol(optarg);
+      if (stack_limit <= 0) {
+        RuntimeError::raise("Invalid stack limit: %s", optarg);
+      }
+      break;
     default:
       RuntimeError::raise("Unknown option: %c", opt);
     }
@@ -67,12 +160,12 @@ int execute(int argc, char **argv) {
         delete tok;
       }
     }
-  } else if (mode == PRINT_AST || mode == EXECUTE) {
+  } else if (mode == PRINT_AST || mode == PRINT_IR || mode == PRINT_CODE || mode == PRINT_C || mode == EXECUTE) {
     // Create parser and parse the input
     std::unique_ptr<Parser2> parser2(new Parser2(lexer.release()));
     std::unique_ptr<Node> ast(parser2->parse());
 
-    if (mode == PRINT_AST) {
+    if (mode == PRINT_AST && !partial) {
       // Print a text representation of the AST
       ASTTreePrint tp;
       tp.print(ast.get());
@@ -80,9 +173,40 @@ int execute(int argc, char **argv) {
       // Execute the program: note that the Interpreter assumes responsibility
       // for deleting the AST
       Interpreter interp(ast.release());
+      interp.set_inline_limit(inline_limit);
+      interp.set_clone_limit(clone_limit);
+      interp.set_memo_size(memo_size);
+      interp.set_engine(engine);
+      interp.set_fusion_stats(fusion_stats);
+      interp.set_call_threshold(call_threshold);
+      interp.set_loop_threshold(loop_threshold);
+      interp.set_log_tiers(log_tiers);
+      if (stack_limit > 0) {
+        interp.set_stack_limit(size_t(stack_limit) << 10);
+      }
       interp.analyze();
-      Value result = interp.execute();
-      printf("Result: %s\n", result.as_str().c_str());
+      if (partial) {
+        interp.partial_evaluate();
+      }
+      if (mode == PRINT_AST) {
+        interp.print_program();
+      } else if (mode == PRINT_IR) {
+        interp.optimize();
+        interp.print_ir();
+      } else if (mode == PRINT_CODE) {
+        interp.optimize();
+        interp.print_code();
+      } else if (mode == PRINT_C) {
+        interp.optimize();
+        interp.print_c();
+      } else {
+        interp.optimize();
+        Value result = interp.execute();
+        printf("Result: %s\n", result.as_str().c_str());
+        if (memo_size > 0) {
+          interp.print_memo_stats();
+        }
+      }
     }
   }
 
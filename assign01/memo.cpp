@@ -0,0 +1,63 @@
+#include <cstdio>
+#include "memo.h"
+
+size_t MemoCache::KeyHash::operator()(const Key &key) const
+{
+  size_t hash = key.size();
+  for (auto i = key.begin(); i != key.end(); ++i)
+  {
+    hash = hash * 31 + size_t(unsigned(*i));
+  }
+  return hash;
+}
+
+MemoCache::MemoCache(const std::string &name, unsigned capacity)
+    : m_name(name), m_capacity(capacity), m_hits(0), m_misses(0), m_evictions(0)
+{
+}
+
+MemoCache::~MemoCache()
+{
+}
+
+bool MemoCache::lookup(const Key &args, int &result)
+{
+  auto entry = m_index.find(args);
+  if (entry == m_index.end())
+  {
+    m_misses++;
+    return false;
+  }
+
+  // Move to the front, as the most recently used
+  m_entries.splice(m_entries.begin(), m_entries, entry->second);
+  m_hits++;
+  result = entry->second->second;
+  return true;
+}
+
+void MemoCache::insert(const Key &args, int result)
+{
+  // A recursive call may have added it already
+  auto entry = m_index.find(args);
+  if (entry != m_index.end())
+  {
+    entry->second->second = result;
+    return;
+  }
+
+  if (m_entries.size() >= m_capacity)
+  {
+    m_index.erase(m_entries.back().first);
+    m_entries.pop_back();
+    m_evictions++;
+  }
+  m_entries.emplace_front(args, result);
+  m_index[args] = m_entries.begin();
+}
+
+void MemoCache::print_stats() const
+{
+  fprintf(stderr, "memo %s: %lu hits, %lu misses, %lu evictions, %u entries\n", m_name.c_str(), m_hits, m_misses,
+          m_evictions, unsigned(m_entries.size()));
+}
@@ -0,0 +1,47 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unordered_map>
+
+// Cache of the results of a pure function for integer arguments,
+// holding at most a given number of entries. When it is full, the
+// least recently used entry is evicted.
+class MemoCache {
+private:
+  typedef std::vector<int> Key;
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const;
+  };
+
+  std::string m_name;
+  unsigned m_capacity;
+
+  // Entries, most recently used first, and their positions by key
+  std::list<std::pair<Key, int>> m_entries;
+  std::unordered_map<Key, std::list<std::pair<Key, int>>::iterator, KeyHash> m_index;
+
+  unsigned long m_hits, m_misses, m_evictions;
+
+  // copy constructor and assignment operator prohibited
+  MemoCache(const MemoCache &);
+  MemoCache &operator=(const MemoCache &);
+
+public:
+  MemoCache(const std::string &name, unsigned capacity);
+  ~MemoCache();
+
+  // Find the result for the arguments, counting a hit or miss
+  bool lookup(const Key &args, int &result);
+
+  void insert(const Key &args, int result);
+
+  // Print the hit, miss and eviction counts to stderr
+  void print_stats() const;
+};
+
+#endif // MEMO_H
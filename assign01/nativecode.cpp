@@ -0,0 +1,25 @@
+#include <cstring>
+#include <sys/mman.h>
+#include "exceptions.h"
+#include "nativecode.h"
+
+NativeCode::NativeCode(const std::vector<unsigned char> &code)
+    : m_mem(nullptr), m_size(code.size())
+{
+  m_mem = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (m_mem == MAP_FAILED)
+  {
+    RuntimeError::raise("Could not allocate memory for native code");
+  }
+  memcpy(m_mem, code.data(), m_size);
+  if (mprotect(m_mem, m_size, PROT_READ | PROT_EXEC) != 0)
+  {
+    munmap(m_mem, m_size);
+    RuntimeError::raise("Could not make native code executable");
+  }
+}
+
+NativeCode::~NativeCode()
+{
+  munmap(m_mem, m_size);
+}
@@ -0,0 +1,39 @@
+#ifndef NATIVECODE_H
+#define NATIVECODE_H
+
+#include <vector>
+class Value;
+class RegisterVM;
+
+// Machine code generated by the JIT for one function. The code is
+// copied into its own mapping, which is writable while it is filled in
+// and then only executable (never both).
+class NativeCode {
+public:
+  // The code runs a call of the function in the register window r
+  // (arguments first), and returns COMPLETED with the result stored
+  // before the window, FAILED if an error was raised, or the offset
+  // in the function's register code to continue interpreting at
+  typedef int (*Entry)(Value *r, RegisterVM *vm);
+
+  enum {
+    COMPLETED = -1,
+    FAILED = -2,
+  };
+
+private:
+  void *m_mem;
+  unsigned long m_size;
+
+  // copy constructor and assignment operator prohibited
+  NativeCode(const NativeCode &);
+  NativeCode &operator=(const NativeCode &);
+
+public:
+  NativeCode(const std::vector<unsigned char> &code);
+  ~NativeCode();
+
+  int run(Value *r, RegisterVM *vm) const { return reinterpret_cast<Entry>(m_mem)(r, vm); }
+};
+
+#endif // NATIVECODE_H
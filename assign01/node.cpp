@@ -18,6 +18,7 @@
 // ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include <cassert>
 #include "node.h"
 
 // Private constructor, used only by other constructors
@@ -86,3 +87,14 @@ void Node::prepend_kid(Node *kid) {
     m_loc = kid->get_loc();
   }
 }
+
+Node *Node::remove_kid(unsigned index) {
+  Node *kid = m_kids.at(index);
+  m_kids.erase(m_kids.begin() + index);
+  return kid;
+}
+
+void Node::insert_kid(unsigned index, Node *kid) {
+  assert(index <= m_kids.size());
+  m_kids.insert(m_kids.begin() + index, kid);
+}
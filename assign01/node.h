@@ -69,6 +69,15 @@ public:
   Node *get_kid(unsigned index) const { return m_kids.at(index); }
   Node *get_last_kid() const { return m_kids.back(); }
 
+  // replace a child (the caller takes responsibility for the old one)
+  void set_kid(unsigned index, Node *kid) { m_kids.at(index) = kid; }
+
+  // remove a child, returning it (the caller takes responsibility for it)
+  Node *remove_kid(unsigned index);
+
+  // insert a child before the given index
+  void insert_kid(unsigned index, Node *kid);
+
   const_iterator cbegin() const { return m_kids.cbegin(); }
   const_iterator cend() const { return m_kids.cend(); }
 
@@ -20,7 +20,20 @@
 
 #include "node_base.h"
 
-NodeBase::NodeBase() {
+NodeBase::NodeBase()
+  : m_depth(-1)
+  , m_slot(-1)
+  , m_env_depth(-1)
+  , m_global(false)
+  , m_symbol(-1)
+  , m_num_slots(0)
+  , m_captured(false)
+  , m_numeric(false)
+  , m_pure(false)
+  , m_safe(false)
+  , m_cached_fn(nullptr)
+  , m_runs(0)
+  , m_quick(0) {
 }
 
 NodeBase::~NodeBase() {
@@ -21,13 +21,64 @@
 #ifndef NODE_BASE_H
 #define NODE_BASE_H
 
+#include "value.h"
+
 // The Node class will inherit from this type, so you can use it
 // to define any attributes and methods that Node objects should have
 // (constant value, results of semantic analysis, code generation info,
 // etc.)
 class NodeBase {
 private:
-  // fields could go here
+  // Lexical address of a variable reference, assignment target,
+  // definition or function call: number of environments to walk
+  // up from the current one, and slot index within that environment.
+  // A negative slot means the node has no address.
+  int m_depth, m_slot;
+
+  // Number of environments to walk up at runtime, which is less than
+  // m_depth when blocks without definitions have no environment
+  int m_env_depth;
+
+  // True if the address refers to a slot of the unit's environment,
+  // which can be found without walking up the environments
+  bool m_global;
+
+  // Program-wide number of the variable the address refers to
+  // (distinguishes variables with the same name in different blocks)
+  int m_symbol;
+
+  // Number of slots needed by the environment of a block
+  // (statement list or unit)
+  unsigned m_num_slots;
+
+  // True if a block's environment can be captured by a function
+  // defined inside it (so it must outlive the block)
+  bool m_captured;
+
+  // True if the value of an expression is known to always be an integer
+  bool m_numeric;
+
+  // True if a function's result depends only on its arguments, and
+  // calling it has no effects
+  bool m_pure;
+
+  // True if an arithmetic operator can't overflow (or divide by 0),
+  // so its result needs no check
+  bool m_safe;
+
+  // Inline cache of a function call: the function last called by the
+  // node, which is known to take as many params as there are args
+  Function *m_cached_fn;
+
+  // Number of times a function body or while loop has run in the tree
+  // walker, counted (for tiered execution) until it is compiled
+  unsigned m_runs;
+
+  // Specialized form the tree walker gave the node after running it
+  // (0 if none), and the value it needs: a literal's, or the intrinsic
+  // a call made
+  int m_quick;
+  Value m_quick_value;
 
   // copy ctor and assignment operator not supported
   NodeBase(const NodeBase &);
@@ -36,6 +87,42 @@ private:
 public:
   NodeBase();
   virtual ~NodeBase();
+
+  void set_address(int depth, int slot, int symbol) { m_depth = m_env_depth = depth; m_slot = slot; m_symbol = symbol; m_global = false; }
+  void clear_address() { m_depth = m_env_depth = -1; m_slot = -1; m_symbol = -1; m_global = false; }
+  bool has_address() const { return m_slot >= 0; }
+  int get_depth() const { return m_depth; }
+  void set_env_depth(int env_depth) { m_env_depth = env_depth; }
+  int get_env_depth() const { return m_env_depth; }
+  void set_global(bool global) { m_global = global; }
+  bool is_global() const { return m_global; }
+  int get_slot() const { return m_slot; }
+  int get_symbol() const { return m_symbol; }
+
+  void set_num_slots(unsigned num_slots) { m_num_slots = num_slots; }
+  unsigned get_num_slots() const { return m_num_slots; }
+
+  void set_captured(bool captured) { m_captured = captured; }
+  bool is_captured() const { return m_captured; }
+
+  void set_numeric(bool numeric) { m_numeric = numeric; }
+  bool is_numeric() const { return m_numeric; }
+
+  void set_pure(bool pure) { m_pure = pure; }
+  bool is_pure() const { return m_pure; }
+
+  void set_safe(bool safe) { m_safe = safe; }
+  bool is_safe() const { return m_safe; }
+
+  void set_cached_fn(Function *fn) { m_cached_fn = fn; }
+  Function *get_cached_fn() const { return m_cached_fn; }
+
+  unsigned count_run() { return ++m_runs; }
+  unsigned get_runs() const { return m_runs; }
+
+  void quicken(int quick, const Value &value = Value()) { m_quick = quick; m_quick_value = value; }
+  int get_quick() const { return m_quick; }
+  const Value &get_quick_value() const { return m_quick_value; }
 };
 
 #endif // NODE_BASE_H
@@ -0,0 +1,627 @@
+#include <cstdlib>
+#include <string>
+#include "ast.h"
+#include "node.h"
+#include "interp.h"
+#include "constfold.h"
+#include "inliner.h"
+#include "partial.h"
+
+namespace {
+
+// Thrown when an ast can't be evaluated at compile time
+struct NotStatic {
+};
+
+// Limits on the work done at compile time: by a top-level statement,
+// by a call in a residual statement, and on the output of a statement
+// and the depth of calls
+const unsigned MAX_STATEMENT_STEPS = 5000000;
+const unsigned MAX_CALL_STEPS = 100000;
+const unsigned MAX_RESIDUAL_PRINTS = 1000;
+const unsigned MAX_CALL_DEPTH = 1000;
+
+bool is_operator(int tag)
+{
+  switch (tag)
+  {
+  case AST_ADD:
+  case AST_SUB:
+  case AST_MULTIPLY:
+  case AST_DIVIDE:
+  case AST_GREATER:
+  case AST_LESS:
+  case AST_GREATER_EQUAL:
+  case AST_LESS_EQUAL:
+  case AST_EQUAL:
+  case AST_NOT_EQUAL:
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+    return true;
+  }
+  return false;
+}
+
+}
+
+PartialEvaluator::PartialEvaluator(unsigned num_symbols, const std::vector<std::string> &intrinsics)
+    : m_num_symbols(num_symbols), m_intrinsics(intrinsics), m_globals(num_symbols), m_frame(nullptr),
+      m_owner(num_symbols, nullptr), m_toplevel(num_symbols, nullptr), m_fn_assigned(num_symbols, false),
+      m_residual(nullptr), m_effects(true), m_steps(0), m_max_steps(0), m_num_prints(0), m_call_depth(0)
+{
+}
+
+PartialEvaluator::~PartialEvaluator()
+{
+}
+
+Node *PartialEvaluator::run(Node *unit)
+{
+  if (!collect(unit))
+  {
+    return unit;
+  }
+  for (unsigned int i = 0; i < m_intrinsics.size(); i++)
+  {
+    m_globals[i].kind = PE_INTRINSIC;
+    m_globals[i].ival = int(i);
+  }
+
+  m_residual = new Node(AST_UNIT);
+  m_residual->set_loc(unit->get_loc());
+
+  PEValue result;
+  bool known = false;
+  for (unsigned int i = 0; i < unit->get_num_kids(); i++)
+  {
+    known = execute(unit->get_kid(i), i == unit->get_num_kids() - 1, result);
+  }
+
+  // The residual program must have the same result, which printing
+  // (the usual last statement) already gives if it is 0
+  if (known)
+  {
+    int val;
+    Node *last = m_residual->get_num_kids() > 0 ? m_residual->get_last_kid()->get_kid(0) : nullptr;
+    bool printed = last != nullptr && last->get_tag() == AST_FNCALL && result.ival == 0 &&
+                   (last->get_str() == "print" || last->get_str() == "println");
+    if (!printed && !(last != nullptr && ConstantFolder::is_constant(last, val) && val == result.ival))
+    {
+      emit(new Node(AST_STATEMENT, {make_literal(unit->get_last_kid(), result.ival)}));
+    }
+  }
+  return m_residual;
+}
+
+bool PartialEvaluator::collect(Node *unit)
+{
+  bool ok = true;
+  int num_intrinsics = int(m_intrinsics.size());
+  unit->each_child([&](Node *stmt) {
+    if (stmt->get_tag() == AST_FUNCTION)
+    {
+      Node *fn = stmt;
+      ok = ok && fn->get_symbol() >= num_intrinsics;
+      m_toplevel[fn->get_symbol()] = fn->get_kid(0);
+
+      // Parameters and variables defined in the body belong to the function
+      if (fn->get_num_kids() == 3)
+      {
+        fn->get_kid(1)->each_child([this, fn](Node *param) { m_owner[param->get_symbol()] = fn; });
+      }
+      fn->get_last_kid()->preorder([this, fn](Node *n) {
+        if (n->get_tag() == AST_DEFINITION && n->has_address())
+        {
+          m_owner[n->get_symbol()] = fn;
+        }
+      });
+      fn->get_last_kid()->preorder([&](Node *n) {
+        if (n->get_tag() == AST_ASSIGNMENT && m_owner[n->get_kid(0)->get_symbol()] != fn)
+        {
+          m_fn_assigned[n->get_kid(0)->get_symbol()] = true;
+        }
+      });
+    }
+    else if (stmt->get_kid(0)->get_tag() == AST_DEFINITION && stmt->get_kid(0)->has_address())
+    {
+      m_toplevel[stmt->get_kid(0)->get_symbol()] = stmt->get_kid(0)->get_kid(0);
+    }
+  });
+
+  unit->preorder([&](Node *n) {
+    if (n->get_tag() == AST_ASSIGNMENT && n->get_kid(0)->get_symbol() < num_intrinsics)
+    {
+      ok = false;
+    }
+  });
+  return ok;
+}
+
+bool PartialEvaluator::execute(Node *stmt, bool last, PEValue &result)
+{
+  result = PEValue();
+  result.kind = PE_INT;
+
+  // Definitions are kept, and the residual program stores the
+  // initial value
+  if (stmt->get_tag() == AST_FUNCTION)
+  {
+    emit(Inliner::copy(stmt));
+    PEValue &fn = m_globals[stmt->get_symbol()];
+    fn.kind = PE_FUNCTION;
+    fn.fn = stmt;
+    fn.stored = true;
+    return false;
+  }
+  if (stmt->get_kid(0)->get_tag() == AST_DEFINITION)
+  {
+    emit(Inliner::copy(stmt));
+    if (stmt->get_kid(0)->has_address())
+    {
+      PEValue &var = m_globals[stmt->get_kid(0)->get_symbol()];
+      var = PEValue();
+      var.kind = PE_INT;
+      var.ival = -1;
+    }
+    return false;
+  }
+
+  std::vector<PEValue> saved = m_globals;
+  unsigned mark = m_residual->get_num_kids();
+  m_effects = true;
+  m_frame = nullptr;
+  m_steps = m_num_prints = m_call_depth = 0;
+  m_max_steps = MAX_STATEMENT_STEPS;
+  try
+  {
+    result = eval(stmt);
+    if (!last || result.kind == PE_INT)
+    {
+      return true;
+    }
+  }
+  catch (NotStatic &)
+  {
+  }
+
+  // Undo the statement's effects and keep it instead
+  m_globals = saved;
+  while (m_residual->get_num_kids() > mark)
+  {
+    delete m_residual->remove_kid(m_residual->get_num_kids() - 1);
+  }
+  residualize(stmt);
+  return false;
+}
+
+void PartialEvaluator::residualize(Node *stmt)
+{
+  // Find the variables the statement can change: those it assigns,
+  // and if it calls a user function, those functions assign
+  std::vector<bool> written(m_num_symbols, false);
+  bool calls = false;
+  int num_intrinsics = int(m_intrinsics.size());
+  stmt->preorder([&](Node *n) {
+    if (n->get_tag() == AST_ASSIGNMENT)
+    {
+      written[n->get_kid(0)->get_symbol()] = true;
+    }
+    else if (n->get_tag() == AST_FNCALL && (!n->has_address() || n->get_symbol() >= num_intrinsics))
+    {
+      calls = true;
+    }
+  });
+  if (calls)
+  {
+    for (unsigned int i = 0; i < m_num_symbols; i++)
+    {
+      written[i] = written[i] || m_fn_assigned[i];
+    }
+  }
+
+  // A called function can read any variable of the unit
+  store(written, calls);
+  for (unsigned int i = 0; i < m_num_symbols; i++)
+  {
+    if (written[i] && m_toplevel[i] != nullptr)
+    {
+      m_globals[i] = PEValue();
+    }
+  }
+  emit(residual_expr(stmt));
+}
+
+PartialEvaluator::PEValue PartialEvaluator::eval(Node *ast)
+{
+  step(1);
+
+  PEValue val;
+  val.kind = PE_INT;
+  switch (ast->get_tag())
+  {
+  case AST_STATEMENT_LIST:
+    for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+    {
+      val = eval(ast->get_kid(i));
+    }
+    return val;
+
+  case AST_STATEMENT:
+    return eval(ast->get_kid(0));
+
+  case AST_INT_LITERAL:
+    val.ival = atoi(ast->get_str().c_str());
+    return val;
+
+  case AST_DEFINITION:
+    if (ast->has_address())
+    {
+      PEValue init;
+      init.kind = PE_INT;
+      init.ival = -1;
+      assign(ast->get_symbol(), init);
+    }
+    return val;
+
+  case AST_ASSIGNMENT:
+    val = eval(ast->get_kid(1));
+    assign(ast->get_kid(0)->get_symbol(), val);
+    return val;
+
+  case AST_VARREF:
+    if (!ast->has_address() || lookup(ast->get_symbol()).kind == PE_UNKNOWN)
+    {
+      throw NotStatic();
+    }
+    return lookup(ast->get_symbol());
+
+  case AST_FNCALL:
+    return eval_call(ast);
+
+  case AST_IF:
+    if (eval_int(ast->get_kid(0)) != 0)
+    {
+      eval(ast->get_kid(1));
+    }
+    else if (ast->get_last_kid()->get_tag() == AST_ELSE)
+    {
+      eval(ast->get_last_kid()->get_kid(0));
+    }
+    return val;
+
+  case AST_WHILE:
+    while (eval_int(ast->get_kid(0)) != 0)
+    {
+      eval(ast->get_kid(1));
+    }
+    return val;
+  }
+
+  if (!is_operator(ast->get_tag()))
+  {
+    throw NotStatic();
+  }
+
+  int val1 = eval_int(ast->get_kid(0));
+  if (ast->get_tag() == AST_LOGICAL_AND && val1 == 0)
+  {
+    val.ival = 0;
+    return val;
+  }
+  if (ast->get_tag() == AST_LOGICAL_OR && val1 != 0)
+  {
+    val.ival = 1;
+    return val;
+  }
+  int val2 = eval_int(ast->get_kid(1));
+
+  // Errors are left to happen at runtime
+  if (Interpreter::fails(ast->get_tag(), val1, val2))
+  {
+    throw NotStatic();
+  }
+  val.ival = Interpreter::doOp(ast->get_tag(), val1, val2, ast).get_ival();
+  return val;
+}
+
+// An assignment operand or condition is an error, which is left to
+// happen at runtime
+int PartialEvaluator::eval_int(Node *ast)
+{
+  if (ast->get_tag() == AST_ASSIGNMENT)
+  {
+    throw NotStatic();
+  }
+  PEValue val = eval(ast);
+  if (val.kind != PE_INT)
+  {
+    throw NotStatic();
+  }
+  return val.ival;
+}
+
+PartialEvaluator::PEValue PartialEvaluator::eval_call(Node *ast)
+{
+  if (!ast->has_address())
+  {
+    throw NotStatic();
+  }
+  PEValue callee = lookup(ast->get_symbol());
+  unsigned num_args = ast->get_num_kids() > 0 ? ast->get_kid(0)->get_num_kids() : 0;
+
+  if (callee.kind == PE_FUNCTION)
+  {
+    Node *params = callee.fn->get_num_kids() == 3 ? callee.fn->get_kid(1) : nullptr;
+    if (num_args != (params != nullptr ? params->get_num_kids() : 0))
+    {
+      throw NotStatic();
+    }
+    std::vector<PEValue> args;
+    for (unsigned int i = 0; i < num_args; i++)
+    {
+      args.push_back(eval(ast->get_kid(0)->get_kid(i)));
+    }
+    return call(callee.fn, args);
+  }
+
+  // Printing a known value becomes a residual call printing it
+  std::string name = callee.kind == PE_INTRINSIC ? m_intrinsics[callee.ival] : "";
+  if ((name != "print" && name != "println") || !m_effects || num_args != 1)
+  {
+    throw NotStatic();
+  }
+  int val = eval_int(ast->get_kid(0)->get_kid(0));
+  if (++m_num_prints > MAX_RESIDUAL_PRINTS)
+  {
+    throw NotStatic();
+  }
+  Node *print = new Node(AST_FNCALL, name);
+  print->set_loc(ast->get_loc());
+  print->append_kid(new Node(AST_ARGUMENT_LIST, {make_literal(ast->get_kid(0)->get_kid(0), val)}));
+  emit(new Node(AST_STATEMENT, {print}));
+
+  PEValue result;
+  result.kind = PE_INT;
+  return result;
+}
+
+PartialEvaluator::PEValue PartialEvaluator::call(Node *fn, const std::vector<PEValue> &args)
+{
+  if (++m_call_depth > MAX_CALL_DEPTH)
+  {
+    throw NotStatic();
+  }
+
+  std::vector<PEValue> frame(m_num_symbols);
+  for (unsigned int i = 0; i < args.size(); i++)
+  {
+    frame[fn->get_kid(1)->get_kid(i)->get_symbol()] = args[i];
+  }
+
+  std::vector<PEValue> *caller = m_frame;
+  m_frame = &frame;
+  PEValue result = eval(fn->get_last_kid());
+  m_frame = caller;
+  m_call_depth--;
+  return result;
+}
+
+void PartialEvaluator::step(unsigned cost)
+{
+  m_steps += cost;
+  if (m_steps > m_max_steps)
+  {
+    throw NotStatic();
+  }
+}
+
+PartialEvaluator::PEValue &PartialEvaluator::lookup(int symbol)
+{
+  if (m_owner[symbol] == nullptr)
+  {
+    return m_globals[symbol];
+  }
+  if (m_frame == nullptr)
+  {
+    throw NotStatic();
+  }
+  return (*m_frame)[symbol];
+}
+
+void PartialEvaluator::assign(int symbol, const PEValue &val)
+{
+  if (m_owner[symbol] != nullptr)
+  {
+    lookup(symbol) = val;
+    return;
+  }
+
+  // The unit's variables may only hold (known) integers, since those
+  // are what the residual program can be given
+  if (!m_effects || symbol < int(m_intrinsics.size()) || (m_toplevel[symbol] != nullptr && val.kind != PE_INT))
+  {
+    throw NotStatic();
+  }
+  m_globals[symbol] = val;
+  m_globals[symbol].stored = false;
+}
+
+Node *PartialEvaluator::residual_expr(Node *ast)
+{
+  switch (ast->get_tag())
+  {
+  case AST_VARREF:
+    if (ast->has_address() && m_toplevel[ast->get_symbol()] != nullptr && m_globals[ast->get_symbol()].kind == PE_INT)
+    {
+      return make_literal(ast, m_globals[ast->get_symbol()].ival);
+    }
+    return shallow_copy(ast);
+
+  case AST_FNCALL:
+    return residual_call(ast);
+
+  case AST_DEFINITION:
+    return Inliner::copy(ast);
+
+  case AST_ASSIGNMENT:
+  {
+    Node *dup = shallow_copy(ast);
+    dup->append_kid(Inliner::copy(ast->get_kid(0)));
+    dup->append_kid(residual_expr(ast->get_kid(1)));
+    return dup;
+  }
+  }
+
+  Node *dup = shallow_copy(ast);
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    dup->append_kid(residual_expr(ast->get_kid(i)));
+  }
+  if (!is_operator(ast->get_tag()))
+  {
+    return dup;
+  }
+
+  // Fold operators on literals which can't fail
+  int val1, val2;
+  if (!ConstantFolder::is_constant(dup->get_kid(0), val1))
+  {
+    return dup;
+  }
+  Node *folded = nullptr;
+  if (ast->get_tag() == AST_LOGICAL_AND && val1 == 0)
+  {
+    folded = make_literal(ast, 0);
+  }
+  else if (ast->get_tag() == AST_LOGICAL_OR && val1 != 0)
+  {
+    folded = make_literal(ast, 1);
+  }
+  else if (ConstantFolder::is_constant(dup->get_kid(1), val2) && !Interpreter::fails(ast->get_tag(), val1, val2))
+  {
+    folded = make_literal(ast, Interpreter::doOp(ast->get_tag(), val1, val2, ast).get_ival());
+  }
+  if (folded == nullptr)
+  {
+    return dup;
+  }
+  delete dup;
+  return folded;
+}
+
+Node *PartialEvaluator::residual_call(Node *ast)
+{
+  Node *dup = shallow_copy(ast);
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    dup->append_kid(residual_expr(ast->get_kid(i)));
+  }
+
+  PEValue result;
+  if (try_call(dup, result))
+  {
+    delete dup;
+    return make_literal(ast, result.ival);
+  }
+  return dup;
+}
+
+bool PartialEvaluator::try_call(Node *site, PEValue &result)
+{
+  if (!site->has_address() || m_toplevel[site->get_symbol()] == nullptr)
+  {
+    return false;
+  }
+  PEValue callee = m_globals[site->get_symbol()];
+  if (callee.kind != PE_FUNCTION)
+  {
+    return false;
+  }
+  Node *params = callee.fn->get_num_kids() == 3 ? callee.fn->get_kid(1) : nullptr;
+  Node *args = site->get_num_kids() > 0 ? site->get_kid(0) : nullptr;
+  unsigned num_args = args != nullptr ? args->get_num_kids() : 0;
+  if (num_args != (params != nullptr ? params->get_num_kids() : 0))
+  {
+    return false;
+  }
+
+  // Arguments must be literals or known functions
+  std::vector<PEValue> vals(num_args);
+  for (unsigned int i = 0; i < num_args; i++)
+  {
+    Node *arg = args->get_kid(i);
+    if (ConstantFolder::is_constant(arg, vals[i].ival))
+    {
+      vals[i].kind = PE_INT;
+      continue;
+    }
+    if (arg->get_tag() != AST_VARREF || !arg->has_address() || m_toplevel[arg->get_symbol()] == nullptr)
+    {
+      return false;
+    }
+    vals[i] = m_globals[arg->get_symbol()];
+    if (vals[i].kind == PE_UNKNOWN)
+    {
+      return false;
+    }
+  }
+
+  // The call may not print or change the unit's variables, since it
+  // would happen out of order
+  bool effects = m_effects;
+  m_effects = false;
+  m_frame = nullptr;
+  m_steps = m_call_depth = 0;
+  m_max_steps = MAX_CALL_STEPS;
+  bool known = false;
+  try
+  {
+    result = call(callee.fn, vals);
+    known = result.kind == PE_INT;
+  }
+  catch (NotStatic &)
+  {
+  }
+  m_effects = effects;
+  m_frame = nullptr;
+  return known;
+}
+
+void PartialEvaluator::store(const std::vector<bool> &written, bool all)
+{
+  for (unsigned int i = 0; i < m_num_symbols; i++)
+  {
+    PEValue &var = m_globals[i];
+    if (m_toplevel[i] == nullptr || var.kind != PE_INT || var.stored || !(all || written[i]))
+    {
+      continue;
+    }
+    Node *name = m_toplevel[i];
+    Node *ref = new Node(AST_VARREF, name->get_str());
+    ref->set_loc(name->get_loc());
+    Node *assign = new Node(AST_ASSIGNMENT, {ref, make_literal(name, var.ival)});
+    emit(new Node(AST_STATEMENT, {assign}));
+    var.stored = true;
+  }
+}
+
+void PartialEvaluator::emit(Node *stmt)
+{
+  m_residual->append_kid(stmt);
+}
+
+Node *PartialEvaluator::make_literal(Node *ast, int val)
+{
+  return ConstantFolder::make_constant(ast, val);
+}
+
+Node *PartialEvaluator::shallow_copy(Node *ast)
+{
+  Node *dup = new Node(ast->get_tag(), ast->get_str());
+  dup->set_loc(ast->get_loc());
+  if (ast->has_address())
+  {
+    dup->set_address(ast->get_depth(), ast->get_slot(), ast->get_symbol());
+  }
+  return dup;
+}
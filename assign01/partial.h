@@ -0,0 +1,113 @@
+#ifndef PARTIAL_H
+#define PARTIAL_H
+
+#include <string>
+#include <vector>
+class Node;
+
+// Partial evaluator, run on the analyzed unit before optimization.
+// Each top-level statement is executed at compile time if everything
+// it depends on is known (no readint, no variable whose value depends
+// on input, no errors), including calls to user functions. Output of
+// such a statement becomes print/println calls of the printed values.
+//
+// Other statements are kept, with reads of known variables replaced
+// by their values and calls which can be made without effects replaced
+// by their results. Known values of variables a kept statement could
+// read or change are first assigned in the residual program (values
+// are otherwise only tracked, not stored), and variables it changes
+// become unknown.
+//
+// The result is a new unit (the residual program), which must be
+// analyzed again.
+class PartialEvaluator {
+private:
+  enum {
+    PE_UNKNOWN,
+    PE_INT,
+    PE_FUNCTION,
+    PE_INTRINSIC,
+  };
+
+  // Value of a variable at compile time: an integer, a function
+  // (definition ast) or intrinsic (index), and for variables of the
+  // unit, whether the residual program has stored it yet
+  struct PEValue {
+    int kind = PE_UNKNOWN;
+    int ival = 0;
+    Node *fn = nullptr;
+    bool stored = true;
+  };
+
+  unsigned m_num_symbols;
+  std::vector<std::string> m_intrinsics;
+
+  // Values of the unit's variables, and of the variables of the
+  // function being called
+  std::vector<PEValue> m_globals;
+  std::vector<PEValue> *m_frame;
+
+  // Function whose body defines each symbol (nullptr for the unit), and
+  // the name of each symbol defined by a top-level statement of the unit
+  std::vector<Node *> m_owner;
+  std::vector<Node *> m_toplevel;
+
+  // Variables of the unit assigned by some function body
+  std::vector<bool> m_fn_assigned;
+
+  // Residual top-level statements, and whether compile-time execution
+  // may print (into them) and change the unit's variables
+  Node *m_residual;
+  bool m_effects;
+  unsigned m_steps, m_max_steps, m_num_prints, m_call_depth;
+
+  // copy constructor and assignment operator prohibited
+  PartialEvaluator(const PartialEvaluator &);
+  PartialEvaluator &operator=(const PartialEvaluator &);
+
+public:
+  PartialEvaluator(unsigned num_symbols, const std::vector<std::string> &intrinsics);
+  ~PartialEvaluator();
+
+  // Return the residual program for the (analyzed) unit, or the unit
+  // itself if it can't be partially evaluated
+  Node *run(Node *unit);
+
+private:
+  // Find the owner of each symbol, returning false if the program
+  // assigns an intrinsic's name (so printing can't be residualized)
+  bool collect(Node *unit);
+
+  // Execute a top-level statement at compile time, or add it to the
+  // residual program
+  bool execute(Node *stmt, bool last, PEValue &result);
+  void residualize(Node *stmt);
+
+  // Evaluate an ast at compile time, throwing if it can't be
+  PEValue eval(Node *ast);
+  int eval_int(Node *ast);
+  PEValue eval_call(Node *ast);
+  PEValue call(Node *fn, const std::vector<PEValue> &args);
+  void step(unsigned cost);
+
+  PEValue &lookup(int symbol);
+  void assign(int symbol, const PEValue &val);
+
+  // Copy of a tree with known values substituted
+  Node *residual_expr(Node *ast);
+  Node *residual_call(Node *ast);
+
+  // Make a call (with residual arguments) without effects at
+  // compile time, if possible
+  bool try_call(Node *site, PEValue &result);
+
+  // Assign the known values of the unit's variables which the
+  // residual program hasn't stored (only the written ones, unless all)
+  void store(const std::vector<bool> &written, bool all);
+
+  void emit(Node *stmt);
+  static Node *make_literal(Node *ast, int val);
+  static Node *shallow_copy(Node *ast);
+};
+
+#endif // PARTIAL_H
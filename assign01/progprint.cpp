@@ -0,0 +1,166 @@
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include "ast.h"
+#include "node.h"
+#include "progprint.h"
+
+namespace {
+
+const char *operator_str(int tag)
+{
+  switch (tag)
+  {
+  case AST_ADD:
+    return "+";
+  case AST_SUB:
+    return "-";
+  case AST_MULTIPLY:
+    return "*";
+  case AST_DIVIDE:
+    return "/";
+  case AST_GREATER:
+    return ">";
+  case AST_LESS:
+    return "<";
+  case AST_GREATER_EQUAL:
+    return ">=";
+  case AST_LESS_EQUAL:
+    return "<=";
+  case AST_EQUAL:
+    return "==";
+  case AST_NOT_EQUAL:
+    return "!=";
+  case AST_LOGICAL_AND:
+    return "&&";
+  case AST_LOGICAL_OR:
+    return "||";
+  }
+  return nullptr;
+}
+
+}
+
+ProgramPrinter::ProgramPrinter()
+    : m_indent(0)
+{
+}
+
+ProgramPrinter::~ProgramPrinter()
+{
+}
+
+void ProgramPrinter::print(Node *unit)
+{
+  print_list(unit);
+}
+
+void ProgramPrinter::print_list(Node *list)
+{
+  for (unsigned int i = 0; i < list->get_num_kids(); i++)
+  {
+    print_stmt(list->get_kid(i));
+  }
+}
+
+void ProgramPrinter::print_stmt(Node *stmt)
+{
+  if (stmt->get_tag() == AST_FUNCTION)
+  {
+    std::string head = "function " + stmt->get_kid(0)->get_str() + "(";
+    if (stmt->get_num_kids() == 3)
+    {
+      Node *params = stmt->get_kid(1);
+      for (unsigned int i = 0; i < params->get_num_kids(); i++)
+      {
+        head += (i > 0 ? ", " : "") + params->get_kid(i)->get_str();
+      }
+    }
+    print_block(head + ")", stmt->get_last_kid());
+    line("");
+    return;
+  }
+
+  Node *ast = stmt->get_kid(0);
+  switch (ast->get_tag())
+  {
+  case AST_DEFINITION:
+    line("var " + ast->get_kid(0)->get_str() + ";");
+    return;
+
+  case AST_IF:
+    print_block("if (" + expr(ast->get_kid(0)) + ")", ast->get_kid(1));
+    if (ast->get_last_kid()->get_tag() == AST_ELSE)
+    {
+      print_block("else", ast->get_last_kid()->get_kid(0));
+    }
+    return;
+
+  case AST_WHILE:
+    print_block("while (" + expr(ast->get_kid(0)) + ")", ast->get_kid(1));
+    return;
+  }
+  line(expr(ast) + ";");
+}
+
+void ProgramPrinter::print_block(const std::string &head, Node *block)
+{
+  line(head + " {");
+  m_indent++;
+  print_list(block);
+  m_indent--;
+  line("}");
+}
+
+void ProgramPrinter::line(const std::string &text)
+{
+  printf("%s%s\n", text.empty() ? "" : std::string(m_indent * 2, ' ').c_str(), text.c_str());
+}
+
+std::string ProgramPrinter::expr(Node *ast)
+{
+  switch (ast->get_tag())
+  {
+  case AST_INT_LITERAL:
+  {
+    // There are no negative literals
+    int val = atoi(ast->get_str().c_str());
+    if (val == INT_MIN)
+    {
+      return "0 - " + std::to_string(INT_MAX) + " - 1";
+    }
+    return val < 0 ? "0 - " + std::to_string(-val) : std::to_string(val);
+  }
+
+  case AST_VARREF:
+    return ast->get_str();
+
+  case AST_ASSIGNMENT:
+    return ast->get_kid(0)->get_str() + " = " + expr(ast->get_kid(1));
+
+  case AST_FNCALL:
+  {
+    std::string call = ast->get_str() + "(";
+    if (ast->get_num_kids() > 0)
+    {
+      Node *args = ast->get_kid(0);
+      for (unsigned int i = 0; i < args->get_num_kids(); i++)
+      {
+        call += (i > 0 ? ", " : "") + expr(args->get_kid(i));
+      }
+    }
+    return call + ")";
+  }
+  }
+  return operand(ast->get_kid(0)) + " " + operator_str(ast->get_tag()) + " " + operand(ast->get_kid(1));
+}
+
+std::string ProgramPrinter::operand(Node *ast)
+{
+  std::string str = expr(ast);
+  if (operator_str(ast->get_tag()) != nullptr || ast->get_tag() == AST_ASSIGNMENT || atoi(ast->get_str().c_str()) < 0)
+  {
+    return "(" + str + ")";
+  }
+  return str;
+}
@@ -0,0 +1,35 @@
+#ifndef PROGPRINT_H
+#define PROGPRINT_H
+
+#include <string>
+class Node;
+
+// Prints a unit as minilang source code, e.g. the residual program
+// left by partial evaluation. Operands which are themselves operators
+// or assignments are parenthesized, and negative literals are written
+// as subtractions.
+class ProgramPrinter {
+private:
+  unsigned m_indent;
+
+  // copy constructor and assignment operator prohibited
+  ProgramPrinter(const ProgramPrinter &);
+  ProgramPrinter &operator=(const ProgramPrinter &);
+
+public:
+  ProgramPrinter();
+  ~ProgramPrinter();
+
+  void print(Node *unit);
+
+private:
+  void print_list(Node *list);
+  void print_stmt(Node *stmt);
+  void print_block(const std::string &head, Node *block);
+  void line(const std::string &text);
+
+  static std::string expr(Node *ast);
+  static std::string operand(Node *ast);
+};
+
+#endif // PROGPRINT_H
@@ -0,0 +1,112 @@
+#include "ast.h"
+#include "node.h"
+#include "purity.h"
+
+PurityAnalysis::PurityAnalysis(unsigned num_symbols, unsigned num_intrinsics)
+    : m_num_intrinsics(num_intrinsics), m_num_assigns(num_symbols, 0), m_exact_fn(num_symbols, nullptr)
+{
+}
+
+PurityAnalysis::~PurityAnalysis()
+{
+}
+
+void PurityAnalysis::run(Node *unit)
+{
+  unit->preorder([this](Node *n) {
+    if (n->get_tag() == AST_ASSIGNMENT)
+    {
+      m_num_assigns[n->get_kid(0)->get_symbol()]++;
+    }
+    else if (n->get_tag() == AST_DEFINITION && n->has_address())
+    {
+      m_num_assigns[n->get_symbol()]++;
+    }
+    else if (n->get_tag() == AST_FUNCTION)
+    {
+      m_num_assigns[n->get_symbol()]++;
+      m_exact_fn[n->get_symbol()] = n;
+    }
+  });
+  for (unsigned int i = 0; i < m_exact_fn.size(); i++)
+  {
+    if (m_exact_fn[i] != nullptr && m_num_assigns[i] != 1)
+    {
+      m_exact_fn[i] = nullptr;
+    }
+  }
+
+  // Parameters and variables defined in the body belong to a function
+  std::vector<Node *> fns;
+  std::vector<std::vector<bool>> locals;
+  unit->each_child([&](Node *stmt) {
+    if (stmt->get_tag() != AST_FUNCTION)
+    {
+      return;
+    }
+    std::vector<bool> local(m_num_assigns.size(), false);
+    if (stmt->get_num_kids() == 3)
+    {
+      stmt->get_kid(1)->each_child([&local](Node *param) { local[param->get_symbol()] = true; });
+    }
+    stmt->get_last_kid()->preorder([&local](Node *n) {
+      if (n->get_tag() == AST_DEFINITION && n->has_address())
+      {
+        local[n->get_symbol()] = true;
+      }
+    });
+    stmt->set_pure(true);
+    fns.push_back(stmt);
+    locals.push_back(local);
+  });
+
+  // Assume every function is pure, until one calls a function which
+  // isn't (recursion doesn't make a function impure)
+  bool changed;
+  do
+  {
+    changed = false;
+    for (unsigned int i = 0; i < fns.size(); i++)
+    {
+      if (fns[i]->is_pure() && !check(fns[i], locals[i]))
+      {
+        fns[i]->set_pure(false);
+        changed = true;
+      }
+    }
+  } while (changed);
+}
+
+bool PurityAnalysis::check(Node *fn, const std::vector<bool> &local)
+{
+  bool pure = true;
+  fn->get_last_kid()->preorder([&](Node *n) {
+    int tag = n->get_tag();
+    if ((tag != AST_VARREF && tag != AST_FNCALL) || !pure)
+    {
+      return;
+    }
+    if (!n->has_address())
+    {
+      // Only the name of a redefinition has no address, but a call
+      // to an undefined name fails
+      pure = tag == AST_VARREF;
+      return;
+    }
+
+    int symbol = n->get_symbol();
+    if (local[symbol])
+    {
+      // A function held by a local variable could be anything
+      pure = tag == AST_VARREF;
+      return;
+    }
+    if (symbol < int(m_num_intrinsics) || m_exact_fn[symbol] == nullptr)
+    {
+      pure = false;
+      return;
+    }
+    pure = tag == AST_VARREF || m_exact_fn[symbol]->is_pure();
+  });
+  return pure;
+}
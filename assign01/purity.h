@@ -0,0 +1,40 @@
+#ifndef PURITY_H
+#define PURITY_H
+
+#include <vector>
+class Node;
+
+// Analysis which marks functions as pure: the body calls no intrinsic
+// (print, println and readint all have effects), assigns no variable
+// other than its own, reads no variable of the unit other than
+// functions (so the result depends only on the arguments), and only
+// calls pure functions. A callee must be a function which is the only
+// value of its name; calls through parameters or variables aren't pure.
+//
+// Run on the optimized unit, just before it is executed.
+class PurityAnalysis {
+private:
+  unsigned m_num_intrinsics;
+
+  // Number of assignments (and definitions) of each symbol, and the
+  // function each symbol always holds (if any)
+  std::vector<unsigned> m_num_assigns;
+  std::vector<Node *> m_exact_fn;
+
+  // copy constructor and assignment operator prohibited
+  PurityAnalysis(const PurityAnalysis &);
+  PurityAnalysis &operator=(const PurityAnalysis &);
+
+public:
+  PurityAnalysis(unsigned num_symbols, unsigned num_intrinsics);
+  ~PurityAnalysis();
+
+  // Mark each function of the (analyzed) unit as pure or not
+  void run(Node *unit);
+
+private:
+  // Check a function's body, assuming the functions still marked pure are
+  bool check(Node *fn, const std::vector<bool> &local);
+};
+
+#endif // PURITY_H
@@ -0,0 +1,541 @@
+#include <climits>
+#include <cstdlib>
+#include <algorithm>
+#include "ast.h"
+#include "node.h"
+#include "range.h"
+
+RangeAnalysis::RangeAnalysis(unsigned num_symbols, unsigned num_intrinsics)
+    : m_num_intrinsics(num_intrinsics), m_local(num_symbols, false), m_fn_assigned(num_symbols, false),
+      m_state(num_symbols, top())
+{
+}
+
+RangeAnalysis::~RangeAnalysis()
+{
+}
+
+void RangeAnalysis::run(Node *unit)
+{
+  collect(unit, false);
+  eval(unit);
+}
+
+bool RangeAnalysis::is_safe_before(Node *loop, Node *ast) const
+{
+  auto i = m_loop_entry.find(loop);
+  if (i == m_loop_entry.end())
+  {
+    return false;
+  }
+  bool safe = true;
+  bound(ast, i->second, safe);
+  return safe;
+}
+
+void RangeAnalysis::collect(Node *ast, bool in_function)
+{
+  switch (ast->get_tag())
+  {
+  case AST_ASSIGNMENT:
+    if (in_function && ast->get_kid(0)->has_address())
+    {
+      m_fn_assigned[ast->get_kid(0)->get_symbol()] = true;
+    }
+    break;
+
+  case AST_DEFINITION:
+    if (in_function && ast->has_address())
+    {
+      m_local[ast->get_symbol()] = true;
+    }
+    return;
+
+  case AST_FUNCTION:
+    if (ast->get_num_kids() == 3)
+    {
+      ast->get_kid(1)->each_child([this](Node *param) { m_local[param->get_symbol()] = true; });
+    }
+    collect(ast->get_last_kid(), true);
+    return;
+  }
+
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    collect(ast->get_kid(i), in_function);
+  }
+}
+
+// Functions are only defined in the unit, so a function's locals can
+// only be changed by its own body
+bool RangeAnalysis::is_tracked(Node *ref) const
+{
+  if (!ref->has_address() || unsigned(ref->get_symbol()) < m_num_intrinsics)
+  {
+    return false;
+  }
+  return m_local[ref->get_symbol()] || !m_fn_assigned[ref->get_symbol()];
+}
+
+RangeAnalysis::Range RangeAnalysis::eval(Node *ast)
+{
+  switch (ast->get_tag())
+  {
+  case AST_INT_LITERAL:
+  case AST_VARREF:
+    return value(ast, m_state);
+
+  case AST_ASSIGNMENT:
+  {
+    Range val = eval(ast->get_kid(1));
+    if (is_tracked(ast->get_kid(0)))
+    {
+      m_state[ast->get_kid(0)->get_symbol()] = val;
+    }
+    return val;
+  }
+
+  // Defined variables start out as -1 (a redefinition keeps the value)
+  case AST_DEFINITION:
+    if (is_tracked(ast))
+    {
+      m_state[ast->get_symbol()] = make(-1, -1);
+    }
+    return make(0, 0);
+
+  // The body can be called from anywhere, with any arguments
+  case AST_FUNCTION:
+  {
+    State saved = m_state;
+    m_state.assign(m_state.size(), top());
+    eval(ast->get_last_kid());
+    m_state = saved;
+    if (is_tracked(ast))
+    {
+      m_state[ast->get_symbol()] = top();
+    }
+    return make(0, 0);
+  }
+
+  case AST_FNCALL:
+    if (ast->get_num_kids() > 0)
+    {
+      eval(ast->get_kid(0));
+    }
+    return top();
+
+  case AST_IF:
+  {
+    Node *cond = ast->get_kid(0);
+    eval(cond);
+    State before = m_state;
+    refine(cond, true);
+    eval(ast->get_kid(1));
+    State taken = m_state;
+    m_state = before;
+    refine(cond, false);
+    if (ast->get_last_kid()->get_tag() == AST_ELSE)
+    {
+      eval(ast->get_last_kid()->get_kid(0));
+    }
+    join(m_state, taken);
+    return make(0, 0);
+  }
+
+  case AST_WHILE:
+    eval_loop(ast);
+    return make(0, 0);
+
+  case AST_ADD:
+  case AST_SUB:
+  case AST_MULTIPLY:
+  case AST_DIVIDE:
+  {
+    Range a = eval(ast->get_kid(0));
+    Range b = eval(ast->get_kid(1));
+    bool safe = true;
+    Range result = arith(ast->get_tag(), a, b, safe);
+    ast->set_safe(safe);
+    return result;
+  }
+
+  case AST_GREATER:
+  case AST_LESS:
+  case AST_GREATER_EQUAL:
+  case AST_LESS_EQUAL:
+  case AST_EQUAL:
+  case AST_NOT_EQUAL:
+    eval(ast->get_kid(0));
+    eval(ast->get_kid(1));
+    return make(0, 1);
+
+  // The second operand only runs if the first doesn't decide
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+  {
+    eval(ast->get_kid(0));
+    State skipped = m_state;
+    refine(ast->get_kid(0), ast->get_tag() == AST_LOGICAL_AND);
+    eval(ast->get_kid(1));
+    join(m_state, skipped);
+    return make(0, 1);
+  }
+  }
+
+  // Statements and lists have the value of their last kid
+  Range result = make(0, 0);
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    result = eval(ast->get_kid(i));
+  }
+  return result;
+}
+
+// The last iteration runs from the intervals which no longer grow, so
+// the marks it leaves hold for every iteration
+void RangeAnalysis::eval_loop(Node *loop)
+{
+  Node *cond = loop->get_kid(0);
+  m_loop_entry[loop] = m_state;
+
+  for (unsigned iter = 0;; iter++)
+  {
+    State head = m_state;
+    eval(cond);
+    State exit = m_state;
+    refine(cond, true);
+    eval(loop->get_kid(1));
+
+    State next = head;
+    join(next, m_state);
+    if (next == head)
+    {
+      m_state = exit;
+      refine(cond, false);
+      return;
+    }
+
+    if (iter >= WIDEN_AFTER)
+    {
+      for (unsigned int i = 0; i < next.size(); i++)
+      {
+        if (head[i].lo > head[i].hi)
+        {
+          continue;
+        }
+        if (next[i].lo < head[i].lo)
+        {
+          next[i].lo = INT_MIN;
+        }
+        if (next[i].hi > head[i].hi)
+        {
+          next[i].hi = INT_MAX;
+        }
+      }
+    }
+    m_state = next;
+  }
+}
+
+void RangeAnalysis::refine(Node *cond, bool truth)
+{
+  // A condition which assigns compares values the state no longer has
+  if (assigns(cond))
+  {
+    return;
+  }
+
+  int tag = cond->get_tag();
+  switch (tag)
+  {
+  case AST_VARREF:
+    if (!truth)
+    {
+      narrow(cond, make(0, 0));
+    }
+    else if (is_tracked(cond))
+    {
+      Range &val = m_state[cond->get_symbol()];
+      if (val.lo == 0)
+      {
+        val = make(1, val.hi);
+      }
+      else if (val.hi == 0)
+      {
+        val = make(val.lo, -1);
+      }
+    }
+    return;
+
+  // Both operands decide one way, either one the other way
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+    if (truth == (tag == AST_LOGICAL_AND))
+    {
+      refine(cond->get_kid(0), truth);
+      refine(cond->get_kid(1), truth);
+    }
+    else
+    {
+      State before = m_state;
+      refine(cond->get_kid(0), truth);
+      State first = m_state;
+      m_state = before;
+      refine(cond->get_kid(0), !truth);
+      refine(cond->get_kid(1), truth);
+      join(m_state, first);
+    }
+    return;
+
+  case AST_GREATER:
+  case AST_LESS:
+  case AST_GREATER_EQUAL:
+  case AST_LESS_EQUAL:
+  case AST_EQUAL:
+  case AST_NOT_EQUAL:
+    break;
+
+  default:
+    return;
+  }
+
+  // Negate a false comparison, then turn > and >= around
+  if (!truth)
+  {
+    switch (tag)
+    {
+    case AST_GREATER:
+      tag = AST_LESS_EQUAL;
+      break;
+    case AST_LESS:
+      tag = AST_GREATER_EQUAL;
+      break;
+    case AST_GREATER_EQUAL:
+      tag = AST_LESS;
+      break;
+    case AST_LESS_EQUAL:
+      tag = AST_GREATER;
+      break;
+    case AST_EQUAL:
+      tag = AST_NOT_EQUAL;
+      break;
+    case AST_NOT_EQUAL:
+      tag = AST_EQUAL;
+      break;
+    }
+  }
+  if (tag == AST_GREATER)
+  {
+    refine_compare(AST_LESS, cond->get_kid(1), cond->get_kid(0));
+  }
+  else if (tag == AST_GREATER_EQUAL)
+  {
+    refine_compare(AST_LESS_EQUAL, cond->get_kid(1), cond->get_kid(0));
+  }
+  else
+  {
+    refine_compare(tag, cond->get_kid(0), cond->get_kid(1));
+  }
+}
+
+void RangeAnalysis::refine_compare(int tag, Node *left, Node *right)
+{
+  Range a = value(left, m_state), b = value(right, m_state);
+
+  switch (tag)
+  {
+  case AST_LESS:
+    narrow(left, make(a.lo, std::min(a.hi, b.hi - 1)));
+    narrow(right, make(std::max(b.lo, a.lo + 1), b.hi));
+    break;
+
+  case AST_LESS_EQUAL:
+    narrow(left, make(a.lo, std::min(a.hi, b.hi)));
+    narrow(right, make(std::max(b.lo, a.lo), b.hi));
+    break;
+
+  case AST_EQUAL:
+    narrow(left, b);
+    narrow(right, a);
+    break;
+
+  // Only excludes a value at the end of an interval
+  case AST_NOT_EQUAL:
+    if (b.lo == b.hi && a.lo == b.lo)
+    {
+      narrow(left, make(a.lo + 1, a.hi));
+    }
+    else if (b.lo == b.hi && a.hi == b.lo)
+    {
+      narrow(left, make(a.lo, a.hi - 1));
+    }
+    if (a.lo == a.hi && b.lo == a.lo)
+    {
+      narrow(right, make(b.lo + 1, b.hi));
+    }
+    else if (a.lo == a.hi && b.hi == a.lo)
+    {
+      narrow(right, make(b.lo, b.hi - 1));
+    }
+    break;
+  }
+}
+
+void RangeAnalysis::narrow(Node *ref, const Range &range)
+{
+  if (ref->get_tag() == AST_VARREF && is_tracked(ref))
+  {
+    Range &val = m_state[ref->get_symbol()];
+    val = make(std::max(val.lo, range.lo), std::min(val.hi, range.hi));
+  }
+}
+
+RangeAnalysis::Range RangeAnalysis::value(Node *ast, const State &state) const
+{
+  if (ast->get_tag() == AST_INT_LITERAL)
+  {
+    int val = atoi(ast->get_str().c_str());
+    return make(val, val);
+  }
+  if (ast->get_tag() == AST_VARREF && is_tracked(ast))
+  {
+    return state[ast->get_symbol()];
+  }
+  return top();
+}
+
+RangeAnalysis::Range RangeAnalysis::bound(Node *ast, const State &state, bool &safe) const
+{
+  switch (ast->get_tag())
+  {
+  case AST_ADD:
+  case AST_SUB:
+  case AST_MULTIPLY:
+  case AST_DIVIDE:
+  {
+    Range a = bound(ast->get_kid(0), state, safe);
+    Range b = bound(ast->get_kid(1), state, safe);
+    return arith(ast->get_tag(), a, b, safe);
+  }
+
+  case AST_GREATER:
+  case AST_LESS:
+  case AST_GREATER_EQUAL:
+  case AST_LESS_EQUAL:
+  case AST_EQUAL:
+  case AST_NOT_EQUAL:
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+    bound(ast->get_kid(0), state, safe);
+    bound(ast->get_kid(1), state, safe);
+    return make(0, 1);
+  }
+  return value(ast, state);
+}
+
+// Results are computed exactly in 64 bits; an operator is safe if they
+// fit in an int, and otherwise its result is whatever doesn't fail
+RangeAnalysis::Range RangeAnalysis::arith(int tag, const Range &a, const Range &b, bool &safe)
+{
+  if (a.lo > a.hi || b.lo > b.hi)
+  {
+    safe = false;
+    return make(1, 0);
+  }
+
+  Range result = make(1, 0);
+  switch (tag)
+  {
+  case AST_ADD:
+    result = make(a.lo + b.lo, a.hi + b.hi);
+    break;
+
+  case AST_SUB:
+    result = make(a.lo - b.hi, a.hi - b.lo);
+    break;
+
+  case AST_MULTIPLY:
+  {
+    long long p[] = { a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi };
+    result = make(*std::min_element(p, p + 4), *std::max_element(p, p + 4));
+    break;
+  }
+
+  // Extremes are at the ends of the negative and positive divisors
+  case AST_DIVIDE:
+  {
+    Range parts[] = { make(b.lo, std::min(b.hi, -1LL)), make(std::max(b.lo, 1LL), b.hi) };
+    for (const Range &d : parts)
+    {
+      if (d.lo <= d.hi)
+      {
+        long long q[] = { a.lo / d.lo, a.lo / d.hi, a.hi / d.lo, a.hi / d.hi };
+        result = join(result, make(*std::min_element(q, q + 4), *std::max_element(q, q + 4)));
+      }
+    }
+    if (b.lo <= 0 && b.hi >= 0)
+    {
+      safe = false;
+    }
+    break;
+  }
+  }
+
+  if (result.lo < INT_MIN || result.hi > INT_MAX)
+  {
+    safe = false;
+  }
+  return make(std::max(result.lo, (long long) INT_MIN), std::min(result.hi, (long long) INT_MAX));
+}
+
+// Empty intervals are all the same
+RangeAnalysis::Range RangeAnalysis::make(long long lo, long long hi)
+{
+  if (lo > hi)
+  {
+    return Range{1, 0};
+  }
+  return Range{lo, hi};
+}
+
+RangeAnalysis::Range RangeAnalysis::top()
+{
+  return Range{INT_MIN, INT_MAX};
+}
+
+RangeAnalysis::Range RangeAnalysis::join(const Range &a, const Range &b)
+{
+  if (a.lo > a.hi)
+  {
+    return b;
+  }
+  if (b.lo > b.hi)
+  {
+    return a;
+  }
+  return make(std::min(a.lo, b.lo), std::max(a.hi, b.hi));
+}
+
+void RangeAnalysis::join(State &state, const State &other)
+{
+  for (unsigned int i = 0; i < state.size(); i++)
+  {
+    state[i] = join(state[i], other[i]);
+  }
+}
+
+bool RangeAnalysis::assigns(Node *ast)
+{
+  if (ast->get_tag() == AST_ASSIGNMENT)
+  {
+    return true;
+  }
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    if (assigns(ast->get_kid(i)))
+    {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,90 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+#include <vector>
+#include <unordered_map>
+class Node;
+
+// Value-range analysis, run after type inference. Tracks the interval
+// of integers each variable can hold at each point of the unit and of
+// each function body, narrowing it by the conditions of if and while
+// statements, and marks arithmetic operators whose result is always in
+// range (and whose divisor is never 0) as safe, so the interpreter can
+// skip its overflow check. Loop counters compared against a bound are
+// the typical case.
+//
+// Variables of the unit which a function body assigns can change at
+// any call, so they (and everything a function reads from the unit)
+// can hold any integer. Loops are iterated until the intervals stop
+// growing; bounds which keep growing are widened to the limits of int.
+class RangeAnalysis {
+private:
+  // Interval of 64-bit values, so results can be checked before they
+  // are clamped; empty (unreachable) if lo > hi
+  struct Range {
+    long long lo, hi;
+    bool operator==(const Range &other) const { return lo == other.lo && hi == other.hi; }
+  };
+  typedef std::vector<Range> State;
+
+  enum {
+    // Loop iterations before bounds are widened
+    WIDEN_AFTER = 2,
+  };
+
+  unsigned m_num_intrinsics;
+
+  // Symbols defined in a function body (parameters and locals), and
+  // symbols assigned in one
+  std::vector<bool> m_local;
+  std::vector<bool> m_fn_assigned;
+
+  // Intervals of the variables at the current point, and on entry to
+  // each while loop (before its first condition)
+  State m_state;
+  std::unordered_map<Node *, State> m_loop_entry;
+
+  // copy constructor and assignment operator prohibited
+  RangeAnalysis(const RangeAnalysis &);
+  RangeAnalysis &operator=(const RangeAnalysis &);
+
+public:
+  RangeAnalysis(unsigned num_symbols, unsigned num_intrinsics);
+  ~RangeAnalysis();
+
+  // Mark the safe operators of the (analyzed) unit
+  void run(Node *unit);
+
+  // Check if evaluating an expression just before a while loop (which
+  // the analysis has visited) can't overflow or divide by 0
+  bool is_safe_before(Node *loop, Node *ast) const;
+
+private:
+  void collect(Node *ast, bool in_function);
+  bool is_tracked(Node *ref) const;
+
+  // Evaluate an expression (or statement) over intervals, updating
+  // m_state and marking its operators
+  Range eval(Node *ast);
+  void eval_loop(Node *loop);
+
+  // Narrow m_state to where a condition (which assigns nothing) is
+  // true or false
+  void refine(Node *cond, bool truth);
+  void refine_compare(int tag, Node *left, Node *right);
+  void narrow(Node *ref, const Range &range);
+
+  // Interval of a literal or variable, and of an expression without
+  // marking it (safe is cleared if an operator can fail)
+  Range value(Node *ast, const State &state) const;
+  Range bound(Node *ast, const State &state, bool &safe) const;
+
+  static Range arith(int tag, const Range &a, const Range &b, bool &safe);
+  static Range make(long long lo, long long hi);
+  static Range top();
+  static Range join(const Range &a, const Range &b);
+  static void join(State &state, const State &other);
+  static bool assigns(Node *ast);
+};
+
+#endif // RANGE_H
@@ -0,0 +1,563 @@
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include "ast.h"
+#include "node.h"
+#include "regcompiler.h"
+
+namespace {
+
+// Name and operand kinds of each instruction (see RegOpcode)
+struct RegOpcodeInfo {
+  const char *name;
+  const char *operands;
+};
+
+const RegOpcodeInfo REG_OPCODES[NUM_REG_OPCODES] = {
+  {"loadk", "rk"}, {"move", "rr"}, {"get_global", "rg"}, {"set_global", "gr"},
+  {"define", "r"}, {"define_global", "g"}, {"numeric", "rs"},
+  {"add", "rrrs"}, {"sub", "rrrs"}, {"multiply", "rrrs"}, {"divide", "rrrs"},
+  {"add_safe", "rrr"}, {"sub_safe", "rrr"}, {"multiply_safe", "rrr"}, {"divide_safe", "rrr"},
+  {"less", "rrr"}, {"less_equal", "rrr"}, {"greater", "rrr"}, {"greater_equal", "rrr"},
+  {"equal", "rrr"}, {"not_equal", "rrr"}, {"bool", "rr"},
+  {"jump", "L"}, {"jump_zero", "rL"}, {"jump_nonzero", "rL"},
+  {"jump_less", "rrL"}, {"jump_less_equal", "rrL"}, {"jump_greater", "rrL"},
+  {"jump_greater_equal", "rrL"}, {"jump_equal", "rrL"}, {"jump_not_equal", "rrL"},
+  {"function", "cg"}, {"callee", "rns"}, {"call", "rns"}, {"return", "r"}, {"fail", "s"}, {"halt", "r"},
+};
+
+int compare_opcode(int tag, bool jump)
+{
+  switch (tag)
+  {
+  case AST_LESS:
+    return jump ? ROP_JUMP_LESS : ROP_LESS;
+  case AST_LESS_EQUAL:
+    return jump ? ROP_JUMP_LESS_EQUAL : ROP_LESS_EQUAL;
+  case AST_GREATER:
+    return jump ? ROP_JUMP_GREATER : ROP_GREATER;
+  case AST_GREATER_EQUAL:
+    return jump ? ROP_JUMP_GREATER_EQUAL : ROP_GREATER_EQUAL;
+  case AST_EQUAL:
+    return jump ? ROP_JUMP_EQUAL : ROP_EQUAL;
+  case AST_NOT_EQUAL:
+    return jump ? ROP_JUMP_NOT_EQUAL : ROP_NOT_EQUAL;
+  }
+  return -1;
+}
+
+int negate_compare(int tag)
+{
+  switch (tag)
+  {
+  case AST_LESS:
+    return AST_GREATER_EQUAL;
+  case AST_LESS_EQUAL:
+    return AST_GREATER;
+  case AST_GREATER:
+    return AST_LESS_EQUAL;
+  case AST_GREATER_EQUAL:
+    return AST_LESS;
+  case AST_EQUAL:
+    return AST_NOT_EQUAL;
+  case AST_NOT_EQUAL:
+    return AST_EQUAL;
+  }
+  return -1;
+}
+
+int arith_opcode(int tag, bool safe)
+{
+  switch (tag)
+  {
+  case AST_ADD:
+    return safe ? ROP_ADD_SAFE : ROP_ADD;
+  case AST_SUB:
+    return safe ? ROP_SUB_SAFE : ROP_SUB;
+  case AST_MULTIPLY:
+    return safe ? ROP_MULTIPLY_SAFE : ROP_MULTIPLY;
+  case AST_DIVIDE:
+    return safe ? ROP_DIVIDE_SAFE : ROP_DIVIDE;
+  }
+  return compare_opcode(tag, false);
+}
+
+// Locals needed by the blocks nested in a node (functions have their own)
+unsigned block_locals(Node *ast)
+{
+  unsigned num_locals = 0;
+  ast->each_child([&num_locals](Node *kid) {
+    unsigned kid_locals = 0;
+    if (kid->get_tag() == AST_STATEMENT_LIST)
+    {
+      kid_locals = kid->get_num_slots() + block_locals(kid);
+    }
+    else if (kid->get_tag() != AST_FUNCTION)
+    {
+      kid_locals = block_locals(kid);
+    }
+    num_locals = std::max(num_locals, kid_locals);
+  });
+  return num_locals;
+}
+
+}
+
+RegisterCompiler::RegisterCompiler()
+    : m_chunk(nullptr), m_num_locals(0), m_next(0)
+{
+}
+
+RegisterCompiler::~RegisterCompiler()
+{
+}
+
+std::vector<Chunk *> RegisterCompiler::compile(Node *unit)
+{
+  // Functions are numbered in order, after the unit
+  m_chunks.push_back(new Chunk());
+  unit->each_child([this](Node *stmt) {
+    if (stmt->get_tag() == AST_FUNCTION)
+    {
+      Chunk *chunk = new Chunk();
+      chunk->fn = stmt;
+      m_chunks.push_back(chunk);
+    }
+  });
+
+  m_chunks[0]->name = "<unit>";
+  m_chunks[0]->fn = nullptr;
+  compile_chunk(m_chunks[0], unit, 0, true);
+  for (unsigned int i = 1; i < m_chunks.size(); i++)
+  {
+    Node *fn = m_chunks[i]->fn;
+    m_chunks[i]->name = fn->get_kid(0)->get_str();
+    compile_chunk(m_chunks[i], fn->get_last_kid(), fn->get_last_kid()->get_num_slots(), false);
+    m_chunks[i]->num_params = fn->get_num_kids() == 3 ? fn->get_kid(1)->get_num_kids() : 0;
+  }
+
+  std::vector<Chunk *> chunks;
+  chunks.swap(m_chunks);
+  return chunks;
+}
+
+// The unit's own variables are globals, a function's body is the first
+// level of locals (its parameters are the first slots). Temporaries
+// follow the deepest nesting of block variables.
+void RegisterCompiler::compile_chunk(Chunk *chunk, Node *body, unsigned level_slots, bool unit)
+{
+  m_chunk = chunk;
+  chunk->num_params = 0;
+  chunk->num_locals = level_slots + block_locals(body);
+  chunk->max_stack = 0;
+  m_bases.assign(1, -1);
+  if (!unit)
+  {
+    m_bases.push_back(0);
+  }
+  m_num_locals = level_slots;
+  m_next = chunk->num_locals;
+
+  int result = compile_list(body, true);
+  emit(unit ? ROP_HALT : ROP_RETURN, {result});
+}
+
+int RegisterCompiler::compile_block(Node *block, bool want)
+{
+  unsigned saved = m_num_locals;
+  m_bases.push_back(int(m_num_locals));
+  m_num_locals += block->get_num_slots();
+
+  int result = compile_list(block, want);
+
+  m_bases.pop_back();
+  m_num_locals = saved;
+  return result;
+}
+
+// The value of a list is the value of its last statement
+int RegisterCompiler::compile_list(Node *list, bool want)
+{
+  int result = -1;
+  for (unsigned int i = 0; i < list->get_num_kids(); i++)
+  {
+    unsigned mark = m_next;
+    result = compile_stmt(list->get_kid(i), want && i == list->get_num_kids() - 1);
+    if (!want || i < list->get_num_kids() - 1)
+    {
+      m_next = mark;
+    }
+  }
+  return result;
+}
+
+int RegisterCompiler::compile_stmt(Node *stmt, bool want)
+{
+  if (stmt->get_tag() == AST_FUNCTION)
+  {
+    unsigned index = 1;
+    while (m_chunks[index]->fn != stmt)
+    {
+      index++;
+    }
+    emit(ROP_FUNCTION, {int(index), stmt->get_slot()});
+  }
+  else
+  {
+    Node *ast = stmt->get_kid(0);
+    switch (ast->get_tag())
+    {
+    case AST_IF:
+    {
+      std::vector<unsigned> skip, end;
+      compile_jump(ast->get_kid(0), ast, false, skip);
+      compile_block(ast->get_kid(1), false);
+      if (ast->get_last_kid()->get_tag() == AST_ELSE)
+      {
+        emit(ROP_JUMP, {-1});
+        end.push_back(unsigned(m_chunk->code.size() - 1));
+        patch(skip);
+        compile_block(ast->get_last_kid()->get_kid(0), false);
+        patch(end);
+      }
+      else
+      {
+        patch(skip);
+      }
+      break;
+    }
+
+    // The condition is tested at the bottom, so each iteration takes
+    // one jump
+    case AST_WHILE:
+    {
+      std::vector<unsigned> test, loop;
+      emit(ROP_JUMP, {-1});
+      test.push_back(unsigned(m_chunk->code.size() - 1));
+      unsigned body = unsigned(m_chunk->code.size());
+      compile_block(ast->get_kid(1), false);
+      patch(test);
+      compile_jump(ast->get_kid(0), ast, true, loop);
+      for (auto i = loop.begin(); i != loop.end(); ++i)
+      {
+        m_chunk->code[*i] = int(body);
+      }
+      break;
+    }
+
+    // Redefinitions have no address and do nothing
+    case AST_DEFINITION:
+      if (ast->has_address())
+      {
+        int reg = local(ast);
+        if (reg >= 0)
+        {
+          emit(ROP_DEFINE, {reg});
+        }
+        else
+        {
+          emit(ROP_DEFINE_GLOBAL, {ast->get_slot()});
+        }
+      }
+      break;
+
+    default:
+      return compile_expr(ast, -1);
+    }
+  }
+
+  // Other statements evaluate to 0
+  if (!want)
+  {
+    return -1;
+  }
+  int reg = alloc();
+  emit(ROP_LOADK, {reg, 0});
+  return reg;
+}
+
+int RegisterCompiler::compile_expr(Node *ast, int dst)
+{
+  switch (ast->get_tag())
+  {
+  case AST_INT_LITERAL:
+  {
+    int reg = dst >= 0 ? dst : alloc();
+    emit(ROP_LOADK, {reg, atoi(ast->get_str().c_str())});
+    return reg;
+  }
+
+  case AST_VARREF:
+  {
+    int reg = local(ast);
+    if (reg < 0)
+    {
+      reg = dst >= 0 ? dst : alloc();
+      emit(ROP_GET_GLOBAL, {reg, ast->get_slot()});
+    }
+    else if (dst >= 0 && dst != reg)
+    {
+      emit(ROP_MOVE, {dst, reg});
+      reg = dst;
+    }
+    return reg;
+  }
+
+  // A local is computed into directly
+  case AST_ASSIGNMENT:
+  {
+    int target = local(ast->get_kid(0));
+    if (target >= 0)
+    {
+      compile_expr(ast->get_kid(1), target);
+      if (dst >= 0 && dst != target)
+      {
+        emit(ROP_MOVE, {dst, target});
+        return dst;
+      }
+      return target;
+    }
+    int reg = compile_expr(ast->get_kid(1), dst);
+    emit(ROP_SET_GLOBAL, {ast->get_kid(0)->get_slot(), reg});
+    return reg;
+  }
+
+  case AST_FNCALL:
+    return compile_call(ast, dst);
+
+  // The second operand is only evaluated if the first doesn't decide
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+  {
+    bool is_and = ast->get_tag() == AST_LOGICAL_AND;
+    unsigned mark = m_next;
+    int left = compile_operand(ast->get_kid(0), ast, false);
+    emit(is_and ? ROP_JUMP_ZERO : ROP_JUMP_NONZERO, {left, -1});
+    std::vector<unsigned> decided(1, unsigned(m_chunk->code.size() - 1));
+    m_next = mark;
+    int right = compile_operand(ast->get_kid(1), ast, false);
+    m_next = mark;
+    int reg = dst >= 0 ? dst : alloc();
+    emit(ROP_BOOL, {reg, right});
+    emit(ROP_JUMP, {-1});
+    std::vector<unsigned> end(1, unsigned(m_chunk->code.size() - 1));
+    patch(decided);
+    emit(ROP_LOADK, {reg, is_and ? 0 : 1});
+    patch(end);
+    return reg;
+  }
+  }
+
+  // A variable read by the left operand must be copied if the right
+  // one assigns (it could be the same variable)
+  unsigned mark = m_next;
+  int left = compile_operand(ast->get_kid(0), ast, assigns(ast->get_kid(1)));
+  int right = compile_operand(ast->get_kid(1), ast, false);
+  m_next = mark;
+  int reg = dst >= 0 ? dst : alloc();
+  int op = arith_opcode(ast->get_tag(), ast->is_safe());
+  if (op == ROP_ADD || op == ROP_SUB || op == ROP_MULTIPLY || op == ROP_DIVIDE)
+  {
+    emit(op, {reg, left, right, site(ast)});
+  }
+  else
+  {
+    emit(op, {reg, left, right});
+  }
+  return reg;
+}
+
+// The callee is checked before the arguments are evaluated, which go
+// in the registers after it
+int RegisterCompiler::compile_call(Node *ast, int dst)
+{
+  unsigned mark = m_next;
+  int callee = alloc();
+  if (!ast->has_address())
+  {
+    emit(ROP_FAIL, {site(ast)});
+  }
+  else
+  {
+    int reg = local(ast);
+    if (reg >= 0)
+    {
+      emit(ROP_MOVE, {callee, reg});
+    }
+    else
+    {
+      emit(ROP_GET_GLOBAL, {callee, ast->get_slot()});
+    }
+
+    unsigned num_args = ast->get_num_kids() == 0 ? 0 : ast->get_kid(0)->get_num_kids();
+    emit(ROP_CALLEE, {callee, int(num_args), site(ast)});
+    for (unsigned int i = 0; i < num_args; i++)
+    {
+      alloc();
+    }
+    for (unsigned int i = 0; i < num_args; i++)
+    {
+      compile_expr(ast->get_kid(0)->get_kid(i), callee + 1 + int(i));
+    }
+    emit(ROP_CALL, {callee, int(num_args), site(ast)});
+  }
+
+  m_next = mark + 1;
+  if (dst >= 0)
+  {
+    emit(ROP_MOVE, {dst, callee});
+    m_next = mark;
+    return dst;
+  }
+  return callee;
+}
+
+// Operands and conditions must be integers (unless known to be), and
+// an assignment is rejected without being evaluated
+int RegisterCompiler::compile_operand(Node *ast, Node *site_ast, bool copy)
+{
+  if (ast->get_tag() == AST_ASSIGNMENT)
+  {
+    emit(ROP_FAIL, {site(site_ast)});
+    return alloc();
+  }
+  int reg = compile_expr(ast, -1);
+  if (copy && reg < int(m_chunk->num_locals))
+  {
+    int temp = alloc();
+    emit(ROP_MOVE, {temp, reg});
+    reg = temp;
+  }
+  if (!ast->is_numeric())
+  {
+    emit(ROP_NUMERIC, {reg, site(site_ast)});
+  }
+  return reg;
+}
+
+void RegisterCompiler::compile_jump(Node *cond, Node *site_ast, bool when, std::vector<unsigned> &jumps)
+{
+  int tag = cond->get_tag();
+  unsigned mark = m_next;
+
+  // Both operands decide one way, either one the other way
+  if (tag == AST_LOGICAL_AND || tag == AST_LOGICAL_OR)
+  {
+    if (when == (tag == AST_LOGICAL_OR))
+    {
+      compile_jump(cond->get_kid(0), cond, when, jumps);
+      compile_jump(cond->get_kid(1), cond, when, jumps);
+    }
+    else
+    {
+      std::vector<unsigned> skip;
+      compile_jump(cond->get_kid(0), cond, !when, skip);
+      compile_jump(cond->get_kid(1), cond, when, jumps);
+      patch(skip);
+    }
+    return;
+  }
+
+  int op = compare_opcode(when ? tag : negate_compare(tag), true);
+  if (op >= 0)
+  {
+    int left = compile_operand(cond->get_kid(0), cond, assigns(cond->get_kid(1)));
+    int right = compile_operand(cond->get_kid(1), cond, false);
+    emit(op, {left, right, -1});
+  }
+  else
+  {
+    int reg = compile_operand(cond, site_ast, false);
+    emit(when ? ROP_JUMP_NONZERO : ROP_JUMP_ZERO, {reg, -1});
+  }
+  jumps.push_back(unsigned(m_chunk->code.size() - 1));
+  m_next = mark;
+}
+
+int RegisterCompiler::local(Node *ref)
+{
+  int base = m_bases[m_bases.size() - 1 - ref->get_depth()];
+  return base < 0 ? -1 : base + ref->get_slot();
+}
+
+int RegisterCompiler::alloc()
+{
+  m_chunk->max_stack = std::max(m_chunk->max_stack, m_next + 1 - m_chunk->num_locals);
+  return int(m_next++);
+}
+
+void RegisterCompiler::emit(int op, std::initializer_list<int> operands)
+{
+  m_chunk->code.push_back(op);
+  m_chunk->code.insert(m_chunk->code.end(), operands);
+}
+
+int RegisterCompiler::site(Node *ast)
+{
+  m_chunk->sites.push_back(ast);
+  return int(m_chunk->sites.size() - 1);
+}
+
+void RegisterCompiler::patch(const std::vector<unsigned> &jumps)
+{
+  for (auto i = jumps.begin(); i != jumps.end(); ++i)
+  {
+    m_chunk->code[*i] = int(m_chunk->code.size());
+  }
+}
+
+bool RegisterCompiler::assigns(Node *ast)
+{
+  if (ast->get_tag() == AST_ASSIGNMENT)
+  {
+    return true;
+  }
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    if (assigns(ast->get_kid(i)))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void RegisterCompiler::disassemble(const Chunk *chunk)
+{
+  printf("%s: %u params, %u locals, %u temporaries\n", chunk->name.c_str(), chunk->num_params, chunk->num_locals,
+         chunk->max_stack);
+  unsigned pc = 0;
+  while (pc < chunk->code.size())
+  {
+    const RegOpcodeInfo &info = REG_OPCODES[chunk->code[pc]];
+    printf(*info.operands != '\0' ? "  %4u  %-18s" : "  %4u  %s", pc, info.name);
+    pc++;
+    for (const char *kind = info.operands; *kind != '\0'; kind++, pc++)
+    {
+      int operand = chunk->code[pc];
+      const char *sep = kind == info.operands ? " " : ", ";
+      switch (*kind)
+      {
+      case 'r':
+        printf("%sr%d", sep, operand);
+        break;
+      case 'g':
+        printf("%sg%d", sep, operand);
+        break;
+      case 'L':
+        printf("%s@%d", sep, operand);
+        break;
+      case 's':
+      {
+        const Location &loc = chunk->sites[operand]->get_loc();
+        printf("  ; %d:%d", loc.get_line(), loc.get_col());
+        break;
+      }
+      default:
+        printf("%s%d", sep, operand);
+        break;
+      }
+    }
+    printf("\n");
+  }
+}
@@ -0,0 +1,118 @@
+#ifndef REGCOMPILER_H
+#define REGCOMPILER_H
+
+#include <vector>
+#include <initializer_list>
+#include "bytecode.h"
+class Node;
+
+// Instructions of the register VM. Operands follow the opcode: r is a
+// register of the current call's window, g a global slot, k a constant,
+// L a code offset, and "site" indexes the chunk's table of ast nodes
+// (for error locations). Results are written after operands are read,
+// so a destination may also be an operand.
+enum RegOpcode {
+  ROP_LOADK,          // r k: r = k
+  ROP_MOVE,           // r1 r2: r1 = r2
+  ROP_GET_GLOBAL,     // r g: r = global g
+  ROP_SET_GLOBAL,     // g r: global g = r
+  ROP_DEFINE,         // r: r = -1
+  ROP_DEFINE_GLOBAL,  // g: global g = -1
+  ROP_NUMERIC,        // r site: fail if r isn't an integer
+  ROP_ADD,            // r1 r2 r3 site: r1 = r2 + r3, checked
+  ROP_SUB,
+  ROP_MULTIPLY,
+  ROP_DIVIDE,
+  ROP_ADD_SAFE,       // r1 r2 r3: arithmetic known not to fail
+  ROP_SUB_SAFE,
+  ROP_MULTIPLY_SAFE,
+  ROP_DIVIDE_SAFE,
+  ROP_LESS,           // r1 r2 r3: r1 = r2 < r3
+  ROP_LESS_EQUAL,
+  ROP_GREATER,
+  ROP_GREATER_EQUAL,
+  ROP_EQUAL,
+  ROP_NOT_EQUAL,
+  ROP_BOOL,           // r1 r2: r1 = r2 != 0
+  ROP_JUMP,           // L
+  ROP_JUMP_ZERO,      // r L: jump if r is 0
+  ROP_JUMP_NONZERO,   // r L: jump if r isn't 0
+  ROP_JUMP_LESS,      // r1 r2 L: jump if r1 < r2
+  ROP_JUMP_LESS_EQUAL,
+  ROP_JUMP_GREATER,
+  ROP_JUMP_GREATER_EQUAL,
+  ROP_JUMP_EQUAL,
+  ROP_JUMP_NOT_EQUAL,
+  ROP_FUNCTION,       // chunk g: define a function in global g
+  ROP_CALLEE,         // r n site: check r is callable with n args
+  ROP_CALL,           // r n site: call r with the n registers after it,
+                      // leaving the result in r
+  ROP_RETURN,         // r: return r from a function
+  ROP_FAIL,           // site: call of an undefined name, or operator or
+                      // condition whose operand is an assignment
+  ROP_HALT,           // r: end of the unit, with r as its result
+  NUM_REG_OPCODES,
+};
+
+// Compiles the (analyzed and optimized) unit to code for the register
+// VM. A call's registers start with the locals (parameters first, then
+// the variables of the body and its nested blocks, as for the stack VM)
+// followed by temporaries, which are allocated like a stack while an
+// expression is compiled. Variables are used as operands directly;
+// conditions of if and while compile to compare-and-jump instructions.
+//
+// Chunks use max_stack for the number of temporaries. Chunk 0 is the
+// unit, the others are its functions in order.
+class RegisterCompiler {
+private:
+  std::vector<Chunk *> m_chunks;
+  Chunk *m_chunk;
+
+  // Base local of each enclosing block (-1 for the unit's globals),
+  // the next free local, and the next free register
+  std::vector<int> m_bases;
+  unsigned m_num_locals;
+  unsigned m_next;
+
+  // copy constructor and assignment operator prohibited
+  RegisterCompiler(const RegisterCompiler &);
+  RegisterCompiler &operator=(const RegisterCompiler &);
+
+public:
+  RegisterCompiler();
+  ~RegisterCompiler();
+
+  // Compile the unit, returning its chunks (which the caller owns)
+  std::vector<Chunk *> compile(Node *unit);
+
+  // Print a chunk's instructions
+  static void disassemble(const Chunk *chunk);
+
+private:
+  void compile_chunk(Chunk *chunk, Node *body, unsigned level_slots, bool unit);
+  int compile_block(Node *block, bool want);
+  int compile_list(Node *list, bool want);
+  int compile_stmt(Node *stmt, bool want);
+
+  // Compile an expression, returning the register holding its value
+  // (dst if it isn't negative, otherwise possibly a variable's own)
+  int compile_expr(Node *ast, int dst);
+  int compile_call(Node *ast, int dst);
+  int compile_operand(Node *ast, Node *site, bool copy);
+
+  // Jump to the targets added to jumps if a condition is (or isn't)
+  // true, checking that it is numeric at site
+  void compile_jump(Node *cond, Node *site, bool when, std::vector<unsigned> &jumps);
+
+  // Register of a local variable, or -1 for a global
+  int local(Node *ref);
+
+  int alloc();
+  void emit(int op, std::initializer_list<int> operands);
+  int site(Node *ast);
+  void patch(const std::vector<unsigned> &jumps);
+
+  static bool assigns(Node *ast);
+};
+
+#endif // REGCOMPILER_H
@@ -0,0 +1,408 @@
+#include <algorithm>
+#include "ast.h"
+#include "node.h"
+#include "exceptions.h"
+#include "function.h"
+#include "environment.h"
+#include "memo.h"
+#include "regcompiler.h"
+#include "nativecode.h"
+#include "jit.h"
+#include "interp.h"
+#include "dispatch.h"
+#include "regvm.h"
+
+RegisterVM::RegisterVM(Interpreter *interp, Environment *globals, const std::vector<Chunk *> &chunks,
+                       unsigned jit_threshold)
+    : m_interp(interp), m_globals(globals), m_chunks(chunks), m_jit_threshold(jit_threshold),
+      m_calls(chunks.size(), 0), m_native(chunks.size(), nullptr), m_native_depth(0)
+{
+}
+
+RegisterVM::~RegisterVM()
+{
+  for (auto i = m_chunks.begin(); i != m_chunks.end(); ++i)
+  {
+    delete *i;
+  }
+  for (auto i = m_native.begin(); i != m_native.end(); ++i)
+  {
+    delete *i;
+  }
+}
+
+void RegisterVM::reserve(unsigned index, unsigned count)
+{
+  if (index + count > m_regs.size())
+  {
+    m_regs.resize(std::max(index + count, unsigned(2 * m_regs.size())));
+  }
+}
+
+Value RegisterVM::run()
+{
+  const Chunk *chunk = m_chunks[0];
+  reserve(0, chunk->num_locals + chunk->max_stack);
+  return execute(chunk, chunk->code.data(), 0);
+}
+
+Value RegisterVM::execute(const Chunk *chunk, const int *pc, unsigned base)
+{
+  size_t depth = m_frames.size();
+  Value *r = &m_regs[base];
+
+#ifdef THREADED_DISPATCH
+  static const void *const OPCODE_LABELS[] = {
+    LABEL(ROP_LOADK), LABEL(ROP_MOVE), LABEL(ROP_GET_GLOBAL), LABEL(ROP_SET_GLOBAL),
+    LABEL(ROP_DEFINE), LABEL(ROP_DEFINE_GLOBAL), LABEL(ROP_NUMERIC), LABEL(ROP_ADD), LABEL(ROP_SUB),
+    LABEL(ROP_MULTIPLY), LABEL(ROP_DIVIDE), LABEL(ROP_ADD_SAFE), LABEL(ROP_SUB_SAFE),
+    LABEL(ROP_MULTIPLY_SAFE), LABEL(ROP_DIVIDE_SAFE), LABEL(ROP_LESS), LABEL(ROP_LESS_EQUAL),
+    LABEL(ROP_GREATER), LABEL(ROP_GREATER_EQUAL), LABEL(ROP_EQUAL), LABEL(ROP_NOT_EQUAL),
+    LABEL(ROP_BOOL), LABEL(ROP_JUMP), LABEL(ROP_JUMP_ZERO), LABEL(ROP_JUMP_NONZERO),
+    LABEL(ROP_JUMP_LESS), LABEL(ROP_JUMP_LESS_EQUAL), LABEL(ROP_JUMP_GREATER),
+    LABEL(ROP_JUMP_GREATER_EQUAL), LABEL(ROP_JUMP_EQUAL), LABEL(ROP_JUMP_NOT_EQUAL),
+    LABEL(ROP_FUNCTION), LABEL(ROP_CALLEE), LABEL(ROP_CALL), LABEL(ROP_RETURN), LABEL(ROP_FAIL),
+    LABEL(ROP_HALT),
+  };
+  static_assert(sizeof(OPCODE_LABELS) / sizeof(OPCODE_LABELS[0]) == NUM_REG_OPCODES, "missing handler");
+#endif
+
+  DISPATCH()
+  {
+  INSTRUCTION(ROP_LOADK):
+    r[pc[0]] = Value(pc[1]);
+    pc += 2;
+    NEXT();
+
+  INSTRUCTION(ROP_MOVE):
+    r[pc[0]] = r[pc[1]];
+    pc += 2;
+    NEXT();
+
+  INSTRUCTION(ROP_GET_GLOBAL):
+    r[pc[0]] = m_globals->lookup(pc[1]);
+    pc += 2;
+    NEXT();
+
+  INSTRUCTION(ROP_SET_GLOBAL):
+    m_globals->assign(pc[0], r[pc[1]]);
+    pc += 2;
+    NEXT();
+
+  INSTRUCTION(ROP_DEFINE):
+    r[*pc++] = Value(-1);
+    NEXT();
+
+  INSTRUCTION(ROP_DEFINE_GLOBAL):
+    m_globals->define(*pc++);
+    NEXT();
+
+  INSTRUCTION(ROP_NUMERIC):
+    if (!r[pc[0]].is_numeric())
+    {
+      EvaluationError::raise(chunk->sites[pc[1]]->get_loc(), "Non-numeric condition");
+    }
+    pc += 2;
+    NEXT();
+
+  INSTRUCTION(ROP_ADD):
+  INSTRUCTION(ROP_SUB):
+  INSTRUCTION(ROP_MULTIPLY):
+  INSTRUCTION(ROP_DIVIDE):
+  {
+    Node *site = chunk->sites[pc[3]];
+    r[pc[0]] = Interpreter::doOp(site->get_tag(), r[pc[1]].get_ival(), r[pc[2]].get_ival(), site);
+    pc += 4;
+    NEXT();
+  }
+
+  INSTRUCTION(ROP_ADD_SAFE):
+    r[pc[0]] = Value(r[pc[1]].get_ival() + r[pc[2]].get_ival());
+    pc += 3;
+    NEXT();
+
+  INSTRUCTION(ROP_SUB_SAFE):
+    r[pc[0]] = Value(r[pc[1]].get_ival() - r[pc[2]].get_ival());
+    pc += 3;
+    NEXT();
+
+  INSTRUCTION(ROP_MULTIPLY_SAFE):
+    r[pc[0]] = Value(r[pc[1]].get_ival() * r[pc[2]].get_ival());
+    pc += 3;
+    NEXT();
+
+  INSTRUCTION(ROP_DIVIDE_SAFE):
+    r[pc[0]] = Value(r[pc[1]].get_ival() / r[pc[2]].get_ival());
+    pc += 3;
+    NEXT();
+
+  INSTRUCTION(ROP_LESS):
+    r[pc[0]] = Value(r[pc[1]].get_ival() < r[pc[2]].get_ival() ? 1 : 0);
+    pc += 3;
+    NEXT();
+
+  INSTRUCTION(ROP_LESS_EQUAL):
+    r[pc[0]] = Value(r[pc[1]].get_ival() <= r[pc[2]].get_ival() ? 1 : 0);
+    pc += 3;
+    NEXT();
+
+  INSTRUCTION(ROP_GREATER):
+    r[pc[0]] = Value(r[pc[1]].get_ival() > r[pc[2]].get_ival() ? 1 : 0);
+    pc += 3;
+    NEXT();
+
+  INSTRUCTION(ROP_GREATER_EQUAL):
+    r[pc[0]] = Value(r[pc[1]].get_ival() >= r[pc[2]].get_ival() ? 1 : 0);
+    pc += 3;
+    NEXT();
+
+  INSTRUCTION(ROP_EQUAL):
+    r[pc[0]] = Value(r[pc[1]].get_ival() == r[pc[2]].get_ival() ? 1 : 0);
+    pc += 3;
+    NEXT();
+
+  INSTRUCTION(ROP_NOT_EQUAL):
+    r[pc[0]] = Value(r[pc[1]].get_ival() != r[pc[2]].get_ival() ? 1 : 0);
+    pc += 3;
+    NEXT();
+
+  INSTRUCTION(ROP_BOOL):
+    r[pc[0]] = Value(r[pc[1]].get_ival() != 0 ? 1 : 0);
+    pc += 2;
+    NEXT();
+
+  INSTRUCTION(ROP_JUMP):
+    pc = chunk->code.data() + *pc;
+    NEXT();
+
+  INSTRUCTION(ROP_JUMP_ZERO):
+    pc = r[pc[0]].get_ival() == 0 ? chunk->code.data() + pc[1] : pc + 2;
+    NEXT();
+
+  INSTRUCTION(ROP_JUMP_NONZERO):
+    pc = r[pc[0]].get_ival() != 0 ? chunk->code.data() + pc[1] : pc + 2;
+    NEXT();
+
+  INSTRUCTION(ROP_JUMP_LESS):
+    pc = r[pc[0]].get_ival() < r[pc[1]].get_ival() ? chunk->code.data() + pc[2] : pc + 3;
+    NEXT();
+
+  INSTRUCTION(ROP_JUMP_LESS_EQUAL):
+    pc = r[pc[0]].get_ival() <= r[pc[1]].get_ival() ? chunk->code.data() + pc[2] : pc + 3;
+    NEXT();
+
+  INSTRUCTION(ROP_JUMP_GREATER):
+    pc = r[pc[0]].get_ival() > r[pc[1]].get_ival() ? chunk->code.data() + pc[2] : pc + 3;
+    NEXT();
+
+  INSTRUCTION(ROP_JUMP_GREATER_EQUAL):
+    pc = r[pc[0]].get_ival() >= r[pc[1]].get_ival() ? chunk->code.data() + pc[2] : pc + 3;
+    NEXT();
+
+  INSTRUCTION(ROP_JUMP_EQUAL):
+    pc = r[pc[0]].get_ival() == r[pc[1]].get_ival() ? chunk->code.data() + pc[2] : pc + 3;
+    NEXT();
+
+  INSTRUCTION(ROP_JUMP_NOT_EQUAL):
+    pc = r[pc[0]].get_ival() != r[pc[1]].get_ival() ? chunk->code.data() + pc[2] : pc + 3;
+    NEXT();
+
+  INSTRUCTION(ROP_FUNCTION):
+  {
+    Function *fn = m_interp->define_function(m_chunks[pc[0]]->fn, m_globals);
+    fn->set_code(pc[0]);
+    pc += 2;
+    NEXT();
+  }
+
+  INSTRUCTION(ROP_CALLEE):
+  {
+    const Value &callee = r[pc[0]];
+    if (callee.get_kind() == VALUE_FUNCTION)
+    {
+      if (callee.get_function()->get_num_params() != unsigned(pc[1]))
+      {
+        EvaluationError::raise(chunk->sites[pc[2]]->get_loc(), "Invalid params");
+      }
+    }
+    else if (callee.get_kind() != VALUE_INTRINSIC_FN)
+    {
+      EvaluationError::raise(chunk->sites[pc[2]]->get_loc(), "Invalid function");
+    }
+    pc += 3;
+    NEXT();
+  }
+
+  INSTRUCTION(ROP_CALL):
+  {
+    unsigned index = base + unsigned(pc[0]);
+    unsigned num_args = unsigned(pc[1]);
+    Node *site = chunk->sites[pc[2]];
+    pc += 3;
+    Function *fn = begin_call(chunk, pc, base, index, num_args, site);
+    if (fn == nullptr)
+    {
+      NEXT();
+    }
+
+    chunk = m_chunks[fn->get_code()];
+    base = index + 1;
+    int resume = run_native(fn, base);
+    r = &m_regs[base];
+    if (resume == NativeCode::COMPLETED)
+    {
+      goto returned;
+    }
+    pc = chunk->code.data() + resume;
+    NEXT();
+  }
+
+  // The result replaces the callee
+  INSTRUCTION(ROP_RETURN):
+    r[-1] = r[*pc];
+  returned:
+  {
+    Frame frame = end_call(base);
+    if (m_frames.size() < depth)
+    {
+      return r[-1];
+    }
+    chunk = frame.chunk;
+    pc = frame.pc;
+    base = frame.base;
+    r = &m_regs[base];
+    NEXT();
+  }
+
+  INSTRUCTION(ROP_FAIL):
+    EvaluationError::raise(chunk->sites[*pc]->get_loc(),
+                           chunk->sites[*pc]->get_tag() == AST_FNCALL ? "Invalid function" : "Non-numeric condition");
+
+  INSTRUCTION(ROP_HALT):
+    return r[*pc];
+  }
+}
+
+Function *RegisterVM::begin_call(const Chunk *chunk, const int *pc, unsigned base, unsigned index,
+                                 unsigned num_args, Node *site)
+{
+  Value *callee = &m_regs[index];
+  if (callee->get_kind() == VALUE_INTRINSIC_FN)
+  {
+    *callee = callee->get_intrinsic_fn()(callee + 1, num_args, site->get_loc(), m_interp);
+    return nullptr;
+  }
+
+  // A memoized function's cached result replaces the call
+  Function *fn = callee->get_function();
+  MemoCache *memo = fn->get_memo();
+  std::vector<int> key;
+  if (memo != nullptr)
+  {
+    int cached;
+    if (!Interpreter::memo_key(std::vector<Value>(callee + 1, callee + 1 + num_args), key))
+    {
+      memo = nullptr;
+    }
+    else if (memo->lookup(key, cached))
+    {
+      *callee = Value(cached);
+      return nullptr;
+    }
+  }
+
+  m_frames.push_back({chunk, pc, base, memo, std::vector<int>()});
+  m_frames.back().key.swap(key);
+
+  // The arguments are the first locals of the callee
+  const Chunk *code = m_chunks[fn->get_code()];
+  reserve(index + 1, code->num_locals + code->max_stack);
+  Value *r = &m_regs[index + 1];
+  for (unsigned i = num_args; i < code->num_locals; i++)
+  {
+    r[i] = Value();
+  }
+  return fn;
+}
+
+RegisterVM::Frame RegisterVM::end_call(unsigned base)
+{
+  Frame frame = std::move(m_frames.back());
+  m_frames.pop_back();
+  const Value &result = m_regs[base - 1];
+  if (frame.memo != nullptr && result.is_numeric())
+  {
+    frame.memo->insert(frame.key, result.get_ival());
+  }
+  return frame;
+}
+
+Value *RegisterVM::native_call(RegisterVM *vm, Value *r, int callee, int num_args, Node *site)
+{
+  unsigned base = unsigned(r - &vm->m_regs[0]);
+  try
+  {
+    vm->call_value(base + unsigned(callee), unsigned(num_args), site);
+  }
+  catch (...)
+  {
+    // Exceptions can't unwind through native code
+    vm->m_error = std::current_exception();
+    return nullptr;
+  }
+  return &vm->m_regs[base];
+}
+
+void RegisterVM::call_value(unsigned index, unsigned num_args, Node *site)
+{
+  Function *fn = begin_call(nullptr, nullptr, 0, index, num_args, site);
+  if (fn == nullptr)
+  {
+    return;
+  }
+
+  unsigned base = index + 1;
+  int resume = run_native(fn, base);
+  if (resume == NativeCode::COMPLETED)
+  {
+    end_call(base);
+  }
+  else
+  {
+    const Chunk *chunk = m_chunks[fn->get_code()];
+    execute(chunk, chunk->code.data() + resume, base);
+  }
+}
+
+int RegisterVM::run_native(Function *fn, unsigned base)
+{
+  if (m_jit_threshold == 0)
+  {
+    return 0;
+  }
+
+  // Functions are compiled once they are hot
+  NativeCode *&native = m_native[fn->get_code()];
+  if (native == nullptr)
+  {
+    if (++m_calls[fn->get_code()] < m_jit_threshold)
+    {
+      return 0;
+    }
+    JitCompiler jit(m_globals, &RegisterVM::native_call);
+    native = jit.compile(m_chunks[fn->get_code()]);
+  }
+  if (m_native_depth == MAX_NATIVE_DEPTH)
+  {
+    return 0;
+  }
+
+  m_native_depth++;
+  int resume = native->run(&m_regs[base], this);
+  m_native_depth--;
+  if (resume == NativeCode::FAILED)
+  {
+    std::rethrow_exception(m_error);
+  }
+  return resume;
+}
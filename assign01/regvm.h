@@ -0,0 +1,105 @@
+#ifndef REGVM_H
+#define REGVM_H
+
+#include <vector>
+#include <exception>
+#include "value.h"
+class Interpreter;
+class Environment;
+class MemoCache;
+class Function;
+class Node;
+class NativeCode;
+struct Chunk;
+
+// Register-based virtual machine running the code of RegisterCompiler.
+// The registers of all active calls are kept in one array: a call's
+// window starts with its arguments, which the caller evaluated into the
+// registers following the callee, and its result replaces the callee.
+// Globals are the slots of the unit's Environment, as for StackVM.
+//
+// With the JIT enabled, a function called often enough is compiled to
+// machine code (see JitCompiler), which its later calls run instead.
+// Native code calls functions through the VM, and leaves whatever it
+// can't handle to be interpreted from the instruction where it stopped.
+class RegisterVM {
+public:
+  static const unsigned DEFAULT_JIT_THRESHOLD = 100;
+
+  // Native calls nested deeper than this are interpreted, so deep
+  // recursion doesn't overflow the C++ stack
+  static const unsigned MAX_NATIVE_DEPTH = 1000;
+
+private:
+  // Caller state saved by a call
+  struct Frame {
+    const Chunk *chunk;
+    const int *pc;
+    unsigned base;
+
+    // Cache to store the result in, with its key
+    MemoCache *memo;
+    std::vector<int> key;
+  };
+
+  Interpreter *m_interp;
+  Environment *m_globals;
+  std::vector<Chunk *> m_chunks;
+
+  std::vector<Value> m_regs;
+  std::vector<Frame> m_frames;
+
+  // Calls of each chunk after which it is compiled (0 if never), the
+  // calls so far, its machine code (which the VM owns), and the number
+  // of native calls active
+  unsigned m_jit_threshold;
+  std::vector<unsigned> m_calls;
+  std::vector<NativeCode *> m_native;
+  unsigned m_native_depth;
+
+  // Error raised in a call made by native code
+  std::exception_ptr m_error;
+
+  // copy constructor and assignment operator prohibited
+  RegisterVM(const RegisterVM &);
+  RegisterVM &operator=(const RegisterVM &);
+
+public:
+  // Run the chunks of a unit (which the VM adopts) with the given globals
+  RegisterVM(Interpreter *interp, Environment *globals, const std::vector<Chunk *> &chunks,
+             unsigned jit_threshold = 0);
+  ~RegisterVM();
+
+  // Execute the unit, returning the value of its last statement
+  Value run();
+
+  // Make a call for native code (see JitCompiler::CallHelper)
+  static Value *native_call(RegisterVM *vm, Value *r, int callee, int num_args, Node *site);
+
+private:
+  // Execute from pc until the call whose window starts at base returns
+  // (or the unit ends), returning its result
+  Value execute(const Chunk *chunk, const int *pc, unsigned base);
+
+  // Start a call of the callee in register index, saving the caller's
+  // state. Intrinsics and cached results are done at once (returning
+  // null), otherwise the callee's window is set up and it is returned.
+  Function *begin_call(const Chunk *chunk, const int *pc, unsigned base, unsigned index, unsigned num_args,
+                       Node *site);
+
+  // Finish the call whose window starts at base (after its result
+  // has replaced the callee), returning the caller's state
+  Frame end_call(unsigned base);
+
+  // Make a call from native code, interpreting it if needed
+  void call_value(unsigned index, unsigned num_args, Node *site);
+
+  // Run a call's native code (compiling it if the function has become
+  // hot), returning NativeCode::COMPLETED or where to interpret from
+  int run_native(Function *fn, unsigned base);
+
+  // Make room for count registers starting at index
+  void reserve(unsigned index, unsigned count);
+};
+
+#endif // REGVM_H
@@ -0,0 +1,72 @@
+#include "scope.h"
+
+Scope::Scope(Scope *parent, bool is_function)
+    : m_parent(parent), m_num_slots(0), m_level(0), m_in_function(is_function), m_captured(false)
+{
+  if (m_parent != nullptr)
+  {
+    m_level = m_parent->m_level + 1;
+    m_in_function = m_in_function || m_parent->m_in_function;
+  }
+}
+
+Scope::~Scope()
+{
+}
+
+// Return parent
+Scope *Scope::getParent()
+{
+  return m_parent;
+}
+
+// Mark scope chain as captured
+void Scope::capture()
+{
+  for (Scope *s = this; s != nullptr && !s->m_captured; s = s->m_parent)
+  {
+    s->m_captured = true;
+  }
+}
+
+// Check if name is defined in this scope
+bool Scope::has(const std::string &name) const
+{
+  return m_slots.count(name) != 0;
+}
+
+// Define a name, reusing its slot if already defined
+ScopeEntry Scope::define(const std::string &name, int symbol)
+{
+  auto i = m_slots.find(name);
+  if (i != m_slots.end())
+  {
+    return i->second;
+  }
+  return define_fresh(name, symbol);
+}
+
+// Define a name in a new slot
+ScopeEntry Scope::define_fresh(const std::string &name, int symbol)
+{
+  ScopeEntry entry = {m_num_slots++, symbol};
+  m_slots[name] = entry;
+  return entry;
+}
+
+// Walk up the scope chain looking for name
+bool Scope::resolve(const std::string &name, int &depth, ScopeEntry &entry) const
+{
+  depth = 0;
+  for (const Scope *s = this; s != nullptr; s = s->m_parent)
+  {
+    auto i = s->m_slots.find(name);
+    if (i != s->m_slots.end())
+    {
+      entry = i->second;
+      return true;
+    }
+    depth++;
+  }
+  return false;
+}
@@ -0,0 +1,67 @@
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#include <map>
+#include <string>
+
+// A name defined in a scope: its slot, and the program-wide
+// symbol number identifying the variable
+struct ScopeEntry {
+  unsigned slot;
+  int symbol;
+};
+
+// Compile-time counterpart of an Environment: maps the names defined
+// in a block to slot indices, so that Interpreter::analyze can resolve
+// every name to a (depth, slot) lexical address.
+class Scope {
+private:
+  Scope *m_parent;
+  std::map<std::string, ScopeEntry> m_slots;
+  unsigned m_num_slots;
+  unsigned m_level;
+  bool m_in_function;
+  bool m_captured;
+
+  // copy constructor and assignment operator prohibited
+  Scope(const Scope &);
+  Scope &operator=(const Scope &);
+
+public:
+  Scope(Scope *parent = nullptr, bool is_function = false);
+  ~Scope();
+
+  // Return parent of this scope
+  Scope *getParent();
+
+  // Nesting level (0 for the global scope)
+  unsigned get_level() const { return m_level; }
+
+  // True if this scope is (or is nested in) a function body
+  bool in_function() const { return m_in_function; }
+
+  // Number of slots the corresponding Environment needs
+  unsigned get_num_slots() const { return m_num_slots; }
+
+  // Note that a function is defined in this scope, so this scope and
+  // all enclosing ones can be referenced after their block finishes
+  void capture();
+  bool is_captured() const { return m_captured; }
+
+  // Check if name is defined in this scope
+  bool has(const std::string &name) const;
+
+  // Define a name as the given symbol, returning its entry. A name
+  // which is already defined keeps its slot and symbol.
+  ScopeEntry define(const std::string &name, int symbol);
+
+  // Define a name in a fresh slot, even if it was already defined
+  // (used for parameters, which always occupy slots 0..n-1)
+  ScopeEntry define_fresh(const std::string &name, int symbol);
+
+  // Find name in this scope or an enclosing one, returning false
+  // if it is not defined anywhere
+  bool resolve(const std::string &name, int &depth, ScopeEntry &entry) const;
+};
+
+#endif // SCOPE_H
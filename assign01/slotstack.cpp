@@ -0,0 +1,50 @@
+#include "slotstack.h"
+
+// Number of slots allocated at once
+const unsigned CHUNK_SIZE = 4096;
+
+SlotStack::SlotStack()
+    : m_chunk(0), m_top(0)
+{
+  m_chunks.push_back(new Value[CHUNK_SIZE]);
+  m_chunk_sizes.push_back(CHUNK_SIZE);
+}
+
+SlotStack::~SlotStack()
+{
+  for (auto i = m_chunks.begin(); i != m_chunks.end(); ++i)
+  {
+    delete[] *i;
+  }
+}
+
+Value *SlotStack::push(unsigned num_slots)
+{
+  // Continue in the next chunk if this one is full
+  if (m_top + num_slots > m_chunk_sizes[m_chunk])
+  {
+    m_chunk++;
+    m_top = 0;
+
+    unsigned size = num_slots > CHUNK_SIZE ? num_slots : CHUNK_SIZE;
+    if (m_chunk == m_chunks.size())
+    {
+      m_chunks.push_back(new Value[size]);
+      m_chunk_sizes.push_back(size);
+    }
+    else if (m_chunk_sizes[m_chunk] < size)
+    {
+      delete[] m_chunks[m_chunk];
+      m_chunks[m_chunk] = new Value[size];
+      m_chunk_sizes[m_chunk] = size;
+    }
+  }
+
+  Value *slots = m_chunks[m_chunk] + m_top;
+  m_top += num_slots;
+  for (unsigned int i = 0; i < num_slots; i++)
+  {
+    slots[i] = Value();
+  }
+  return slots;
+}
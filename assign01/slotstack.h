@@ -0,0 +1,40 @@
+#ifndef SLOTSTACK_H
+#define SLOTSTACK_H
+
+#include <vector>
+#include "value.h"
+
+// Region of memory for the slots of environments which can't outlive
+// the block or call that creates them. Slots are allocated and freed
+// in LIFO order, in chunks which are kept and reused.
+class SlotStack {
+public:
+  // Position in the stack, used to free everything allocated after it
+  struct Mark {
+    unsigned chunk;
+    unsigned top;
+  };
+
+private:
+  std::vector<Value *> m_chunks;
+  std::vector<unsigned> m_chunk_sizes;
+  unsigned m_chunk, m_top;
+
+  // copy constructor and assignment operator prohibited
+  SlotStack(const SlotStack &);
+  SlotStack &operator=(const SlotStack &);
+
+public:
+  SlotStack();
+  ~SlotStack();
+
+  Mark get_mark() const { return {m_chunk, m_top}; }
+
+  // Allocate num_slots (initialized) slots
+  Value *push(unsigned num_slots);
+
+  // Free everything allocated since mark was taken
+  void pop(const Mark &mark) { m_chunk = mark.chunk; m_top = mark.top; }
+};
+
+#endif // SLOTSTACK_H
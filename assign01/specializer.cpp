@@ -0,0 +1,267 @@
+#include "ast.h"
+#include "node.h"
+#include "inliner.h"
+#include "specializer.h"
+
+Specializer::Specializer(unsigned num_symbols, unsigned max_clones)
+    : m_max_clones(max_clones), m_num_assigns(num_symbols, 0), m_exact_fn(num_symbols, nullptr),
+      m_defined(num_symbols, false), m_changed(false)
+{
+}
+
+Specializer::~Specializer()
+{
+}
+
+bool Specializer::run(Node *unit)
+{
+  collect(unit);
+
+  // A symbol defined by a single function definition always holds it
+  for (unsigned int i = 0; i < m_exact_fn.size(); i++)
+  {
+    if (m_exact_fn[i] != nullptr && m_num_assigns[i] != 1)
+    {
+      m_exact_fn[i] = nullptr;
+    }
+  }
+
+  m_changed = false;
+  specialize_calls(unit);
+
+  // Define the new clones right after their function, so they exist
+  // wherever a call to the function could be made
+  for (unsigned int i = 0; i < unit->get_num_kids(); i++)
+  {
+    auto clones = m_new_clones.find(unit->get_kid(i));
+    if (clones != m_new_clones.end())
+    {
+      for (auto j = clones->second.begin(); j != clones->second.end(); ++j)
+      {
+        unit->insert_kid(++i, *j);
+      }
+    }
+  }
+  return m_changed;
+}
+
+void Specializer::collect(Node *unit)
+{
+  unit->preorder([this](Node *n) {
+    if (n->get_tag() == AST_ASSIGNMENT)
+    {
+      m_num_assigns[n->get_kid(0)->get_symbol()]++;
+    }
+    else if (n->get_tag() == AST_DEFINITION && n->has_address())
+    {
+      m_num_assigns[n->get_symbol()]++;
+    }
+    else if (n->get_tag() == AST_FUNCTION)
+    {
+      m_num_assigns[n->get_symbol()]++;
+      m_exact_fn[n->get_symbol()] = n;
+
+      // Clones made earlier count towards their function's limit
+      std::string name = n->get_kid(0)->get_str();
+      size_t sep = name.find('$');
+      if (sep != std::string::npos)
+      {
+        m_clones[name.substr(0, sep)].push_back(name);
+      }
+    }
+  });
+}
+
+void Specializer::specialize_calls(Node *ast)
+{
+  if (ast->get_tag() == AST_FUNCTION)
+  {
+    // The body can only run after the definition (and the clones which
+    // follow it), so calls in it to the function itself are included
+    m_defined[ast->get_symbol()] = true;
+    specialize_calls(ast->get_last_kid());
+    return;
+  }
+
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    specialize_calls(ast->get_kid(i));
+  }
+
+  if (ast->get_tag() == AST_FNCALL && ast->has_address())
+  {
+    Node *fn = m_exact_fn[ast->get_symbol()];
+    if (fn != nullptr && m_defined[ast->get_symbol()])
+    {
+      specialize(ast, fn);
+    }
+  }
+}
+
+void Specializer::specialize(Node *call, Node *fn)
+{
+  // Clones aren't specialized further (calls to the function with
+  // more constants get their own clone)
+  std::string base = fn->get_kid(0)->get_str();
+  if (base.find('$') != std::string::npos)
+  {
+    return;
+  }
+
+  // Wrong number of arguments is an error at runtime
+  Node *params = fn->get_num_kids() == 3 ? fn->get_kid(1) : nullptr;
+  Node *args = call->get_num_kids() > 0 ? call->get_kid(0) : nullptr;
+  unsigned num_params = params != nullptr ? params->get_num_kids() : 0;
+  unsigned num_args = args != nullptr ? args->get_num_kids() : 0;
+  if (num_params != num_args)
+  {
+    return;
+  }
+
+  // Only literal arguments the body uses are worth specializing on
+  Node *body = fn->get_last_kid();
+  std::vector<bool> constant(num_args, false);
+  std::string name = base;
+  bool any = false;
+  for (unsigned int i = 0; i < num_args; i++)
+  {
+    Node *arg = args->get_kid(i);
+    constant[i] = arg->get_tag() == AST_INT_LITERAL && is_read(body, params->get_kid(i)->get_symbol());
+    name += "$" + (constant[i] ? arg->get_str() : std::string("_"));
+    any = any || constant[i];
+  }
+  if (!any)
+  {
+    return;
+  }
+
+  std::vector<std::string> &clones = m_clones[base];
+  bool found = false;
+  for (auto i = clones.begin(); i != clones.end(); ++i)
+  {
+    found = found || *i == name;
+  }
+  if (!found)
+  {
+    if (clones.size() >= m_max_clones)
+    {
+      return;
+    }
+    clones.push_back(name);
+    m_new_clones[fn].push_back(make_clone(fn, args, constant, name));
+  }
+
+  // Call the clone with the remaining arguments
+  call->set_str(name);
+  for (unsigned int i = num_args; i-- > 0;)
+  {
+    if (constant[i])
+    {
+      delete args->remove_kid(i);
+    }
+  }
+  if (args->get_num_kids() == 0)
+  {
+    delete call->remove_kid(0);
+  }
+  m_changed = true;
+}
+
+Node *Specializer::make_clone(Node *fn, Node *args, const std::vector<bool> &constant, const std::string &name)
+{
+  Node *params = fn->get_kid(1);
+  Node *body = Inliner::copy(fn->get_last_kid());
+  Node *kept = new Node(AST_P_LIST);
+  unsigned num_set = 0;
+
+  for (unsigned int i = 0; i < constant.size(); i++)
+  {
+    Node *param = params->get_kid(i);
+    if (!constant[i])
+    {
+      kept->append_kid(Inliner::copy(param));
+      continue;
+    }
+
+    // A parameter the body changes (or calls) must stay a variable
+    Node *arg = args->get_kid(i);
+    if (is_bound(body, param->get_symbol()))
+    {
+      Node *def_ref = new Node(AST_VARREF, param->get_str());
+      Node *assign_ref = new Node(AST_VARREF, param->get_str());
+      def_ref->set_loc(param->get_loc());
+      assign_ref->set_loc(param->get_loc());
+      Node *def = new Node(AST_DEFINITION, {def_ref});
+      Node *assign = new Node(AST_ASSIGNMENT, {assign_ref, Inliner::copy(arg)});
+      body->insert_kid(num_set++, new Node(AST_STATEMENT, {def}));
+      body->insert_kid(num_set++, new Node(AST_STATEMENT, {assign}));
+    }
+    else
+    {
+      replace_reads(body, param->get_symbol(), arg);
+    }
+  }
+
+  Node *fn_name = new Node(AST_VARREF, name);
+  fn_name->set_loc(fn->get_kid(0)->get_loc());
+  Node *clone = new Node(AST_FUNCTION, {fn_name});
+  clone->set_loc(fn->get_loc());
+  if (kept->get_num_kids() > 0)
+  {
+    clone->append_kid(kept);
+  }
+  else
+  {
+    delete kept;
+  }
+  clone->append_kid(body);
+  return clone;
+}
+
+void Specializer::replace_reads(Node *ast, int symbol, Node *lit)
+{
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    Node *kid = ast->get_kid(i);
+    if (kid->get_tag() == AST_VARREF && kid->has_address() && kid->get_symbol() == symbol)
+    {
+      // Errors are reported where the parameter was used
+      Node *val = new Node(AST_INT_LITERAL, lit->get_str());
+      val->set_loc(kid->get_loc());
+      ast->set_kid(i, val);
+      delete kid;
+    }
+    else if (kid->get_tag() != AST_DEFINITION)
+    {
+      replace_reads(kid, symbol, lit);
+    }
+  }
+}
+
+bool Specializer::is_read(Node *ast, int symbol)
+{
+  bool read = false;
+  ast->preorder([symbol, &read](Node *n) {
+    if ((n->get_tag() == AST_VARREF || n->get_tag() == AST_FNCALL) && n->has_address() && n->get_symbol() == symbol)
+    {
+      read = true;
+    }
+  });
+  return read;
+}
+
+bool Specializer::is_bound(Node *ast, int symbol)
+{
+  bool bound = false;
+  ast->preorder([symbol, &bound](Node *n) {
+    if (n->get_tag() == AST_ASSIGNMENT && n->get_kid(0)->has_address() && n->get_kid(0)->get_symbol() == symbol)
+    {
+      bound = true;
+    }
+    else if (n->get_tag() == AST_FNCALL && n->has_address() && n->get_symbol() == symbol)
+    {
+      bound = true;
+    }
+  });
+  return bound;
+}
@@ -0,0 +1,70 @@
+#ifndef SPECIALIZER_H
+#define SPECIALIZER_H
+
+#include <map>
+#include <string>
+#include <vector>
+class Node;
+
+// Optimization pass which clones a function for the literal arguments
+// passed at a call site, and redirects the call to the clone. The
+// clone takes only the other parameters; the constant ones are
+// replaced by the literal (or, if the body assigns or calls them,
+// defined and set from it at the start of the body), so later folding
+// can simplify the clone.
+//
+// A clone is named after the function and its arguments (e.g. f$_$10
+// for f(x, 10)), so calls with the same constants share it, and is
+// defined right after the function. Like inlining, only calls after
+// the definition of a function which is the only value of its name
+// are specialized. The number of clones of each function is capped.
+class Specializer {
+private:
+  unsigned m_max_clones;
+
+  // Number of assignments (and definitions) of each symbol
+  std::vector<unsigned> m_num_assigns;
+
+  // Function each symbol always holds (if any), and whether the
+  // definition comes before the current point
+  std::vector<Node *> m_exact_fn;
+  std::vector<bool> m_defined;
+
+  // Clones of each function (by name), including ones made by earlier
+  // runs, and the new clones to add to the unit after each function
+  std::map<std::string, std::vector<std::string>> m_clones;
+  std::map<Node *, std::vector<Node *>> m_new_clones;
+
+  bool m_changed;
+
+  // copy constructor and assignment operator prohibited
+  Specializer(const Specializer &);
+  Specializer &operator=(const Specializer &);
+
+public:
+  Specializer(unsigned num_symbols, unsigned max_clones);
+  ~Specializer();
+
+  // Specialize calls in the (analyzed) unit, returning true if any
+  // were redirected (the unit must then be analyzed again)
+  bool run(Node *unit);
+
+private:
+  void collect(Node *unit);
+
+  // Redirect calls in a tree to clones
+  void specialize_calls(Node *ast);
+  void specialize(Node *call, Node *fn);
+
+  // Clone of a function with the constant parameters removed
+  Node *make_clone(Node *fn, Node *args, const std::vector<bool> &constant, const std::string &name);
+
+  // Replace reads of a variable by copies of a literal
+  static void replace_reads(Node *ast, int symbol, Node *lit);
+
+  // How a parameter is used by a tree
+  static bool is_read(Node *ast, int symbol);
+  static bool is_bound(Node *ast, int symbol);
+};
+
+#endif // SPECIALIZER_H
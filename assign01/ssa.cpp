@@ -0,0 +1,516 @@
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include "ast.h"
+#include "node.h"
+#include "ssa.h"
+
+SSAFunction::SSAFunction(const std::string &name, const std::vector<bool> &promotable)
+    : m_name(name), m_promotable(promotable), m_result(nullptr),
+      m_current(promotable.size(), nullptr), m_entry_values(promotable.size(), nullptr),
+      m_names(promotable.size()), m_block(nullptr)
+{
+}
+
+SSAFunction::~SSAFunction()
+{
+  for (auto i = m_blocks.begin(); i != m_blocks.end(); ++i)
+  {
+    delete *i;
+  }
+  for (auto i = m_instrs.begin(); i != m_instrs.end(); ++i)
+  {
+    delete *i;
+  }
+}
+
+void SSAFunction::build_function(Node *fn)
+{
+  m_block = new_block(nullptr);
+
+  // Parameters are renamed variables set on entry
+  if (fn->get_num_kids() == 3)
+  {
+    Node *params = fn->get_kid(1);
+    for (unsigned int i = 0; i < params->get_num_kids(); i++)
+    {
+      Node *param = params->get_kid(i);
+      m_names[param->get_symbol()] = param->get_str();
+      m_current[param->get_symbol()] = emit(IR_ENTRY, 0, 0, param->get_symbol(), param->get_str(), {});
+      m_values[param] = m_current[param->get_symbol()];
+    }
+  }
+
+  set_result(build_list(fn->get_last_kid()));
+}
+
+void SSAFunction::build_unit(Node *unit, const std::vector<std::string> &intrinsics)
+{
+  m_block = new_block(nullptr);
+
+  // The intrinsics can be reassigned, so they need a value up front
+  for (unsigned int i = 0; i < intrinsics.size(); i++)
+  {
+    m_names[i] = intrinsics[i];
+    m_current[i] = emit(IR_ENTRY, 0, 0, int(i), m_names[i], {});
+  }
+
+  set_result(build_list(unit));
+}
+
+IRInstr *SSAFunction::get_value(Node *ast) const
+{
+  auto i = m_values.find(ast);
+  return i == m_values.end() ? nullptr : i->second;
+}
+
+const std::vector<IRInstr *> &SSAFunction::get_phis(Node *ast) const
+{
+  static const std::vector<IRInstr *> none;
+  auto i = m_joins.find(ast);
+  return i == m_joins.end() ? none : i->second;
+}
+
+IRInstr *SSAFunction::leader(IRInstr *instr)
+{
+  while (instr->leader != instr)
+  {
+    instr = instr->leader;
+  }
+  return instr;
+}
+
+bool SSAFunction::dominates(IRBlock *a, IRBlock *b)
+{
+  for (; b != nullptr; b = b->idom)
+  {
+    if (b == a)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Print the IR, with the results of value numbering
+void SSAFunction::print() const
+{
+  ASTTreePrint tp;
+
+  printf("%s:\n", m_name.c_str());
+  for (auto i = m_blocks.begin(); i != m_blocks.end(); ++i)
+  {
+    IRBlock *block = *i;
+    printf("b%u:", block->id);
+    for (unsigned int j = 0; j < block->preds.size(); j++)
+    {
+      printf("%s b%u", j == 0 ? "  ; preds" : ",", block->preds[j]->id);
+    }
+    printf("\n");
+
+    for (auto j = block->instrs.begin(); j != block->instrs.end(); ++j)
+    {
+      IRInstr *instr = *j;
+      printf("  v%u = ", instr->id);
+      switch (instr->op)
+      {
+      case IR_CONST:
+        printf("const %d", instr->value);
+        break;
+      case IR_ENTRY:
+        printf("entry %s", instr->name.c_str());
+        break;
+      case IR_FUNC:
+        printf("function %s", instr->name.c_str());
+        break;
+      case IR_LOAD:
+        printf("load %s", instr->name.c_str());
+        break;
+      case IR_STORE:
+        printf("store %s", instr->name.c_str());
+        break;
+      case IR_BINARY:
+        printf("%s", tp.node_tag_to_string(instr->tag).c_str());
+        break;
+      case IR_PHI:
+        printf("phi%s%s", instr->name.empty() ? "" : " ", instr->name.c_str());
+        break;
+      case IR_CALL:
+        printf("call %s", instr->name.c_str());
+        break;
+      }
+
+      for (unsigned int k = 0; k < instr->args.size(); k++)
+      {
+        printf("%s v%u", k == 0 ? "" : ",", instr->args[k]->id);
+      }
+
+      IRInstr *l = leader(instr);
+      if (instr->known && instr->op != IR_CONST)
+      {
+        printf("  ; = %d", instr->value);
+      }
+      else if (l != instr)
+      {
+        printf("  ; = v%u", l->id);
+      }
+      printf("\n");
+    }
+
+    if (block->cond != nullptr)
+    {
+      printf("  br v%u, b%u, b%u\n", block->cond->id, block->succs[0]->id, block->succs[1]->id);
+    }
+    else if (!block->succs.empty())
+    {
+      printf("  jmp b%u\n", block->succs[0]->id);
+    }
+    else if (m_result != nullptr)
+    {
+      printf("  ret v%u\n", m_result->id);
+    }
+  }
+}
+
+IRBlock *SSAFunction::new_block(IRBlock *idom)
+{
+  IRBlock *block = new IRBlock();
+  block->id = unsigned(m_blocks.size());
+  block->idom = idom;
+  block->cond = nullptr;
+  m_blocks.push_back(block);
+  return block;
+}
+
+IRInstr *SSAFunction::emit(int op, int tag, int value, int symbol, const std::string &name, const std::vector<IRInstr *> &args)
+{
+  IRInstr *instr = new IRInstr();
+  instr->id = unsigned(m_instrs.size());
+  instr->op = op;
+  instr->tag = tag;
+  instr->value = value;
+  instr->symbol = symbol;
+  instr->name = name;
+  instr->args = args;
+  instr->block = m_block;
+  instr->leader = instr;
+  instr->known = op == IR_CONST;
+  m_instrs.push_back(instr);
+
+  // Phis go before the other instructions of the block
+  if (op == IR_PHI)
+  {
+    auto pos = m_block->instrs.begin();
+    while (pos != m_block->instrs.end() && (*pos)->op == IR_PHI)
+    {
+      ++pos;
+    }
+    m_block->instrs.insert(pos, instr);
+  }
+  else
+  {
+    m_block->instrs.push_back(instr);
+  }
+  return instr;
+}
+
+void SSAFunction::jump(IRBlock *from, IRBlock *to)
+{
+  from->succs.push_back(to);
+  to->preds.push_back(from);
+}
+
+IRInstr *SSAFunction::read(Node *ref)
+{
+  int symbol = ref->get_symbol();
+  m_names[symbol] = ref->get_str();
+  if (!m_promotable[symbol])
+  {
+    return emit(IR_LOAD, 0, 0, symbol, ref->get_str(), {});
+  }
+  if (m_current[symbol] != nullptr)
+  {
+    return m_current[symbol];
+  }
+
+  // A global read by a function body, which no function changes;
+  // its value is the same everywhere in the body
+  if (m_entry_values[symbol] == nullptr)
+  {
+    IRBlock *block = m_block;
+    m_block = m_blocks[0];
+    m_entry_values[symbol] = emit(IR_ENTRY, 0, 0, symbol, ref->get_str(), {});
+    m_block = block;
+  }
+  return m_entry_values[symbol];
+}
+
+void SSAFunction::write(Node *ref, IRInstr *val)
+{
+  int symbol = ref->get_symbol();
+  m_names[symbol] = ref->get_str();
+  if (m_promotable[symbol])
+  {
+    m_current[symbol] = val;
+  }
+  else
+  {
+    emit(IR_STORE, 0, 0, symbol, ref->get_str(), {val});
+  }
+}
+
+IRInstr *SSAFunction::build_list(Node *list)
+{
+  IRInstr *val = nullptr;
+  for (unsigned int i = 0; i < list->get_num_kids(); i++)
+  {
+    val = build_stmt(list->get_kid(i));
+  }
+  return val;
+}
+
+// The last statement of the unit or a function body is the result,
+// which is 0 unless it is an expression
+void SSAFunction::set_result(IRInstr *val)
+{
+  m_result = val != nullptr ? val : emit(IR_CONST, 0, 0, -1, "", {});
+}
+
+IRInstr *SSAFunction::build_stmt(Node *stmt)
+{
+  if (stmt->get_tag() == AST_FUNCTION)
+  {
+    // Only the unit has function definitions
+    IRInstr *fn = emit(IR_FUNC, 0, 0, stmt->get_symbol(), stmt->get_kid(0)->get_str(), {});
+    m_values[stmt] = fn;
+    write(stmt->get_kid(0), fn);
+    return nullptr;
+  }
+
+  Node *ast = stmt->get_kid(0);
+  switch (ast->get_tag())
+  {
+  case AST_DEFINITION:
+    // Redefinitions (without an address) do nothing
+    if (ast->has_address())
+    {
+      IRInstr *marker = emit(IR_CONST, 0, -1, -1, "", {});
+      m_values[ast] = marker;
+      write(ast->get_kid(0), marker);
+    }
+    return nullptr;
+
+  case AST_IF:
+    return build_if(ast);
+
+  case AST_WHILE:
+    return build_while(ast);
+
+  default:
+    return build_expr(ast);
+  }
+}
+
+IRInstr *SSAFunction::build_if(Node *ast)
+{
+  IRInstr *cond = build_expr(ast->get_kid(0));
+  IRBlock *cond_block = m_block;
+  cond_block->cond = cond;
+
+  bool has_else = ast->get_last_kid()->get_tag() == AST_ELSE;
+  IRBlock *then_block = new_block(cond_block);
+  IRBlock *else_block = has_else ? new_block(cond_block) : nullptr;
+  IRBlock *join = new_block(cond_block);
+  std::vector<IRInstr *> before = m_current;
+
+  jump(cond_block, then_block);
+  m_block = then_block;
+  build_list(ast->get_kid(1));
+  jump(m_block, join);
+  std::vector<IRInstr *> then_values = m_current;
+
+  m_current = before;
+  if (has_else)
+  {
+    jump(cond_block, else_block);
+    m_block = else_block;
+    build_list(ast->get_last_kid()->get_kid(0));
+    jump(m_block, join);
+  }
+  else
+  {
+    jump(cond_block, join);
+  }
+  std::vector<IRInstr *> else_values = m_current;
+
+  // Variables of enclosing blocks which the arms leave different
+  m_current = before;
+  m_block = join;
+  std::vector<IRInstr *> &phis = m_joins[ast];
+  for (unsigned int i = 0; i < before.size(); i++)
+  {
+    if (before[i] != nullptr && then_values[i] != else_values[i])
+    {
+      m_current[i] = emit(IR_PHI, 0, 0, int(i), m_names[i], {then_values[i], else_values[i]});
+      phis.push_back(m_current[i]);
+    }
+  }
+  return nullptr;
+}
+
+IRInstr *SSAFunction::build_while(Node *ast)
+{
+  IRBlock *preheader = m_block;
+  IRBlock *header = new_block(preheader);
+  jump(preheader, header);
+  m_block = header;
+
+  // Variables the loop changes get a phi, whose second arg (the value
+  // at the end of the body) is filled in afterwards
+  std::vector<int> assigned, defined;
+  find_assigned(ast, assigned, defined);
+  std::vector<IRInstr *> &phis = m_joins[ast];
+  for (auto i = assigned.begin(); i != assigned.end(); ++i)
+  {
+    bool has_phi = m_current[*i] != nullptr && m_current[*i]->op == IR_PHI && m_current[*i]->block == header;
+    if (m_current[*i] != nullptr && !has_phi && std::find(defined.begin(), defined.end(), *i) == defined.end())
+    {
+      IRInstr *phi = emit(IR_PHI, 0, 0, *i, m_names[*i], {m_current[*i]});
+      m_current[*i] = phi;
+      phis.push_back(phi);
+    }
+  }
+
+  IRInstr *cond = build_expr(ast->get_kid(0));
+  IRBlock *cond_block = m_block;
+  cond_block->cond = cond;
+  IRBlock *body = new_block(cond_block);
+  IRBlock *exit = new_block(cond_block);
+  jump(cond_block, body);
+  jump(cond_block, exit);
+  std::vector<IRInstr *> after_cond = m_current;
+
+  m_block = body;
+  build_list(ast->get_kid(1));
+  jump(m_block, header);
+  for (auto i = phis.begin(); i != phis.end(); ++i)
+  {
+    (*i)->args.push_back(m_current[(*i)->symbol]);
+  }
+
+  m_current = after_cond;
+  m_block = exit;
+  return nullptr;
+}
+
+IRInstr *SSAFunction::build_expr(Node *ast)
+{
+  IRInstr *val;
+
+  switch (ast->get_tag())
+  {
+  case AST_INT_LITERAL:
+    val = emit(IR_CONST, 0, atoi(ast->get_str().c_str()), -1, "", {});
+    break;
+
+  case AST_VARREF:
+    val = read(ast);
+    break;
+
+  case AST_ASSIGNMENT:
+    val = build_expr(ast->get_kid(1));
+    write(ast->get_kid(0), val);
+    break;
+
+  case AST_FNCALL:
+  {
+    std::vector<IRInstr *> args;
+    if (ast->get_num_kids() > 0)
+    {
+      Node *arg_list = ast->get_kid(0);
+      for (unsigned int i = 0; i < arg_list->get_num_kids(); i++)
+      {
+        args.push_back(build_expr(arg_list->get_kid(i)));
+      }
+    }
+    val = emit(IR_CALL, 0, 0, ast->has_address() ? ast->get_symbol() : -1, ast->get_str(), args);
+    break;
+  }
+
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+    val = build_logical(ast);
+    break;
+
+  default:
+  {
+    IRInstr *left = build_expr(ast->get_kid(0));
+    IRInstr *right = build_expr(ast->get_kid(1));
+    val = emit(IR_BINARY, ast->get_tag(), 0, -1, "", {left, right});
+    break;
+  }
+  }
+
+  m_values[ast] = val;
+  return val;
+}
+
+// The right operand of && and || is only evaluated if the left one
+// doesn't decide the result
+IRInstr *SSAFunction::build_logical(Node *ast)
+{
+  bool is_and = ast->get_tag() == AST_LOGICAL_AND;
+  IRInstr *left = build_expr(ast->get_kid(0));
+  IRInstr *decided = emit(IR_CONST, 0, is_and ? 0 : 1, -1, "", {});
+  IRBlock *left_block = m_block;
+  left_block->cond = left;
+
+  IRBlock *right_block = new_block(left_block);
+  IRBlock *join = new_block(left_block);
+  if (is_and)
+  {
+    jump(left_block, right_block);
+    jump(left_block, join);
+  }
+  else
+  {
+    jump(left_block, join);
+    jump(left_block, right_block);
+  }
+
+  m_block = right_block;
+  IRInstr *right = build_expr(ast->get_kid(1));
+  IRInstr *zero = emit(IR_CONST, 0, 0, -1, "", {});
+  IRInstr *truth = emit(IR_BINARY, AST_NOT_EQUAL, 0, -1, "", {right, zero});
+  IRBlock *right_end = m_block;
+  jump(right_end, join);
+
+  m_block = join;
+  return emit(IR_PHI, 0, 0, -1, "", {decided, truth});
+}
+
+void SSAFunction::find_assigned(Node *ast, std::vector<int> &assigned, std::vector<int> &defined)
+{
+  switch (ast->get_tag())
+  {
+  case AST_ASSIGNMENT:
+    if (m_promotable[ast->get_kid(0)->get_symbol()])
+    {
+      assigned.push_back(ast->get_kid(0)->get_symbol());
+    }
+    find_assigned(ast->get_kid(1), assigned, defined);
+    return;
+
+  case AST_DEFINITION:
+    if (ast->has_address())
+    {
+      defined.push_back(ast->get_symbol());
+    }
+    return;
+  }
+
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    find_assigned(ast->get_kid(i), assigned, defined);
+  }
+}
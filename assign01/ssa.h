@@ -0,0 +1,120 @@
+#ifndef SSA_H
+#define SSA_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+class Node;
+struct IRBlock;
+
+// Kinds of IR instructions
+enum IROp {
+  IR_CONST,  // integer constant
+  IR_ENTRY,  // value of a variable when the code is entered
+  IR_FUNC,   // function value created by a definition
+  IR_LOAD,   // read of a variable which calls can change
+  IR_STORE,  // assignment to a variable which calls can change
+  IR_BINARY, // operator (tag is the ast node tag)
+  IR_PHI,    // value of a variable at a join, one arg per predecessor
+  IR_CALL,   // function call (symbol is the callee, -1 if unresolved)
+};
+
+// An instruction, which defines one SSA value
+struct IRInstr {
+  unsigned id;
+  int op, tag, value, symbol;
+  std::string name;
+  std::vector<IRInstr *> args;
+  IRBlock *block;
+
+  // Set by value numbering: an equivalent instruction which dominates
+  // this one (this one if there is none), and the value if constant
+  IRInstr *leader;
+  bool known;
+};
+
+// Basic block: phis come first in instrs. A block with a condition
+// branches to succs[0] if it is non-zero and succs[1] otherwise.
+struct IRBlock {
+  unsigned id;
+  std::vector<IRInstr *> instrs;
+  std::vector<IRBlock *> preds, succs;
+  IRBlock *idom;
+  IRInstr *cond;
+};
+
+// SSA form of a function body, or of the code of the unit outside
+// functions. Variables which a call can change (globals assigned by
+// some function) are not renamed, but loaded and stored.
+//
+// Besides the blocks, the IR records the value of each expression
+// node it was built from, and the phis each if or while statement
+// introduces, so that results can be applied back to the ast.
+class SSAFunction {
+private:
+  std::string m_name;
+  const std::vector<bool> &m_promotable;
+  std::vector<IRBlock *> m_blocks;
+  std::vector<IRInstr *> m_instrs;
+  IRInstr *m_result;
+
+  std::unordered_map<Node *, IRInstr *> m_values;
+  std::unordered_map<Node *, std::vector<IRInstr *>> m_joins;
+
+  // Current value of each renamed variable while building, and
+  // the values on entry
+  std::vector<IRInstr *> m_current;
+  std::vector<IRInstr *> m_entry_values;
+  std::vector<std::string> m_names;
+  IRBlock *m_block;
+
+  // copy constructor and assignment operator prohibited
+  SSAFunction(const SSAFunction &);
+  SSAFunction &operator=(const SSAFunction &);
+
+public:
+  SSAFunction(const std::string &name, const std::vector<bool> &promotable);
+  ~SSAFunction();
+
+  // Build from a function definition, or the unit (skipping function
+  // bodies); the first symbols are the intrinsics, set on entry
+  void build_function(Node *fn);
+  void build_unit(Node *unit, const std::vector<std::string> &intrinsics);
+
+  const std::vector<IRBlock *> &get_blocks() const { return m_blocks; }
+
+  // Value computed by an expression (or assigned by a definition)
+  IRInstr *get_value(Node *ast) const;
+
+  // Phis at the join after an if, or the header of a while
+  const std::vector<IRInstr *> &get_phis(Node *ast) const;
+
+  // Equivalent instruction found by value numbering
+  static IRInstr *leader(IRInstr *instr);
+
+  // Check if block a dominates block b
+  static bool dominates(IRBlock *a, IRBlock *b);
+
+  void print() const;
+
+private:
+  IRBlock *new_block(IRBlock *idom);
+  IRInstr *emit(int op, int tag, int value, int symbol, const std::string &name, const std::vector<IRInstr *> &args);
+  void jump(IRBlock *from, IRBlock *to);
+
+  IRInstr *read(Node *ref);
+  void write(Node *ref, IRInstr *val);
+
+  IRInstr *build_list(Node *list);
+  void set_result(IRInstr *val);
+  IRInstr *build_stmt(Node *stmt);
+  IRInstr *build_if(Node *ast);
+  IRInstr *build_while(Node *ast);
+  IRInstr *build_expr(Node *ast);
+  IRInstr *build_logical(Node *ast);
+
+  // Renamed variables assigned (and not defined) in a tree
+  void find_assigned(Node *ast, std::vector<int> &assigned, std::vector<int> &defined);
+};
+
+#endif // SSA_H
@@ -0,0 +1,418 @@
+#include <cstdio>
+#include <algorithm>
+#include "ast.h"
+#include "node.h"
+#include "exceptions.h"
+#include "function.h"
+#include "environment.h"
+#include "memo.h"
+#include "bytecode.h"
+#include "interp.h"
+#include "dispatch.h"
+#include "stackvm.h"
+
+namespace {
+
+bool compare(int tag, int op1, int op2)
+{
+  switch (tag)
+  {
+  case AST_LESS:
+    return op1 < op2;
+  case AST_LESS_EQUAL:
+    return op1 <= op2;
+  case AST_GREATER:
+    return op1 > op2;
+  case AST_GREATER_EQUAL:
+    return op1 >= op2;
+  case AST_EQUAL:
+    return op1 == op2;
+  }
+  return op1 != op2;
+}
+
+}
+
+StackVM::StackVM(Interpreter *interp, Environment *globals, const std::vector<Chunk *> &chunks, bool count_fused)
+    : m_interp(interp), m_globals(globals), m_chunks(chunks), m_count_fused(count_fused), m_runs(NUM_OPCODES, 0),
+      m_unfused_prints(0)
+{
+}
+
+StackVM::~StackVM()
+{
+  for (auto i = m_chunks.begin(); i != m_chunks.end(); ++i)
+  {
+    delete *i;
+  }
+}
+
+bool StackVM::reserve(unsigned index, unsigned count)
+{
+  if (index + count <= m_stack.size())
+  {
+    return true;
+  }
+  m_stack.resize(std::max(index + count, unsigned(2 * m_stack.size())));
+  return false;
+}
+
+Value StackVM::run()
+{
+  const Chunk *chunk = m_chunks[0];
+  reserve(0, chunk->num_locals + chunk->max_stack);
+  unsigned base = 0;
+  Value *locals = &m_stack[0];
+  Value *sp = locals + chunk->num_locals;
+  const int *pc = chunk->code.data();
+
+  // Variable operand of a superinstruction
+  auto var = [&](int operand) -> const Value & {
+    return operand >= 0 ? locals[operand] : m_globals->lookup(-1 - operand);
+  };
+
+#ifdef THREADED_DISPATCH
+  static const void *const OPCODE_LABELS[] = {
+    LABEL(OP_INT), LABEL(OP_LOAD), LABEL(OP_STORE), LABEL(OP_LOAD_GLOBAL), LABEL(OP_STORE_GLOBAL),
+    LABEL(OP_DEFINE), LABEL(OP_DEFINE_GLOBAL), LABEL(OP_POP), LABEL(OP_DUP), LABEL(OP_NUMERIC),
+    LABEL(OP_ADD), LABEL(OP_SUB), LABEL(OP_MULTIPLY), LABEL(OP_DIVIDE), LABEL(OP_ADD_SAFE),
+    LABEL(OP_SUB_SAFE), LABEL(OP_MULTIPLY_SAFE), LABEL(OP_DIVIDE_SAFE), LABEL(OP_LESS),
+    LABEL(OP_LESS_EQUAL), LABEL(OP_GREATER), LABEL(OP_GREATER_EQUAL), LABEL(OP_EQUAL),
+    LABEL(OP_NOT_EQUAL), LABEL(OP_BOOL), LABEL(OP_JUMP), LABEL(OP_JUMP_ZERO),
+    LABEL(OP_JUMP_NONZERO), LABEL(OP_FUNCTION), LABEL(OP_CALLEE), LABEL(OP_CALL), LABEL(OP_RETURN),
+    LABEL(OP_FAIL), LABEL(OP_HALT), LABEL(OP_INCR), LABEL(OP_LESS_JUMP), LABEL(OP_COMPARE_K),
+    LABEL(OP_COMPARE_K_JUMP), LABEL(OP_PRINT_VAR),
+  };
+  static_assert(sizeof(OPCODE_LABELS) / sizeof(OPCODE_LABELS[0]) == NUM_OPCODES, "missing handler");
+#endif
+
+  DISPATCH()
+  {
+  INSTRUCTION(OP_INT):
+    *sp++ = Value(*pc++);
+    NEXT();
+
+  INSTRUCTION(OP_LOAD):
+    *sp++ = locals[*pc++];
+    NEXT();
+
+  INSTRUCTION(OP_STORE):
+    locals[*pc++] = *--sp;
+    NEXT();
+
+  INSTRUCTION(OP_LOAD_GLOBAL):
+    *sp++ = m_globals->lookup(*pc++);
+    NEXT();
+
+  INSTRUCTION(OP_STORE_GLOBAL):
+    m_globals->assign(*pc++, *--sp);
+    NEXT();
+
+  INSTRUCTION(OP_DEFINE):
+    locals[*pc++] = Value(-1);
+    NEXT();
+
+  INSTRUCTION(OP_DEFINE_GLOBAL):
+    m_globals->define(*pc++);
+    NEXT();
+
+  INSTRUCTION(OP_POP):
+    sp--;
+    NEXT();
+
+  INSTRUCTION(OP_DUP):
+    *sp = sp[-1];
+    sp++;
+    NEXT();
+
+  INSTRUCTION(OP_NUMERIC):
+    if (!sp[-1].is_numeric())
+    {
+      EvaluationError::raise(chunk->sites[*pc]->get_loc(), "Non-numeric condition");
+    }
+    pc++;
+    NEXT();
+
+  INSTRUCTION(OP_ADD):
+  INSTRUCTION(OP_SUB):
+  INSTRUCTION(OP_MULTIPLY):
+  INSTRUCTION(OP_DIVIDE):
+  {
+    Node *site = chunk->sites[*pc++];
+    sp--;
+    sp[-1] = Interpreter::doOp(site->get_tag(), sp[-1].get_ival(), sp->get_ival(), site);
+    NEXT();
+  }
+
+  INSTRUCTION(OP_ADD_SAFE):
+    sp--;
+    sp[-1] = Value(sp[-1].get_ival() + sp->get_ival());
+    NEXT();
+
+  INSTRUCTION(OP_SUB_SAFE):
+    sp--;
+    sp[-1] = Value(sp[-1].get_ival() - sp->get_ival());
+    NEXT();
+
+  INSTRUCTION(OP_MULTIPLY_SAFE):
+    sp--;
+    sp[-1] = Value(sp[-1].get_ival() * sp->get_ival());
+    NEXT();
+
+  INSTRUCTION(OP_DIVIDE_SAFE):
+    sp--;
+    sp[-1] = Value(sp[-1].get_ival() / sp->get_ival());
+    NEXT();
+
+  INSTRUCTION(OP_LESS):
+    sp--;
+    sp[-1] = Value(sp[-1].get_ival() < sp->get_ival() ? 1 : 0);
+    NEXT();
+
+  INSTRUCTION(OP_LESS_EQUAL):
+    sp--;
+    sp[-1] = Value(sp[-1].get_ival() <= sp->get_ival() ? 1 : 0);
+    NEXT();
+
+  INSTRUCTION(OP_GREATER):
+    sp--;
+    sp[-1] = Value(sp[-1].get_ival() > sp->get_ival() ? 1 : 0);
+    NEXT();
+
+  INSTRUCTION(OP_GREATER_EQUAL):
+    sp--;
+    sp[-1] = Value(sp[-1].get_ival() >= sp->get_ival() ? 1 : 0);
+    NEXT();
+
+  INSTRUCTION(OP_EQUAL):
+    sp--;
+    sp[-1] = Value(sp[-1].get_ival() == sp->get_ival() ? 1 : 0);
+    NEXT();
+
+  INSTRUCTION(OP_NOT_EQUAL):
+    sp--;
+    sp[-1] = Value(sp[-1].get_ival() != sp->get_ival() ? 1 : 0);
+    NEXT();
+
+  INSTRUCTION(OP_BOOL):
+    sp[-1] = Value(sp[-1].get_ival() != 0 ? 1 : 0);
+    NEXT();
+
+  INSTRUCTION(OP_JUMP):
+    pc = chunk->code.data() + *pc;
+    NEXT();
+
+  INSTRUCTION(OP_JUMP_ZERO):
+    pc = (--sp)->get_ival() == 0 ? chunk->code.data() + *pc : pc + 1;
+    NEXT();
+
+  INSTRUCTION(OP_JUMP_NONZERO):
+    pc = (--sp)->get_ival() != 0 ? chunk->code.data() + *pc : pc + 1;
+    NEXT();
+
+  INSTRUCTION(OP_FUNCTION):
+  {
+    Function *fn = m_interp->define_function(m_chunks[pc[0]]->fn, m_globals);
+    fn->set_code(pc[0]);
+    pc += 2;
+    NEXT();
+  }
+
+  INSTRUCTION(OP_CALLEE):
+  {
+    const Value &callee = sp[-1];
+    if (callee.get_kind() == VALUE_FUNCTION)
+    {
+      if (callee.get_function()->get_num_params() != unsigned(pc[0]))
+      {
+        EvaluationError::raise(chunk->sites[pc[1]]->get_loc(), "Invalid params");
+      }
+    }
+    else if (callee.get_kind() != VALUE_INTRINSIC_FN)
+    {
+      EvaluationError::raise(chunk->sites[pc[1]]->get_loc(), "Invalid function");
+    }
+    pc += 2;
+    NEXT();
+  }
+
+  INSTRUCTION(OP_CALL):
+  {
+    unsigned num_args = unsigned(pc[0]);
+    Node *site = chunk->sites[pc[1]];
+    pc += 2;
+    Value *args = sp - num_args;
+    if (args[-1].get_kind() == VALUE_INTRINSIC_FN)
+    {
+      Value result = args[-1].get_intrinsic_fn()(args, num_args, site->get_loc(), m_interp);
+      sp = args;
+      sp[-1] = result;
+      NEXT();
+    }
+
+    // A memoized function's cached result replaces the call
+    Function *fn = args[-1].get_function();
+    MemoCache *memo = fn->get_memo();
+    std::vector<int> key;
+    if (memo != nullptr)
+    {
+      int cached;
+      if (!Interpreter::memo_key(std::vector<Value>(args, sp), key))
+      {
+        memo = nullptr;
+      }
+      else if (memo->lookup(key, cached))
+      {
+        sp = args;
+        sp[-1] = Value(cached);
+        NEXT();
+      }
+    }
+
+    m_frames.push_back({chunk, pc, base, memo, std::vector<int>()});
+    m_frames.back().key.swap(key);
+
+    // The arguments are the first locals of the callee
+    chunk = m_chunks[fn->get_code()];
+    base = unsigned(args - &m_stack[0]);
+    if (!reserve(base, chunk->num_locals + chunk->max_stack))
+    {
+      args = &m_stack[base];
+    }
+    locals = args;
+    sp = locals + chunk->num_locals;
+    for (Value *local = locals + num_args; local != sp; ++local)
+    {
+      *local = Value();
+    }
+    pc = chunk->code.data();
+    NEXT();
+  }
+
+  INSTRUCTION(OP_RETURN):
+  {
+    Value result = sp[-1];
+    Frame &frame = m_frames.back();
+    if (frame.memo != nullptr && result.is_numeric())
+    {
+      frame.memo->insert(frame.key, result.get_ival());
+    }
+
+    // The result replaces the callee
+    sp = locals;
+    sp[-1] = result;
+    chunk = frame.chunk;
+    pc = frame.pc;
+    base = frame.base;
+    locals = &m_stack[base];
+    m_frames.pop_back();
+    NEXT();
+  }
+
+  INSTRUCTION(OP_FAIL):
+    EvaluationError::raise(chunk->sites[*pc]->get_loc(),
+                           chunk->sites[*pc]->get_tag() == AST_FNCALL ? "Invalid function" : "Non-numeric condition");
+
+  INSTRUCTION(OP_HALT):
+    return sp[-1];
+
+  // Operands are checked (and errors raised) as by the instructions
+  // they replace
+  INSTRUCTION(OP_INCR):
+  {
+    const Value &val = var(pc[0]);
+    Node *site = chunk->sites[pc[2]];
+    if (!val.is_numeric())
+    {
+      EvaluationError::raise(site->get_loc(), "Non-numeric condition");
+    }
+    int result;
+    if (__builtin_add_overflow(val.get_ival(), pc[1], &result))
+    {
+      Interpreter::doOp(AST_ADD, val.get_ival(), pc[1], site);
+    }
+    if (pc[0] >= 0)
+    {
+      locals[pc[0]] = Value(result);
+    }
+    else
+    {
+      m_globals->assign(-1 - pc[0], Value(result));
+    }
+    m_runs[OP_INCR] += m_count_fused;
+    pc += 3;
+    NEXT();
+  }
+
+  INSTRUCTION(OP_LESS_JUMP):
+  {
+    const Value &op1 = var(pc[0]);
+    const Value &op2 = var(pc[1]);
+    if (!op1.is_numeric() || !op2.is_numeric())
+    {
+      EvaluationError::raise(chunk->sites[pc[3]]->get_loc(), "Non-numeric condition");
+    }
+    m_runs[OP_LESS_JUMP] += m_count_fused;
+    pc = op1.get_ival() < op2.get_ival() ? pc + 4 : chunk->code.data() + pc[2];
+    NEXT();
+  }
+
+  INSTRUCTION(OP_COMPARE_K):
+  {
+    const Value &val = var(pc[0]);
+    if (!val.is_numeric())
+    {
+      EvaluationError::raise(chunk->sites[pc[3]]->get_loc(), "Non-numeric condition");
+    }
+    *sp++ = Value(compare(pc[2], val.get_ival(), pc[1]) ? 1 : 0);
+    m_runs[OP_COMPARE_K] += m_count_fused;
+    pc += 4;
+    NEXT();
+  }
+
+  INSTRUCTION(OP_COMPARE_K_JUMP):
+  {
+    const Value &val = var(pc[0]);
+    if (!val.is_numeric())
+    {
+      EvaluationError::raise(chunk->sites[pc[4]]->get_loc(), "Non-numeric condition");
+    }
+    m_runs[OP_COMPARE_K_JUMP] += m_count_fused;
+    pc = compare(pc[2], val.get_ival(), pc[1]) ? pc + 5 : chunk->code.data() + pc[3];
+    NEXT();
+  }
+
+  INSTRUCTION(OP_PRINT_VAR):
+  {
+    const Value &callee = m_globals->lookup(pc[0]);
+    if (callee.get_kind() != VALUE_INTRINSIC_FN)
+    {
+      m_unfused_prints += m_count_fused;
+      pc += 5;
+      NEXT();
+    }
+    Value arg = var(pc[1]);
+    Value result = callee.get_intrinsic_fn()(&arg, 1, chunk->sites[pc[4]]->get_loc(), m_interp);
+    if (pc[2])
+    {
+      *sp++ = result;
+    }
+    m_runs[OP_PRINT_VAR] += m_count_fused;
+    pc = chunk->code.data() + pc[3];
+    NEXT();
+  }
+  }
+}
+
+void StackVM::print_fusion_stats() const
+{
+  for (int op = FIRST_FUSED_OPCODE; op < NUM_OPCODES; op++)
+  {
+    fprintf(stderr, "fusion %s: %lu runs", BytecodeCompiler::opcode_name(op), m_runs[op]);
+    if (op == OP_PRINT_VAR)
+    {
+      fprintf(stderr, ", %lu unfused", m_unfused_prints);
+    }
+    fprintf(stderr, "\n");
+  }
+}
@@ -0,0 +1,64 @@
+#ifndef STACKVM_H
+#define STACKVM_H
+
+#include <vector>
+#include "value.h"
+class Interpreter;
+class Environment;
+class MemoCache;
+struct Chunk;
+
+// Stack-based virtual machine running the bytecode of BytecodeCompiler.
+// Locals and operands of all active calls are kept in one array: a
+// call's arguments, pushed by the caller, become its first locals, and
+// its result replaces the callee. Globals are the slots of the unit's
+// Environment, so intrinsics and functions are shared with the tree
+// walking interpreter.
+class StackVM {
+private:
+  // Caller state saved by a call
+  struct Frame {
+    const Chunk *chunk;
+    const int *pc;
+    unsigned base;
+
+    // Cache to store the result in, with its key
+    MemoCache *memo;
+    std::vector<int> key;
+  };
+
+  Interpreter *m_interp;
+  Environment *m_globals;
+  std::vector<Chunk *> m_chunks;
+
+  std::vector<Value> m_stack;
+  std::vector<Frame> m_frames;
+
+  // Whether to count the superinstructions run, the counts (by opcode),
+  // and the print_vars which ran the call's code instead
+  bool m_count_fused;
+  std::vector<unsigned long> m_runs;
+  unsigned long m_unfused_prints;
+
+  // copy constructor and assignment operator prohibited
+  StackVM(const StackVM &);
+  StackVM &operator=(const StackVM &);
+
+public:
+  // Run the chunks of a unit (which the VM adopts) with the given globals
+  StackVM(Interpreter *interp, Environment *globals, const std::vector<Chunk *> &chunks, bool count_fused = false);
+  ~StackVM();
+
+  // Execute the unit, returning the value of its last statement
+  Value run();
+
+  // Print how often each superinstruction ran to stderr
+  void print_fusion_stats() const;
+
+private:
+  // Make room for count values starting at index, returning false if
+  // the stack moved
+  bool reserve(unsigned index, unsigned count);
+};
+
+#endif // STACKVM_H
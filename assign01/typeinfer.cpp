@@ -0,0 +1,242 @@
+#include "ast.h"
+#include "node.h"
+#include "typeinfer.h"
+
+TypeInference::TypeInference(unsigned num_symbols, unsigned num_intrinsics)
+    : m_sym_type(num_symbols, 0), m_num_assigns(num_symbols, 0), m_escapes(num_symbols, false),
+      m_exact_fn(num_symbols, -1), m_all_ret(0), m_changed(false)
+{
+  for (unsigned int i = 0; i < num_intrinsics; i++)
+  {
+    m_sym_type[i] = TYPE_INTRINSIC;
+  }
+}
+
+TypeInference::~TypeInference()
+{
+}
+
+void TypeInference::run(Node *unit)
+{
+  collect(unit);
+
+  // A symbol defined only by one function definition always holds it
+  for (unsigned int i = 0; i < m_functions.size(); i++)
+  {
+    int symbol = m_functions[i]->get_symbol();
+    if (m_num_assigns[symbol] == 1)
+    {
+      m_exact_fn[symbol] = int(i);
+    }
+  }
+
+  // Parameters of a function that can be called indirectly can be anything
+  for (auto i = m_functions.begin(); i != m_functions.end(); ++i)
+  {
+    Node *fn = *i;
+    if ((m_exact_fn[fn->get_symbol()] < 0 || m_escapes[fn->get_symbol()]) && fn->get_num_kids() == 3)
+    {
+      fn->get_kid(1)->each_child([this](Node *param) { join(param->get_symbol(), TYPE_ANY); });
+    }
+  }
+  m_fn_ret.assign(m_functions.size(), 0);
+
+  // Kinds only grow, so this reaches a fixed point
+  do
+  {
+    m_changed = false;
+    infer(unit);
+
+    // A call returns the value of the body's last statement
+    for (unsigned int i = 0; i < m_functions.size(); i++)
+    {
+      int ret = m_fn_ret[i] | type_of(m_functions[i]->get_last_kid()->get_last_kid());
+      if (ret != m_fn_ret[i])
+      {
+        m_fn_ret[i] = ret;
+        m_all_ret |= ret;
+        m_changed = true;
+      }
+    }
+  } while (m_changed);
+
+  mark(unit);
+}
+
+void TypeInference::collect(Node *ast)
+{
+  switch (ast->get_tag())
+  {
+  case AST_VARREF:
+    m_escapes[ast->get_symbol()] = true;
+    return;
+
+  case AST_ASSIGNMENT:
+    m_num_assigns[ast->get_kid(0)->get_symbol()]++;
+    collect(ast->get_kid(1));
+    return;
+
+  case AST_DEFINITION:
+    if (ast->has_address())
+    {
+      m_num_assigns[ast->get_symbol()]++;
+    }
+    return;
+
+  case AST_FUNCTION:
+    m_num_assigns[ast->get_symbol()]++;
+    m_functions.push_back(ast);
+    collect(ast->get_last_kid());
+    return;
+  }
+
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    collect(ast->get_kid(i));
+  }
+}
+
+void TypeInference::infer(Node *ast)
+{
+  switch (ast->get_tag())
+  {
+  case AST_ASSIGNMENT:
+    infer(ast->get_kid(1));
+    join(ast->get_kid(0)->get_symbol(), type_of(ast->get_kid(1)));
+    return;
+
+  // Defined variables start out as -1
+  case AST_DEFINITION:
+    if (ast->has_address())
+    {
+      join(ast->get_symbol(), TYPE_INT);
+    }
+    return;
+
+  case AST_FUNCTION:
+    join(ast->get_symbol(), TYPE_FUNCTION);
+    infer(ast->get_last_kid());
+    return;
+
+  // Arguments of direct calls flow into the parameters
+  case AST_FNCALL:
+    if (ast->get_num_kids() > 0)
+    {
+      infer(ast->get_kid(0));
+    }
+    if (ast->has_address() && m_exact_fn[ast->get_symbol()] >= 0 && ast->get_num_kids() > 0)
+    {
+      Node *fn = m_functions[m_exact_fn[ast->get_symbol()]];
+      Node *args = ast->get_kid(0);
+      if (fn->get_num_kids() == 3 && fn->get_kid(1)->get_num_kids() == args->get_num_kids())
+      {
+        for (unsigned int i = 0; i < args->get_num_kids(); i++)
+        {
+          join(fn->get_kid(1)->get_kid(i)->get_symbol(), type_of(args->get_kid(i)));
+        }
+      }
+    }
+    return;
+  }
+
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    infer(ast->get_kid(i));
+  }
+}
+
+int TypeInference::type_of(Node *ast)
+{
+  switch (ast->get_tag())
+  {
+  case AST_VARREF:
+    return m_sym_type[ast->get_symbol()];
+
+  // An assignment is never a numeric operand or condition, whatever
+  // it assigns; as a statement it has the value it assigns
+  case AST_ASSIGNMENT:
+    return TYPE_ANY;
+
+  case AST_STATEMENT:
+    if (ast->get_kid(0)->get_tag() == AST_ASSIGNMENT)
+    {
+      return type_of(ast->get_kid(0)->get_kid(1));
+    }
+    return type_of(ast->get_kid(0));
+
+  // A call to anything other than a function fails
+  case AST_FNCALL:
+  {
+    if (!ast->has_address())
+    {
+      return 0;
+    }
+
+    int callee = m_sym_type[ast->get_symbol()];
+    int type = 0;
+    if (callee & TYPE_INTRINSIC)
+    {
+      type |= TYPE_INT;
+    }
+    if (callee & TYPE_FUNCTION)
+    {
+      int fn = m_exact_fn[ast->get_symbol()];
+      type |= fn >= 0 ? m_fn_ret[fn] : m_all_ret;
+    }
+    return type;
+  }
+
+  // Operators, literals, and statements other than expressions
+  // all produce integers
+  default:
+    return TYPE_INT;
+  }
+}
+
+void TypeInference::join(int symbol, int type)
+{
+  if ((m_sym_type[symbol] | type) != m_sym_type[symbol])
+  {
+    m_sym_type[symbol] |= type;
+    m_changed = true;
+  }
+}
+
+void TypeInference::mark(Node *ast)
+{
+  switch (ast->get_tag())
+  {
+  case AST_IF:
+  case AST_WHILE:
+    mark_if_int(ast->get_kid(0));
+    break;
+
+  case AST_ADD:
+  case AST_SUB:
+  case AST_MULTIPLY:
+  case AST_DIVIDE:
+  case AST_GREATER:
+  case AST_LESS:
+  case AST_GREATER_EQUAL:
+  case AST_LESS_EQUAL:
+  case AST_EQUAL:
+  case AST_NOT_EQUAL:
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+    mark_if_int(ast->get_kid(0));
+    mark_if_int(ast->get_kid(1));
+    break;
+  }
+
+  for (unsigned int i = 0; i < ast->get_num_kids(); i++)
+  {
+    mark(ast->get_kid(i));
+  }
+}
+
+// An expression which never produces a value (a call which always
+// fails) is also safe to mark
+void TypeInference::mark_if_int(Node *ast)
+{
+  ast->set_numeric((type_of(ast) & ~TYPE_INT) == 0);
+}
@@ -0,0 +1,75 @@
+#ifndef TYPEINFER_H
+#define TYPEINFER_H
+
+#include <vector>
+class Node;
+
+// Optimization pass which infers the kinds of values (integer, function,
+// intrinsic function) each variable and expression can have, and marks
+// operands and conditions which are always integers, so the interpreter
+// can skip its non-numeric check for them.
+//
+// The inference is flow-insensitive: a variable's kinds are the union
+// of the kinds of everything assigned to it. Parameters of a function
+// which is only ever called directly by name get the kinds of the
+// arguments at its call sites; parameters of other functions can be
+// anything.
+class TypeInference {
+private:
+  // Kinds of values, combined as a bit set
+  enum {
+    TYPE_INT = 1,
+    TYPE_FUNCTION = 2,
+    TYPE_INTRINSIC = 4,
+    TYPE_ANY = 7,
+  };
+
+  // Kinds each symbol can hold
+  std::vector<int> m_sym_type;
+
+  // Number of definitions and assignments of each symbol
+  std::vector<unsigned> m_num_assigns;
+
+  // True if a symbol is read other than as the callee of a call
+  std::vector<bool> m_escapes;
+
+  // Function (index into m_functions) a symbol always holds, or -1
+  std::vector<int> m_exact_fn;
+
+  // All function definitions, and the kinds their calls return
+  std::vector<Node *> m_functions;
+  std::vector<int> m_fn_ret;
+  int m_all_ret;
+
+  bool m_changed;
+
+  // copy constructor and assignment operator prohibited
+  TypeInference(const TypeInference &);
+  TypeInference &operator=(const TypeInference &);
+
+public:
+  TypeInference(unsigned num_symbols, unsigned num_intrinsics);
+  ~TypeInference();
+
+  // Infer types in the (analyzed) unit and mark numeric nodes
+  void run(Node *unit);
+
+private:
+  // Find functions, definitions and escaping functions
+  void collect(Node *ast);
+
+  // One round of propagating kinds through assignments, calls and returns
+  void infer(Node *ast);
+
+  // Kinds of values an expression (or statement) can evaluate to
+  int type_of(Node *ast);
+
+  // Add kinds to a symbol
+  void join(int symbol, int type);
+
+  // Mark operands and conditions which are always integers
+  void mark(Node *ast);
+  void mark_if_int(Node *ast);
+};
+
+#endif // TYPEINFER_H
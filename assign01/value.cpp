@@ -1,9 +1,13 @@
+#include <cstddef>
 #include "cpputil.h"
 #include "exceptions.h"
 #include "valrep.h"
 #include "function.h"
 #include "value.h"
 
+const unsigned Value::KIND_OFFSET = offsetof(Value, m_kind);
+const unsigned Value::DATA_OFFSET = offsetof(Value, m_atomic);
+
 Value::Value(int ival)
   : m_kind(VALUE_INT) {
   m_atomic.ival = ival;
@@ -2,6 +2,7 @@
 #define VALUE_H
 
 #include <cassert>
+#include <string>
 class ValRep;
 class Function;
 
@@ -77,6 +78,11 @@ public:
   bool is_dynamic() const { return m_kind >= VALUE_FUNCTION; }
   bool is_atomic() const  { return !is_dynamic(); }
 
+  // Byte offsets of the kind and of the contents (the int, intrinsic
+  // or ValRep pointer), for code generated by the JIT
+  static const unsigned KIND_OFFSET;
+  static const unsigned DATA_OFFSET;
+
 private:
   // TODO: add additional member functions, if necessary
 };
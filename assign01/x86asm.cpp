@@ -0,0 +1,237 @@
+#include <cassert>
+#include "x86asm.h"
+
+X86Assembler::X86Assembler()
+{
+}
+
+X86Assembler::~X86Assembler()
+{
+}
+
+void X86Assembler::mov(Reg dst, Reg src)
+{
+  rex(false, src, dst);
+  byte(0x89);
+  modrm(src, dst);
+}
+
+void X86Assembler::mov(Reg dst, int32_t imm)
+{
+  rex(false, 0, dst);
+  byte(0xb8 + (dst & 7));
+  dword(uint32_t(imm));
+}
+
+void X86Assembler::load(Reg dst, Reg base, int32_t disp)
+{
+  rex(false, dst, base);
+  byte(0x8b);
+  mem(dst, base, disp);
+}
+
+void X86Assembler::store(Reg base, int32_t disp, Reg src)
+{
+  rex(false, src, base);
+  byte(0x89);
+  mem(src, base, disp);
+}
+
+void X86Assembler::store(Reg base, int32_t disp, int32_t imm)
+{
+  rex(false, 0, base);
+  byte(0xc7);
+  mem(0, base, disp);
+  dword(uint32_t(imm));
+}
+
+void X86Assembler::mov64(Reg dst, Reg src)
+{
+  rex(true, src, dst);
+  byte(0x89);
+  modrm(src, dst);
+}
+
+void X86Assembler::mov64(Reg dst, uint64_t imm)
+{
+  rex(true, 0, dst);
+  byte(0xb8 + (dst & 7));
+  dword(uint32_t(imm));
+  dword(uint32_t(imm >> 32));
+}
+
+void X86Assembler::store64(Reg base, int32_t disp, Reg src)
+{
+  rex(true, src, base);
+  byte(0x89);
+  mem(src, base, disp);
+}
+
+void X86Assembler::alu(AluOp op, Reg dst, Reg src)
+{
+  rex(false, src, dst);
+  byte(op);
+  modrm(src, dst);
+}
+
+void X86Assembler::alu64(AluOp op, Reg dst, Reg src)
+{
+  rex(true, src, dst);
+  byte(op);
+  modrm(src, dst);
+}
+
+void X86Assembler::imul(Reg dst, Reg src)
+{
+  rex(false, dst, src);
+  byte(0x0f);
+  byte(0xaf);
+  modrm(dst, src);
+}
+
+void X86Assembler::cmp(Reg reg, int32_t imm)
+{
+  rex(false, 0, reg);
+  byte(0x81);
+  modrm(7, reg);
+  dword(uint32_t(imm));
+}
+
+void X86Assembler::cmp(Reg base, int32_t disp, int32_t imm)
+{
+  rex(false, 0, base);
+  byte(0x81);
+  mem(7, base, disp);
+  dword(uint32_t(imm));
+}
+
+void X86Assembler::cmp64(Reg base, int32_t disp, Reg reg)
+{
+  rex(true, reg, base);
+  byte(0x39);
+  mem(reg, base, disp);
+}
+
+void X86Assembler::cdq()
+{
+  byte(0x99);
+}
+
+void X86Assembler::idiv(Reg divisor)
+{
+  rex(false, 0, divisor);
+  byte(0xf7);
+  modrm(7, divisor);
+}
+
+// setcc al, then movzx eax, al
+void X86Assembler::set(Cond cond)
+{
+  byte(0x0f);
+  byte(0x90 + cond);
+  modrm(0, RAX);
+  byte(0x0f);
+  byte(0xb6);
+  modrm(RAX, RAX);
+}
+
+unsigned X86Assembler::jcc(Cond cond)
+{
+  byte(0x0f);
+  byte(0x80 + cond);
+  dword(0);
+  return get_offset() - 4;
+}
+
+unsigned X86Assembler::jmp()
+{
+  byte(0xe9);
+  dword(0);
+  return get_offset() - 4;
+}
+
+// Displacements are relative to the end of the jump
+void X86Assembler::patch(unsigned jump, unsigned target)
+{
+  uint32_t disp = uint32_t(int32_t(target) - int32_t(jump + 4));
+  for (unsigned int i = 0; i < 4; i++)
+  {
+    m_code[jump + i] = (disp >> (8 * i)) & 0xff;
+  }
+}
+
+void X86Assembler::call(Reg target)
+{
+  rex(false, 0, target);
+  byte(0xff);
+  modrm(2, target);
+}
+
+void X86Assembler::push(Reg reg)
+{
+  rex(false, 0, reg);
+  byte(0x50 + (reg & 7));
+}
+
+void X86Assembler::pop(Reg reg)
+{
+  rex(false, 0, reg);
+  byte(0x58 + (reg & 7));
+}
+
+void X86Assembler::add64(Reg reg, int8_t imm)
+{
+  rex(true, 0, reg);
+  byte(0x83);
+  modrm(0, reg);
+  byte(uint8_t(imm));
+}
+
+void X86Assembler::sub64(Reg reg, int8_t imm)
+{
+  rex(true, 0, reg);
+  byte(0x83);
+  modrm(5, reg);
+  byte(uint8_t(imm));
+}
+
+void X86Assembler::ret()
+{
+  byte(0xc3);
+}
+
+void X86Assembler::byte(unsigned b)
+{
+  m_code.push_back((unsigned char)b);
+}
+
+void X86Assembler::dword(uint32_t d)
+{
+  for (unsigned int i = 0; i < 4; i++)
+  {
+    byte((d >> (8 * i)) & 0xff);
+  }
+}
+
+// A REX prefix is only needed for 64-bit operands or registers r8-r15
+void X86Assembler::rex(bool wide, unsigned reg, unsigned rm)
+{
+  unsigned bits = (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+  if (bits != 0)
+  {
+    byte(0x40 | bits);
+  }
+}
+
+void X86Assembler::modrm(unsigned reg, unsigned rm)
+{
+  byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// Always a 32-bit displacement
+void X86Assembler::mem(unsigned reg, Reg base, int32_t disp)
+{
+  assert((base & 7) != RSP);
+  byte(0x80 | ((reg & 7) << 3) | (base & 7));
+  dword(uint32_t(disp));
+}
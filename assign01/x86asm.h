@@ -0,0 +1,91 @@
+#ifndef X86ASM_H
+#define X86ASM_H
+
+#include <cstdint>
+#include <vector>
+
+// Encoder for the few x86-64 instructions the JIT generates. Operations
+// are on 32-bit registers unless named ...64; memory operands are a
+// base register plus a displacement (the base can't be rsp or r12).
+class X86Assembler {
+public:
+  enum Reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+  };
+
+  // Condition codes of jcc and setcc
+  enum Cond {
+    CC_O = 0x0,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_L = 0xc,
+    CC_GE = 0xd,
+    CC_LE = 0xe,
+    CC_G = 0xf,
+  };
+
+  // Opcodes (r/m, reg forms) of two-operand arithmetic
+  enum AluOp {
+    ALU_ADD = 0x01,
+    ALU_SUB = 0x29,
+    ALU_CMP = 0x39,
+    ALU_TEST = 0x85,
+  };
+
+private:
+  std::vector<unsigned char> m_code;
+
+  // copy constructor and assignment operator prohibited
+  X86Assembler(const X86Assembler &);
+  X86Assembler &operator=(const X86Assembler &);
+
+public:
+  X86Assembler();
+  ~X86Assembler();
+
+  const std::vector<unsigned char> &get_code() const { return m_code; }
+  unsigned get_offset() const { return unsigned(m_code.size()); }
+
+  void mov(Reg dst, Reg src);
+  void mov(Reg dst, int32_t imm);
+  void load(Reg dst, Reg base, int32_t disp);
+  void store(Reg base, int32_t disp, Reg src);
+  void store(Reg base, int32_t disp, int32_t imm);
+  void mov64(Reg dst, Reg src);
+  void mov64(Reg dst, uint64_t imm);
+  void store64(Reg base, int32_t disp, Reg src);
+
+  void alu(AluOp op, Reg dst, Reg src);
+  void alu64(AluOp op, Reg dst, Reg src);
+  void imul(Reg dst, Reg src);
+  void cmp(Reg reg, int32_t imm);
+  void cmp(Reg base, int32_t disp, int32_t imm);
+  void cmp64(Reg base, int32_t disp, Reg reg);
+  void cdq();
+  void idiv(Reg divisor);
+
+  // Set eax to 1 if cond holds, else 0
+  void set(Cond cond);
+
+  // Jumps return the offset of their displacement, for patch
+  unsigned jcc(Cond cond);
+  unsigned jmp();
+  void patch(unsigned jump, unsigned target);
+
+  void call(Reg target);
+  void push(Reg reg);
+  void pop(Reg reg);
+  void add64(Reg reg, int8_t imm);
+  void sub64(Reg reg, int8_t imm);
+  void ret();
+
+private:
+  void byte(unsigned b);
+  void dword(uint32_t d);
+  void rex(bool wide, unsigned reg, unsigned rm);
+  void modrm(unsigned reg, unsigned rm);
+  void mem(unsigned reg, Reg base, int32_t disp);
+};
+
+#endif // X86ASM_H